@@ -0,0 +1,171 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Minimal harness for the hot-path microbenchmarks.
+// Every measurement is emitted as one JSON object per line (or one CSV row),
+// so results can be diffed or plotted across commits.
+namespace pipeann {
+  namespace bench {
+    template<typename V>
+    inline void do_not_optimize(V const &v) {
+      asm volatile("" : : "r,m"(v) : "memory");
+    }
+
+    inline void clobber_memory() {
+      asm volatile("" : : : "memory");
+    }
+
+    using BenchParams = std::vector<std::pair<std::string, std::string>>;
+
+    struct BenchConfig {
+      std::string filter;         // run only benchmarks whose name contains this.
+      std::string tag;            // free-form label, e.g., a commit id.
+      double min_time_ms = 50;    // minimum duration of one repetition.
+      int repetitions = 5;        // repetitions per benchmark, median is reported.
+      unsigned max_threads = std::max(1u, std::thread::hardware_concurrency());
+      bool csv = false;
+    };
+
+    class BenchRunner {
+     public:
+      BenchRunner(const BenchConfig &config, std::ostream &out) : config_(config), out_(out) {
+        if (config_.csv) {
+          out_ << "tag,name,params,threads,iters,ns_per_op_median,ns_per_op_min,mops_per_s" << std::endl;
+        }
+      }
+
+      const BenchConfig &config() const {
+        return config_;
+      }
+
+      bool enabled(const std::string &name) const {
+        return config_.filter.empty() || name.find(config_.filter) != std::string::npos;
+      }
+
+      // fn(iters) performs iters * ops_per_iter operations.
+      void run(const std::string &name, const BenchParams &params, const std::function<void(uint64_t)> &fn,
+               uint64_t ops_per_iter = 1) {
+        if (!enabled(name)) {
+          return;
+        }
+        measure(name, params, 1, ops_per_iter, [&](uint64_t iters) {
+          auto st = std::chrono::steady_clock::now();
+          fn(iters);
+          clobber_memory();
+          return elapsed_ns(st);
+        });
+      }
+
+      // fn(tid, iters) is run by nthreads threads concurrently; reported ns/op is
+      // wall time over the operations of all threads (i.e., inverse throughput).
+      void run_threaded(const std::string &name, const BenchParams &params, unsigned nthreads,
+                        const std::function<void(unsigned, uint64_t)> &fn, uint64_t ops_per_iter = 1) {
+        if (!enabled(name) || nthreads > config_.max_threads) {
+          return;
+        }
+        measure(name, params, nthreads, ops_per_iter * nthreads, [&](uint64_t iters) {
+          std::atomic<unsigned> ready{0};
+          std::atomic<bool> go{false};
+          std::vector<std::thread> threads;
+          for (unsigned t = 0; t < nthreads; ++t) {
+            threads.emplace_back([&, t]() {
+              ready.fetch_add(1);
+              while (!go.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+              }
+              fn(t, iters);
+            });
+          }
+          while (ready.load() != nthreads) {
+            std::this_thread::yield();
+          }
+          auto st = std::chrono::steady_clock::now();
+          go.store(true, std::memory_order_release);
+          for (auto &th : threads) {
+            th.join();
+          }
+          return elapsed_ns(st);
+        });
+      }
+
+     private:
+      static double elapsed_ns(std::chrono::steady_clock::time_point st) {
+        return (double) std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - st)
+            .count();
+      }
+
+      void measure(const std::string &name, const BenchParams &params, unsigned nthreads, uint64_t ops_per_iter,
+                   const std::function<double(uint64_t)> &timed) {
+        // Calibrate the iteration count so that one repetition takes min_time_ms.
+        const double min_ns = config_.min_time_ms * 1e6;
+        uint64_t iters = 1;
+        double ns = timed(iters);
+        while (ns < min_ns && iters < (1ull << 40)) {
+          double scale = ns > 0 ? std::min(10.0, 1.2 * min_ns / ns) : 10.0;
+          iters = std::max<uint64_t>(iters + 1, (uint64_t) (iters * scale));
+          ns = timed(iters);
+        }
+
+        std::vector<double> ns_per_op;
+        ns_per_op.push_back(ns / (double) (iters * ops_per_iter));
+        for (int r = 1; r < config_.repetitions; ++r) {
+          ns_per_op.push_back(timed(iters) / (double) (iters * ops_per_iter));
+        }
+        std::sort(ns_per_op.begin(), ns_per_op.end());
+        double median = ns_per_op[ns_per_op.size() / 2];
+        report(name, params, nthreads, iters, median, ns_per_op.front());
+      }
+
+      void report(const std::string &name, const BenchParams &params, unsigned nthreads, uint64_t iters,
+                  double median, double min) {
+        std::ostringstream line;
+        if (config_.csv) {
+          line << config_.tag << "," << name << ",";
+          for (size_t i = 0; i < params.size(); ++i) {
+            line << (i ? ";" : "") << params[i].first << "=" << params[i].second;
+          }
+          line << "," << nthreads << "," << iters << "," << median << "," << min << "," << 1e3 / median;
+        } else {
+          line << "{\"tag\":\"" << config_.tag << "\",\"name\":\"" << name << "\",\"params\":{";
+          for (size_t i = 0; i < params.size(); ++i) {
+            line << (i ? "," : "") << "\"" << params[i].first << "\":\"" << params[i].second << "\"";
+          }
+          line << "},\"threads\":" << nthreads << ",\"iters\":" << iters << ",\"ns_per_op_median\":" << median
+               << ",\"ns_per_op_min\":" << min << ",\"mops_per_s\":" << 1e3 / median << "}";
+        }
+        out_ << line.str() << std::endl;
+      }
+
+      BenchConfig config_;
+      std::ostream &out_;
+    };
+
+    // Thread counts used by the contention benchmarks.
+    inline std::vector<unsigned> thread_counts(const BenchConfig &config) {
+      std::vector<unsigned> counts;
+      for (unsigned t = 1; t <= config.max_threads; t *= 2) {
+        counts.push_back(t);
+      }
+      if (counts.back() != config.max_threads) {
+        counts.push_back(config.max_threads);
+      }
+      return counts;
+    }
+
+    void run_pq_benches(BenchRunner &runner);
+    void run_search_benches(BenchRunner &runner);
+    void run_sync_benches(BenchRunner &runner);
+  }  // namespace bench
+}  // namespace pipeann
@@ -0,0 +1,54 @@
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include "bench_common.h"
+
+// Microbenchmarks of the search/update hot-path kernels.
+// Output: one JSON object (or CSV row with --csv) per measurement.
+int main(int argc, char **argv) {
+  pipeann::bench::BenchConfig config;
+  std::string out_path;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--filter" && i + 1 < argc) {
+      config.filter = argv[++i];
+    } else if (arg == "--tag" && i + 1 < argc) {
+      config.tag = argv[++i];
+    } else if (arg == "--min-time-ms" && i + 1 < argc) {
+      config.min_time_ms = std::stod(argv[++i]);
+    } else if (arg == "--repetitions" && i + 1 < argc) {
+      config.repetitions = std::max(1, std::stoi(argv[++i]));
+    } else if (arg == "--max-threads" && i + 1 < argc) {
+      config.max_threads = std::max(1, std::stoi(argv[++i]));
+    } else if (arg == "--csv") {
+      config.csv = true;
+    } else if (arg == "--output" && i + 1 < argc) {
+      out_path = argv[++i];
+    } else {
+      std::cerr << "Usage: " << argv[0]
+                << " [--filter <substring>] [--tag <label>] [--min-time-ms <ms>] [--repetitions <n>]"
+                   " [--max-threads <n>] [--csv] [--output <file>]"
+                << std::endl;
+      std::cerr << "Benchmarks: pq_dist_lookup aggregate_coords populate_chunk_distances[_nt] distance_compare "
+                   "insert_into_pool robin_set_{insert,find} sparse_lock_table_{wrlock,rdlock} "
+                   "concurrent_queue_pop_push page_cache_{get_hit,get_miss,put}"
+                << std::endl;
+      return arg == "--help" ? 0 : -1;
+    }
+  }
+
+  std::ofstream out_file;
+  if (!out_path.empty()) {
+    out_file.open(out_path);
+    if (!out_file.is_open()) {
+      std::cerr << "Cannot open " << out_path << std::endl;
+      return -1;
+    }
+  }
+  pipeann::bench::BenchRunner runner(config, out_path.empty() ? std::cout : out_file);
+  pipeann::bench::run_pq_benches(runner);
+  pipeann::bench::run_search_benches(runner);
+  pipeann::bench::run_sync_benches(runner);
+  return 0;
+}
@@ -0,0 +1,164 @@
+#include <cstring>
+#include <memory>
+#include <sstream>
+
+#include "bench_common.h"
+#include "pq_table.h"
+#include "ssd_index.h"
+
+namespace pipeann {
+  namespace bench {
+    namespace {
+      template<typename U>
+      void write_bin_section(std::ostream &out, const U *data, int32_t nr, int32_t nc) {
+        out.write((const char *) &nr, sizeof(int32_t));
+        out.write((const char *) &nc, sizeof(int32_t));
+        out.write((const char *) data, (size_t) nr * nc * sizeof(U));
+      }
+
+      // Builds a pivots image in the layout of *_pq_pivots.bin, with random
+      // centers, so FixedChunkPQTable can be benchmarked without an index.
+      template<typename T>
+      void load_synthetic_pq_table(FixedChunkPQTable<T> &table, _u64 ndims, _u64 n_chunks, std::mt19937 &rng) {
+        std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+        std::vector<float> tables(NUM_PQ_CENTROIDS * ndims), centroid(ndims);
+        for (auto &v : tables) {
+          v = dist(rng);
+        }
+        for (auto &v : centroid) {
+          v = dist(rng);
+        }
+        std::vector<uint32_t> rearrangement(ndims), chunk_offsets(n_chunks + 1);
+        for (_u64 i = 0; i < ndims; ++i) {
+          rearrangement[i] = (uint32_t) i;
+        }
+        for (_u64 c = 0; c <= n_chunks; ++c) {
+          chunk_offsets[c] = (uint32_t) (c * ndims / n_chunks);
+        }
+
+        std::stringstream body;
+        std::vector<_u64> offsets(NUM_PQ_OFFSETS);
+        const _u64 header_size = 2 * sizeof(int32_t) + NUM_PQ_OFFSETS * sizeof(_u64);
+        offsets[0] = header_size;
+        write_bin_section(body, tables.data(), NUM_PQ_CENTROIDS, (int32_t) ndims);
+        offsets[1] = header_size + body.tellp();
+        write_bin_section(body, centroid.data(), (int32_t) ndims, 1);
+        offsets[2] = header_size + body.tellp();
+        write_bin_section(body, rearrangement.data(), (int32_t) ndims, 1);
+        offsets[3] = header_size + body.tellp();
+        write_bin_section(body, chunk_offsets.data(), (int32_t) n_chunks + 1, 1);
+        offsets[4] = header_size + body.tellp();
+
+        std::stringstream image;
+        write_bin_section(image, offsets.data(), NUM_PQ_OFFSETS, 1);
+        image << body.rdbuf();
+        table.load_pq_pivots_new(image, n_chunks, 0);
+        table.post_load_pq_table();
+      }
+
+      template<typename T>
+      void bench_populate_chunk_distances(BenchRunner &runner, const std::string &type_name) {
+        std::mt19937 rng(1234);
+        for (_u64 ndims : {128ul, 768ul}) {
+          for (_u64 n_chunks : {16ul, 32ul, 64ul, 128ul}) {
+            if (n_chunks > ndims ||
+                !(runner.enabled("populate_chunk_distances") || runner.enabled("populate_chunk_distances_nt"))) {
+              continue;
+            }
+            FixedChunkPQTable<T> table;
+            load_synthetic_pq_table(table, ndims, n_chunks, rng);
+            std::vector<T> query(ndims);
+            for (auto &v : query) {
+              v = (T) (rng() % 100);
+            }
+            float *dists = nullptr;
+            alloc_aligned((void **) &dists, NUM_PQ_CENTROIDS * n_chunks * sizeof(float), 64);
+
+            BenchParams params = {{"type", type_name}, {"ndims", std::to_string(ndims)},
+                                  {"n_chunks", std::to_string(n_chunks)}};
+            runner.run("populate_chunk_distances", params, [&](uint64_t iters) {
+              for (uint64_t i = 0; i < iters; ++i) {
+                table.populate_chunk_distances(query.data(), dists);
+                do_not_optimize(dists[0]);
+              }
+            });
+            runner.run("populate_chunk_distances_nt", params, [&](uint64_t iters) {
+              for (uint64_t i = 0; i < iters; ++i) {
+                table.populate_chunk_distances_nt(query.data(), dists);
+                do_not_optimize(dists[0]);
+              }
+            });
+            aligned_free(dists);
+          }
+        }
+      }
+    }  // namespace
+
+    void run_pq_benches(BenchRunner &runner) {
+      std::mt19937 rng(42);
+      const std::vector<_u64> chunk_counts = {8, 16, 32, 64, 128};
+
+      // pq_dist_lookup: the ids come from one neighbor list, codes are contiguous.
+      for (_u64 n_chunks : chunk_counts) {
+        for (_u64 n_pts : {32ul, 64ul, 128ul}) {
+          std::vector<_u8> codes(n_pts * n_chunks);
+          for (auto &c : codes) {
+            c = (_u8) rng();
+          }
+          float *pq_dists = nullptr, *out = nullptr;
+          alloc_aligned((void **) &pq_dists, NUM_PQ_CENTROIDS * n_chunks * sizeof(float), 64);
+          alloc_aligned((void **) &out, ROUND_UP(n_pts * sizeof(float), 64), 64);
+          for (_u64 i = 0; i < NUM_PQ_CENTROIDS * n_chunks; ++i) {
+            pq_dists[i] = (float) (rng() % 1000);
+          }
+          runner.run(
+              "pq_dist_lookup", {{"n_chunks", std::to_string(n_chunks)}, {"n_pts", std::to_string(n_pts)}},
+              [&](uint64_t iters) {
+                for (uint64_t i = 0; i < iters; ++i) {
+                  ::pq_dist_lookup(codes.data(), n_pts, n_chunks, pq_dists, out);
+                  do_not_optimize(out[0]);
+                }
+              },
+              n_pts);
+          aligned_free(pq_dists);
+          aligned_free(out);
+        }
+      }
+
+      // aggregate_coords: gather codes of random ids from a large code array,
+      // which is cache-missing in the same way as in search.
+      constexpr _u64 kNumCodedPts = 1 << 18;
+      constexpr _u64 kIdsPerCall = 64;
+      for (_u64 n_chunks : chunk_counts) {
+        if (!runner.enabled("aggregate_coords")) {
+          break;
+        }
+        std::vector<_u8> all_codes(kNumCodedPts * n_chunks);
+        for (auto &c : all_codes) {
+          c = (_u8) rng();
+        }
+        std::vector<unsigned> ids(1 << 16);
+        for (auto &id : ids) {
+          id = rng() % kNumCodedPts;
+        }
+        std::vector<_u8> out(kIdsPerCall * n_chunks);
+        uint64_t pos = 0;
+        runner.run(
+            "aggregate_coords",
+            {{"n_chunks", std::to_string(n_chunks)}, {"n_ids", std::to_string(kIdsPerCall)},
+             {"n_coded_pts", std::to_string(kNumCodedPts)}},
+            [&](uint64_t iters) {
+              for (uint64_t i = 0; i < iters; ++i) {
+                ::aggregate_coords(ids.data() + pos, kIdsPerCall, all_codes.data(), n_chunks, out.data());
+                do_not_optimize(out[0]);
+                pos = (pos + kIdsPerCall) % (ids.size() - kIdsPerCall);
+              }
+            },
+            kIdsPerCall);
+      }
+
+      bench_populate_chunk_distances<float>(runner, "float");
+      bench_populate_chunk_distances<_u8>(runner, "uint8");
+    }
+  }  // namespace bench
+}  // namespace pipeann
@@ -0,0 +1,123 @@
+#include <cstring>
+#include <memory>
+
+#include "bench_common.h"
+#include "distance.h"
+#include "neighbor.h"
+#include "tsl/robin_set.h"
+#include "utils.h"
+
+namespace pipeann {
+  namespace bench {
+    namespace {
+      template<typename T>
+      void bench_distance(BenchRunner &runner, Metric metric, const std::string &type_name,
+                          const std::string &metric_name) {
+        if (!runner.enabled("distance_compare")) {
+          return;
+        }
+        std::unique_ptr<Distance<T>> dist(get_distance_function<T>(metric));
+        std::mt19937 rng(7);
+        // 256 base vectors, so the working set stays cache-resident and the
+        // kernel (not memory) is measured.
+        constexpr _u64 kNumVecs = 256;
+        for (_u64 dim : {32ul, 96ul, 128ul, 200ul, 256ul, 768ul, 960ul}) {
+          const _u64 aligned_dim = ROUND_UP(dim, 8);
+          T *data = nullptr, *query = nullptr;
+          alloc_aligned((void **) &data, kNumVecs * aligned_dim * sizeof(T), 8 * sizeof(T));
+          alloc_aligned((void **) &query, aligned_dim * sizeof(T), 8 * sizeof(T));
+          memset((void *) data, 0, kNumVecs * aligned_dim * sizeof(T));
+          memset((void *) query, 0, aligned_dim * sizeof(T));
+          for (_u64 i = 0; i < kNumVecs * aligned_dim; ++i) {
+            if (i % aligned_dim < dim) {
+              data[i] = (T) (rng() % 64);
+            }
+          }
+          for (_u64 d = 0; d < dim; ++d) {
+            query[d] = (T) (rng() % 64);
+          }
+          runner.run("distance_compare",
+                     {{"type", type_name}, {"metric", metric_name}, {"dim", std::to_string(dim)}},
+                     [&](uint64_t iters) {
+                       float sum = 0;
+                       for (uint64_t i = 0; i < iters; ++i) {
+                         sum += dist->compare(query, data + (i % kNumVecs) * aligned_dim, (unsigned) aligned_dim);
+                       }
+                       do_not_optimize(sum);
+                     });
+          aligned_free(data);
+          aligned_free(query);
+        }
+      }
+    }  // namespace
+
+    void run_search_benches(BenchRunner &runner) {
+      bench_distance<float>(runner, Metric::L2, "float", "l2");
+      bench_distance<float>(runner, Metric::COSINE, "float", "cosine");
+      bench_distance<int8_t>(runner, Metric::L2, "int8", "l2");
+      bench_distance<int8_t>(runner, Metric::COSINE, "int8", "cosine");
+      bench_distance<uint8_t>(runner, Metric::L2, "uint8", "l2");
+
+      std::mt19937 rng(99);
+      std::uniform_real_distribution<float> unif(0.0f, 1.0f);
+
+      // InsertIntoPool on a full, sorted pool of size L, as in the search loop.
+      // The pool is restored from a template every kResetEvery inserts so that
+      // insert positions stay uniformly spread; the restore is amortized in.
+      constexpr uint64_t kResetEvery = 16;
+      for (unsigned L : {16u, 32u, 64u, 128u, 256u, 512u}) {
+        std::vector<Neighbor> pool_template(L + 1);
+        for (unsigned i = 0; i < L; ++i) {
+          pool_template[i] = Neighbor(i, (float) i / L, true);
+        }
+        std::sort(pool_template.begin(), pool_template.begin() + L);
+        std::vector<Neighbor> pool(pool_template);
+        std::vector<Neighbor> cands(4096);
+        for (unsigned i = 0; i < cands.size(); ++i) {
+          cands[i] = Neighbor(L + i, unif(rng), true);
+        }
+        runner.run("insert_into_pool", {{"L", std::to_string(L)}}, [&](uint64_t iters) {
+          unsigned acc = 0;
+          for (uint64_t i = 0; i < iters; ++i) {
+            if (i % kResetEvery == 0) {
+              memcpy((void *) pool.data(), pool_template.data(), L * sizeof(Neighbor));
+            }
+            auto &nn = cands[i % cands.size()];
+            if (nn.distance < pool[L - 1].distance) {
+              acc += InsertIntoPool(pool.data(), L, nn);
+            }
+          }
+          do_not_optimize(acc);
+        });
+      }
+
+      // robin_set visited operations, cleared per "query" like QueryBuffer::visited.
+      for (uint64_t set_size : {128ul, 1024ul, 8192ul}) {
+        std::vector<unsigned> ids(set_size * 2);
+        for (auto &id : ids) {
+          id = (unsigned) (rng() % 100000000);
+        }
+        tsl::robin_set<unsigned> visited(4096);
+        runner.run("robin_set_insert", {{"set_size", std::to_string(set_size)}}, [&](uint64_t iters) {
+          for (uint64_t i = 0; i < iters; ++i) {
+            if (i % set_size == 0) {
+              visited.clear();
+            }
+            visited.insert(ids[i % set_size]);
+          }
+          do_not_optimize(visited.size());
+        });
+        visited.clear();
+        visited.insert(ids.begin(), ids.begin() + set_size);
+        // Half of the probes hit, half miss.
+        runner.run("robin_set_find", {{"set_size", std::to_string(set_size)}}, [&](uint64_t iters) {
+          uint64_t hits = 0;
+          for (uint64_t i = 0; i < iters; ++i) {
+            hits += visited.find(ids[i % ids.size()]) != visited.end();
+          }
+          do_not_optimize(hits);
+        });
+      }
+    }
+  }  // namespace bench
+}  // namespace pipeann
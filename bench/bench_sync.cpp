@@ -0,0 +1,94 @@
+#include <cstring>
+
+#include "bench_common.h"
+#include "concurrent_queue.h"
+#include "v2/lock_table.h"
+#include "v2/page_cache.h"
+
+namespace pipeann {
+  namespace bench {
+    void run_sync_benches(BenchRunner &runner) {
+      const auto nthreads_list = thread_counts(runner.config());
+
+      // SparseLockTable: lock/unlock pairs over a hot (16) or spread (1M) key space.
+      for (uint64_t n_keys : {16ul, 1ul << 20}) {
+        for (unsigned nthreads : nthreads_list) {
+          v2::SparseLockTable<uint64_t> table;
+          BenchParams params = {{"n_keys", std::to_string(n_keys)}};
+          runner.run_threaded("sparse_lock_table_wrlock", params, nthreads, [&](unsigned tid, uint64_t iters) {
+            uint64_t key = tid * 0x9E3779B97F4A7C15ull;
+            for (uint64_t i = 0; i < iters; ++i) {
+              key = key * 6364136223846793005ull + 1442695040888963407ull;
+              table.wrlock((key >> 33) % n_keys);
+              table.unlock((key >> 33) % n_keys);
+            }
+          });
+          runner.run_threaded("sparse_lock_table_rdlock", params, nthreads, [&](unsigned tid, uint64_t iters) {
+            uint64_t key = tid * 0x9E3779B97F4A7C15ull;
+            for (uint64_t i = 0; i < iters; ++i) {
+              key = key * 6364136223846793005ull + 1442695040888963407ull;
+              table.rdlock((key >> 33) % n_keys);
+              table.unlock((key >> 33) % n_keys);
+            }
+          });
+        }
+      }
+
+      // ConcurrentQueue: pop + push of a pooled item, the QueryBuffer pattern.
+      for (unsigned nthreads : nthreads_list) {
+        ConcurrentQueue<uint64_t *> queue(nullptr);
+        std::vector<uint64_t> items(2 * nthreads);
+        for (auto &item : items) {
+          queue.push(&item);
+        }
+        runner.run_threaded("concurrent_queue_pop_push", {}, nthreads, [&](unsigned tid, uint64_t iters) {
+          for (uint64_t i = 0; i < iters; ++i) {
+            uint64_t *item = queue.pop();
+            while (item == nullptr) {
+              item = queue.pop();
+            }
+            (*item)++;
+            queue.push(item);
+          }
+        });
+      }
+
+      // PageCache: get hits, get misses and put (overwrite) on resident pages.
+      constexpr uint64_t kResidentPages = 4096;
+      if (runner.enabled("page_cache")) {
+        v2::PageCache pc;
+        std::vector<uint8_t> page(SECTOR_LEN, 0xAB);
+        for (uint64_t b = 0; b < kResidentPages; ++b) {
+          pc.put(b, page.data(), true);
+        }
+        for (unsigned nthreads : nthreads_list) {
+          runner.run_threaded("page_cache_get_hit", {}, nthreads, [&](unsigned tid, uint64_t iters) {
+            alignas(64) uint8_t buf[SECTOR_LEN];
+            for (uint64_t i = 0; i < iters; ++i) {
+              pc.get((i * 7 + tid) % kResidentPages, buf);
+            }
+            do_not_optimize(buf[0]);
+          });
+          runner.run_threaded("page_cache_get_miss", {}, nthreads, [&](unsigned tid, uint64_t iters) {
+            alignas(64) uint8_t buf[SECTOR_LEN];
+            uint64_t hits = 0;
+            for (uint64_t i = 0; i < iters; ++i) {
+              hits += pc.get(kResidentPages + i, buf);
+            }
+            do_not_optimize(hits);
+          });
+          runner.run_threaded("page_cache_put", {}, nthreads, [&](unsigned tid, uint64_t iters) {
+            alignas(64) uint8_t buf[SECTOR_LEN];
+            memset(buf, tid, SECTOR_LEN);
+            for (uint64_t i = 0; i < iters; ++i) {
+              pc.put((i * 7 + tid) % kResidentPages, buf);
+            }
+          });
+        }
+        for (uint64_t b = 0; b < kResidentPages; ++b) {
+          pc.deref(b);
+        }
+      }
+    }
+  }  // namespace bench
+}  // namespace pipeann
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "neighbor.h"
+
+namespace pipeann {
+  struct AdaptiveBudgetParams {
+    // a query's L and beam width are scaled by 1 - spread (easiest) to 1 + spread (hardest).
+    float spread = 0.5f;
+    uint32_t window = 512;       // difficulties of the last window queries rank a new one.
+    uint32_t min_samples = 32;   // unscaled until then.
+    uint32_t n_entries = 16;     // entry candidates the difficulty looks at.
+  };
+
+  // Per-query search budgets from the query's difficulty, estimated before any disk IO from its entry
+  // candidates (PQ distances, sorted): the nearest one over their mean when there are several (a clear
+  // nearest candidate means an easy query), else the distance to the single entry point. The budget scales
+  // with the difficulty's rank among recent queries, which is uniform, so the mean budget is the configured
+  // one. Thread-safe.
+  class AdaptiveBudget {
+   public:
+    explicit AdaptiveBudget(const AdaptiveBudgetParams &params = AdaptiveBudgetParams());
+
+    static float difficulty(const Neighbor *entries, unsigned n, unsigned n_entries);
+
+    // scales l_search (to at least k_search) and beam_width (to at least 1) for the query.
+    void apply(const Neighbor *entries, unsigned n, uint64_t k_search, uint64_t &l_search, uint64_t &beam_width);
+
+    const AdaptiveBudgetParams &params() const {
+      return params_;
+    }
+
+   private:
+    AdaptiveBudgetParams params_;
+    std::mutex lock;
+    std::vector<float> recent;  // ring buffer.
+    uint64_t n_seen = 0;
+  };
+}  // namespace pipeann
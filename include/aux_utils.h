@@ -58,4 +58,15 @@ namespace pipeann {
   void create_disk_layout(const std::string &mem_index_file, const std::string &base_file, const std::string &tag_file,
                           const std::string &pq_pivots_file, const std::string &pq_compressed_vectors_file,
                           bool single_file_index, const std::string &output_file);
+
+  // rewrites in_prefix's disk index into out_prefix with each node's neighbor PQ codes stored after its
+  // neighbor list, so search can run without the in-memory PQ array (SSDIndex::set_keep_pq_codes).
+  // Copies the PQ and tag files along. Returns -1 on error.
+  template<typename T>
+  int create_inline_pq_layout(const std::string &in_prefix, const std::string &out_prefix);
+
+  // writes prefix's node coordinates as 8-bit scalar-quantized codes to <prefix>_sq8.bin (see RefineCodes),
+  // used to rerank unexpanded search candidates (SSDIndex::load_refine_codes). Returns -1 on error.
+  template<typename T>
+  int create_refine_codes(const std::string &prefix);
 }  // namespace pipeann
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "neighbor.h"
+
+namespace pipeann {
+  // Per-hop features of a search, all from the candidate list (PQ distances):
+  enum EarlyStopFeature : uint32_t {
+    kEsLogHops = 0,       // log2(1 + hops).
+    kEsStableHops,        // hops since the top-k candidates last changed (capped at 16).
+    kEsTopkChurn,         // fraction of the top-k candidates replaced by this hop.
+    kEsFrontierGap,       // (best unexpanded - k-th) / |k-th| distance, clamped to [-1, 4].
+    kEsFrontierPos,       // position of the best unexpanded candidate / k, capped at 4.
+    kNumEarlyStopFeatures
+  };
+
+  // Logistic model of "the results would not improve by going on"; see tests/train_early_stop.cpp.
+  struct EarlyStopModel {
+    float weights[kNumEarlyStopFeatures] = {};
+    float bias = 0;
+    float threshold = 1.0f;  // stops once the predicted probability reaches it.
+    uint32_t min_hops = 4;   // never stops before.
+
+    // text format, one "key values..." per line; returns 0 on success.
+    int load(const std::string &path);
+    int save(const std::string &path) const;
+    float predict(const float *features) const;
+  };
+
+  // Hops recorded for training: per query, the features and the k nearest expanded IDs after each hop.
+  struct EarlyStopTrace {
+    struct Query {
+      std::vector<std::array<float, kNumEarlyStopFeatures>> features;
+      std::vector<std::vector<uint32_t>> topk;
+    };
+    std::mutex lock;
+    std::vector<Query> queries;  // in the order the queries finished.
+  };
+
+  // Early-termination state of one query. With a trace it records every hop and never stops.
+  class EarlyStop {
+   public:
+    ~EarlyStop() {
+      finish();
+    }
+
+    // model and trace may be nullptr (disabled).
+    void init(const EarlyStopModel *model, EarlyStopTrace *trace, uint64_t k_search);
+    bool enabled() const {
+      return model != nullptr || trace != nullptr;
+    }
+
+    // after each hop; retset is the sorted candidate list, expanded the nodes expanded so far.
+    // Returns true if the search should stop.
+    bool after_hop(const Neighbor *retset, unsigned cur_list_size, unsigned first_unexpanded,
+                   const std::vector<Neighbor> &expanded);
+
+    // hands the recorded hops to the trace (once per query).
+    void finish();
+
+   private:
+    const EarlyStopModel *model = nullptr;
+    EarlyStopTrace *trace = nullptr;
+    uint64_t k = 0;
+    uint32_t hops = 0, stable_hops = 0;
+    std::vector<unsigned> prev_topk, cur_topk;
+    EarlyStopTrace::Query rec;
+  };
+}  // namespace pipeann
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <atomic>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <shared_mutex>
+#include <string>
+#include <vector>
+
+#include "aligned_file_reader.h"
+
+// Emulated SSD: serves IO from an in-memory image of the file, completing
+// requests asynchronously after a modeled device latency.
+//
+// Service model (shared by all threads, i.e., one emulated device per reader):
+// - every request first passes the IOPS and bandwidth token buckets;
+// - it is then served by the earliest-free of n_channels internal channels
+//   (flash dies), so requests queue once the queue depth exceeds n_channels;
+// - its service time is drawn from the latency distribution, plus
+//   qd_penalty_us for every request already in flight on the device.
+// Completions are delivered through the usual poll()/poll_all()/poll_wait()
+// interface, so search algorithms run unmodified.
+struct SSDEmulatorConfig {
+  enum LatencyDist { FIXED, UNIFORM, NORMAL, LOGNORMAL, BIMODAL };
+
+  LatencyDist dist = LOGNORMAL;
+  double read_lat_us = 80;    // mean (median for lognormal) read service time.
+  double lat_spread_us = 20;  // stddev (normal/lognormal) or half-width (uniform).
+  double tail_prob = 0.01;    // bimodal: probability of a slow read...
+  double tail_lat_us = 1000;  // ...and its service time.
+  double write_lat_us = 20;   // writes land in the device write buffer.
+  double qd_penalty_us = 0;   // extra service time per in-flight request.
+  unsigned n_channels = 64;   // internal parallelism of the device.
+  double max_iops = 0;        // 0 = unlimited.
+  double max_bw_mbps = 0;     // 0 = unlimited (MB/s, 1MB = 2^20B).
+  uint64_t seed = 0;          // per-thread latency streams are seeded from this.
+
+  // Parses "key=value,key=value", e.g.
+  // "dist=lognormal,lat_us=80,spread_us=20,channels=64,iops=500000,bw_mbps=3000".
+  // Keys: dist (fixed|uniform|normal|lognormal|bimodal), lat_us, spread_us,
+  // tail_prob, tail_us, write_us, qd_penalty_us, channels, iops, bw_mbps, seed.
+  static SSDEmulatorConfig parse(const std::string &spec);
+  std::string to_string() const;
+};
+
+class EmulatedAlignedFileReader : public AlignedFileReader {
+ public:
+  EmulatedAlignedFileReader(const SSDEmulatorConfig &config = SSDEmulatorConfig());
+  ~EmulatedAlignedFileReader();
+
+  void *get_ctx(int flag = 0);
+
+  // Loads the whole file into memory. Writes go to the image only; the file on
+  // disk is left untouched.
+  void open(const std::string &fname, bool enable_writes, bool enable_create);
+  void close();
+
+  void read(std::vector<IORequest> &read_reqs, void *ctx, bool async = false);
+  void write(std::vector<IORequest> &write_reqs, void *ctx, bool async = false);
+  // Other files are accessed with pread/pwrite, with emulated latency.
+  void read_fd(int fd, std::vector<IORequest> &read_reqs, void *ctx);
+  void write_fd(int fd, std::vector<IORequest> &write_reqs, void *ctx);
+
+  void read_alloc(std::vector<IORequest> &read_reqs, void *ctx, std::vector<uint64_t> *page_ref = nullptr);
+  int send_read_no_alloc(IORequest &req, void *ctx);
+  int send_read_no_alloc(std::vector<IORequest> &reqs, void *ctx);
+
+  void send_io(IORequest &req, void *ctx, bool write);
+  void send_io(std::vector<IORequest> &reqs, void *ctx, bool write);
+  int poll(void *ctx);
+  void poll_all(void *ctx);
+  void poll_wait(void *ctx);
+
+  void register_thread(int flag = 0);
+  void deregister_thread();
+  void deregister_all_threads();
+
+  const SSDEmulatorConfig &config() const {
+    return config_;
+  }
+  uint64_t n_reads() const {
+    return n_reads_.load(std::memory_order_relaxed);
+  }
+  uint64_t n_writes() const {
+    return n_writes_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  struct PendingIO {
+    uint64_t complete_ns;
+    IORequest *req;
+    bool operator>(const PendingIO &other) const {
+      return complete_ns > other.complete_ns;
+    }
+  };
+
+  // Per-thread completion queue, ordered by completion time.
+  struct EmuCtx {
+    std::priority_queue<PendingIO, std::vector<PendingIO>, std::greater<PendingIO>> pending;
+    std::mt19937_64 rng;
+  };
+
+  // Applies the IO to the image (or fd) and returns its completion time.
+  uint64_t submit(EmuCtx *ctx, IORequest &req, bool write, int fd = -1);
+  double sample_latency_us(EmuCtx *ctx, bool write);
+  void wait_until(uint64_t ns);
+  void complete_blocking(EmuCtx *ctx, std::vector<IORequest> &reqs, bool write, int fd);
+
+  SSDEmulatorConfig config_;
+
+  std::shared_mutex image_lock_;  // exclusive only when the image grows.
+  char *image_ = nullptr;
+  uint64_t image_size_ = 0, image_capacity_ = 0;
+
+  std::mutex device_lock_;
+  std::vector<uint64_t> channel_free_ns_;
+  std::priority_queue<uint64_t, std::vector<uint64_t>, std::greater<uint64_t>> in_flight_;
+  double iops_gate_ns_ = 0, bw_gate_ns_ = 0;
+
+  std::atomic<uint64_t> n_reads_{0}, n_writes_{0};
+  std::atomic<uint64_t> n_threads_{0};
+};
+
+// Returns an EmulatedAlignedFileReader if PIPEANN_SSD_EMULATOR is set (its
+// value is the SSDEmulatorConfig spec, may be empty), else a
+// LinuxAlignedFileReader.
+AlignedFileReader *new_aligned_file_reader();
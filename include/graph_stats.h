@@ -1,8 +1,10 @@
 #pragma once
 
 #include <cstddef>
+#include <cstdint>
 #include <iostream>
 #include <ostream>
+#include <string>
 #include <vector>
 
 namespace pipeann {
@@ -47,6 +49,85 @@ enum class DiskIndexDataType { kFloat = 0, kUint8, kInt8 };
 // Returns stats with total_nodes=0 on read error.
 GraphStats compute_graph_stats_from_disk_index(const std::string &path, DiskIndexDataType data_type);
 
+// Full adjacency of a disk index, for offline analysis (cache simulation, layout locality).
+// Node i lives in sector 1 + i / nnodes_per_sector (the build-time layout, without a partition file).
+struct DiskIndexGraph {
+  uint64_t nnodes = 0;
+  uint64_t nnodes_per_sector = 0;
+  uint64_t max_node_len = 0;
+  unsigned entry_point = 0;
+  std::vector<std::vector<unsigned>> adj;
+
+  uint64_t page_of(uint64_t id) const {
+    return 1 + id / nnodes_per_sector;
+  }
+};
+
+// Load the whole graph of a disk index (coordinates are skipped). Returns false on read error or
+// for multi-sector nodes (nnodes_per_sector == 0).
+bool load_graph_from_disk_index(const std::string &path, DiskIndexDataType data_type, DiskIndexGraph *out);
+
+// Layout locality and search-cost estimates of a disk index (inspect_graph --locality).
+struct LocalityOptions {
+  std::string partition_file;  // optional *_partition.bin.aligned; empty = node i in slot i.
+  unsigned num_threads = 0;    // 0 = OpenMP default.
+  bool bfs = true;             // BFS from the medoid (random reads of every reachable page, twice).
+  size_t top_hub_pages = 10;
+  // Pages to rank for pinning (needs bfs): a node scores (1 + in-degree) * hot_decay^(hops from the medoid),
+  // a page the sum of its nodes. Hubs near the entry are on the path of most queries.
+  size_t hot_pages = 0;
+  double hot_decay = 0.5;
+  uint64_t sectors_per_chunk = 16384;  // sectors streamed per read in the sequential pass.
+};
+
+struct LocalityStats {
+  uint64_t nnodes = 0;
+  uint64_t nnodes_per_sector = 0;
+  uint64_t n_pages = 0;  // data sectors in the file.
+  unsigned entry_point = 0;
+
+  // Slot fragmentation: slots without a node (kInvalidID in the page layout, or past the last node).
+  uint64_t n_slots = 0;
+  uint64_t n_holes = 0;
+  uint64_t pages_with_holes = 0;
+  uint64_t empty_pages = 0;
+
+  // Edges u->v with u and v in the same page are free once u's page is read.
+  uint64_t n_edges = 0;
+  uint64_t colocated_edges = 0;
+  // Distinct pages other than its own among a node's neighbors: IOs one expansion can trigger.
+  double avg_unique_pages_per_expansion = 0.0;
+  // Lower bound of the above if neighbors were packed densely: ceil(degree / nnodes_per_sector).
+  double avg_min_pages_per_expansion = 0.0;
+
+  // In-degree distribution over nodes.
+  uint64_t indeg_zero = 0;
+  double indeg_avg = 0.0;
+  uint32_t indeg_p50 = 0, indeg_p90 = 0, indeg_p99 = 0, indeg_p999 = 0, indeg_max = 0;
+  // Pages with the most edges from other pages: (page, in-edges), descending.
+  std::vector<std::pair<uint64_t, uint64_t>> hub_pages;
+
+  // nodes_at_hop[h]: nodes at h hops from the medoid (beam search reads one page per node, so h ~ IOs on the path).
+  std::vector<uint64_t> nodes_at_hop;
+  // nodes_at_page_hop[h]: nodes whose page is h page reads from the medoid's page when a read expands
+  // every node of the page (page search); 0 = the medoid's page.
+  std::vector<uint64_t> nodes_at_page_hop;
+  uint64_t unreachable_nodes = 0;
+
+  // (sector, score), hottest first; see LocalityOptions::hot_pages.
+  std::vector<std::pair<uint64_t, double>> hot_pages;
+};
+
+// Streams the disk index once (multi-threaded over chunks of sectors), then runs the BFSes with parallel
+// random reads of the frontier pages. Returns false on read error or an unsupported layout.
+bool compute_locality_from_disk_index(const std::string &path, DiskIndexDataType data_type,
+                                      const LocalityOptions &opts, LocalityStats *out);
+
+void print_locality_report(const LocalityStats &s, std::ostream &out);
+
+// Writes s.hot_pages as text, one "<sector> <score>" line per page, hottest first (SSDIndex::load_pinned_pages).
+bool save_hot_pages(const LocalityStats &s, const std::string &path);
+
 // Print adjacency sample from a disk index file (first num_nodes nodes).
 void print_adjacency_sample_from_disk_index(const std::string &path, DiskIndexDataType data_type,
                                             size_t num_nodes, size_t max_neighbors_per_node, std::ostream &out);
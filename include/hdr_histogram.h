@@ -0,0 +1,280 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <vector>
+
+namespace pipeann {
+  class StreamingHistogram;
+
+  // HdrHistogram-style log-linear histogram over non-negative integers.
+  // Values below 2^kSubBucketBits are counted exactly; above that, every power
+  // of two is split into 2^(kSubBucketBits-1) linear buckets, so the relative
+  // error of any reported value is below 2^-(kSubBucketBits-1) (< 1%).
+  // Values above kMaxValue are clamped into the last bucket.
+  class HdrHistogram {
+   public:
+    static constexpr int kSubBucketBits = 8;
+    static constexpr uint64_t kSubBucketCount = 1ull << kSubBucketBits;
+    static constexpr uint64_t kSubBucketHalf = kSubBucketCount / 2;
+    static constexpr int kMaxValueBits = 48;
+    static constexpr uint64_t kMaxValue = (1ull << kMaxValueBits) - 1;
+    static constexpr size_t kNumBuckets = (kMaxValueBits - kSubBucketBits + 2) * kSubBucketHalf;
+
+    HdrHistogram() : counts_(kNumBuckets, 0) {
+    }
+
+    static inline size_t bucket_index(uint64_t v) {
+      if (v < kSubBucketCount) {
+        return (size_t) v;
+      }
+      v = std::min(v, kMaxValue);
+      // v in [2^e, 2^(e+1)), e >= kSubBucketBits; (v >> shift) in [half, count).
+      int shift = (63 - __builtin_clzll(v)) - (kSubBucketBits - 1);
+      return (size_t) shift * kSubBucketHalf + (size_t) (v >> shift);
+    }
+
+    // Smallest value that maps to bucket idx.
+    static inline uint64_t bucket_lowest(size_t idx) {
+      if (idx < kSubBucketCount) {
+        return idx;
+      }
+      uint64_t shift = idx / kSubBucketHalf - 1;
+      return (kSubBucketHalf + idx % kSubBucketHalf) << shift;
+    }
+
+    // Largest value that maps to bucket idx.
+    static inline uint64_t bucket_highest(size_t idx) {
+      if (idx < kSubBucketCount) {
+        return idx;
+      }
+      uint64_t shift = idx / kSubBucketHalf - 1;
+      return bucket_lowest(idx) + (1ull << shift) - 1;
+    }
+
+    inline void record(uint64_t v, uint64_t n = 1) {
+      counts_[bucket_index(v)] += n;
+      total_ += n;
+      sum_ += (double) v * n;
+      min_ = std::min(min_, v);
+      max_ = std::max(max_, v);
+    }
+
+    void merge(const HdrHistogram &other) {
+      for (size_t i = 0; i < kNumBuckets; ++i) {
+        counts_[i] += other.counts_[i];
+      }
+      total_ += other.total_;
+      sum_ += other.sum_;
+      min_ = std::min(min_, other.min_);
+      max_ = std::max(max_, other.max_);
+    }
+
+    void reset() {
+      std::fill(counts_.begin(), counts_.end(), 0);
+      total_ = 0;
+      sum_ = 0;
+      min_ = UINT64_MAX;
+      max_ = 0;
+    }
+
+    uint64_t count() const {
+      return total_;
+    }
+    uint64_t min() const {
+      return total_ == 0 ? 0 : min_;
+    }
+    uint64_t max() const {
+      return max_;
+    }
+    double mean() const {
+      return total_ == 0 ? 0 : sum_ / total_;
+    }
+
+    // Value at percentile p in [0, 100]: the highest value equivalent to the
+    // bucket holding the ceil(p% * count)-th smallest sample, capped by max().
+    uint64_t percentile(double p) const {
+      if (total_ == 0) {
+        return 0;
+      }
+      p = std::min(std::max(p, 0.0), 100.0);
+      uint64_t rank = std::max<uint64_t>(1, (uint64_t) (p / 100.0 * total_ + 0.5));
+      uint64_t seen = 0;
+      for (size_t i = 0; i < kNumBuckets; ++i) {
+        seen += counts_[i];
+        if (seen >= rank) {
+          return std::min(bucket_highest(i), max_);
+        }
+      }
+      return max_;
+    }
+
+    // Percentile distribution in the HdrHistogram .hgrm text layout
+    // (Value, Percentile, TotalCount, 1/(1-Percentile)), values divided by scale.
+    void print_percentiles(std::ostream &os, double scale = 1.0, int ticks_per_half = 5) const {
+      os << "       Value     Percentile TotalCount 1/(1-Percentile)\n\n";
+      if (total_ == 0) {
+        return;
+      }
+      char line[128];
+      uint64_t seen = 0;
+      size_t i = 0;
+      // Report ticks_per_half points in each half of the remaining distance to 100%.
+      for (int half = 0; seen < total_ && half < 40; ++half) {
+        double lo = 100.0 * (1.0 - std::ldexp(1.0, -half));
+        double width = 50.0 * std::ldexp(1.0, -half) / ticks_per_half;
+        for (int t = 0; t < ticks_per_half && seen < total_; ++t) {
+          double pct = lo + t * width;
+          uint64_t rank = std::max<uint64_t>(1, (uint64_t) std::ceil(pct / 100.0 * total_));
+          while (seen < rank) {
+            seen += counts_[i++];
+          }
+          double value = std::min(bucket_highest(i - 1), max_) / scale;
+          if (seen < total_) {
+            snprintf(line, sizeof(line), "%12.3f %14.12f %10lu %14.2f\n", value, pct / 100.0, seen,
+                     1.0 / (1.0 - pct / 100.0));
+          } else {
+            snprintf(line, sizeof(line), "%12.3f %14.12f %10lu\n", value, 1.0, seen);
+          }
+          os << line;
+        }
+      }
+      snprintf(line, sizeof(line), "#[Mean = %12.3f, Max = %12.3f, Total count = %10lu]\n", mean() / scale,
+               max_ / scale, total_);
+      os << line;
+    }
+
+   private:
+    friend class StreamingHistogram;
+    std::vector<uint64_t> counts_;
+    uint64_t total_ = 0;
+    double sum_ = 0;
+    uint64_t min_ = UINT64_MAX;
+    uint64_t max_ = 0;
+  };
+
+  // Dense per-process index of the calling thread (0, 1, 2, ... in order of first call).
+  inline uint32_t histogram_thread_ordinal() {
+    static std::atomic<uint32_t> next_ordinal{0};
+    thread_local uint32_t ordinal = next_ordinal.fetch_add(1, std::memory_order_relaxed);
+    return ordinal;
+  }
+
+  // HdrHistogram for concurrent, always-on recording with O(1) memory per metric.
+  // Each thread records into its own shard (allocated on first use), so the
+  // hot path is a few uncontended relaxed atomic adds on thread-private cache
+  // lines. snapshot() merges the shards with relaxed loads while recorders keep
+  // running; a snapshot may tear between buckets of a concurrent record, which
+  // only shifts a sample into the next snapshot.
+  // Threads beyond kMaxShards share shards, which stays correct (atomic adds).
+  class StreamingHistogram {
+   public:
+    static constexpr uint32_t kMaxShards = 128;
+
+    StreamingHistogram() {
+      for (auto &shard : shards_) {
+        shard.store(nullptr, std::memory_order_relaxed);
+      }
+    }
+
+    ~StreamingHistogram() {
+      for (auto &shard : shards_) {
+        delete shard.load(std::memory_order_relaxed);
+      }
+    }
+
+    StreamingHistogram(const StreamingHistogram &) = delete;
+    StreamingHistogram &operator=(const StreamingHistogram &) = delete;
+
+    inline void record(uint64_t v) {
+      Shard *shard = local_shard();
+      shard->counts[HdrHistogram::bucket_index(v)].fetch_add(1, std::memory_order_relaxed);
+      shard->total.fetch_add(1, std::memory_order_relaxed);
+      shard->sum.fetch_add(v, std::memory_order_relaxed);
+      uint64_t cur = shard->min.load(std::memory_order_relaxed);
+      while (v < cur && !shard->min.compare_exchange_weak(cur, v, std::memory_order_relaxed)) {
+      }
+      cur = shard->max.load(std::memory_order_relaxed);
+      while (v > cur && !shard->max.compare_exchange_weak(cur, v, std::memory_order_relaxed)) {
+      }
+    }
+
+    // Merges all shards into out (out is not reset first).
+    void snapshot_into(HdrHistogram &out) const {
+      for (auto &s : shards_) {
+        Shard *shard = s.load(std::memory_order_acquire);
+        if (shard == nullptr) {
+          continue;
+        }
+        for (size_t i = 0; i < HdrHistogram::kNumBuckets; ++i) {
+          out.counts_[i] += shard->counts[i].load(std::memory_order_relaxed);
+        }
+        uint64_t total = shard->total.load(std::memory_order_relaxed);
+        if (total == 0) {
+          continue;
+        }
+        out.total_ += total;
+        out.sum_ += (double) shard->sum.load(std::memory_order_relaxed);
+        out.min_ = std::min(out.min_, shard->min.load(std::memory_order_relaxed));
+        out.max_ = std::max(out.max_, shard->max.load(std::memory_order_relaxed));
+      }
+    }
+
+    HdrHistogram snapshot() const {
+      HdrHistogram out;
+      snapshot_into(out);
+      return out;
+    }
+
+    // Not atomic with respect to concurrent record(): samples racing with the
+    // reset may be kept or lost.
+    void reset() {
+      for (auto &s : shards_) {
+        Shard *shard = s.load(std::memory_order_acquire);
+        if (shard != nullptr) {
+          shard->clear();
+        }
+      }
+    }
+
+   private:
+    struct alignas(64) Shard {
+      std::atomic<uint64_t> counts[HdrHistogram::kNumBuckets];
+      alignas(64) std::atomic<uint64_t> total, sum, min, max;
+
+      Shard() {
+        clear();
+      }
+      void clear() {
+        for (auto &c : counts) {
+          c.store(0, std::memory_order_relaxed);
+        }
+        total.store(0, std::memory_order_relaxed);
+        sum.store(0, std::memory_order_relaxed);
+        min.store(UINT64_MAX, std::memory_order_relaxed);
+        max.store(0, std::memory_order_relaxed);
+      }
+    };
+
+    inline Shard *local_shard() {
+      auto &slot = shards_[histogram_thread_ordinal() % kMaxShards];
+      Shard *shard = slot.load(std::memory_order_acquire);
+      if (__builtin_expect(shard != nullptr, 1)) {
+        return shard;
+      }
+      Shard *fresh = new Shard();
+      if (slot.compare_exchange_strong(shard, fresh, std::memory_order_acq_rel)) {
+        return fresh;
+      }
+      delete fresh;  // another thread sharing this slot won.
+      return shard;
+    }
+
+    std::atomic<Shard *> shards_[kMaxShards];
+  };
+}  // namespace pipeann
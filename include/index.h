@@ -1,6 +1,8 @@
 #pragma once
 
+#include <atomic>
 #include <cassert>
+#include <mutex>
 #include <shared_mutex>
 #include <string>
 #include <unordered_map>
@@ -186,6 +188,37 @@ namespace pipeann {
     // Returns number of live points left after consolidation
     size_t consolidate_deletes(const Parameters &parameters);
 
+    // Bounded-pause variant of consolidate_deletes(): repairs at most max_nodes
+    // slots per call, so a background thread can absorb deletes between
+    // inserts and searches. A sweep consolidates the deletes recorded when it
+    // started; later deletes are picked up by the next sweep. Safe to run
+    // concurrently with insert_point() (including the resize() it may do, which
+    // _update_lock keeps out of each step; slots it adds are swept before the
+    // sweep ends) and lazy_delete(), but not with compact_data() or
+    // consolidate_deletes(). One caller at a time.
+    // Returns the number of slots left in the current sweep (0 = sweep done,
+    // deleted slots have been released to _empty_slots).
+    size_t consolidate_deletes_incremental(const Parameters &parameters, size_t max_nodes);
+
+    struct ConsolidateScratch {
+      tsl::robin_set<unsigned> candidate_set;
+      std::vector<unsigned> candidates;
+      std::vector<float> dists;
+      std::vector<Neighbor> expanded_nghrs;
+      std::vector<Neighbor> result;
+      std::vector<unsigned> old_nbrs;
+    };
+
+    // Rewrites the out-neighbors of loc that point into del_set, by pruning
+    // over the union of live neighbors and neighbors-of-deleted-neighbors.
+    // Returns true if the list was modified. With locked = true, the lists are
+    // accessed under _locks, for use alongside concurrent inserts.
+    bool consolidate_node(unsigned loc, const tsl::robin_set<unsigned> &del_set, const unsigned range,
+                          const unsigned maxc, const float alpha, bool locked, ConsolidateScratch &scratch);
+
+    // dists[i] = distance(query, _data[ids[i]]), prefetching the next vectors.
+    void compute_dists_batch(const T *query, const unsigned *ids, size_t n, float *dists);
+
    public:
     std::shared_timed_mutex _tag_lock;  // reader-writer lock on
                                         // _tag_to_location and
@@ -241,6 +274,13 @@ namespace pipeann {
     std::shared_timed_mutex _update_lock;  // coordinate save() and any change
                                            // being done to the graph.
 
+    // State of the in-progress consolidate_deletes_incremental() sweep.
+    std::atomic<bool> _consolidate_active{false};
+    _u64 _consolidate_cursor = 0;
+    tsl::robin_set<unsigned> _consolidate_set;        // deletes being consolidated.
+    std::vector<unsigned> _consolidate_revisit;       // inserted behind the cursor.
+    std::mutex _consolidate_lock;                     // protects _consolidate_revisit.
+
     const float INDEX_GROWTH_FACTOR = 1.5f;
   };
 }  // namespace pipeann
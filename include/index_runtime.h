@@ -0,0 +1,71 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "aligned_file_reader.h"
+#include "concurrent_queue.h"
+#include "query_buf.h"
+
+namespace pipeann {
+  // Resources shared by many SSDIndex instances (tenants) in one process: a QueryBuffer pool sized for
+  // the largest dimension, a write-back pool committing in-place inserts, and the tenants' readers.
+  // An index registered with SSDIndex::set_runtime() before load() allocates no buffers or background
+  // threads of its own, so a tenant costs only its metadata (PQ codes, ID maps, page layout).
+  // io_uring rings are per thread already, so a thread serves all tenants' files with one ring.
+  template<typename T>
+  class IndexRuntime {
+   public:
+    // num_threads sizes the buffer pool (two buffers per thread, as SSDIndex::load does); indexes with
+    // more than max_dim dimensions cannot register.
+    IndexRuntime(uint32_t num_threads, uint64_t max_dim, uint32_t n_write_back_threads = 1);
+    ~IndexRuntime();
+
+    // a reader kept alive by the runtime, for SSDIndex's constructor (which holds a reference to it).
+    std::shared_ptr<AlignedFileReader> &new_reader();
+
+    uint64_t max_aligned_dim() const {
+      return aligned_dim;
+    }
+
+    QueryBuffer<T> *pop_query_buf() {
+      QueryBuffer<T> *buf = free_bufs.pop();
+      while (buf == nullptr) {
+        free_bufs.wait_for_push_notify();
+        buf = free_bufs.pop();
+      }
+      return buf;
+    }
+
+    void push_query_buf(QueryBuffer<T> *buf) {
+      free_bufs.push(buf);
+      free_bufs.push_notify_all();
+    }
+
+    // distances run over aligned_dim, so the padding past data_dim in the query and coordinate scratch
+    // must be zero; re-zeroes it if the buffer was last used by a tenant of another dimension.
+    void fit_query_buf(QueryBuffer<T> *buf, uint64_t data_dim, uint64_t tenant_aligned_dim);
+
+    // runs fn on a write-back thread, in submission order per thread.
+    void write_back(std::function<void()> fn);
+
+   private:
+    void write_back_thread();
+
+    uint64_t aligned_dim;
+    std::vector<QueryBuffer<T> *> bufs;
+    ConcurrentQueue<QueryBuffer<T> *> free_bufs = ConcurrentQueue<QueryBuffer<T> *>(nullptr);
+
+    ConcurrentQueue<std::function<void()> *> write_backs = ConcurrentQueue<std::function<void()> *>(nullptr);
+    std::vector<std::thread> write_back_threads;
+    std::atomic<bool> stopping{false};
+
+    std::deque<std::shared_ptr<AlignedFileReader>> readers;  // deque: references stay valid.
+    std::mutex readers_lock;
+  };
+}  // namespace pipeann
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "tsl/robin_map.h"
+
+namespace pipeann {
+  // Page reads in flight across all queries of an index, keyed by first sector. A query about to read a
+  // sector that another query is already reading attaches to that read instead of issuing its own; the
+  // query that issued it (the leader) copies the page into every attached buffer once its read completes
+  // (see SSDIndex::set_read_coalescing).
+  //
+  // Ownership: an attached buffer and its finished flag belong to the waiting query and must stay valid (not
+  // reused as scratch, not returned with its QueryBuffer) until the flag is set. The leader's buffer is only
+  // read inside complete(), so the leader may reuse it right after.
+  class InflightReads {
+   public:
+    // with no read of sector in flight, registers buf as its leader and returns false: the caller issues
+    // the read and calls complete() when it finishes. With one in flight of the same len and epoch, queues
+    // buf and returns true: *finished is set (release) once buf holds the page, and no read is needed.
+    // Otherwise (a mismatching read in flight) returns false without registering; complete() is then a no-op.
+    bool attach_or_lead(uint64_t sector, uint64_t len, void *buf, bool *finished, uint64_t epoch);
+
+    // publishes the completed read of sector into buf if buf leads it; does nothing otherwise.
+    void complete(uint64_t sector, const void *buf);
+
+   private:
+    struct Waiter {
+      void *buf;
+      bool *finished;
+    };
+    struct Entry {
+      const void *leader;
+      uint64_t len, epoch;
+      std::vector<Waiter> waiters;
+    };
+    struct alignas(64) Shard {
+      std::mutex mu;
+      tsl::robin_map<uint64_t, Entry> reads;
+    };
+    static constexpr uint64_t kNumShards = 64;
+
+    Shard &shard(uint64_t sector) {
+      return shards[(sector * 0x9E3779B97F4A7C15ull) >> 58];
+    }
+    Shard shards[kNumShards];
+  };
+}  // namespace pipeann
@@ -85,8 +85,16 @@ inline IoContext &observability_io_context() {
   return ctx;
 }
 
+/** Tags the calling thread. Renaming the thread is a syscall, so it (and the
+ *  USDT transition probe) only happens when the context actually changes. */
 inline void set_io_context(IoContext ctx) {
-  observability_io_context() = ctx;
+  static thread_local bool named = false;
+  IoContext &cur = observability_io_context();
+  if (named && cur == ctx) {
+    return;
+  }
+  cur = ctx;
+  named = true;
 #ifdef __linux__
   /* Thread names limited to 15 visible chars (16 with NUL); use short "pa:" prefix. */
   const char *name = "pa:other";
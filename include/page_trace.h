@@ -0,0 +1,63 @@
+#pragma once
+
+/**
+ * Page access trace for sizing a DRAM page cache offline (tests/cache_sim).
+ *
+ * Every page a search requests (beam/page/pipe search, including the
+ * insert-time beam searches) is logged as one fixed-size PageAccess record,
+ * whether or not the page cache then serves it. Records are buffered per
+ * thread and appended to the file in chunks, so the file is not globally
+ * ordered; readers sort by ts_ns.
+ *
+ * Enable with PIPEANN_PAGE_TRACE=<file> (truncated at start), or
+ * page_trace_start(path); page_trace_stop() (also run at exit) flushes.
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace pipeann {
+  struct PageAccess {
+    uint64_t ts_ns;     // steady_clock.
+    uint32_t query_id;  // per-process query counter.
+    uint32_t page_id;   // sector number in the index file.
+    uint32_t hop;       // search iteration (beam/page) or expansion count (pipe) at the time of the read.
+    uint32_t thread;
+  };
+  static_assert(sizeof(PageAccess) == 24, "PageAccess is part of the trace file format");
+
+  struct PageTraceFileHeader {
+    char magic[8];  // "PAPAGES1"
+    uint32_t version;
+    uint32_t record_size;
+  };
+  constexpr char kPageTraceMagic[8] = {'P', 'A', 'P', 'A', 'G', 'E', 'S', '1'};
+
+  inline std::atomic<bool> page_trace_enabled_flag{false};
+  inline thread_local uint32_t tls_page_trace_query = 0;
+
+  inline bool page_trace_enabled() {
+    return page_trace_enabled_flag.load(std::memory_order_relaxed);
+  }
+
+  // returns 0 on success, -1 if path cannot be created.
+  int page_trace_start(const std::string &path);
+  void page_trace_stop();
+  void page_trace_start_from_env();
+
+  uint32_t page_trace_next_query_id();
+  void page_trace_record(uint64_t page_id, uint32_t hop);
+
+  inline void page_trace_query_begin() {
+    if (__builtin_expect(page_trace_enabled(), 0)) {
+      tls_page_trace_query = page_trace_next_query_id();
+    }
+  }
+
+  inline void page_trace_read(uint64_t page_id, uint32_t hop) {
+    if (__builtin_expect(page_trace_enabled(), 0)) {
+      page_trace_record(page_id, hop);
+    }
+  }
+}  // namespace pipeann
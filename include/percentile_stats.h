@@ -1,10 +1,29 @@
 #pragma once
 
+#include <algorithm>
 #include <cstdint>
 #include <functional>
 #include <vector>
 
+#include "hdr_histogram.h"
+
 namespace pipeann {
+  // Where a query's time goes, attributed with rdtsc by PhaseTimer (telemetry.h).
+  enum QueryPhase : uint32_t {
+    kPhaseHead = 0,  // in-memory (head) index search.
+    kPhasePqSetup,   // query <-> PQ centroid distance table.
+    kPhasePqScore,   // PQ distances of neighbors.
+    kPhaseExact,     // full-precision distances of expanded nodes.
+    kPhasePool,      // candidate pool and visited set maintenance, beam selection.
+    kPhaseSubmit,    // building and submitting IO requests (incl. page cache lookups).
+    kPhaseWait,      // blocking on or polling for IO completions.
+    kPhaseLock,      // index and page lock acquisition and release.
+    kPhaseOther,     // the rest of total_us (buffers, result copy; for coro_search, other queries' turns).
+    kNumQueryPhases
+  };
+  constexpr const char *kQueryPhaseNames[kNumQueryPhases] = {"Head", "PQSetup", "PQScore", "Exact", "Pool",
+                                                             "Submit", "Wait",    "Lock",    "Other"};
+
   struct QueryStats {
     double total_us = 0;        // total time to process query in micros
     double n_4k = 0;            // # of 4kB reads
@@ -21,8 +40,10 @@ namespace pipeann {
     double n_cmps_saved = 0;    // # cmps saved
     double n_cmps = 0;          // # cmps
     double n_cache_hits = 0;    // # cache_hits
+    double n_coalesced = 0;     // # reads served by another query's in-flight read
     double n_hops = 0;          // # search hops
     double n_current_used = 0;  // # force return for latency limit
+    double phase_us[kNumQueryPhases] = {};  // time per QueryPhase in micros
   };
 
   inline double get_percentile_stats(QueryStats *stats, uint64_t len, float percentile,
@@ -47,4 +68,49 @@ namespace pipeann {
     }
     return avg / ((double) len);
   }
+
+  struct QueryStatsSnapshot {
+    HdrHistogram latency_ns, n_ios, n_hops, n_cmps;
+    HdrHistogram phase_ns[kNumQueryPhases];
+  };
+
+  // Streaming aggregation of QueryStats: constant memory, safe to record from
+  // any number of threads, and snapshot-able at any time (see StreamingHistogram).
+  class QueryStatsRecorder {
+   public:
+    inline void record(const QueryStats &stats) {
+      latency_ns.record((uint64_t) (stats.total_us * 1e3));
+      n_ios.record((uint64_t) stats.n_ios);
+      n_hops.record((uint64_t) stats.n_hops);
+      n_cmps.record((uint64_t) stats.n_cmps);
+      for (uint32_t p = 0; p < kNumQueryPhases; ++p) {
+        phase_ns[p].record((uint64_t) (stats.phase_us[p] * 1e3));
+      }
+    }
+
+    QueryStatsSnapshot snapshot() const {
+      QueryStatsSnapshot snap;
+      latency_ns.snapshot_into(snap.latency_ns);
+      n_ios.snapshot_into(snap.n_ios);
+      n_hops.snapshot_into(snap.n_hops);
+      n_cmps.snapshot_into(snap.n_cmps);
+      for (uint32_t p = 0; p < kNumQueryPhases; ++p) {
+        phase_ns[p].snapshot_into(snap.phase_ns[p]);
+      }
+      return snap;
+    }
+
+    void reset() {
+      latency_ns.reset();
+      n_ios.reset();
+      n_hops.reset();
+      n_cmps.reset();
+      for (auto &h : phase_ns) {
+        h.reset();
+      }
+    }
+
+    StreamingHistogram latency_ns, n_ios, n_hops, n_cmps;
+    StreamingHistogram phase_ns[kNumQueryPhases];
+  };
 }  // namespace pipeann
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "tsl/robin_map.h"
+
+namespace pipeann {
+  // In-memory copies of the hottest pages of a disk index, ranked offline by inspect_graph --hot-pages (one
+  // "<sector> [score]" line per page, hottest first). The copies live in one mlock'ed region, so they are
+  // never swapped out; searches serve reads of these pages without IO (see SSDIndex::load_pinned_pages).
+  class PinnedPages {
+   public:
+    ~PinnedPages();
+
+    // pins the first max_pages pages of the list (0: all) that lie inside disk_index_path.
+    int load(const std::string &list_path, const std::string &disk_index_path, uint64_t max_pages);
+
+    // page of sector, or nullptr if it is not pinned.
+    const char *find(uint64_t sector) const {
+      auto it = slots.find(sector);
+      return it == slots.end() ? nullptr : buf + (uint64_t) it->second * kSectorLen;
+    }
+
+    uint64_t num_pages() const {
+      return slots.size();
+    }
+    uint64_t bytes() const {
+      return slots.size() * kSectorLen;
+    }
+    // false if mlock failed (e.g., RLIMIT_MEMLOCK); the pages are still served, but may be swapped out.
+    bool locked() const {
+      return locked_;
+    }
+
+    static constexpr uint64_t kSectorLen = 4096;
+
+   private:
+    tsl::robin_map<uint64_t, uint32_t> slots;  // sector -> index in buf.
+    char *buf = nullptr;
+    uint64_t buf_len = 0;
+    bool locked_ = false;
+  };
+}  // namespace pipeann
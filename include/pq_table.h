@@ -2,6 +2,7 @@
 
 #include "utils.h"
 #include <immintrin.h>
+#include <algorithm>
 #include <sstream>
 #include <string_view>
 
@@ -179,6 +180,100 @@ namespace pipeann {
 #endif
     }
 
+    // populate_chunk_distances for nq queries at once, e.g., a coro_search batch. The table is a small GEMM
+    // (queries x tables_T) with (c - q)^2 in place of the product: each tables_T row is loaded once per block of
+    // four queries, not once per query, and the AVX-512 kernel keeps a 4-query x 64-center tile in registers.
+    void populate_chunk_distances_batch(const T *const *queries, _u64 nq, float *const *dist_vecs) {
+      constexpr _u64 kBlock = 4;
+      static thread_local std::vector<float> shifted;  // [kBlock][ndims], query - centroid in table order.
+      shifted.assign(kBlock * ndims, 0.0f);
+      for (_u64 qb = 0; qb < nq; qb += kBlock) {
+        _u64 nb = std::min(kBlock, nq - qb);
+        for (_u64 b = 0; b < nb; ++b) {
+          for (_u64 j = 0; j < ndims; ++j) {
+            _u32 d = rearrangement[j];
+            shifted[b * ndims + j] = (float) queries[qb + b][d] - centroid[d];
+          }
+        }
+        for (_u64 chunk = 0; chunk < n_chunks; chunk++) {
+#ifdef USE_AVX512
+          for (_u64 idx = 0; idx < 256; idx += 64) {
+            __m512 acc[kBlock][4];
+            for (_u64 b = 0; b < kBlock; ++b) {
+              for (int v = 0; v < 4; ++v) {
+                acc[b][v] = _mm512_setzero_ps();
+              }
+            }
+            for (_u64 j = chunk_offsets[chunk]; j < chunk_offsets[chunk + 1]; j++) {
+              const float *centers = tables_T + 256 * j + idx;
+              __m512 c[4];
+              for (int v = 0; v < 4; ++v) {
+                c[v] = _mm512_load_ps(centers + 16 * v);
+              }
+              for (_u64 b = 0; b < kBlock; ++b) {  // padding queries (b >= nb) are computed and dropped.
+                __m512 q = _mm512_set1_ps(shifted[b * ndims + j]);
+                for (int v = 0; v < 4; ++v) {
+                  __m512 diff = _mm512_sub_ps(c[v], q);
+                  acc[b][v] = _mm512_fmadd_ps(diff, diff, acc[b][v]);
+                }
+              }
+            }
+            for (_u64 b = 0; b < nb; ++b) {
+              float *chunk_dists = dist_vecs[qb + b] + 256 * chunk + idx;
+              for (int v = 0; v < 4; ++v) {
+                _mm512_storeu_ps(chunk_dists + 16 * v, acc[b][v]);
+              }
+            }
+          }
+#else
+          for (_u64 b = 0; b < nb; ++b) {
+            float *chunk_dists = dist_vecs[qb + b] + 256 * chunk;
+            memset(chunk_dists, 0, 256 * sizeof(float));
+            for (_u64 j = chunk_offsets[chunk]; j < chunk_offsets[chunk + 1]; j++) {
+              const float *centers_dim_vec = tables_T + (256 * j);
+              float q = shifted[b * ndims + j];
+              for (_u64 idx = 0; idx < 256; idx++) {
+                float diff = centers_dim_vec[idx] - q;
+                chunk_dists[idx] += diff * diff;
+              }
+            }
+          }
+#endif
+        }
+      }
+    }
+
+#ifdef __F16C__
+    // fp16 tables (half the cache footprint of pq_dist_lookup). A table is stored divided by its scale, so that
+    // its largest entry fits fp16; lookups multiply the sums back (see pq_dist_lookup with a scale).
+    void populate_chunk_distances_batch_fp16(const T *const *queries, _u64 nq, uint16_t *const *dist_vecs,
+                                             float *scales) {
+      const _u64 table_len = 256 * n_chunks;
+      static thread_local std::vector<float> tables_f32;
+      static thread_local std::vector<float *> ptrs;
+      tables_f32.resize(nq * table_len);
+      ptrs.resize(nq);
+      for (_u64 i = 0; i < nq; ++i) {
+        ptrs[i] = tables_f32.data() + i * table_len;
+      }
+      populate_chunk_distances_batch(queries, nq, ptrs.data());
+      for (_u64 i = 0; i < nq; ++i) {
+        const float *src = ptrs[i];
+        float max_dist = *std::max_element(src, src + table_len);
+        scales[i] = max_dist > 0 ? max_dist / 65504.0f : 1.0f;  // 65504: largest finite fp16.
+        const float inv = 1.0f / scales[i];
+        _u64 idx = 0;
+        for (; idx + 8 <= table_len; idx += 8) {
+          __m256 v = _mm256_mul_ps(_mm256_loadu_ps(src + idx), _mm256_set1_ps(inv));
+          _mm_storeu_si128((__m128i *) (dist_vecs[i] + idx), _mm256_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT));
+        }
+        for (; idx < table_len; ++idx) {
+          dist_vecs[i][idx] = _cvtss_sh(src[idx] * inv, _MM_FROUND_TO_NEAREST_INT);
+        }
+      }
+    }
+#endif
+
     // computes PQ distance between comp_src and comp_dsts in efficient manner
     // comp_src: [nchunks]
     // comp_dsts: count * [nchunks]
@@ -56,6 +56,7 @@ namespace pipeann {
     _u8 *aligned_pq_coord_scratch = nullptr;  // MUST BE AT LEAST  [N_CHUNKS * MAX_DEGREE], for neighbor PQ vectors.
     T *aligned_query_T = nullptr;
     char *update_buf = nullptr;
+    _u64 padded_dim = 0;  // data_dim whose padding is zeroed, for buffers shared across dimensions.
 
     tsl::robin_set<_u64> *visited = nullptr;
     tsl::robin_set<unsigned> *page_visited = nullptr;
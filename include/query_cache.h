@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace pipeann {
+  struct QueryCacheParams {
+    uint64_t capacity = 1 << 16;  // entries over all shards; LRU eviction.
+    uint64_t ttl_us = 0;          // 0: entries never expire.
+    // near-duplicate tier: a query within near_dist (squared L2 on the raw query) of a cached query with the
+    // same k and L is served its results. Candidates come from the query's LSH bucket (lsh_bits random
+    // hyperplanes), so a near-duplicate across a hyperplane is a miss. 0 disables the tier.
+    float near_dist = 0;
+    uint32_t lsh_bits = 16;  // at most 64.
+    // an entry stored at update epoch e is served while the current epoch is at most e + max_epoch_lag;
+    // 0 invalidates every entry on any insert or delete.
+    uint64_t max_epoch_lag = 0;
+    uint32_t n_shards = 16;
+    uint64_t seed = 0x5eed;
+  };
+
+  struct QueryCacheStats {
+    uint64_t exact_hits = 0, near_hits = 0, misses = 0;
+    uint64_t expired = 0, stale = 0;  // misses dropping an entry past its TTL or its epoch lag.
+    uint64_t evictions = 0, entries = 0;
+  };
+
+  // Result cache in front of an index search. Keys are a hash of the query bytes with k and L; the query
+  // is stored, so a hash collision is a miss. Thread-safe: entries are spread over mutex-guarded shards.
+  // The caller supplies the index's update epoch (see DynamicSSDIndex::update_epoch()) on every call.
+  template<typename T, typename TagT = uint32_t>
+  class QueryCache {
+   public:
+    QueryCache(uint64_t dim, const QueryCacheParams &params = QueryCacheParams());
+
+    // on a hit, fills tags and dists (nearest first) and returns true.
+    bool lookup(const T *query, uint64_t k, uint64_t l_search, uint64_t epoch, std::vector<TagT> &tags,
+                std::vector<float> &dists);
+    // stores the first n results of a search that ran at epoch (read before the search started).
+    void insert(const T *query, uint64_t k, uint64_t l_search, uint64_t epoch, const TagT *tags, const float *dists,
+                uint64_t n);
+
+    void clear();
+    QueryCacheStats stats() const;
+
+    const QueryCacheParams &params() const {
+      return params_;
+    }
+
+   private:
+    struct Entry {
+      uint64_t hash, sig, k, l_search, epoch;
+      std::chrono::steady_clock::time_point inserted;
+      std::vector<T> query;
+      std::vector<TagT> tags;
+      std::vector<float> dists;
+    };
+    using EntryIter = typename std::list<Entry>::iterator;
+
+    struct Shard {
+      std::mutex lock;
+      std::list<Entry> lru;  // most recent first.
+      std::unordered_map<uint64_t, EntryIter> exact;
+      std::unordered_map<uint64_t, std::vector<EntryIter>> buckets;  // LSH signature -> entries.
+    };
+
+    uint64_t hash(const T *query, uint64_t k, uint64_t l_search) const;
+    uint64_t signature(const T *query) const;
+    // true if the entry may be served at epoch; otherwise counts why not.
+    bool fresh(const Entry &e, uint64_t epoch, std::chrono::steady_clock::time_point now);
+    void erase(Shard &s, EntryIter it);
+
+    uint64_t dim;
+    QueryCacheParams params_;
+    uint64_t shard_capacity;
+    std::vector<float> hyperplanes;  // lsh_bits x dim.
+    std::unique_ptr<Shard[]> shards;
+
+    std::atomic<uint64_t> n_exact_hits{0}, n_near_hits{0}, n_misses{0}, n_expired{0}, n_stale{0}, n_evictions{0};
+  };
+}  // namespace pipeann
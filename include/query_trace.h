@@ -0,0 +1,160 @@
+#pragma once
+
+/**
+ * Per-query structured traces, captured in-process (no root, no uprobes).
+ *
+ * While a traced query runs, its events (expansions, IO submit/complete
+ * timestamps, tier hits/misses, candidate-list snapshots) are staged in a
+ * thread-local buffer. At query end the whole query is committed to the
+ * thread's lock-free single-producer ring if it was sampled, flagged with
+ * trace_flag_next_query(), or slower than the slow_us threshold; otherwise it
+ * is discarded. Rings are drained (by one consumer at a time) into a compact
+ * binary file, decoded by tests/decode_query_trace.
+ *
+ * Enable with PIPEANN_TRACE="<file>[,sample=N][,slow_us=U][,cands=C][,ring=E][,interval_ms=M]":
+ *   sample=N      commit every N-th query (0: none; default 0).
+ *   slow_us=U     commit every query slower than U us (0: off; default 0).
+ *   cands=C       candidates per snapshot (default 8; 0: no snapshots).
+ *   ring=E        per-thread ring capacity in events (rounded up to 2^k; default 65536).
+ *   interval_ms=M background drain period (default 1000); rings are also drained at exit.
+ * When tracing is disabled the hot-path cost is one thread-local branch per event site.
+ * coro_search interleaves queries on one thread and is not traced.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "percentile_stats.h"
+
+namespace pipeann {
+  enum TraceEventType : uint16_t {
+    kTrQueryBegin = 1,  // a = l_search | thread << 32, b = beam_width, arg = search mode.
+    kTrQueryEnd,        // a = n_ios | n_hops << 32, b = total_us, arg = kTrReason* bits.
+    kTrExpand,          // a = node id, b = page id.
+    kTrIoSubmit,        // a = offset, b = len.
+    kTrIoComplete,      // a = offset, b = len (time the searcher observed completion).
+    kTrTierHit,         // a = page id (served by the page cache, no device IO).
+    kTrTierMiss,        // a = page id.
+    kTrCandidate,       // a = node id, b = distance (float bits), arg = rank; rank 0 starts a snapshot.
+  };
+
+  enum TraceReason : uint16_t { kTrReasonSampled = 1, kTrReasonSlow = 2, kTrReasonFlagged = 4 };
+
+  struct TraceEvent {
+    uint64_t ts;  // read_cycles().
+    uint64_t query_id;
+    uint64_t a;
+    uint32_t b;
+    uint16_t type;
+    uint16_t arg;
+  };
+  static_assert(sizeof(TraceEvent) == 32, "TraceEvent is part of the trace file format");
+
+  // Trace file: TraceFileHeader, then TraceEvents in commit order per thread
+  // (the events of one query are contiguous).
+  struct TraceFileHeader {
+    char magic[8];  // "PATRACE1"
+    uint32_t version;
+    uint32_t event_size;
+    double cycles_per_second;
+  };
+  constexpr char kTraceMagic[8] = {'P', 'A', 'T', 'R', 'A', 'C', 'E', '1'};
+
+  // Single-producer single-consumer ring. push() is all-or-nothing so a
+  // query is never split; a full ring drops the query and counts it.
+  class TraceRing {
+   public:
+    explicit TraceRing(size_t capacity);
+
+    bool push(const TraceEvent *events, size_t n);
+    // appends all committed events to out; returns the number appended.
+    size_t drain(std::vector<TraceEvent> &out);
+
+    uint64_t dropped() const {
+      return dropped_.load(std::memory_order_relaxed);
+    }
+
+   private:
+    std::vector<TraceEvent> buf_;
+    uint64_t mask_;
+    alignas(64) std::atomic<uint64_t> head_{0};  // written by the producer.
+    alignas(64) std::atomic<uint64_t> tail_{0};  // written by the consumer.
+    std::atomic<uint64_t> dropped_{0};
+  };
+
+  struct TraceConfig {
+    uint32_t sample_every = 0;
+    uint64_t slow_us = 0;
+    uint32_t n_candidates = 8;
+    size_t ring_events = 65536;
+  };
+
+  inline std::atomic<bool> trace_enabled_flag{false};
+  inline thread_local bool tls_trace_active = false;
+
+  inline bool trace_enabled() {
+    return trace_enabled_flag.load(std::memory_order_relaxed);
+  }
+
+  // Enables tracing with cfg (disabled again by trace_disable()).
+  void trace_configure(const TraceConfig &cfg);
+  void trace_disable();
+  // Commit the next query started on this thread regardless of sampling.
+  void trace_flag_next_query();
+  // Starts PIPEANN_TRACE (config + background drainer), at most once.
+  void trace_start_from_env();
+  // Drains all rings and appends to path (writing the header if the file is
+  // empty). Returns the number of events written, or -1 on IO error.
+  int64_t trace_drain(const std::string &path);
+  // Queries dropped because a ring was full.
+  uint64_t trace_dropped();
+
+  void trace_begin_slow(uint16_t mode, uint32_t l_search, uint32_t beam_width);
+  void trace_end_slow(const QueryStats &stats);
+  void trace_push(uint16_t type, uint64_t a, uint32_t b, uint16_t arg);
+  uint32_t trace_n_candidates();
+
+  inline void trace_query_begin(uint16_t mode, uint32_t l_search, uint32_t beam_width) {
+    if (__builtin_expect(trace_enabled(), 0)) {
+      trace_begin_slow(mode, l_search, beam_width);
+    }
+  }
+
+  inline void trace_query_end(const QueryStats &stats) {
+    if (__builtin_expect(tls_trace_active, 0)) {
+      trace_end_slow(stats);
+    }
+  }
+
+  inline void trace_event(TraceEventType type, uint64_t a, uint32_t b = 0, uint16_t arg = 0) {
+    if (__builtin_expect(tls_trace_active, 0)) {
+      trace_push(type, a, b, arg);
+    }
+  }
+
+  template<typename ReqVec>
+  inline void trace_ios(TraceEventType type, const ReqVec &reqs) {
+    if (__builtin_expect(tls_trace_active, 0)) {
+      for (auto &req : reqs) {
+        trace_push(type, req.offset, (uint32_t) req.len, 0);
+      }
+    }
+  }
+
+  // Snapshot of the best n entries of a sorted candidate pool (Neighbor-like: .id, .distance).
+  template<typename NbrT>
+  inline void trace_candidates(const NbrT *pool, uint32_t n) {
+    if (__builtin_expect(tls_trace_active, 0)) {
+      n = std::min(n, trace_n_candidates());
+      for (uint32_t i = 0; i < n; ++i) {
+        uint32_t bits;
+        memcpy(&bits, &pool[i].distance, sizeof(bits));
+        trace_push(kTrCandidate, pool[i].id, bits, (uint16_t) i);
+      }
+    }
+  }
+}  // namespace pipeann
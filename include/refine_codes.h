@@ -0,0 +1,82 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "neighbor.h"
+
+namespace pipeann {
+  // 8-bit scalar-quantized vectors used to rerank search candidates that were never expanded (their only
+  // distance is the PQ estimate). Written by create_refine_codes as <prefix>_sq8.bin:
+  //   header (header_sectors sectors): [npts(u64)][dim(u64)][header_sectors(u64)][min(float) * dim][scale(float) * dim]
+  //   codes: SECTOR_LEN / dim codes per sector, none straddling a sector; x[d] ~ min[d] + scale[d] * code[d].
+  template<typename T>
+  class RefineCodes {
+   public:
+    ~RefineCodes();
+
+    // in_memory keeps all codes in memory; otherwise they are read per query (see fd() / code_offset()).
+    int load(const std::string &path, uint64_t dim, bool in_memory);
+
+    uint64_t num_points() const {
+      return npts;
+    }
+    bool in_memory() const {
+      return !codes.empty();
+    }
+    // O_DIRECT handle of the code file (on-disk mode).
+    int fd() const {
+      return fd_;
+    }
+
+    // byte offset of id's code in the file; sectors hold whole codes.
+    uint64_t code_offset(uint32_t id) const {
+      return (header_sectors + id / codes_per_sector) * kSectorLen + (id % codes_per_sector) * dim;
+    }
+    // in-memory mode only.
+    const uint8_t *code(uint32_t id) const {
+      return codes.data() + (uint64_t) id * dim;
+    }
+
+    void decode(const uint8_t *code, T *out) const;
+
+    static constexpr uint64_t kSectorLen = 4096;
+
+   private:
+    uint64_t npts = 0, dim = 0, header_sectors = 0, codes_per_sector = 0;
+    std::vector<float> mins, scales;
+    std::vector<uint8_t> codes;
+    int fd_ = -1;
+  };
+
+  // The best PQ-scored candidates a search dropped from its L-sized candidate list, or never admitted to
+  // it; reranking them recovers neighbors whose PQ estimates were too pessimistic. capacity 0 disables it.
+  class RefinePool {
+   public:
+    void reset(uint32_t capacity) {
+      cap = capacity;
+      heap.clear();
+    }
+    inline void offer(const Neighbor &nbr) {
+      if (cap == 0 || (heap.size() == cap && !(nbr < heap.front()))) {
+        return;
+      }
+      if (heap.size() == cap) {
+        std::pop_heap(heap.begin(), heap.end());
+        heap.pop_back();
+      }
+      heap.push_back(nbr);
+      std::push_heap(heap.begin(), heap.end());
+    }
+    // unordered.
+    const std::vector<Neighbor> &candidates() const {
+      return heap;
+    }
+
+   private:
+    uint32_t cap = 0;
+    std::vector<Neighbor> heap;  // max-heap on PQ distance.
+  };
+}  // namespace pipeann
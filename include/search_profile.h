@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace pipeann {
+  // Search parameters tuned for one index on one device (tests/tune_search.cpp). SSDIndex::load reads
+  // <prefix>_search.profile if present; SSDIndex::default_search_params() then returns its values, and the
+  // Python module and search_disk_index fall back to them for arguments left unset.
+  struct SearchProfile {
+    int mode = 2;  // SearchMode, or 4 for search_async.
+    uint32_t mem_L = 0;
+    uint64_t l_search = 40;
+    uint64_t beam_width = 4;
+    // what the tuner measured, for reference.
+    uint64_t k = 10;
+    uint32_t threads = 1;
+    float recall = 0, p99_us = 0, qps = 0;
+
+    // text format, one "key value" per line; returns 0 on success.
+    int load(const std::string &path);
+    int save(const std::string &path) const;
+  };
+}  // namespace pipeann
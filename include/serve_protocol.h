@@ -0,0 +1,100 @@
+#pragma once
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Wire format of serve_index (tests/serve_index.cpp), which serves one index over a
+// Unix domain socket. Every message is a fixed header followed by body_len bytes,
+// in host byte order (the socket is local). A client may pipeline any number of
+// requests on a connection; responses echo req_id and may arrive out of order.
+namespace pipeann {
+  namespace serve {
+    constexpr uint32_t kMagic = 0x4e4e4150;  // "PANN"
+    constexpr uint32_t kMaxBodyLen = 1 << 24;
+
+    enum Op : uint32_t {
+      kOpInfo = 0,    // -> InfoBody
+      kOpSearch = 1,  // SearchBody, query (dim elements) -> n (u32), n tags (u32), n dists (float)
+      kOpInsert = 2,  // tag (u32), vector (dim elements); dynamic index only
+      kOpDelete = 3,  // tag (u32); dynamic index only
+      kOpStats = 4,   // -> text report
+      kOpReload = 5,  // static: reopen the index files; dynamic: merge deletes and reload. Replies when done.
+    };
+
+    enum Status : uint32_t {
+      kOk = 0,
+      kBadRequest = 1,   // malformed body or out-of-range parameters.
+      kUnsupported = 2,  // e.g., insert on a static index.
+      kBusy = 3,         // a reload is already running.
+    };
+
+    struct RequestHeader {
+      uint32_t magic = kMagic;
+      uint32_t op = kOpInfo;
+      uint64_t req_id = 0;
+      uint32_t body_len = 0;
+      uint32_t reserved = 0;
+    };
+
+    struct ResponseHeader {
+      uint32_t magic = kMagic;
+      uint32_t status = kOk;
+      uint64_t req_id = 0;
+      uint32_t body_len = 0;
+      uint32_t reserved = 0;
+    };
+
+    struct SearchBody {
+      uint32_t k = 10;
+      uint32_t L = 40;
+      uint32_t mem_L = 0;
+      uint32_t beam_width = 4;
+    };
+
+    struct InfoBody {
+      uint32_t dim = 0;
+      uint32_t elem_size = 0;  // sizeof(T) of the served index.
+      uint32_t dynamic = 0;    // accepts inserts and deletes.
+      uint32_t max_batch = 0;  // queries per search batch.
+    };
+
+    static_assert(sizeof(RequestHeader) == 24 && sizeof(ResponseHeader) == 24, "wire headers are 24 bytes");
+
+    // false on EOF or error.
+    inline bool read_full(int fd, void *buf, size_t n) {
+      char *p = (char *) buf;
+      while (n > 0) {
+        ssize_t r = ::read(fd, p, n);
+        if (r < 0 && errno == EINTR) {
+          continue;
+        }
+        if (r <= 0) {
+          return false;
+        }
+        p += r;
+        n -= r;
+      }
+      return true;
+    }
+
+    // MSG_NOSIGNAL: a peer that went away is an error, not SIGPIPE.
+    inline bool write_full(int fd, const void *buf, size_t n) {
+      const char *p = (const char *) buf;
+      while (n > 0) {
+        ssize_t r = ::send(fd, p, n, MSG_NOSIGNAL);
+        if (r < 0 && errno == EINTR) {
+          continue;
+        }
+        if (r <= 0) {
+          return false;
+        }
+        p += r;
+        n -= r;
+      }
+      return true;
+    }
+  }  // namespace serve
+}  // namespace pipeann
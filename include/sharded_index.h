@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "parameters.h"
+#include "ssd_index.h"
+
+namespace pipeann {
+  // Scatter-gather search over independent SSDIndex shards (separate files or devices). Each shard
+  // owns a tag range: its tags map to global tags as tag + tag_offset. A query runs on every shard at
+  // once through the shards' async engines and the per-shard top-k lists are merged. With early stop,
+  // the first shard to finish publishes its k-th distance (times a slack) as a bound, and the shards
+  // still running stop once none of their unexpanded candidates can beat it (after
+  // AsyncSearchParams::stop_min_hops hops, so a shard is not judged before its walk gets close).
+  template<typename T, typename TagT = uint32_t>
+  class ShardedIndex {
+   public:
+    // returns the shard an inserted point goes to.
+    using InsertPolicy = std::function<uint32_t(const T *point, TagT tag, const ShardedIndex &index)>;
+
+    // insert_params (L, R, C, alpha, beamwidth, as for DynamicSSDIndex's disk index) enable insert() and
+    // must stay valid while shards are added; inserts modify the shard files in place.
+    ShardedIndex(Metric metric, Parameters *insert_params = nullptr);
+    ~ShardedIndex();
+
+    // loads a shard; num_threads sizes its search buffers, async_workers its engine. Returns its number or -1.
+    int add_shard(const std::string &index_prefix, uint32_t num_threads, TagT tag_offset = 0,
+                  uint32_t async_workers = 2);
+
+    // slack <= 0 disables early stop (the default); larger slack stops less aggressively.
+    void set_early_stop(float slack) {
+      early_stop_slack = slack;
+    }
+    void set_insert_policy(InsertPolicy policy) {
+      insert_policy = std::move(policy);
+    }
+    // shards added afterwards share runtime's buffers, write-back threads and reader ownership.
+    void set_runtime(std::shared_ptr<IndexRuntime<T>> runtime) {
+      this->runtime = std::move(runtime);
+    }
+
+    // tags are global, nearest first; stats sum the shards' IOs, cache hits, coalesced reads, hops and
+    // comparisons. With no shards, the callback runs right away with an empty result.
+    void search_async(const T *query, const AsyncSearchParams &params, AsyncSearchCallback<TagT> callback);
+    std::future<AsyncSearchResult<TagT>> search_async(const T *query, const AsyncSearchParams &params);
+    // returns the number of results written.
+    size_t search(const T *query, const AsyncSearchParams &params, TagT *res_tags, float *res_dists,
+                  QueryStats *stats = nullptr);
+
+    // routes by the insert policy; returns -1 if inserts are disabled or the tag is below the shard's range.
+    int insert(const T *point, const TagT &tag);
+
+    // the shard with the largest tag_offset <= tag (the default).
+    static InsertPolicy tag_range_policy();
+    static InsertPolicy round_robin_policy();
+    // the shard with the fewest points.
+    static InsertPolicy least_loaded_policy();
+
+    uint32_t num_shards() const {
+      return (uint32_t) shards.size();
+    }
+    SSDIndex<T, TagT> &shard(uint32_t i) const {
+      return *shards[i]->index;
+    }
+    TagT shard_tag_offset(uint32_t i) const {
+      return shards[i]->tag_offset;
+    }
+
+   private:
+    struct Shard {
+      std::shared_ptr<AlignedFileReader> reader;  // the index keeps a reference to it (unless in runtime).
+      std::unique_ptr<SSDIndex<T, TagT>> index;
+      TagT tag_offset = 0;
+    };
+    struct Gather;
+
+    Metric metric;
+    Parameters *insert_params;
+    std::vector<std::unique_ptr<Shard>> shards;
+    InsertPolicy insert_policy;
+    float early_stop_slack = 0;
+    std::shared_ptr<IndexRuntime<T>> runtime;
+  };
+}  // namespace pipeann
@@ -1,7 +1,11 @@
 #pragma once
 #include <immintrin.h>
+#include <atomic>
 #include <cassert>
 #include <cstdint>
+#include <functional>
+#include <future>
+#include <mutex>
 #include <string>
 #include <set>
 #include "v2/page_cache.h"
@@ -9,11 +13,19 @@
 #include <iomanip>
 #include <omp.h>
 
+#include "adaptive_budget.h"
 #include "aligned_file_reader.h"
 #include "concurrent_queue.h"
+#include "early_stop.h"
+#include "index_runtime.h"
+#include "inflight_reads.h"
 #include "parameters.h"
 #include "percentile_stats.h"
+#include "pinned_pages.h"
 #include "pq_table.h"
+#include "query_cache.h"
+#include "refine_codes.h"
+#include "search_profile.h"
 #include "utils.h"
 #include "neighbor.h"
 #include "index.h"
@@ -24,6 +36,8 @@
 #define SECTOR_LEN 4096
 
 constexpr int kIndexSizeFactor = 2;
+// disk index metadata entry holding the PQ code length stored inline per neighbor (absent or 0: none).
+constexpr uint64_t kInlinePqMetaIdx = 10;
 
 enum SearchMode { BEAM_SEARCH = 0, PAGE_SEARCH = 1, PIPE_SEARCH = 2, CORO_SEARCH = 3 };
 
@@ -62,6 +76,26 @@ namespace {
       }
     }
   }
+
+#ifdef __F16C__
+  // pq_dist_lookup over fp16 tables stored divided by scale (FixedChunkPQTable::populate_chunk_distances_batch_fp16).
+  inline void pq_dist_lookup(const _u8 *pq_ids, const _u64 n_pts, const _u64 pq_nchunks, const uint16_t *pq_dists,
+                             const float scale, float *dists_out) {
+    _mm_prefetch((char *) dists_out, _MM_HINT_T0);
+    _mm_prefetch((char *) pq_ids, _MM_HINT_T0);
+    memset(dists_out, 0, n_pts * sizeof(float));
+    for (_u64 chunk = 0; chunk < pq_nchunks; chunk++) {
+      const uint16_t *chunk_dists = pq_dists + 256 * chunk;
+      for (_u64 idx = 0; idx < n_pts; idx++) {
+        _u8 pq_centerid = pq_ids[pq_nchunks * idx + chunk];
+        dists_out[idx] += _cvtsh_ss(chunk_dists[pq_centerid]);
+      }
+    }
+    for (_u64 idx = 0; idx < n_pts; idx++) {
+      dists_out[idx] *= scale;
+    }
+  }
+#endif
 }  // namespace
 
 namespace pipeann {
@@ -70,6 +104,31 @@ namespace pipeann {
 #define READ_U32(stream, val) stream.read((char *) &val, sizeof(_u32))
 #define READ_UNSIGNED(stream, val) stream.read((char *) &val, sizeof(unsigned))
 
+  class PhaseTimer;
+
+  // Parameters of one asynchronous query (see SSDIndex::search_async).
+  struct AsyncSearchParams {
+    _u64 k_search = 10;
+    _u32 mem_L = 0;  // 0: start from the medoid.
+    _u64 l_search = 40;
+    _u64 beam_width = 4;
+    // if set, the search ends once no unexpanded candidate is closer than *stop_dist (PQ distance),
+    // checked from hop stop_min_hops on (the walk starts far from the query). The caller may lower
+    // *stop_dist while the query runs; it must outlive the query.
+    const std::atomic<float> *stop_dist = nullptr;
+    _u32 stop_min_hops = 8;
+  };
+
+  template<typename TagT>
+  struct AsyncSearchResult {
+    std::vector<TagT> tags;  // up to k_search, nearest first.
+    std::vector<float> dists;
+    QueryStats stats;  // total_us counts from submission, queueing included.
+  };
+
+  template<typename TagT>
+  using AsyncSearchCallback = std::function<void(AsyncSearchResult<TagT> &&)>;
+
   template<typename T, typename TagT = uint32_t>
   class SSDIndex {
    public:
@@ -88,6 +147,35 @@ namespace pipeann {
       return (unsigned *) (node_buf + data_dim * sizeof(T));
     }
 
+    // inline-PQ layout only: region after the neighbor list containing [NBR_PQ_CODE(n_chunks)] * max_degree
+    inline _u8 *offset_to_node_nbr_codes(const char *node_buf) {
+      return (_u8 *) (node_buf + data_dim * sizeof(T) + (max_degree + 1) * sizeof(unsigned));
+    }
+
+    // inline-PQ layout: refreshes the node's neighbor codes from the in-memory ones (insert, merge).
+    inline void write_nbr_codes(char *node_buf, const uint32_t *nbrs, uint32_t nnbrs) {
+      if (inline_pq_chunks == 0) {
+        return;
+      }
+      _u8 *codes = offset_to_node_nbr_codes(node_buf);
+      for (uint32_t i = 0; i < nnbrs; ++i) {
+        memcpy(codes + i * n_chunks, this->data.data() + (_u64) nbrs[i] * n_chunks, n_chunks);
+      }
+    }
+
+    // gathers the PQ codes of ids into out. Without in-memory codes only the medoid's is kept, which is
+    // all the search needs: neighbor codes then come from the node records.
+    inline void aggregate_pq_codes(const unsigned *ids, const _u64 n_ids, _u8 *out) {
+      if (likely(!this->data.empty())) {
+        ::aggregate_coords(ids, n_ids, this->data.data(), this->n_chunks, out);
+        return;
+      }
+      for (_u64 i = 0; i < n_ids; ++i) {
+        assert(ids[i] == medoids[0]);
+        memcpy(out + i * n_chunks, medoid_pq_code.data(), n_chunks);
+      }
+    }
+
     // obtains region of sector containing node
     inline char *offset_to_node(const char *sector_buf, uint32_t node_id) {
       return offset_to_loc(sector_buf, id2loc(node_id));
@@ -124,14 +212,15 @@ namespace pipeann {
       return (sector_no - 1) * nnodes_per_sector + sector_off;
     }
 
-    void init_query_buf(QueryBuffer<T> &buf) {
-      _u64 coord_alloc_size = ROUND_UP(MAX_N_CMPS * this->aligned_dim, 256);
+    // scratch for searches and inserts over vectors of up to aligned_dim dimensions.
+    static void init_query_buf(QueryBuffer<T> &buf, _u64 aligned_dim) {
+      _u64 coord_alloc_size = ROUND_UP(MAX_N_CMPS * aligned_dim, 256);
       pipeann::alloc_aligned((void **) &buf.coord_scratch, coord_alloc_size, 256);
       pipeann::alloc_aligned((void **) &buf.sector_scratch, MAX_N_SECTOR_READS * SECTOR_LEN, SECTOR_LEN);
       pipeann::alloc_aligned((void **) &buf.aligned_pq_coord_scratch, 32768 * 32 * sizeof(_u8), 256);
       pipeann::alloc_aligned((void **) &buf.aligned_pqtable_dist_scratch, 25600 * sizeof(float), 256);
       pipeann::alloc_aligned((void **) &buf.aligned_dist_scratch, 512 * sizeof(float), 256);
-      pipeann::alloc_aligned((void **) &buf.aligned_query_T, this->aligned_dim * sizeof(T), 8 * sizeof(T));
+      pipeann::alloc_aligned((void **) &buf.aligned_query_T, aligned_dim * sizeof(T), 8 * sizeof(T));
       pipeann::alloc_aligned((void **) &buf.update_buf, (2 * MAX_N_EDGES + 1) * SECTOR_LEN,
                              SECTOR_LEN);  // 2x for read + write
 
@@ -140,15 +229,33 @@ namespace pipeann {
 
       memset(buf.sector_scratch, 0, MAX_N_SECTOR_READS * SECTOR_LEN);
       memset(buf.coord_scratch, 0, coord_alloc_size);
-      memset(buf.aligned_query_T, 0, this->aligned_dim * sizeof(T));
+      memset(buf.aligned_query_T, 0, aligned_dim * sizeof(T));
       memset(buf.update_buf, 0, (2 * MAX_N_EDGES + 1) * SECTOR_LEN);
     }
 
+    static void free_query_buf(QueryBuffer<T> &buf) {
+      pipeann::aligned_free((void *) buf.coord_scratch);
+      pipeann::aligned_free((void *) buf.sector_scratch);
+      pipeann::aligned_free((void *) buf.aligned_pq_coord_scratch);
+      pipeann::aligned_free((void *) buf.aligned_pqtable_dist_scratch);
+      pipeann::aligned_free((void *) buf.aligned_dist_scratch);
+      pipeann::aligned_free((void *) buf.aligned_query_T);
+      pipeann::aligned_free((void *) buf.update_buf);
+      delete buf.visited;
+      delete buf.page_visited;
+    }
+
     QueryBuffer<T> *pop_query_buf(const T *query) {
-      QueryBuffer<T> *data = this->thread_data_queue.pop();
-      while (data == nullptr) {
-        this->thread_data_queue.wait_for_push_notify();
+      QueryBuffer<T> *data = nullptr;
+      if (runtime_ != nullptr) {
+        data = runtime_->pop_query_buf();
+        runtime_->fit_query_buf(data, this->data_dim, this->aligned_dim);
+      } else {
         data = this->thread_data_queue.pop();
+        while (data == nullptr) {
+          this->thread_data_queue.wait_for_push_notify();
+          data = this->thread_data_queue.pop();
+        }
       }
 
       if (likely(query != nullptr)) {
@@ -166,10 +273,81 @@ namespace pipeann {
     }
 
     void push_query_buf(QueryBuffer<T> *data) {
+      if (runtime_ != nullptr) {
+        runtime_->push_query_buf(data);
+        return;
+      }
       this->thread_data_queue.push(data);
       this->thread_data_queue.push_notify_all();
     }
 
+    // shares runtime's query buffers and write-back threads instead of allocating per-index ones; call
+    // before load(). The runtime outlives the index.
+    void set_runtime(std::shared_ptr<IndexRuntime<T>> runtime) {
+      runtime_ = std::move(runtime);
+    }
+
+    // with the inline-PQ disk layout (see create_inline_pq_layout), keep = false loads only the medoid's PQ
+    // code: searches score neighbors from the node records, inserts, merges and mem_L need all codes.
+    // Call before load().
+    void set_keep_pq_codes(bool keep) {
+      keep_pq_codes = keep;
+    }
+
+    // search_async answers repeated (and, if enabled, near-duplicate) queries from cache, without IO and
+    // on the calling thread. Queries with a stop_dist bypass it. nullptr disables the cache.
+    void set_query_cache(std::shared_ptr<QueryCache<T, TagT>> cache) {
+      std::atomic_store(&query_cache_, std::move(cache));
+    }
+    // every search mode (and search_async) ends a query once model predicts its results are final; with
+    // trace, searches instead record their hops for training (tests/train_early_stop.cpp). nullptr disables.
+    // Set before searching; both must outlive the searches.
+    void set_early_stop(std::shared_ptr<const EarlyStopModel> model, EarlyStopTrace *trace = nullptr) {
+      early_stop_model_ = std::move(model);
+      early_stop_trace_ = trace;
+    }
+
+    // beam_search and pipe_search rerank their refine_r best unexpanded candidates (ranked by PQ distance
+    // only, including those that fell out of the L-sized list) with the SQ8 codes at path (see
+    // create_refine_codes), merging them with the expanded nodes. Without in_memory the codes are fetched with
+    // one batched read per query. Points inserted after the codes were written are not reranked, and reload()
+    // drops the codes. Call after load(); returns -1 on error.
+    int load_refine_codes(const std::string &path, uint32_t refine_r, bool in_memory = false);
+
+    // every search mode serves reads of the first max_pages pages (0: all) of list_path, ranked by
+    // inspect_graph --hot-pages, from mlock'ed copies instead of the SSD. Served reads count as kTmPinnedHits
+    // and QueryStats::n_cache_hits, not as IOs. The copies are no longer used after the first update
+    // (insert_in_place or reload). Call after load(); returns -1 on error.
+    int load_pinned_pages(const std::string &list_path, uint64_t max_pages = 0);
+
+    // every search mode (and search_async) coalesces concurrent reads of a page: a query that needs a page
+    // another query is reading waits for that read and receives a copy (see InflightReads). Coalesced reads
+    // count as kTmCoalescedReads and QueryStats::n_coalesced, not as IOs. Set before searching.
+    void set_read_coalescing(bool enable) {
+      inflight_reads_ = enable ? std::make_unique<InflightReads>() : nullptr;
+    }
+
+    // beam, pipe and coro search (and search_async) scale each query's L and beam width by its difficulty,
+    // keeping their means; see AdaptiveBudget. nullptr disables. Set before searching.
+    void set_adaptive_budget(std::shared_ptr<AdaptiveBudget> budget) {
+      adaptive_budget_ = std::move(budget);
+    }
+
+    // bumped by every insert_in_place and reload; cached results from older epochs age out (see
+    // QueryCacheParams::max_epoch_lag).
+    uint64_t update_epoch() const {
+      return update_epoch_.load(std::memory_order_acquire);
+    }
+
+    // the profile load() found at <prefix>_search.profile (see tests/tune_search.cpp), or nullptr.
+    const SearchProfile *search_profile() const {
+      return has_search_profile_ ? &search_profile_ : nullptr;
+    }
+
+    // the profile's k, mem_L, L and beam width, or the AsyncSearchParams defaults without a profile. mem_L is
+    // 0 until a memory index is loaded.
+    AsyncSearchParams default_search_params() const;
+
     // load compressed data, and obtains the handle to the disk-resident index
     int load(const char *index_prefix, uint32_t num_threads, bool new_index_format = true,
              bool use_page_search = false);
@@ -187,8 +365,9 @@ namespace pipeann {
                        float *res_dists, const _u64 beam_width, QueryStats *stats = nullptr,
                        tsl::robin_set<uint32_t> *deleted_nodes = nullptr, bool dyn_search_l = true);
 
+    // stats, if given, holds N entries (one per query).
     size_t coro_search(T **queries, const _u64 k_search, const _u32 mem_L, const _u64 l_search, TagT **res_tags,
-                       float **res_dists, const _u64 beam_width, int N);
+                       float **res_dists, const _u64 beam_width, int N, QueryStats *stats = nullptr);
 
     // read-only search algorithms.
     size_t page_search(const T *query, const _u64 k_search, const _u32 mem_L, const _u64 l_search, TagT *res_tags,
@@ -197,6 +376,27 @@ namespace pipeann {
     size_t pipe_search(const T *query, const _u64 k_search, const _u32 mem_L, const _u64 l_search, TagT *res_tags,
                        float *res_dists, const _u64 beam_width, QueryStats *stats = nullptr);
 
+    // throughput-oriented search for offline and bulk jobs (dedup, k-NN graph construction, evaluation), where
+    // only total IO and CPU matter: each of num_threads threads (0: all) runs batches of queries in lockstep.
+    // Every round reads each sector the batch's frontiers need once, in sector order, for all queries waiting
+    // on it (offline_search.cpp). queries holds n_queries rows of data_dim; res_tags (and res_dists, unless
+    // nullptr) get k_search entries per query, and stats, if given, n_queries entries, each query charged an
+    // even share of the reads it waited on. Early stop, adaptive budgets and refinement do not apply.
+    // Returns n_queries.
+    size_t batch_search_offline(const T *queries, const _u64 n_queries, const _u64 k_search, const _u32 mem_L,
+                                const _u64 l_search, TagT *res_tags, float *res_dists, const _u64 beam_width,
+                                uint32_t num_threads = 0, QueryStats *stats = nullptr);
+
+    // asynchronous search: queries are queued to n_workers engine threads, each multiplexing up to
+    // queries_per_worker in-flight queries over its own IO ring (coro_search with continuous admission).
+    // The engine starts with defaults on the first search_async; returns -1 if already running.
+    int start_async_engine(uint32_t n_workers, uint32_t queries_per_worker = 8);
+    // finishes the queued queries, then joins the engine threads.
+    void stop_async_engine();
+    // the query is copied before returning. callback runs on an engine thread, so it should not block.
+    void search_async(const T *query, const AsyncSearchParams &params, AsyncSearchCallback<TagT> callback);
+    std::future<AsyncSearchResult<TagT>> search_async(const T *query, const AsyncSearchParams &params);
+
     std::vector<uint32_t> get_init_ids() {
       return std::vector<uint32_t>(this->medoids, this->medoids + this->num_medoids);
     }
@@ -225,6 +425,7 @@ namespace pipeann {
     // nnbrs of node `i`: *(unsigned*) (buf)
     // nbrs of node `i`: ((unsigned*)buf) + 1
     _u64 max_node_len = 0, nnodes_per_sector = 0, max_degree = 0;
+    _u64 inline_pq_chunks = 0;  // PQ code bytes stored per neighbor in node records (0: not inline).
 
    protected:
     void use_medoids_data_as_centroids();
@@ -251,6 +452,8 @@ namespace pipeann {
     // chunk_size = chunk size of each dimension chunk
     // pq_tables = float* [[2^8 * [chunk_size]] * n_chunks]
     std::vector<_u8> data;
+    std::vector<_u8> medoid_pq_code;  // the only code in memory when data is not kept.
+    bool keep_pq_codes = true;
     _u64 chunk_size;
     _u64 n_chunks;
     FixedChunkPQTable<T> pq_table;
@@ -270,7 +473,8 @@ namespace pipeann {
     void do_beam_search(const T *vec, uint32_t mem_L, uint32_t Lsize, const uint32_t beam_width,
                         std::vector<Neighbor> &expanded_nodes_info, tsl::robin_map<uint32_t, T *> *coord_map = nullptr,
                         QueryStats *stats = nullptr, tsl::robin_set<uint32_t> *exclude_nodes = nullptr,
-                        bool dyn_search_l = true, std::vector<uint64_t> *passthrough_page_ref = nullptr);
+                        bool dyn_search_l = true, std::vector<uint64_t> *passthrough_page_ref = nullptr,
+                        const _u64 k_search = 0 /* > 0: early stop as configured */);
     void occlude_list(std::vector<Neighbor> &pool, const tsl::robin_map<uint32_t, T *> &coord_map,
                       std::vector<Neighbor> &result, std::vector<float> &occlude_factor);
     void prune_neighbors(const tsl::robin_map<uint32_t, T *> &coord_map, std::vector<Neighbor> &pool,
@@ -305,6 +509,8 @@ namespace pipeann {
     // its concurrency should not be the bottleneck.
     ConcurrentQueue<BgTask *> bg_tasks = ConcurrentQueue<BgTask *>(nullptr);
     void bg_io_thread();
+    // writes the task's pages, releases its locks and buffer.
+    void commit_bg_task(BgTask *task, void *ctx);
     static constexpr int kBgIOThreads = 1;
     std::thread *bg_io_thread_[kBgIOThreads]{nullptr};
 
@@ -385,6 +591,27 @@ namespace pipeann {
 #endif
     }
 
+    // read-locks neighbors like lock_idx() into locked, but does not wait: if one is write-locked, releases
+    // the others and returns false.
+    bool try_rdlock_idx(v2::SparseLockTable<uint64_t> &lock_table, const std::vector<uint32_t> &neighbors,
+                        std::vector<uint32_t> &locked) {
+#ifndef READ_ONLY_TESTS
+      locked = get_to_lock_idx(kInvalidID, neighbors);
+      for (size_t i = 0; i < locked.size(); ++i) {
+        if (lock_table.tryrdlock(locked[i]) != 0) {
+          for (size_t j = 0; j < i; ++j) {
+            lock_table.unlock(locked[j]);
+          }
+          locked.clear();
+          return false;
+        }
+      }
+#else
+      locked.clear();
+#endif
+      return true;
+    }
+
     void unlock_idx(v2::SparseLockTable<uint64_t> &lock_table, const std::vector<uint32_t> &to_lock) {
 #ifndef READ_ONLY_TESTS
       for (auto &id : to_lock) {
@@ -682,5 +909,66 @@ namespace pipeann {
 
     bool load_flag = false;    // already loaded.
     bool enable_tags = false;  // support for tags and dynamic indexing
+
+    // per-query state of coro_search and the async engine (coro_search.cpp).
+    struct CoroQuery;
+    class AsyncEngine;
+    // per-query state of batch_search_offline (offline_search.cpp).
+    struct OfflineQuery;
+    // one lockstep batch of batch_search_offline; slots holds at least n entries.
+    void search_offline_batch(const T *queries, const _u64 n, const _u64 k_search, const _u32 mem_L,
+                              const _u64 l_search, TagT *res_tags, float *res_dists, const _u64 beam_width,
+                              OfflineQuery *slots, QueryStats *stats);
+    AsyncEngine *async_engine_ = nullptr;
+    std::mutex async_engine_lock_;
+
+    std::shared_ptr<IndexRuntime<T>> runtime_;
+    std::atomic<uint64_t> n_runtime_bg_tasks_{0};  // submitted to runtime_ and not yet committed.
+
+    std::shared_ptr<QueryCache<T, TagT>> query_cache_;
+    std::shared_ptr<const EarlyStopModel> early_stop_model_;
+    std::shared_ptr<AdaptiveBudget> adaptive_budget_;
+    EarlyStopTrace *early_stop_trace_ = nullptr;
+    std::atomic<uint64_t> update_epoch_{0};
+
+    // appends the SQ8 distances of the refine_r_ best candidates (by PQ distance) in retset or dropped that
+    // are not in full_retset.
+    void refine_candidates(const T *query, const Neighbor *retset, unsigned cur_list_size, const RefinePool &dropped,
+                           std::vector<Neighbor> &full_retset, QueryBuffer<T> *query_buf, void *ctx,
+                           QueryStats *stats, PhaseTimer &phases);
+    std::unique_ptr<RefineCodes<T>> refine_codes_;
+    uint32_t refine_r_ = 0;
+
+    // copies the page of req if every sector it spans is pinned, and marks it finished.
+    bool serve_pinned(IORequest &req, QueryStats *stats);
+    // serves the pinned reads in reqs and removes them; returns how many.
+    size_t serve_pinned(std::vector<IORequest> &reqs, QueryStats *stats);
+    std::unique_ptr<PinnedPages> pinned_pages_;
+    uint64_t pinned_epoch_ = 0;
+
+    // attaches req to an in-flight read of its page (req.finished is set once the page is copied in), or
+    // makes req the page's leader, which must publish_read() it once it finishes. Returns true if attached.
+    bool coalesce_read(IORequest &req, QueryStats *stats);
+    // moves the reqs that attached to in-flight reads to attached, which keeps their addresses until the
+    // next call; returns how many.
+    size_t coalesce_reads(std::vector<IORequest> &reqs, std::vector<IORequest> &attached, QueryStats *stats);
+    void publish_read(const IORequest &req) {
+      if (inflight_reads_ != nullptr) {
+        inflight_reads_->complete(req.offset / SECTOR_LEN, req.buf);
+      }
+    }
+    // publishes the finished reads of leading and removes them.
+    void publish_finished(std::vector<IORequest *> &leading);
+    // read-locks id like lock_idx(), publishing the reads of leading as they finish while it waits: a query
+    // attached to them may hold a lock the writer ahead of us waits for.
+    void rdlock_idx_publishing(v2::SparseLockTable<uint64_t> &lock_table, uint32_t id, void *ctx,
+                               std::vector<IORequest *> &leading);
+    // spins until every read in attached is published. Call it with no index locks held: a leader may be
+    // waiting for a writer that waits for them.
+    static void wait_attached(const std::vector<IORequest> &attached);
+    std::unique_ptr<InflightReads> inflight_reads_;
+
+    SearchProfile search_profile_;
+    bool has_search_profile_ = false;
   };
 }  // namespace pipeann
@@ -0,0 +1,196 @@
+#pragma once
+
+/**
+ * Always-on, low-overhead telemetry.
+ *
+ * Every thread owns a cache-line-aligned TelemetrySlot of counters that only it
+ * writes (relaxed load + store, no atomic RMW, no shared cache lines), so the
+ * hot-path cost is a handful of L1-resident stores per query or IO.
+ * telemetry_snapshot() sums all live slots (plus the totals of exited threads)
+ * without stopping the writers.
+ *
+ * Export: set PIPEANN_TELEMETRY to start a background exporter that writes the
+ * Prometheus text exposition format
+ *   PIPEANN_TELEMETRY="file:/var/lib/node_exporter/pipeann.prom,interval_ms=1000"
+ *     rewrites the file atomically (tmp + rename) every interval;
+ *   PIPEANN_TELEMETRY="unix:/run/pipeann.sock"
+ *     serves the current snapshot to every client that connects to the socket.
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+#include "hdr_histogram.h"
+#include "observability.h"
+#include "percentile_stats.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+namespace pipeann {
+  enum TelemetryCounter : uint32_t {
+    kTmQueries = 0,
+    kTmQueryCycles,
+    kTmHops,
+    kTmCmps,
+    kTmTierHits,        // page reads served by the in-memory page cache.
+    kTmTierMisses,      // page reads that went to the device.
+    kTmPinnedHits,      // page reads served by pinned hot pages (SSDIndex::load_pinned_pages).
+    kTmCoalescedReads,  // page reads served by another query's in-flight read (SSDIndex::set_read_coalescing).
+    kTmInserts,
+    kTmInsertCycles,
+    kTmNumCounters
+  };
+
+  enum TelemetryIoField : uint32_t { kTmReadIOs = 0, kTmReadBytes, kTmWriteIOs, kTmWriteBytes, kTmNumIoFields };
+  constexpr uint32_t kTmNumContexts = (uint32_t) IoContext::OTHER + 1;
+
+  // Cycle counter for cheap interval timing (TSC on x86, steady_clock ns elsewhere).
+  inline uint64_t read_cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+#endif
+  }
+
+  // read_cycles() ticks per second, calibrated once against steady_clock.
+  double cycles_per_second();
+
+  // Splits a query's time into QueryPhases with one read_cycles() per boundary:
+  // mark(p) charges the time since the previous mark (or start/skip) to p.
+  class PhaseTimer {
+   public:
+    PhaseTimer() : last_(read_cycles()) {
+    }
+
+    inline void mark(QueryPhase p) {
+      uint64_t now = read_cycles();
+      cycles_[p] += now - last_;
+      last_ = now;
+    }
+
+    // charges cycles measured elsewhere, e.g., a query's share of work done for a whole batch.
+    inline void add(QueryPhase p, uint64_t cycles) {
+      cycles_[p] += cycles;
+    }
+
+    // restarts without charging; the skipped time ends up in kPhaseOther.
+    inline void skip() {
+      last_ = read_cycles();
+    }
+
+    // Adds the phases to stats (stats->total_us must be set) and derives
+    // head_us, io_us (submit + wait) and cpu_us (PQ, exact, pool) from them.
+    void finish(QueryStats *stats) const;
+
+   private:
+    uint64_t last_;
+    uint64_t cycles_[kNumQueryPhases] = {};
+  };
+
+  struct alignas(64) TelemetrySlot {
+    std::atomic<uint64_t> counters[kTmNumCounters];
+    std::atomic<uint64_t> io[kTmNumContexts][kTmNumIoFields];
+
+    TelemetrySlot() {
+      for (auto &c : counters) {
+        c.store(0, std::memory_order_relaxed);
+      }
+      for (auto &ctx : io) {
+        for (auto &c : ctx) {
+          c.store(0, std::memory_order_relaxed);
+        }
+      }
+    }
+
+    // single writer (the owning thread).
+    inline void add(TelemetryCounter c, uint64_t n = 1) {
+      counters[c].store(counters[c].load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    inline void add_io(bool write, uint64_t n_ios, uint64_t bytes) {
+      auto &ctx = io[(uint32_t) get_io_context()];
+      uint32_t f = write ? kTmWriteIOs : kTmReadIOs;
+      ctx[f].store(ctx[f].load(std::memory_order_relaxed) + n_ios, std::memory_order_relaxed);
+      ctx[f + 1].store(ctx[f + 1].load(std::memory_order_relaxed) + bytes, std::memory_order_relaxed);
+    }
+  };
+
+  // Registers a slot for the calling thread; its counts are folded into the
+  // exited-thread totals when the thread exits.
+  TelemetrySlot *register_telemetry_slot();
+  inline thread_local TelemetrySlot *tls_telemetry_slot = nullptr;
+
+  inline TelemetrySlot &telemetry_slot() {
+    TelemetrySlot *slot = tls_telemetry_slot;
+    if (__builtin_expect(slot == nullptr, 0)) {
+      slot = register_telemetry_slot();
+    }
+    return *slot;
+  }
+
+  // Latency distribution of all searches (ns).
+  StreamingHistogram &telemetry_query_latency();
+
+  inline void telemetry_record_query(const QueryStats &stats, uint64_t cycles) {
+    TelemetrySlot &slot = telemetry_slot();
+    slot.add(kTmQueries);
+    slot.add(kTmQueryCycles, cycles);
+    slot.add(kTmHops, (uint64_t) stats.n_hops);
+    slot.add(kTmCmps, (uint64_t) stats.n_cmps);
+    telemetry_query_latency().record((uint64_t) (stats.total_us * 1e3));
+  }
+
+  template<typename ReqVec>
+  inline void telemetry_record_ios(const ReqVec &reqs, bool write) {
+    uint64_t bytes = 0;
+    for (auto &req : reqs) {
+      bytes += req.len;
+    }
+    telemetry_slot().add_io(write, reqs.size(), bytes);
+  }
+
+  struct TelemetrySnapshot {
+    uint64_t counters[kTmNumCounters] = {};
+    uint64_t io[kTmNumContexts][kTmNumIoFields] = {};
+    uint64_t n_threads = 0;  // threads currently holding a slot.
+    double cycles_per_second = 1;
+    HdrHistogram query_latency_ns;
+
+    // Prometheus text exposition format (version 0.0.4).
+    std::string to_prometheus() const;
+  };
+
+  TelemetrySnapshot telemetry_snapshot();
+
+  // Background exporter of telemetry_snapshot().to_prometheus().
+  // target: "file:<path>" or "unix:<socket path>".
+  class TelemetryExporter {
+   public:
+    ~TelemetryExporter();
+    // returns 0 on success, -1 on a bad target or socket error.
+    int start(const std::string &target, uint64_t interval_ms = 1000);
+    void stop();
+
+   private:
+    void run_file();
+    void run_unix();
+
+    std::string path_;
+    bool unix_ = false;
+    int listen_fd_ = -1;
+    uint64_t interval_ms_ = 1000;
+    std::atomic<bool> stop_{false};
+    std::thread thread_;
+  };
+
+  // Starts the process-wide exporter described by PIPEANN_TELEMETRY, at most once.
+  void telemetry_start_from_env();
+}  // namespace pipeann
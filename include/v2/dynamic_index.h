@@ -12,6 +12,8 @@
 #include <string>
 #include <unordered_map>
 #include "parameters.h"
+#include "percentile_stats.h"
+#include "query_cache.h"
 
 namespace pipeann {
 
@@ -42,8 +44,25 @@ namespace pipeann {
     void final_merge(const uint32_t &nthreads = 0,
                      const uint32_t &n_sampled_nbrs = std::numeric_limits<uint32_t>::max());
 
+    // logs percentiles of search/insert/delete since construction (or reset_stats()).
+    void log_stats();
+    void reset_stats();
+
+    // search() answers repeated (and, if enabled, near-duplicate) queries from cache; hits skip IO and
+    // report n_ios = 0. nullptr disables the cache.
+    void set_query_cache(std::shared_ptr<QueryCache<T, TagT>> cache) {
+      std::atomic_store(&query_cache, std::move(cache));
+    }
+    // bumped by every insert, lazy_delete and final_merge.
+    uint64_t update_epoch() const {
+      return _update_epoch.load(std::memory_order_acquire);
+    }
+
    private:
     void save_del_set();
+    // serves a cache hit unless it holds a deleted tag; true if tags/distances were filled.
+    bool search_cached(QueryCache<T, TagT> &cache, const T *query, const uint64_t K, const uint64_t search_L,
+                       uint64_t epoch, TagT *tags, float *distances, QueryStats *stats);
     void merge(const uint32_t &nthreads, const uint32_t &n_sampled_nbrs);
 
    public:
@@ -76,5 +95,13 @@ namespace pipeann {
     bool _use_mem_index = false;
     double _mem_index_ratio = 1.0;  // mem index size / disk index size
     int search_mode = BEAM_SEARCH;
+
+    // always-on streaming percentiles.
+    QueryStatsRecorder search_stats;
+    StreamingHistogram insert_latency_ns, delete_latency_ns;
+
+   private:
+    std::shared_ptr<QueryCache<T, TagT>> query_cache;
+    std::atomic<uint64_t> _update_epoch{0};
   };
 };  // namespace pipeann
@@ -1,5 +1,36 @@
 #include "pyindex.h"
 
+#include <pybind11/stl.h>
+
+namespace {
+  template<typename T>
+  void bind_index(py::module_ &m, const char *name) {
+    using I = PyIndex<T>;
+    py::class_<I>(m, name)
+        .def(py::init<IndexParams>(), py::arg("params"))
+        .def("build", &I::build, py::arg("data_path"), py::arg("index_prefix"), py::arg("tag_file") = "",
+             py::arg("build_mem_index") = false, py::arg("build_L") = 0, py::arg("PQ_bytes") = 32,
+             py::arg("memory_use_GB") = 0)
+        .def("load", &I::load, py::arg("index_prefix"))
+        // search arguments left as None take the index's tuned defaults (PyIndex::search_args).
+        .def("search", &I::search, py::arg("query"), py::arg("topk"), py::arg("L") = py::none(),
+             py::arg("mode") = py::none(), py::arg("mem_L") = py::none(), py::arg("beam_width") = py::none())
+        .def("batch_search", &I::batch_search, py::arg("queries"), py::arg("topk"), py::arg("L") = py::none(),
+             py::arg("mode") = py::none(), py::arg("mem_L") = py::none(), py::arg("beam_width") = py::none(),
+             py::arg("num_threads") = 0)
+        .def("batch_search_offline", &I::batch_search_offline, py::arg("queries"), py::arg("topk"),
+             py::arg("L") = py::none(), py::arg("mem_L") = py::none(), py::arg("beam_width") = py::none(),
+             py::arg("num_threads") = 0)
+        .def("add", &I::add, py::arg("vectors"), py::arg("tags"))
+        .def("insert", &I::insert, py::arg("point"), py::arg("tag"))
+        .def("remove", &I::remove, py::arg("tag"))
+        .def("save", &I::save, py::arg("index_prefix"))
+        .def("stats", &I::stats)
+        .def("reset_stats", &I::reset_stats)
+        .def("__repr__", &I::to_string);
+  }
+}  // namespace
+
 PYBIND11_MODULE(pipeannpy, m) {
   m.doc() = "PipeANN";
   m.attr("__version__") = "dev";
@@ -8,4 +39,47 @@ PYBIND11_MODULE(pipeannpy, m) {
       .value("L2", pipeann::Metric::L2)
       .value("COSINE", pipeann::Metric::COSINE)
       .export_values();
-}
\ No newline at end of file
+
+  py::enum_<SearchMode>(m, "SearchMode")
+      .value("BEAM_SEARCH", BEAM_SEARCH)
+      .value("PAGE_SEARCH", PAGE_SEARCH)
+      .value("PIPE_SEARCH", PIPE_SEARCH)
+      .value("CORO_SEARCH", CORO_SEARCH)
+      .export_values();
+
+  py::class_<IndexParams>(m, "IndexParams")
+      .def(py::init<py::dtype, py::dtype, uint32_t, pipeann::Metric, uint32_t, uint32_t, uint32_t, uint32_t>(),
+           py::arg("data_type") = py::dtype::of<float>(), py::arg("tag_type") = py::dtype::of<uint32_t>(),
+           py::arg("data_dim") = 0, py::arg("metric") = pipeann::Metric::L2, py::arg("max_nthreads") = 32,
+           py::arg("max_nbrs") = 64, py::arg("sampled_nbrs_for_delete") = 20, py::arg("build_threshold") = 100000)
+      .def_readwrite("data_type", &IndexParams::data_type)
+      .def_readwrite("tag_type", &IndexParams::tag_type)
+      .def_readwrite("data_dim", &IndexParams::data_dim)
+      .def_readwrite("metric", &IndexParams::metric)
+      .def_readwrite("max_nthreads", &IndexParams::max_nthreads)
+      .def_readwrite("max_nbrs", &IndexParams::max_nbrs)
+      .def_readwrite("sampled_nbrs_for_delete", &IndexParams::sampled_nbrs_for_delete)
+      .def_readwrite("build_threshold", &IndexParams::build_threshold);
+
+  bind_index<float>(m, "IndexFloat");
+  bind_index<int8_t>(m, "IndexInt8");
+  bind_index<uint8_t>(m, "IndexUInt8");
+
+  // Index(params) returns the IndexFloat / IndexInt8 / IndexUInt8 matching params.data_type.
+  m.def(
+      "Index",
+      [](const IndexParams &params) -> py::object {
+        switch (params.data_type.char_()) {
+          case 'f':
+            return py::cast(new PyIndex<float>(params), py::return_value_policy::take_ownership);
+          case 'b':
+            return py::cast(new PyIndex<int8_t>(params), py::return_value_policy::take_ownership);
+          case 'B':
+            return py::cast(new PyIndex<uint8_t>(params), py::return_value_policy::take_ownership);
+          default:
+            throw std::invalid_argument(std::string("unsupported data type ") + params.data_type.char_() +
+                                        ", expected float32, int8 or uint8");
+        }
+      },
+      py::arg("params"));
+}
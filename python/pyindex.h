@@ -1,14 +1,19 @@
 #include <omp.h>
 #include <pybind11/pybind11.h>
 #include <pybind11/numpy.h>
+#include <chrono>
 #include <filesystem>
+#include <limits>
 #include <mutex>
+#include <optional>
 #include <random>
 #include <shared_mutex>
+#include <stdexcept>
 #include "aux_utils.h"
 #include "index.h"
 #include "linux_aligned_file_reader.h"
 #include "partition_and_pq.h"
+#include "percentile_stats.h"
 #include "ssd_index.h"
 #include "utils.h"
 #include <sys/sysinfo.h>
@@ -43,9 +48,15 @@ template<class T>
 class PyIndex : public BasePyIndex {
   static constexpr float kMemIndexP = 0.01;
   static constexpr int kMemIndexMaxPts = 2000000;
+  static constexpr uint32_t kCoroBatch = 8;  // queries per coro_search call, as in search_disk_index.
+  static constexpr int kAsyncProfileMode = 4;  // a profile tuned for search_async; runs as coro search here.
+  static constexpr size_t kConsolidateStep = 4096;  // memory index slots an insert or remove repairs.
   using TagT = uint32_t;
 
  public:
+  using QueryArray = py::array_t<T, py::array::c_style | py::array::forcecast>;
+  using TagArray = py::array_t<TagT, py::array::c_style | py::array::forcecast>;
+
   PyIndex() = delete;
 
   explicit PyIndex(IndexParams params) : params_(std::move(params)) {
@@ -80,86 +91,115 @@ class PyIndex : public BasePyIndex {
   }
 
   void load(const std::string &index_prefix) {
-    auto mem_index_path = index_prefix + "_mem.index";
-    mem_index_.reset(new pipeann::Index<T, TagT>(params_.metric, params_.data_dim, kMemIndexMaxPts, true, false, true));
-    mem_index_->load(mem_index_path.c_str());
-
+    py::gil_scoped_release release;
     auto disk_index_file = index_prefix + "_disk.index";
-    if (std::filesystem::exists(disk_index_file)) {
-      use_disk_index_ = true;
-      disk_index_->load(index_prefix.c_str(), params_.max_nthreads, true, true);
-      disk_index_->mem_index_.reset(mem_index_.get());
-    } else {
-      use_disk_index_ = false;
+    use_disk_index_ = std::filesystem::exists(disk_index_file);
+    if (use_disk_index_) {
+      if (disk_index_->load(index_prefix.c_str(), params_.max_nthreads, true, true) != 0) {
+        throw std::runtime_error("Cannot load disk index " + index_prefix);
+      }
+      if (params_.data_dim == 0) {
+        params_.data_dim = disk_index_->data_dim;
+      }
+    }
+
+    // the disk index owns the memory index (used for entry points) once there is one.
+    auto mem_index_path = index_prefix + "_mem.index";
+    if (std::filesystem::exists(mem_index_path)) {
+      auto mem_index = std::make_unique<pipeann::Index<T, TagT>>(params_.metric, params_.data_dim, kMemIndexMaxPts,
+                                                                 true, false, true);
+      mem_index->load(mem_index_path.c_str());
+      set_mem_index(std::move(mem_index));
+    } else if (!use_disk_index_) {
+      throw std::runtime_error("Neither " + disk_index_file + " nor " + mem_index_path + " exists");
     }
 
     cur_index_prefix_ = index_prefix;
   }
 
-  // Use file path to build. For easier interface, refer to PyIndexInterface.
-  void build(const std::string &data_path, const std::string &index_prefix, const char *tag_file = nullptr,
+  // Builds from a .bin data file; Index() in the module picks the PyIndex type from IndexParams.data_type.
+  void build(const std::string &data_path, const std::string &index_prefix, const std::string &tag_file = "",
              bool build_mem_index = false, uint32_t build_L = 0, uint32_t PQ_bytes = 32, uint32_t memory_use_GB = 0) {
-    if (build_L == 0) {
-      build_L = params_.max_nbrs + 32;
-    }
-
-    if (memory_use_GB == 0) {
-      struct sysinfo info;
-      sysinfo(&info);
-      memory_use_GB = info.totalram / (1024 * 1024 * 1024) / 2;
-      LOG(INFO) << "Memory use not specified. Using 1/2 of total memory: " << memory_use_GB << "GB";
-    }
-    pipeann::build_disk_index_py<T, TagT>(data_path.c_str(), index_prefix.c_str(), params_.max_nbrs, build_L,
-                                          memory_use_GB, params_.max_nthreads, PQ_bytes, params_.metric, false,
-                                          tag_file);  // create tag later.
+    py::gil_scoped_release release;
+    do_build(data_path, index_prefix, tag_file, build_mem_index, build_L, PQ_bytes, memory_use_GB);
+  }
 
-    if (build_mem_index) {
-      build_mem(data_path, index_prefix);
+  // Returns (tags, dists), each of length topk; unfilled slots hold max uint32 / inf. Arguments left as None
+  // take the index's defaults (see search_args).
+  std::tuple<py::array_t<TagT>, py::array_t<float>> search(QueryArray &query, uint32_t topk,
+                                                           std::optional<uint32_t> L_arg = std::nullopt,
+                                                           std::optional<int> mode_arg = std::nullopt,
+                                                           std::optional<uint32_t> mem_L_arg = std::nullopt,
+                                                           std::optional<uint32_t> beam_width_arg = std::nullopt) {
+    check_query(query, 1);
+    auto [L, mode, mem_L, beam_width] = search_args(L_arg, mode_arg, mem_L_arg, beam_width_arg);
+    check_mode(mode);
+    auto ret_ids = py::array_t<TagT>(topk);
+    auto ret_dists = py::array_t<float>(topk);
+    const T *query_p = query.data();
+    TagT *ret_ids_p = ret_ids.mutable_data();
+    float *ret_dists_p = ret_dists.mutable_data();
+    {
+      py::gil_scoped_release release;
+      auto mu = std::shared_lock<std::shared_mutex>(save_mu_);
+      run_queries(query_p, 1, topk, L, mode, mem_L, beam_width, ret_ids_p, ret_dists_p);
     }
+    return std::make_tuple(ret_ids, ret_dists);
   }
 
-  void build_mem(const std::string &data_path, const std::string &index_prefix) {
-    // sample rate 0.01
-    std::string sample_prefix = index_prefix + "_mem_sample";
-    gen_random_slice<T>(data_path, sample_prefix, kMemIndexP);
-
-    std::string sample_data_bin = sample_prefix + "_data.bin";
-    uint64_t data_num, data_dim;
-    pipeann::get_bin_metadata(sample_data_bin, data_num, data_dim);
-
-    std::string sample_id_bin = sample_prefix + "_ids.bin";
-    std::ifstream reader;
-    reader.open(sample_id_bin, std::ios::binary);
-    reader.seekg(2 * sizeof(uint32_t), std::ios::beg);
-    uint32_t tags_size = data_num * data_dim;
-    std::vector<TagT> tags(data_num);
-    reader.read((char *) tags.data(), tags_size * sizeof(uint32_t));
-    reader.close();
-
-    auto s = std::chrono::high_resolution_clock::now();
-    mem_index_.reset(new pipeann::Index<T, TagT>(params_.metric, data_dim, kMemIndexMaxPts, true, false, true));
-    mem_index_.build(sample_data_bin.c_str(), data_num, mem_index_params_, tags);
-    std::chrono::duration<double> diff = std::chrono::high_resolution_clock::now() - s;
-
-    LOG(INFO) << "Finish building memory index, indexing time: " << diff.count() << "\n";
-    std::string save_path = index_prefix + "_mem.index";
-    mem_index_.save(save_path.c_str());
+  // queries: (n, dim). Returns (tags, dists) of shape (n, topk). The GIL is released while the
+  // queries run on num_threads OpenMP threads (0 = max_nthreads).
+  std::tuple<py::array_t<TagT>, py::array_t<float>> batch_search(
+      QueryArray &queries, uint32_t topk, std::optional<uint32_t> L_arg = std::nullopt,
+      std::optional<int> mode_arg = std::nullopt, std::optional<uint32_t> mem_L_arg = std::nullopt,
+      std::optional<uint32_t> beam_width_arg = std::nullopt, uint32_t num_threads = 0) {
+    check_query(queries, 2);
+    auto [L, mode, mem_L, beam_width] = search_args(L_arg, mode_arg, mem_L_arg, beam_width_arg);
+    check_mode(mode);
+    uint64_t n = queries.ndim() == 2 ? queries.shape(0) : 1;
+    auto ret_ids = py::array_t<TagT>({(py::ssize_t) n, (py::ssize_t) topk});
+    auto ret_dists = py::array_t<float>({(py::ssize_t) n, (py::ssize_t) topk});
+    const T *query_p = queries.data();
+    TagT *ret_ids_p = ret_ids.mutable_data();
+    float *ret_dists_p = ret_dists.mutable_data();
+    {
+      py::gil_scoped_release release;
+      auto mu = std::shared_lock<std::shared_mutex>(save_mu_);
+      run_queries(query_p, n, topk, L, mode, mem_L, beam_width, ret_ids_p, ret_dists_p,
+                  num_threads ? num_threads : params_.max_nthreads);
+    }
+    return std::make_tuple(ret_ids, ret_dists);
   }
 
-  std::tuple<py::array_t<TagT>, py::array_t<float>> search(py::array_t<T> &query, uint32_t topk, uint32_t L) {
-    auto mu = std::shared_lock<std::shared_mutex>(save_mu_);
-
-    auto *query_p = static_cast<T *>(query.request().ptr);
-    auto ret_ids = py::array_t<TagT>(topk);
-    auto ret_ids_p = static_cast<TagT *>(ret_ids.request().ptr);
-    auto ret_dists = py::array_t<float>(topk);
-    auto ret_dists_p = static_cast<float *>(ret_dists.request().ptr);
-    if (use_disk_index_) {
-      // TODO: lock and excluded_nodes in pipe search.
-      // mem_L is a value by experience, we use 10 in PipeANN.
-      disk_index_->pipe_search(query_p, topk, 10, L, ret_ids_p, ret_dists_p, 32);
-    } else {
-      mem_index_->search_with_tags(query_p, topk, L, ret_ids_p, ret_dists_p);
+  // Throughput-oriented batch_search over the disk index (SSDIndex::batch_search_offline): the queries of a
+  // batch advance in lockstep and share page reads. Same arguments and results as batch_search.
+  std::tuple<py::array_t<TagT>, py::array_t<float>> batch_search_offline(
+      QueryArray &queries, uint32_t topk, std::optional<uint32_t> L_arg = std::nullopt,
+      std::optional<uint32_t> mem_L_arg = std::nullopt, std::optional<uint32_t> beam_width_arg = std::nullopt,
+      uint32_t num_threads = 0) {
+    check_query(queries, 2);
+    if (!use_disk_index_) {
+      throw std::runtime_error("batch_search_offline needs a disk index");
+    }
+    auto [L, mode, mem_L, beam_width] = search_args(L_arg, std::nullopt, mem_L_arg, beam_width_arg);
+    uint64_t n = queries.ndim() == 2 ? queries.shape(0) : 1;
+    auto ret_ids = py::array_t<TagT>({(py::ssize_t) n, (py::ssize_t) topk});
+    auto ret_dists = py::array_t<float>({(py::ssize_t) n, (py::ssize_t) topk});
+    const T *query_p = queries.data();
+    TagT *ret_ids_p = ret_ids.mutable_data();
+    float *ret_dists_p = ret_dists.mutable_data();
+    {
+      py::gil_scoped_release release;
+      auto mu = std::shared_lock<std::shared_mutex>(save_mu_);
+      std::fill(ret_ids_p, ret_ids_p + n * topk, std::numeric_limits<TagT>::max());
+      std::fill(ret_dists_p, ret_dists_p + n * topk, std::numeric_limits<float>::infinity());
+      std::vector<pipeann::QueryStats> stats(n);
+      disk_index_->batch_search_offline(query_p, n, topk, mem_index_ == nullptr ? 0 : mem_L, L, ret_ids_p,
+                                        ret_dists_p, beam_width, num_threads ? num_threads : params_.max_nthreads,
+                                        stats.data());
+      for (auto &s : stats) {
+        recorder_.record(s);
+      }
     }
     return std::make_tuple(ret_ids, ret_dists);
   }
@@ -167,23 +207,40 @@ class PyIndex : public BasePyIndex {
   void transform_mem_index_to_disk_index() {
     auto mu = std::lock_guard<std::shared_mutex>(save_mu_);
     LOG(INFO) << "Transform memory index to disk index.";
+    // finish the in-progress sweep, consolidate the deletes made since, and compact, so that the saved rows
+    // are exactly the live points.
+    const size_t all_slots = std::numeric_limits<uint32_t>::max();
+    for (int sweep = 0; sweep < 2; ++sweep) {
+      while (mem_index_->consolidate_deletes_incremental(mem_index_params_, all_slots) != 0) {
+      }
+    }
+    if (!mem_index_->_data_compacted) {
+      mem_index_->compact_data();
+    }
     mem_index_->save_data(cur_index_prefix_ + "_mem_data.bin");
     mem_index_->save_tags(cur_index_prefix_ + "_disk.index.tags");
     // re-build
-    this->build(cur_index_prefix_ + "_mem_data.bin", cur_index_prefix_,
-                (cur_index_prefix_ + "_disk.index.tags").c_str(), true);
-    this->load(cur_index_prefix_);  // here sets use_disk_index_ to true.
+    this->do_build(cur_index_prefix_ + "_mem_data.bin", cur_index_prefix_, cur_index_prefix_ + "_disk.index.tags",
+                   true);
+    this->load_locked(cur_index_prefix_);  // here sets use_disk_index_ to true.
     LOG(INFO) << "Transform memory index to disk index done.";
   }
 
-  // bulk add.
-  void add(py::array_t<T> &vectors, py::array_t<T> &tags) {
+  // bulk add: vectors (n, dim), tags (n,).
+  void add(QueryArray &vectors, TagArray &tags) {
+    check_query(vectors, 2);
+    uint64_t n = vectors.ndim() == 2 ? vectors.shape(0) : 1;
+    if ((uint64_t) tags.size() != n) {
+      throw std::invalid_argument("add: got " + std::to_string(n) + " vectors but " + std::to_string(tags.size()) +
+                                  " tags");
+    }
+    const T *vectors_p = vectors.data();
+    const TagT *tags_p = tags.data();
+    py::gil_scoped_release release;
     save_mu_.lock_shared();
-#pragma omp parallel for schedule(dynamic)
-    for (uint32_t i = 0; i < vectors.shape(0); i++) {
-      auto *vector_p = static_cast<T *>(vectors.request().ptr) + i * params_.data_dim;
-      auto *tag_p = static_cast<T *>(tags.request().ptr) + i;
-      do_insert(vector_p, *tag_p);
+#pragma omp parallel for schedule(dynamic) num_threads(params_.max_nthreads)
+    for (uint64_t i = 0; i < n; i++) {
+      do_insert(vectors_p + i * params_.data_dim, tags_p[i]);
     }
     save_mu_.unlock_shared();
 
@@ -192,9 +249,11 @@ class PyIndex : public BasePyIndex {
     }
   }
 
-  void insert(py::array_t<T> &point, TagT tag) {
+  void insert(QueryArray &point, TagT tag) {
+    check_query(point, 1);
+    const T *point_p = point.data();
+    py::gil_scoped_release release;
     save_mu_.lock_shared();
-    auto *point_p = static_cast<T *>(point.request().ptr);
     do_insert(point_p, tag);
     save_mu_.unlock_shared();
 
@@ -203,24 +262,68 @@ class PyIndex : public BasePyIndex {
     }
   }
 
-  void do_insert(T *point_p, TagT tag) {
+  void do_insert(const T *point_p, TagT tag) {
     if (use_disk_index_) {
       int target_id = disk_index_->insert_in_place(point_p, tag, &this->deleted_nodes_set_);
-      if (rand_uniform() <= kMemIndexP) {  // probably insert into the memory index.
+      if (mem_index_ != nullptr && rand_uniform() <= kMemIndexP) {  // probably insert into the memory index.
         mem_index_->insert_point(point_p, mem_index_params_, target_id);
       }
     } else {
       mem_index_->insert_point(point_p, mem_index_params_, tag);
+      consolidate_step();
     }
   }
 
+  // Advances the memory index's incremental delete consolidation by one bounded step, so deletes are
+  // absorbed a few thousand slots at a time instead of in one pause. One caller at a time; the others skip.
+  void consolidate_step() {
+    std::unique_lock<std::mutex> guard(consolidate_mu_, std::try_to_lock);
+    if (guard.owns_lock()) {
+      mem_index_->consolidate_deletes_incremental(mem_index_params_, kConsolidateStep);
+    }
+  }
+
+  // Deleted tags are excluded by beam search right away and purged from the disk index by save().
   void remove(TagT tag) {
-    auto mu = std::shared_lock<std::shared_mutex>(save_mu_);
+    py::gil_scoped_release release;
+    auto mu = std::lock_guard<std::shared_mutex>(save_mu_);  // searches and inserts read deleted_nodes_set_.
     if (deleted_nodes_set_.find(tag) == deleted_nodes_set_.end()) {
       deleted_nodes_set_.insert(tag);
       deleted_nodes_.push_back(tag);
     }
-    mem_index_->lazy_delete(tag);
+    if (!use_disk_index_) {
+      mem_index_->lazy_delete(tag);
+      consolidate_step();
+    }
+  }
+
+  // Index size and the distribution of the queries run since construction or reset_stats().
+  py::dict stats() const {
+    pipeann::QueryStatsSnapshot snap = recorder_.snapshot();
+    py::dict d;
+    d["num_points"] = use_disk_index_ ? (uint64_t) disk_index_->num_points
+                                      : (uint64_t) (mem_index_ ? mem_index_->get_num_points() : 0);
+    d["data_dim"] = params_.data_dim;
+    d["disk_index"] = use_disk_index_;
+    d["pending_deletes"] = deleted_nodes_.size();
+    d["queries"] = snap.latency_ns.count();
+    d["latency_us_mean"] = snap.latency_ns.mean() / 1e3;
+    d["latency_us_p50"] = snap.latency_ns.percentile(50) / 1e3;
+    d["latency_us_p99"] = snap.latency_ns.percentile(99) / 1e3;
+    d["latency_us_p999"] = snap.latency_ns.percentile(99.9) / 1e3;
+    d["ios_mean"] = snap.n_ios.mean();
+    d["hops_mean"] = snap.n_hops.mean();
+    d["cmps_mean"] = snap.n_cmps.mean();
+    py::dict phases;
+    for (uint32_t p = 0; p < pipeann::kNumQueryPhases; ++p) {
+      phases[pipeann::kQueryPhaseNames[p]] = snap.phase_ns[p].mean() / 1e3;
+    }
+    d["phase_us_mean"] = phases;
+    return d;
+  }
+
+  void reset_stats() {
+    recorder_.reset();
   }
 
   std::string to_string() const {
@@ -229,55 +332,226 @@ class PyIndex : public BasePyIndex {
   }
 
   bool save(const std::string &index_prefix /* requires double-version. */) {
+    py::gil_scoped_release release;
     auto mu = std::lock_guard<std::shared_mutex>(save_mu_);
 
     if (cur_index_prefix_ == "" || cur_index_prefix_ == index_prefix) {
       return false;
     }
 
-    if (this->deleted_nodes_.size() == 0) {
-// directly save the memory index is OK.
-#ifndef IN_PLACE_RECORD_UPDATE
-      static_assert(false, "Require storing page layout.");
+#ifdef IN_PLACE_RECORD_UPDATE
+    bool layout_unchanged = true;
+#else
+    // out-of-place inserts move records, and the page layout is not saved: rewrite the index instead.
+    bool layout_unchanged = !use_disk_index_;
 #endif
+    if (this->deleted_nodes_.size() == 0 && layout_unchanged) {
+      // directly save the memory index is OK.
       if (use_disk_index_) {
         disk_index_->write_metadata_and_pq(cur_index_prefix_, cur_index_prefix_, disk_index_->num_points,
-                                           disk_index_->medoids[0]);
+                                           disk_index_->get_init_ids()[0]);
+      }
+      if (mem_index_ != nullptr) {
+        mem_index_->save((index_prefix + "_mem.index").c_str());
       }
-      mem_index_.save((index_prefix + "_mem.index").c_str());
     } else {
       // There are deleted vectors, go slow path.
       if (use_disk_index_) {
         disk_index_->merge_deletes(cur_index_prefix_, index_prefix, deleted_nodes_, deleted_nodes_set_,
-                                   params_.max_nthreads);
+                                   params_.max_nthreads, params_.sampled_nbrs_for_delete);
         disk_index_->reload(index_prefix.c_str(), 1);  // reload the newest index.
         cur_index_prefix_ = index_prefix;
+        deleted_nodes_.clear();
+        deleted_nodes_set_.clear();
       }
-      LOG(INFO) << "TODO here";
       // TODO(gh): build mem index using the vectors in the index, instead of using original vector data.
       // rebuilding the memory index is advised.
-      build_mem(cur_index_prefix_, index_prefix);
-      std::string save_path = index_prefix + "_mem.index";
-      mem_index_.save(save_path.c_str());
+      if (!data_path_.empty()) {
+        build_mem(data_path_, index_prefix);
+      }
     }
     return true;
   }
 
  private:
+  void load_locked(const std::string &index_prefix) {
+    use_disk_index_ = true;
+    if (disk_index_->load(index_prefix.c_str(), params_.max_nthreads, true, true) != 0) {
+      throw std::runtime_error("Cannot load disk index " + index_prefix);
+    }
+    auto mem_index = std::make_unique<pipeann::Index<T, TagT>>(params_.metric, params_.data_dim, kMemIndexMaxPts,
+                                                               true, false, true);
+    mem_index->load((index_prefix + "_mem.index").c_str());
+    set_mem_index(std::move(mem_index));
+    own_mem_index_.reset();
+  }
+
+  void do_build(const std::string &data_path, const std::string &index_prefix, const std::string &tag_file,
+                bool build_mem_index, uint32_t build_L = 0, uint32_t PQ_bytes = 32, uint32_t memory_use_GB = 0) {
+    if (build_L == 0) {
+      build_L = params_.max_nbrs + 32;
+    }
+
+    if (memory_use_GB == 0) {
+      struct sysinfo info;
+      sysinfo(&info);
+      memory_use_GB = info.totalram / (1024 * 1024 * 1024) / 2;
+      LOG(INFO) << "Memory use not specified. Using 1/2 of total memory: " << memory_use_GB << "GB";
+    }
+    pipeann::build_disk_index_py<T, TagT>(data_path.c_str(), index_prefix.c_str(), params_.max_nbrs, build_L,
+                                          memory_use_GB, params_.max_nthreads, PQ_bytes, params_.metric, false,
+                                          tag_file.empty() ? nullptr : tag_file.c_str());  // create tag later.
+    data_path_ = data_path;
+
+    if (build_mem_index) {
+      build_mem(data_path, index_prefix);
+    }
+  }
+
+  void build_mem(const std::string &data_path, const std::string &index_prefix) {
+    // sample rate 0.01
+    std::string sample_prefix = index_prefix + "_mem_sample";
+    gen_random_slice<T>(data_path, sample_prefix, kMemIndexP);
+
+    std::string sample_data_bin = sample_prefix + "_data.bin";
+    uint64_t data_num, data_dim;
+    pipeann::get_bin_metadata(sample_data_bin, data_num, data_dim);
+
+    std::string sample_id_bin = sample_prefix + "_ids.bin";
+    std::ifstream reader;
+    reader.open(sample_id_bin, std::ios::binary);
+    reader.seekg(2 * sizeof(uint32_t), std::ios::beg);
+    std::vector<TagT> tags(data_num);
+    reader.read((char *) tags.data(), data_num * sizeof(uint32_t));
+    reader.close();
+
+    auto s = std::chrono::high_resolution_clock::now();
+    auto mem_index =
+        std::make_unique<pipeann::Index<T, TagT>>(params_.metric, data_dim, kMemIndexMaxPts, true, false, true);
+    mem_index->build(sample_data_bin.c_str(), data_num, mem_index_params_, tags);
+    std::chrono::duration<double> diff = std::chrono::high_resolution_clock::now() - s;
+
+    LOG(INFO) << "Finish building memory index, indexing time: " << diff.count() << "\n";
+    std::string save_path = index_prefix + "_mem.index";
+    mem_index->save(save_path.c_str());
+    set_mem_index(std::move(mem_index));
+  }
+
+  // The disk index takes ownership when loaded; mem_index_ keeps a borrowed pointer either way.
+  void set_mem_index(std::unique_ptr<pipeann::Index<T, TagT>> mem_index) {
+    if (use_disk_index_) {
+      disk_index_->mem_index_ = std::move(mem_index);
+      mem_index_ = disk_index_->mem_index_.get();
+    } else {
+      own_mem_index_ = std::move(mem_index);
+      mem_index_ = own_mem_index_.get();
+      mem_index_->enable_delete();  // remove() deletes from it; consolidation reuses the slots.
+    }
+  }
+
+  void check_query(const QueryArray &q, int max_ndim) const {
+    uint64_t dim = q.ndim() == 0 ? 0 : q.shape(q.ndim() - 1);
+    if (q.ndim() < 1 || q.ndim() > max_ndim || dim != params_.data_dim) {
+      throw std::invalid_argument("expected " + std::string(max_ndim == 1 ? "(dim,)" : "(n, dim)") +
+                                  " array with dim = " + std::to_string(params_.data_dim));
+    }
+  }
+
+  struct SearchArgs {
+    uint32_t L;
+    int mode;
+    uint32_t mem_L, beam_width;
+  };
+
+  // Fills unset search arguments from the disk index's search profile (tune_search) if it has one, and
+  // otherwise from the module defaults: L 40, pipe search, mem_L 10, beam width 32.
+  SearchArgs search_args(std::optional<uint32_t> L, std::optional<int> mode, std::optional<uint32_t> mem_L,
+                         std::optional<uint32_t> beam_width) const {
+    SearchArgs d{40, PIPE_SEARCH, 10, 32};
+    const pipeann::SearchProfile *profile = use_disk_index_ ? disk_index_->search_profile() : nullptr;
+    if (profile != nullptr) {
+      pipeann::AsyncSearchParams p = disk_index_->default_search_params();
+      d = {(uint32_t) p.l_search, profile->mode == kAsyncProfileMode ? (int) CORO_SEARCH : profile->mode, p.mem_L,
+           (uint32_t) p.beam_width};
+    }
+    return {L.value_or(d.L), mode.value_or(d.mode), mem_L.value_or(d.mem_L), beam_width.value_or(d.beam_width)};
+  }
+
+  void check_mode(int mode) const {
+    if (mode < BEAM_SEARCH || mode > CORO_SEARCH) {
+      throw std::invalid_argument("unknown search mode " + std::to_string(mode));
+    }
+  }
+
+  // Runs n queries into preallocated (n, topk) outputs on nthreads OpenMP threads. Caller holds save_mu_.
+  void run_queries(const T *queries, uint64_t n, uint32_t topk, uint32_t L, int mode, uint32_t mem_L,
+                   uint32_t beam_width, TagT *ids, float *dists, uint32_t nthreads = 1) {
+    std::fill(ids, ids + n * topk, std::numeric_limits<TagT>::max());
+    std::fill(dists, dists + n * topk, std::numeric_limits<float>::infinity());
+    if (mem_index_ == nullptr) {
+      mem_L = 0;  // no memory index to seed the search from.
+    }
+    uint64_t dim = params_.data_dim;
+    if (use_disk_index_ && mode == CORO_SEARCH) {
+#pragma omp parallel for schedule(dynamic, 1) num_threads(nthreads)
+      for (uint64_t i = 0; i < n; i += kCoroBatch) {
+        int N = std::min<uint64_t>(kCoroBatch, n - i);
+        T *q[kCoroBatch];
+        TagT *res_ids[kCoroBatch];
+        float *res_dists[kCoroBatch];
+        pipeann::QueryStats stats[kCoroBatch];
+        for (int v = 0; v < N; ++v) {
+          q[v] = const_cast<T *>(queries + (i + v) * dim);
+          res_ids[v] = ids + (i + v) * topk;
+          res_dists[v] = dists + (i + v) * topk;
+        }
+        disk_index_->coro_search(q, topk, mem_L, L, res_ids, res_dists, beam_width, N, stats);
+        for (int v = 0; v < N; ++v) {
+          recorder_.record(stats[v]);
+        }
+      }
+      return;
+    }
+
+#pragma omp parallel for schedule(dynamic, 1) num_threads(nthreads)
+    for (uint64_t i = 0; i < n; ++i) {
+      const T *q = queries + i * dim;
+      TagT *res_ids = ids + i * topk;
+      float *res_dists = dists + i * topk;
+      pipeann::QueryStats stats;
+      if (!use_disk_index_) {
+        auto s = std::chrono::high_resolution_clock::now();
+        mem_index_->search_with_tags(q, topk, L, res_ids, res_dists);
+        stats.total_us = std::chrono::duration<double, std::micro>(std::chrono::high_resolution_clock::now() - s)
+                             .count();
+      } else if (mode == BEAM_SEARCH) {
+        disk_index_->beam_search(q, topk, mem_L, L, res_ids, res_dists, beam_width, &stats, &deleted_nodes_set_,
+                                 false);
+      } else if (mode == PAGE_SEARCH) {
+        disk_index_->page_search(q, topk, mem_L, L, res_ids, res_dists, beam_width, &stats);
+      } else {
+        // TODO: lock and excluded_nodes in pipe search.
+        disk_index_->pipe_search(q, topk, mem_L, L, res_ids, res_dists, beam_width, &stats);
+      }
+      recorder_.record(stats);
+    }
+  }
+
   bool use_disk_index_ = false;
   std::shared_ptr<AlignedFileReader> reader_;
   std::shared_mutex save_mu_;  // save mutex.
+  std::mutex consolidate_mu_;  // one consolidate_step() at a time.
   std::string data_path_;
   std::string cur_index_prefix_;
   IndexParams params_;
   std::vector<TagT> deleted_nodes_;
   tsl::robin_set<TagT> deleted_nodes_set_;  // copy of deleted nodes.
+  pipeann::QueryStatsRecorder recorder_;
 
   // if vectors are less than the threshold, use mem index instead.
   std::mt19937 gen;
   pipeann::Parameters mem_index_params_;
-  std::shared_ptr<pipeann::Index<T, TagT>> mem_index_;
+  pipeann::Index<T, TagT> *mem_index_ = nullptr;             // owned by disk_index_ or own_mem_index_.
+  std::unique_ptr<pipeann::Index<T, TagT>> own_mem_index_;  // memory-only index.
   std::shared_ptr<pipeann::SSDIndex<T, TagT>> disk_index_;
 };
-
-class PyIndexInterface {};
\ No newline at end of file
@@ -1,8 +1,14 @@
 #include "graph_stats.h"
+#include <algorithm>
 #include <cstdint>
 #include <cstring>
 #include <fstream>
 #include <limits>
+#include <queue>
+
+#include <fcntl.h>
+#include <omp.h>
+#include <unistd.h>
 
 namespace pipeann {
 
@@ -21,6 +27,40 @@ size_t elem_size(DiskIndexDataType t) {
   return 4;
 }
 
+struct DiskIndexMeta {
+  uint64_t nnodes, ndims, medoid, max_node_len, nnodes_per_sector;
+  size_t coord_bytes;
+};
+
+// Format A (save_bin header of 2*i32) or format B (5 uint64s at 0), as in compute_graph_stats_from_disk_index.
+// Rejects multi-sector nodes.
+bool read_disk_index_meta(std::ifstream &in, DiskIndexDataType data_type, DiskIndexMeta *m) {
+  int32_t meta_npts, meta_ndims;
+  in.read(reinterpret_cast<char *>(&meta_npts), sizeof(int32_t));
+  in.read(reinterpret_cast<char *>(&meta_ndims), sizeof(int32_t));
+  if (!in.good() || meta_npts < 5) {
+    in.clear();
+    in.seekg(0, in.beg);
+  }
+  in.read(reinterpret_cast<char *>(&m->nnodes), sizeof(uint64_t));
+  in.read(reinterpret_cast<char *>(&m->ndims), sizeof(uint64_t));
+  in.read(reinterpret_cast<char *>(&m->medoid), sizeof(uint64_t));
+  in.read(reinterpret_cast<char *>(&m->max_node_len), sizeof(uint64_t));
+  in.read(reinterpret_cast<char *>(&m->nnodes_per_sector), sizeof(uint64_t));
+  m->coord_bytes = m->ndims * elem_size(data_type);
+  return in.good() && m->nnodes_per_sector != 0 && m->max_node_len >= m->coord_bytes + sizeof(uint32_t) &&
+         m->max_node_len <= kSectorLen;
+}
+
+// Neighbor list of the node at slot j of a sector buffer; count clamped to what fits in the node.
+const unsigned *node_nbrs(const char *sector, uint64_t j, const DiskIndexMeta &m, uint32_t *nnbrs) {
+  const char *node = sector + j * m.max_node_len;
+  memcpy(nnbrs, node + m.coord_bytes, sizeof(uint32_t));
+  uint32_t max_nbrs = (m.max_node_len - m.coord_bytes - sizeof(uint32_t)) / sizeof(unsigned);
+  *nnbrs = std::min(*nnbrs, max_nbrs);
+  return reinterpret_cast<const unsigned *>(node + m.coord_bytes + sizeof(uint32_t));
+}
+
 }  // namespace
 
 GraphStats compute_graph_stats(const std::vector<std::vector<unsigned>> &graph, size_t nd,
@@ -363,6 +403,468 @@ GraphStats compute_graph_stats_from_disk_index(const std::string &path, DiskInde
   return s;
 }
 
+bool load_graph_from_disk_index(const std::string &path, DiskIndexDataType data_type, DiskIndexGraph *out) {
+  std::ifstream in(path, std::ios::binary);
+  DiskIndexMeta m;
+  if (!in.is_open() || !read_disk_index_meta(in, data_type, &m)) {
+    return false;
+  }
+
+  out->nnodes = m.nnodes;
+  out->nnodes_per_sector = m.nnodes_per_sector;
+  out->max_node_len = m.max_node_len;
+  out->entry_point = static_cast<unsigned>(m.medoid);
+  out->adj.assign(m.nnodes, {});
+  std::vector<char> sector(kSectorLen);
+  uint64_t n_sectors = (m.nnodes + m.nnodes_per_sector - 1) / m.nnodes_per_sector;
+  in.seekg(static_cast<std::streamoff>(kDiskIndexDataOffset), in.beg);
+  for (uint64_t sec = 0; sec < n_sectors; sec++) {
+    if (!in.read(sector.data(), kSectorLen)) {
+      return false;
+    }
+    for (uint64_t j = 0; j < m.nnodes_per_sector; j++) {
+      uint64_t node_id = sec * m.nnodes_per_sector + j;
+      if (node_id >= m.nnodes) {
+        break;
+      }
+      uint32_t nnbrs;
+      const unsigned *nbrs = node_nbrs(sector.data(), j, m, &nnbrs);
+      out->adj[node_id].assign(nbrs, nbrs + nnbrs);
+    }
+  }
+  return true;
+}
+
+namespace {
+
+constexpr uint32_t kInvalidSlot = std::numeric_limits<uint32_t>::max();
+constexpr uint8_t kUnvisited = std::numeric_limits<uint8_t>::max();
+
+// Node <-> slot mapping of a disk index: identity, or read from a partition file
+// (header C, partition_nums, nd; then per page: u32 count, C u32 ids).
+struct SlotLayout {
+  uint64_t nnodes = 0, nnodes_per_sector = 0, n_pages = 0;
+  std::vector<uint32_t> slots;   // page * C + j -> id; empty = identity.
+  std::vector<uint32_t> id2loc;  // empty = identity.
+
+  uint32_t id_at(uint64_t page, uint64_t j) const {
+    uint64_t loc = page * nnodes_per_sector + j;
+    if (!slots.empty()) {
+      return slots[loc];
+    }
+    return loc < nnodes ? static_cast<uint32_t>(loc) : kInvalidSlot;
+  }
+  uint64_t loc_of(uint32_t id) const {
+    return id2loc.empty() ? id : id2loc[id];
+  }
+  // 0-based data page, i.e. sector - 1.
+  uint64_t page_of(uint32_t id) const {
+    return loc_of(id) / nnodes_per_sector;
+  }
+};
+
+bool load_slot_layout(const std::string &partition_file, SlotLayout *l) {
+  if (partition_file.empty()) {
+    return true;
+  }
+  std::ifstream part(partition_file, std::ios::binary);
+  uint64_t C, partition_nums, nd;
+  part.read(reinterpret_cast<char *>(&C), sizeof(uint64_t));
+  part.read(reinterpret_cast<char *>(&partition_nums), sizeof(uint64_t));
+  part.read(reinterpret_cast<char *>(&nd), sizeof(uint64_t));
+  if (!part.good() || C != l->nnodes_per_sector || partition_nums > l->n_pages) {
+    return false;
+  }
+  l->slots.assign(l->n_pages * C, kInvalidSlot);
+  l->id2loc.assign(l->nnodes, kInvalidSlot);
+  std::vector<uint32_t> rec(1 + C);
+  for (uint64_t p = 0; p < partition_nums; ++p) {
+    if (!part.read(reinterpret_cast<char *>(rec.data()), rec.size() * sizeof(uint32_t))) {
+      return false;
+    }
+    for (uint32_t j = 0; j < std::min<uint64_t>(rec[0], C); ++j) {
+      uint32_t id = rec[1 + j];
+      if (id < l->nnodes) {
+        l->slots[p * C + j] = id;
+        l->id2loc[id] = p * C + j;
+      }
+    }
+  }
+  return true;
+}
+
+bool pread_sectors(int fd, char *buf, uint64_t first_page, uint64_t n_pages) {
+  uint64_t off = kDiskIndexDataOffset + first_page * kSectorLen, len = n_pages * kSectorLen, done = 0;
+  while (done < len) {
+    ssize_t r = pread(fd, buf + done, len - done, off + done);
+    if (r <= 0) {
+      return false;
+    }
+    done += r;
+  }
+  return true;
+}
+
+// One BFS level per call: reads each page in pages once (in parallel) and calls visit(tid, sector, page).
+template<typename F>
+bool for_each_page_parallel(int fd, const std::vector<uint64_t> &pages, unsigned nt, F visit) {
+  bool ok = true;
+#pragma omp parallel num_threads(nt)
+  {
+    std::vector<char> sector(kSectorLen);
+    int tid = omp_get_thread_num();
+#pragma omp for schedule(dynamic, 16)
+    for (int64_t i = 0; i < (int64_t) pages.size(); ++i) {
+      if (!pread_sectors(fd, sector.data(), pages[i], 1)) {
+        ok = false;
+        continue;
+      }
+      visit(tid, sector.data(), pages[i]);
+    }
+  }
+  return ok;
+}
+
+bool try_visit(std::vector<uint8_t> &dist, uint64_t i, uint8_t d) {
+  uint8_t expected = kUnvisited;
+  return __atomic_load_n(&dist[i], __ATOMIC_RELAXED) == kUnvisited &&
+         __atomic_compare_exchange_n(&dist[i], &expected, d, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+}  // namespace
+
+bool compute_locality_from_disk_index(const std::string &path, DiskIndexDataType data_type,
+                                      const LocalityOptions &opts, LocalityStats *out) {
+  std::ifstream in(path, std::ios::binary | std::ios::ate);
+  DiskIndexMeta m;
+  if (!in.is_open()) {
+    return false;
+  }
+  uint64_t file_size = in.tellg();
+  in.seekg(0, in.beg);
+  if (!read_disk_index_meta(in, data_type, &m) || m.medoid >= m.nnodes || file_size < kDiskIndexDataOffset) {
+    return false;
+  }
+  in.close();
+
+  SlotLayout layout;
+  layout.nnodes = m.nnodes;
+  layout.nnodes_per_sector = m.nnodes_per_sector;
+  layout.n_pages = (file_size - kDiskIndexDataOffset) / kSectorLen;
+  if (!load_slot_layout(opts.partition_file, &layout)) {
+    return false;
+  }
+  const uint64_t C = m.nnodes_per_sector, n_pages = layout.n_pages, nnodes = m.nnodes;
+  unsigned nt = opts.num_threads ? opts.num_threads : omp_get_max_threads();
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+
+  LocalityStats s;
+  s.nnodes = nnodes;
+  s.nnodes_per_sector = C;
+  s.n_pages = n_pages;
+  s.entry_point = static_cast<unsigned>(m.medoid);
+  s.n_slots = n_pages * C;
+
+  // Pass 1: stream all sectors in order; each chunk is split across threads.
+  std::vector<uint32_t> indeg(nnodes, 0);
+  std::vector<uint64_t> page_in(n_pages, 0);
+  std::vector<uint8_t> page_nodes(n_pages, 0);
+  uint64_t used = 0, pages_with_holes = 0, empty_pages = 0, edges = 0, colocated = 0, unique_pages = 0,
+           min_pages = 0;
+  uint64_t chunk_pages = std::max<uint64_t>(opts.sectors_per_chunk, 1);
+  std::vector<char> chunk(std::min(chunk_pages, std::max<uint64_t>(n_pages, 1)) * kSectorLen);
+  bool ok = true;
+  for (uint64_t first = 0; first < n_pages && ok; first += chunk_pages) {
+    uint64_t n = std::min(chunk_pages, n_pages - first);
+    if (!pread_sectors(fd, chunk.data(), first, n)) {
+      ok = false;
+      break;
+    }
+#pragma omp parallel for schedule(dynamic, 64) num_threads(nt) \
+    reduction(+ : used, pages_with_holes, empty_pages, edges, colocated, unique_pages, min_pages)
+    for (int64_t k = 0; k < (int64_t) n; ++k) {
+      uint64_t page = first + k;
+      const char *sector = chunk.data() + k * kSectorLen;
+      std::vector<uint64_t> nbr_pages;
+      uint32_t in_page = 0;
+      for (uint64_t j = 0; j < C; ++j) {
+        uint32_t id = layout.id_at(page, j);
+        if (id == kInvalidSlot) {
+          continue;
+        }
+        ++in_page;
+        uint32_t nnbrs;
+        const unsigned *nbrs = node_nbrs(sector, j, m, &nnbrs);
+        edges += nnbrs;
+        min_pages += (nnbrs + C - 1) / C;
+        nbr_pages.clear();
+        for (uint32_t e = 0; e < nnbrs; ++e) {
+          uint32_t v = nbrs[e];
+          if (v >= nnodes || layout.loc_of(v) == kInvalidSlot) {
+            continue;
+          }
+          __atomic_fetch_add(&indeg[v], 1, __ATOMIC_RELAXED);
+          uint64_t pv = layout.page_of(v);
+          if (pv == page) {
+            ++colocated;
+          } else {
+            nbr_pages.push_back(pv);
+            __atomic_fetch_add(&page_in[pv], 1, __ATOMIC_RELAXED);
+          }
+        }
+        std::sort(nbr_pages.begin(), nbr_pages.end());
+        unique_pages += std::unique(nbr_pages.begin(), nbr_pages.end()) - nbr_pages.begin();
+      }
+      page_nodes[page] = static_cast<uint8_t>(in_page);
+      used += in_page;
+      pages_with_holes += (in_page > 0 && in_page < C);
+      empty_pages += (in_page == 0);
+    }
+  }
+  if (!ok) {
+    close(fd);
+    return false;
+  }
+  s.n_holes = s.n_slots - used;
+  s.pages_with_holes = pages_with_holes;
+  s.empty_pages = empty_pages;
+  s.n_edges = edges;
+  s.colocated_edges = colocated;
+  s.avg_unique_pages_per_expansion = used ? static_cast<double>(unique_pages) / used : 0.0;
+  s.avg_min_pages_per_expansion = used ? static_cast<double>(min_pages) / used : 0.0;
+
+  // In-degree distribution and hub pages.
+  uint32_t indeg_max = 0;
+#pragma omp parallel for reduction(max : indeg_max) num_threads(nt)
+  for (int64_t i = 0; i < (int64_t) nnodes; ++i) {
+    indeg_max = std::max(indeg_max, indeg[i]);
+  }
+  std::vector<uint64_t> indeg_hist(indeg_max + 1, 0);
+  uint64_t placed = 0, in_edges = 0;
+  for (uint64_t i = 0; i < nnodes; ++i) {
+    if (layout.loc_of(i) != kInvalidSlot) {
+      ++indeg_hist[indeg[i]];
+      ++placed;
+      in_edges += indeg[i];
+    }
+  }
+  s.indeg_zero = indeg_hist[0];
+  s.indeg_max = indeg_max;
+  s.indeg_avg = placed ? static_cast<double>(in_edges) / placed : 0.0;
+  uint32_t *pcts[] = {&s.indeg_p50, &s.indeg_p90, &s.indeg_p99, &s.indeg_p999};
+  double qs[] = {0.5, 0.9, 0.99, 0.999};
+  uint64_t cum = 0;
+  size_t qi = 0;
+  for (uint32_t d = 0; d <= indeg_max && qi < 4; ++d) {
+    cum += indeg_hist[d];
+    while (qi < 4 && cum >= qs[qi] * placed) {
+      *pcts[qi++] = d;
+    }
+  }
+  using PageCount = std::pair<uint64_t, uint64_t>;  // (in-edges, page)
+  std::priority_queue<PageCount, std::vector<PageCount>, std::greater<PageCount>> top;
+  for (uint64_t p = 0; p < n_pages && opts.top_hub_pages > 0; ++p) {
+    if (top.size() < opts.top_hub_pages) {
+      top.push({page_in[p], p});
+    } else if (page_in[p] > top.top().first) {
+      top.pop();
+      top.push({page_in[p], p});
+    }
+  }
+  for (; !top.empty(); top.pop()) {
+    s.hub_pages.push_back({top.top().second + 1, top.top().first});  // report sector numbers.
+  }
+  std::reverse(s.hub_pages.begin(), s.hub_pages.end());
+  if (opts.hot_pages == 0 || !opts.bfs) {
+    std::vector<uint32_t>().swap(indeg);
+  }
+  std::vector<uint64_t>().swap(page_in);
+
+  if (!opts.bfs) {
+    close(fd);
+    *out = std::move(s);
+    return true;
+  }
+
+  // Node-level BFS from the medoid: frontier nodes grouped by page, so a page is read once per level.
+  std::vector<uint8_t> dist(nnodes, kUnvisited);
+  std::vector<uint32_t> frontier = {static_cast<uint32_t>(m.medoid)};
+  dist[m.medoid] = 0;
+  uint64_t reached = 0;
+  for (uint8_t level = 0; !frontier.empty() && ok; ++level) {
+    s.nodes_at_hop.push_back(frontier.size());
+    reached += frontier.size();
+    if (level + 1 == kUnvisited) {
+      break;
+    }
+    std::sort(frontier.begin(), frontier.end(),
+              [&](uint32_t a, uint32_t b) { return layout.loc_of(a) < layout.loc_of(b); });
+    std::vector<uint64_t> pages;
+    std::vector<size_t> group_start;
+    for (size_t i = 0; i < frontier.size(); ++i) {
+      uint64_t p = layout.page_of(frontier[i]);
+      if (pages.empty() || pages.back() != p) {
+        pages.push_back(p);
+        group_start.push_back(i);
+      }
+    }
+    group_start.push_back(frontier.size());
+    std::vector<std::vector<uint32_t>> next(nt);
+    ok = for_each_page_parallel(fd, pages, nt, [&](int tid, const char *sector, uint64_t page) {
+      size_t g = std::lower_bound(pages.begin(), pages.end(), page) - pages.begin();
+      for (size_t i = group_start[g]; i < group_start[g + 1]; ++i) {
+        uint32_t nnbrs;
+        const unsigned *nbrs = node_nbrs(sector, layout.loc_of(frontier[i]) % C, m, &nnbrs);
+        for (uint32_t e = 0; e < nnbrs; ++e) {
+          uint32_t v = nbrs[e];
+          if (v < nnodes && layout.loc_of(v) != kInvalidSlot && try_visit(dist, v, level + 1)) {
+            next[tid].push_back(v);
+          }
+        }
+      }
+    });
+    frontier.clear();
+    for (auto &v : next) {
+      frontier.insert(frontier.end(), v.begin(), v.end());
+    }
+  }
+  s.unreachable_nodes = used - std::min(used, reached);
+
+  // Hot pages: in-degree weighted by reachability from the medoid.
+  if (opts.hot_pages > 0 && ok) {
+    std::vector<double> decay_pow(kUnvisited, 0.0);
+    for (uint32_t h = 0; h < kUnvisited; ++h) {
+      decay_pow[h] = h == 0 ? 1.0 : decay_pow[h - 1] * opts.hot_decay;
+    }
+    std::vector<double> page_score(n_pages, 0.0);
+    for (uint64_t v = 0; v < nnodes; ++v) {
+      if (dist[v] != kUnvisited) {
+        page_score[layout.page_of(static_cast<uint32_t>(v))] += (1.0 + indeg[v]) * decay_pow[dist[v]];
+      }
+    }
+    std::vector<uint64_t> order;
+    for (uint64_t p = 0; p < n_pages; ++p) {
+      if (page_score[p] > 0) {
+        order.push_back(p);
+      }
+    }
+    size_t n_hot = std::min(opts.hot_pages, order.size());
+    std::partial_sort(order.begin(), order.begin() + n_hot, order.end(),
+                      [&](uint64_t a, uint64_t b) { return page_score[a] > page_score[b]; });
+    for (size_t i = 0; i < n_hot; ++i) {
+      s.hot_pages.push_back({order[i] + 1, page_score[order[i]]});  // report sector numbers.
+    }
+  }
+  std::vector<uint32_t>().swap(indeg);
+  std::vector<uint8_t>().swap(dist);
+
+  // Page-level BFS: a read expands every node in the page.
+  std::vector<uint8_t> page_dist(n_pages, kUnvisited);
+  std::vector<uint64_t> page_frontier = {layout.page_of(static_cast<uint32_t>(m.medoid))};
+  page_dist[page_frontier[0]] = 0;
+  for (uint8_t level = 0; !page_frontier.empty() && ok; ++level) {
+    uint64_t n_nodes = 0;
+    for (uint64_t p : page_frontier) {
+      n_nodes += page_nodes[p];
+    }
+    s.nodes_at_page_hop.push_back(n_nodes);
+    if (level + 1 == kUnvisited) {
+      break;
+    }
+    std::sort(page_frontier.begin(), page_frontier.end());
+    std::vector<std::vector<uint64_t>> next(nt);
+    ok = for_each_page_parallel(fd, page_frontier, nt, [&](int tid, const char *sector, uint64_t page) {
+      for (uint64_t j = 0; j < C; ++j) {
+        if (layout.id_at(page, j) == kInvalidSlot) {
+          continue;
+        }
+        uint32_t nnbrs;
+        const unsigned *nbrs = node_nbrs(sector, j, m, &nnbrs);
+        for (uint32_t e = 0; e < nnbrs; ++e) {
+          uint32_t v = nbrs[e];
+          if (v < nnodes && layout.loc_of(v) != kInvalidSlot) {
+            uint64_t pv = layout.page_of(v);
+            if (try_visit(page_dist, pv, level + 1)) {
+              next[tid].push_back(pv);
+            }
+          }
+        }
+      }
+    });
+    page_frontier.clear();
+    for (auto &v : next) {
+      page_frontier.insert(page_frontier.end(), v.begin(), v.end());
+    }
+  }
+  close(fd);
+  if (!ok) {
+    return false;
+  }
+  *out = std::move(s);
+  return true;
+}
+
+void print_locality_report(const LocalityStats &s, std::ostream &out) {
+  auto pct = [](uint64_t a, uint64_t b) { return b ? 100.0 * a / b : 0.0; };
+  uint64_t used = s.n_slots - s.n_holes;
+  out << "Layout: pages=" << s.n_pages << " nodes_per_page=" << s.nnodes_per_sector << " slots=" << s.n_slots
+      << " holes=" << s.n_holes << " (" << pct(s.n_holes, s.n_slots) << "%) pages_with_holes=" << s.pages_with_holes
+      << " empty_pages=" << s.empty_pages << std::endl;
+  out << "Locality: edges=" << s.n_edges << " colocated=" << s.colocated_edges << " ("
+      << pct(s.colocated_edges, s.n_edges) << "%) unique_pages_per_expansion=" << s.avg_unique_pages_per_expansion
+      << " (packed lower bound " << s.avg_min_pages_per_expansion << ")" << std::endl;
+  out << "In-degree: avg=" << s.indeg_avg << " p50=" << s.indeg_p50 << " p90=" << s.indeg_p90
+      << " p99=" << s.indeg_p99 << " p99.9=" << s.indeg_p999 << " max=" << s.indeg_max
+      << " zero=" << s.indeg_zero << std::endl;
+  out << "Hub pages (sector: in-edges from other pages):";
+  for (auto &[page, n] : s.hub_pages) {
+    out << " " << page << ":" << n;
+  }
+  out << std::endl;
+
+  auto print_hops = [&](const char *title, const std::vector<uint64_t> &hops) {
+    if (hops.empty()) {
+      return;
+    }
+    uint64_t cum = 0;
+    double sum = 0;
+    out << title << " from medoid " << s.entry_point << ":" << std::endl;
+    for (size_t h = 0; h < hops.size(); ++h) {
+      cum += hops[h];
+      sum += static_cast<double>(h) * hops[h];
+      out << "  hop " << h << ": " << hops[h] << " nodes (cum " << pct(cum, used) << "%)" << std::endl;
+    }
+    out << "  mean=" << (cum ? sum / cum : 0.0) << " reached=" << cum << std::endl;
+  };
+  print_hops("Node hops (beam search IOs to reach)", s.nodes_at_hop);
+  print_hops("Page hops (page search IOs to reach, after the medoid's page)", s.nodes_at_page_hop);
+  if (!s.nodes_at_hop.empty()) {
+    out << "Unreachable nodes: " << s.unreachable_nodes << std::endl;
+  }
+  if (!s.hot_pages.empty()) {
+    double total = 0;
+    for (auto &hp : s.hot_pages) {
+      total += hp.second;
+    }
+    out << "Hot pages: " << s.hot_pages.size() << " ranked, top (sector:score):";
+    for (size_t i = 0; i < std::min<size_t>(s.hot_pages.size(), 10); ++i) {
+      out << " " << s.hot_pages[i].first << ":" << s.hot_pages[i].second;
+    }
+    out << " total_score=" << total << std::endl;
+  }
+}
+
+bool save_hot_pages(const LocalityStats &s, const std::string &path) {
+  std::ofstream out(path);
+  for (auto &[sector, score] : s.hot_pages) {
+    out << sector << " " << score << "\n";
+  }
+  return out.good();
+}
+
 void print_adjacency_sample_from_disk_index(const std::string &path, DiskIndexDataType data_type,
                                             size_t num_nodes, size_t max_neighbors_per_node, std::ostream &out) {
   std::ifstream in(path, std::ios::binary);
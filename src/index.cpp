@@ -1373,6 +1373,104 @@ namespace pipeann {
     _nd--;
   }
 
+  template<typename T, typename TagT>
+  void Index<T, TagT>::compute_dists_batch(const T *query, const unsigned *ids, size_t n, float *dists) {
+    constexpr size_t kPrefetchAhead = 2;
+    for (size_t i = 0; i < n && i < kPrefetchAhead; ++i) {
+      pipeann::prefetch_vector((const char *) (_data + _aligned_dim * (size_t) ids[i]), sizeof(T) * _aligned_dim);
+    }
+    for (size_t i = 0; i < n; ++i) {
+      if (i + kPrefetchAhead < n) {
+        pipeann::prefetch_vector((const char *) (_data + _aligned_dim * (size_t) ids[i + kPrefetchAhead]),
+                                 sizeof(T) * _aligned_dim);
+      }
+      dists[i] = _distance->compare(query, _data + _aligned_dim * (size_t) ids[i], (unsigned) _aligned_dim);
+    }
+  }
+
+  template<typename T, typename TagT>
+  bool Index<T, TagT>::consolidate_node(unsigned loc, const tsl::robin_set<unsigned> &del_set, const unsigned range,
+                                        const unsigned maxc, const float alpha, bool locked,
+                                        ConsolidateScratch &scratch) {
+    auto &candidate_set = scratch.candidate_set;
+    auto &old_nbrs = scratch.old_nbrs;
+    candidate_set.clear();
+    scratch.candidates.clear();
+    scratch.expanded_nghrs.clear();
+    scratch.result.clear();
+
+    if (locked) {
+      v2::LockGuard guard(_locks->rdlock(loc));
+      old_nbrs = _final_graph[loc];
+    } else {
+      old_nbrs = _final_graph[loc];
+    }
+
+    bool modify = false;
+    for (auto ngh : old_nbrs) {
+      if (del_set.find(ngh) != del_set.end()) {
+        modify = true;
+        // Add outgoing links from the deleted neighbor.
+        if (locked) {
+          v2::LockGuard guard(_locks->rdlock(ngh));
+          for (auto j : _final_graph[ngh])
+            if (del_set.find(j) == del_set.end())
+              candidate_set.insert(j);
+        } else {
+          for (auto j : _final_graph[ngh])
+            if (del_set.find(j) == del_set.end())
+              candidate_set.insert(j);
+        }
+      } else {
+        candidate_set.insert(ngh);
+      }
+    }
+    if (!modify) {
+      return false;
+    }
+
+    candidate_set.erase(loc);
+    scratch.candidates.assign(candidate_set.begin(), candidate_set.end());
+    scratch.dists.resize(scratch.candidates.size());
+    compute_dists_batch(_data + _aligned_dim * (size_t) loc, scratch.candidates.data(), scratch.candidates.size(),
+                        scratch.dists.data());
+    for (size_t k = 0; k < scratch.candidates.size(); ++k) {
+      scratch.expanded_nghrs.emplace_back(scratch.candidates[k], scratch.dists[k], true);
+    }
+
+    std::sort(scratch.expanded_nghrs.begin(), scratch.expanded_nghrs.end());
+    occlude_list(scratch.expanded_nghrs, alpha, range, maxc, scratch.result);
+
+    auto write_back = [&]() {
+      auto &nbrs = _final_graph[loc];
+      // Keep links appended by concurrent inserts since old_nbrs was taken.
+      std::vector<unsigned> appended;
+      if (locked) {
+        for (auto j : nbrs)
+          if (std::find(old_nbrs.begin(), old_nbrs.end(), j) == old_nbrs.end() && del_set.find(j) == del_set.end())
+            appended.push_back(j);
+      }
+      nbrs.clear();
+      for (auto &j : scratch.result) {
+        if (j.id != loc && (del_set.find(j.id) == del_set.end()))
+          nbrs.push_back(j.id);
+      }
+      for (auto j : appended) {
+        if (nbrs.size() >= (_u64) (SLACK_FACTOR * range))
+          break;
+        if (std::find(nbrs.begin(), nbrs.end(), j) == nbrs.end())
+          nbrs.push_back(j);
+      }
+    };
+    if (locked) {
+      v2::LockGuard guard(_locks->wrlock(loc));
+      write_back();
+    } else {
+      write_back();
+    }
+    return true;
+  }
+
   // Do not call consolidate_deletes() if you have not locked _change_lock.
   // Returns number of live points left after consolidation
   // proxy inserts all nghrs of deleted points
@@ -1401,48 +1499,10 @@ namespace pipeann {
     auto start = std::chrono::high_resolution_clock::now();
 #pragma omp parallel for schedule(dynamic)
     for (_s64 block = 0; block < total_blocks; ++block) {
-      tsl::robin_set<unsigned> candidate_set;
-      std::vector<Neighbor> expanded_nghrs;
-      std::vector<Neighbor> result;
-
-      for (_s64 i = block * block_size;
-           i < (_s64) ((block + 1) * block_size) && i < (_s64) (_max_points + _num_frozen_pts); i++) {
+      ConsolidateScratch scratch;
+      for (_s64 i = block * block_size; i < (_s64) ((block + 1) * block_size) && i < (_s64) total_pts; i++) {
         if ((_delete_set.find((_u32) i) == _delete_set.end()) && (_empty_slots.find((_u32) i) == _empty_slots.end())) {
-          candidate_set.clear();
-          expanded_nghrs.clear();
-          result.clear();
-
-          bool modify = false;
-          for (auto ngh : _final_graph[(_u32) i]) {
-            if (_delete_set.find(ngh) != _delete_set.end()) {
-              modify = true;
-
-              // Add outgoing links from
-              for (auto j : _final_graph[ngh])
-                if (_delete_set.find(j) == _delete_set.end())
-                  candidate_set.insert(j);
-            } else {
-              candidate_set.insert(ngh);
-            }
-          }
-          if (modify) {
-            for (auto j : candidate_set) {
-              expanded_nghrs.push_back(
-                  Neighbor(j,
-                           _distance->compare(_data + _aligned_dim * i, _data + _aligned_dim * (size_t) j,
-                                              (unsigned) _aligned_dim),
-                           true));
-            }
-
-            std::sort(expanded_nghrs.begin(), expanded_nghrs.end());
-            occlude_list(expanded_nghrs, alpha, range, maxc, result);
-
-            _final_graph[(_u32) i].clear();
-            for (auto j : result) {
-              if (j.id != (_u32) i && (_delete_set.find(j.id) == _delete_set.end()))
-                _final_graph[(_u32) i].push_back(j.id);
-            }
-          }
+          consolidate_node((_u32) i, _delete_set, range, maxc, alpha, false, scratch);
         }
       }
     }
@@ -1461,6 +1521,98 @@ namespace pipeann {
     return _nd;
   }
 
+  template<typename T, typename TagT>
+  size_t Index<T, TagT>::consolidate_deletes_incremental(const Parameters &parameters, size_t max_nodes) {
+    if (_eager_done) {
+      LOG(INFO) << "In consolidate_deletes_incremental(), _eager_done is true. So exiting.";
+      return 0;
+    }
+    std::shared_lock<std::shared_timed_mutex> lock(_update_lock);
+
+    const unsigned range = parameters.Get<unsigned>("R");
+    const unsigned maxc = parameters.Get<unsigned>("C");
+    const float alpha = parameters.Get<float>("alpha");
+    const _u64 total_pts = _max_points + _num_frozen_pts;
+
+    if (!_consolidate_active) {
+      {
+        std::shared_lock<std::shared_timed_mutex> dl(_delete_lock);
+        if (_delete_set.empty()) {
+          return 0;
+        }
+        _consolidate_set = _delete_set;
+      }
+      std::lock_guard<std::mutex> guard(_consolidate_lock);
+      _consolidate_cursor = 0;
+      _consolidate_revisit.clear();
+      _consolidate_active = true;
+      LOG(INFO) << "Starting incremental consolidation of " << _consolidate_set.size() << " deletes.";
+    }
+
+    // Advance the cursor before processing, so inserts landing inside the range
+    // are recorded for a revisit.
+    _u64 begin, end;
+    {
+      std::lock_guard<std::mutex> guard(_consolidate_lock);
+      begin = _consolidate_cursor;
+      end = std::min<_u64>(total_pts, begin + std::max<size_t>(max_nodes, 1));
+      _consolidate_cursor = end;
+    }
+
+    unsigned block_size = 1 << 8;
+    _s64 total_blocks = DIV_ROUND_UP(end - begin, block_size);
+#pragma omp parallel for schedule(dynamic)
+    for (_s64 block = 0; block < total_blocks; ++block) {
+      ConsolidateScratch scratch;
+      for (_u64 i = begin + block * block_size; i < begin + (block + 1) * block_size && i < end; ++i) {
+        if (_consolidate_set.find((_u32) i) == _consolidate_set.end()) {
+          consolidate_node((_u32) i, _consolidate_set, range, maxc, alpha, true, scratch);
+        }
+      }
+    }
+
+    if (end < total_pts) {
+      return total_pts - end;
+    }
+
+    // Sweep done: wait out in-flight inserts, repair the nodes inserted behind
+    // the cursor, then release the slots.
+    lock.unlock();
+    std::unique_lock<std::shared_timed_mutex> update_guard(_update_lock);
+    if (_max_points + _num_frozen_pts != total_pts) {
+      // an insert resized the index before we got here: the new slots (and the
+      // moved frozen point) lie past the cursor, so sweep them first.
+      return _max_points + _num_frozen_pts - end;
+    }
+    std::vector<unsigned> revisit;
+    {
+      std::lock_guard<std::mutex> guard(_consolidate_lock);
+      revisit.swap(_consolidate_revisit);
+      _consolidate_active = false;
+    }
+    ConsolidateScratch scratch;
+    for (auto loc : revisit) {
+      if (_consolidate_set.find(loc) == _consolidate_set.end()) {
+        consolidate_node(loc, _consolidate_set, range, maxc, alpha, true, scratch);
+      }
+    }
+
+    {
+      std::unique_lock<std::shared_timed_mutex> dl(_delete_lock);
+      LockGuard guard(_change_lock);
+      for (auto iter : _consolidate_set) {
+        _delete_set.erase(iter);
+        _empty_slots.insert(iter);
+      }
+      _nd -= _consolidate_set.size();
+      _data_compacted = false;
+    }
+    LOG(INFO) << "Incremental consolidation released " << _consolidate_set.size() << " slots, " << revisit.size()
+              << " nodes revisited.";
+    _consolidate_set.clear();
+    return 0;
+  }
+
   template<typename T, typename TagT>
   void Index<T, TagT>::consolidate(Parameters &parameters) {
     consolidate_deletes(parameters);
@@ -1509,14 +1661,36 @@ namespace pipeann {
     auto start = std::chrono::high_resolution_clock::now();
     auto fnstart = start;
 
-    std::vector<unsigned> new_location = std::vector<unsigned>(_max_points + _num_frozen_pts, (_u32) _max_points);
-
-    _u32 new_counter = 0;
-
-    for (_u32 old_counter = 0; old_counter < _max_points + _num_frozen_pts; old_counter++) {
-      if (_location_to_tag.find(old_counter) != _location_to_tag.end()) {
-        new_location[old_counter] = new_counter;
-        new_counter++;
+    const _u64 total_pts = _max_points + _num_frozen_pts;
+    std::vector<unsigned> new_location = std::vector<unsigned>(total_pts, (_u32) _max_points);
+
+    // Prefix-sum over per-block survivor counts gives every block its first
+    // destination slot, so the renumbering is computed in parallel.
+    constexpr _u64 kScanBlock = 1 << 16;
+    _s64 n_scan_blocks = DIV_ROUND_UP(total_pts, kScanBlock);
+    std::vector<_u64> block_start(n_scan_blocks + 1, 0);
+#pragma omp parallel for schedule(static)
+    for (_s64 b = 0; b < n_scan_blocks; ++b) {
+      _u64 cnt = 0;
+      for (_u64 i = b * kScanBlock; i < std::min(total_pts, (b + 1) * kScanBlock); ++i) {
+        cnt += _location_to_tag.find((_u32) i) != _location_to_tag.end();
+      }
+      block_start[b + 1] = cnt;
+    }
+    for (_s64 b = 0; b < n_scan_blocks; ++b) {
+      block_start[b + 1] += block_start[b];
+    }
+    const _u64 new_counter = block_start[n_scan_blocks];
+    // survivors[new] = old; monotone, so destinations never pass their sources.
+    std::vector<unsigned> survivors(new_counter);
+#pragma omp parallel for schedule(static)
+    for (_s64 b = 0; b < n_scan_blocks; ++b) {
+      _u64 next = block_start[b];
+      for (_u64 i = b * kScanBlock; i < std::min(total_pts, (b + 1) * kScanBlock); ++i) {
+        if (_location_to_tag.find((_u32) i) != _location_to_tag.end()) {
+          new_location[i] = (_u32) next;
+          survivors[next++] = (_u32) i;
+        }
       }
     }
 
@@ -1529,7 +1703,7 @@ namespace pipeann {
       auto old_ep = _ep;
       // First active neighbor of old start node is new start node
       for (auto iter : _final_graph[_ep])
-        if (_delete_set.find(iter) != _delete_set.end()) {
+        if (_delete_set.find(iter) == _delete_set.end()) {
           _ep = iter;
           break;
         }
@@ -1542,49 +1716,80 @@ namespace pipeann {
     }
 
     start = std::chrono::high_resolution_clock::now();
-    double copy_time = 0;
-    for (unsigned old = 0; old <= _max_points; ++old) {
-      if ((new_location[old] < _max_points) || (old == _max_points)) {  // If point continues to exist
-
-        // Renumber nodes to compact the order
-        for (size_t i = 0; i < _final_graph[old].size(); ++i) {
-          if (new_location[_final_graph[old][i]] > _final_graph[old][i]) {
+    // Renumber the neighbor lists in place; each list is owned by one thread.
+    std::atomic<bool> renumber_failed{false};
+#pragma omp parallel for schedule(dynamic, 8192)
+    for (_s64 old = 0; old < (_s64) total_pts; ++old) {
+      if ((new_location[old] < _max_points) || (old == (_s64) _max_points)) {  // If point continues to exist
+        auto &nbrs = _final_graph[old];
+        for (size_t i = 0; i < nbrs.size(); ++i) {
+          if (new_location[nbrs[i]] > nbrs[i]) {
             std::stringstream sstream;
             sstream << "Error in compact_data(). Found point: " << old << " whose " << i
-                    << "th neighbor has new location " << new_location[_final_graph[old][i]]
-                    << " that is greater than its old location: " << _final_graph[old][i];
-            if (_delete_set.find(_final_graph[old][i]) != _delete_set.end()) {
-              sstream << " Point: " << old << " index: " << i << " neighbor: " << _final_graph[old][i]
+                    << "th neighbor has new location " << new_location[nbrs[i]]
+                    << " that is greater than its old location: " << nbrs[i];
+            if (_delete_set.find(nbrs[i]) != _delete_set.end()) {
+              sstream << " Point: " << old << " index: " << i << " neighbor: " << nbrs[i]
                       << " found in delete set of size: " << _delete_set.size();
             } else {
-              sstream << " Point: " << old << " neighbor: " << _final_graph[old][i]
+              sstream << " Point: " << old << " neighbor: " << nbrs[i]
                       << " NOT found in delete set of size: " << _delete_set.size();
             }
-
             LOG(ERROR) << sstream.str();
-            crash();
+            renumber_failed = true;
+            break;
           }
-          _final_graph[old][i] = new_location[_final_graph[old][i]];
+          nbrs[i] = new_location[nbrs[i]];
         }
-
-        // Move the data and adj list to the correct position
-        auto c_start = std::chrono::high_resolution_clock::now();
-        if (new_location[old] != old) {
-          assert(new_location[old] < old);
-          _final_graph[new_location[old]].swap(_final_graph[old]);
-          memcpy((void *) (_data + _aligned_dim * (size_t) new_location[old]),
-                 (void *) (_data + _aligned_dim * (size_t) old), _aligned_dim * sizeof(T));
-        }
-        auto c_stop = std::chrono::high_resolution_clock::now();
-        copy_time += std::chrono::duration_cast<std::chrono::duration<double>>(c_stop - c_start).count();
-
       } else {
         _final_graph[old].clear();
       }
     }
+    if (renumber_failed) {
+      crash();
+    }
     stop = std::chrono::high_resolution_clock::now();
-    LOG(INFO) << "Time taken for moving data around: "
-              << std::chrono::duration_cast<std::chrono::duration<double>>(stop - start).count()
+    double renumber_time = std::chrono::duration_cast<std::chrono::duration<double>>(stop - start).count();
+
+    // Move the data and adj lists in destination windows. A window's sources
+    // lie at or after the window, and after all earlier windows' sources, so
+    // staging one window in a bounded scratch buffer makes the parallel moves
+    // safe without a second copy of _data.
+    start = std::chrono::high_resolution_clock::now();
+    constexpr _u64 kMaxScratchBytes = 64ull << 20;
+    const _u64 vec_bytes = _aligned_dim * sizeof(T);
+    const _u64 window = std::max<_u64>(1024, kMaxScratchBytes / vec_bytes);
+    _u64 first_moved = 0;
+    while (first_moved < new_counter && survivors[first_moved] == first_moved) {
+      ++first_moved;
+    }
+    if (first_moved < new_counter) {
+      T *scratch_data = nullptr;
+      const _u64 scratch_pts = std::min(window, new_counter - first_moved);
+      alloc_aligned((void **) &scratch_data, scratch_pts * vec_bytes, 8 * sizeof(T));
+      std::vector<std::vector<unsigned>> scratch_graph(scratch_pts);
+      for (_u64 lo = first_moved; lo < new_counter; lo += window) {
+        _s64 n = (_s64) std::min(window, new_counter - lo);
+#pragma omp parallel for schedule(static)
+        for (_s64 k = 0; k < n; ++k) {
+          _u64 old = survivors[lo + k];
+          memcpy((void *) (scratch_data + _aligned_dim * (size_t) k), (void *) (_data + _aligned_dim * (size_t) old),
+                 vec_bytes);
+          scratch_graph[k].swap(_final_graph[old]);
+        }
+#pragma omp parallel for schedule(static)
+        for (_s64 k = 0; k < n; ++k) {
+          memcpy((void *) (_data + _aligned_dim * (size_t) (lo + k)),
+                 (void *) (scratch_data + _aligned_dim * (size_t) k), vec_bytes);
+          _final_graph[lo + k].swap(scratch_graph[k]);
+          scratch_graph[k].clear();
+        }
+      }
+      aligned_free(scratch_data);
+    }
+    stop = std::chrono::high_resolution_clock::now();
+    double copy_time = std::chrono::duration_cast<std::chrono::duration<double>>(stop - start).count();
+    LOG(INFO) << "Time taken for moving data around: " << renumber_time + copy_time
               << "s. Of which copy_time: " << copy_time << "s.";
 
     start = std::chrono::high_resolution_clock::now();
@@ -1597,7 +1802,8 @@ namespace pipeann {
       _location_to_tag[iter.second] = iter.first;
     }
 
-    for (_u64 old = _nd; old < _max_points; ++old) {
+#pragma omp parallel for schedule(static)
+    for (_s64 old = _nd; old < (_s64) _max_points; ++old) {
       _final_graph[old].clear();
     }
     _delete_set.clear();
@@ -1804,6 +2010,13 @@ namespace pipeann {
     }
 
     assert(_final_graph[location].size() <= range);
+    if (_consolidate_active) {
+      // The new list may link to nodes an incremental sweep is removing.
+      std::lock_guard<std::mutex> guard(_consolidate_lock);
+      if (_consolidate_active && (_u64) location < _consolidate_cursor) {
+        _consolidate_revisit.push_back(location);
+      }
+    }
     inter_insert(location, pruned_list, parameters);
     return 0;
   }
@@ -0,0 +1,91 @@
+#include "index_runtime.h"
+
+#include <cstring>
+
+#include "emulated_aligned_file_reader.h"
+#include "log.h"
+#include "observability.h"
+#include "ssd_index.h"
+
+namespace pipeann {
+  template<typename T>
+  IndexRuntime<T>::IndexRuntime(uint32_t num_threads, uint64_t max_dim, uint32_t n_write_back_threads)
+      : aligned_dim(ROUND_UP(max_dim, 8)) {
+    uint64_t n_buffers = (uint64_t) num_threads * 2;
+    for (uint64_t i = 0; i < n_buffers; ++i) {
+      QueryBuffer<T> *buf = new QueryBuffer<T>();
+      SSDIndex<T>::init_query_buf(*buf, aligned_dim);
+      bufs.push_back(buf);
+      free_bufs.push(buf);
+    }
+    for (uint32_t i = 0; i < n_write_back_threads; ++i) {
+      write_back_threads.emplace_back(&IndexRuntime<T>::write_back_thread, this);
+    }
+    LOG(INFO) << "Index runtime: " << n_buffers << " query buffers for dim <= " << aligned_dim << ", "
+              << n_write_back_threads << " write-back threads.";
+  }
+
+  template<typename T>
+  IndexRuntime<T>::~IndexRuntime() {
+    stopping.store(true);
+    write_backs.push_notify_all();
+    for (auto &t : write_back_threads) {
+      t.join();
+    }
+    for (auto buf : bufs) {
+      SSDIndex<T>::free_query_buf(*buf);
+      delete buf;
+    }
+  }
+
+  template<typename T>
+  std::shared_ptr<AlignedFileReader> &IndexRuntime<T>::new_reader() {
+    std::lock_guard<std::mutex> lk(readers_lock);
+    readers.emplace_back(new_aligned_file_reader());
+    return readers.back();
+  }
+
+  template<typename T>
+  void IndexRuntime<T>::fit_query_buf(QueryBuffer<T> *buf, uint64_t data_dim, uint64_t tenant_aligned_dim) {
+    if (likely(buf->padded_dim == data_dim)) {
+      return;
+    }
+    // search writes only the first data_dim entries of each aligned_dim slot, so the padding stays zero
+    // until a tenant with another layout takes the buffer.
+    uint64_t pad = tenant_aligned_dim - data_dim;
+    if (pad != 0) {
+      memset(buf->aligned_query_T + data_dim, 0, pad * sizeof(T));
+      for (uint64_t i = 0; i < MAX_N_CMPS; ++i) {
+        memset(buf->coord_scratch + i * tenant_aligned_dim + data_dim, 0, pad * sizeof(T));
+      }
+    }
+    buf->padded_dim = data_dim;
+  }
+
+  template<typename T>
+  void IndexRuntime<T>::write_back(std::function<void()> fn) {
+    write_backs.push(new std::function<void()>(std::move(fn)));
+    write_backs.push_notify_one();
+  }
+
+  template<typename T>
+  void IndexRuntime<T>::write_back_thread() {
+    pipeann::set_io_context(pipeann::IoContext::INSERT);
+    while (true) {
+      auto fn = write_backs.pop();
+      while (fn == nullptr) {
+        if (stopping.load()) {
+          return;  // queue drained.
+        }
+        write_backs.wait_for_push_notify();
+        fn = write_backs.pop();
+      }
+      (*fn)();
+      delete fn;
+    }
+  }
+
+  template class IndexRuntime<float>;
+  template class IndexRuntime<_s8>;
+  template class IndexRuntime<_u8>;
+}  // namespace pipeann
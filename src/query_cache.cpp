@@ -0,0 +1,220 @@
+#include "query_cache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <random>
+
+#include "log.h"
+#include "utils.h"
+
+namespace pipeann {
+  namespace {
+    // a bucket past this many entries drops its oldest; bounds the near-duplicate scan.
+    constexpr size_t kMaxBucketEntries = 16;
+  }  // namespace
+
+  template<typename T, typename TagT>
+  QueryCache<T, TagT>::QueryCache(uint64_t dim, const QueryCacheParams &params) : dim(dim), params_(params) {
+    params_.n_shards = std::max(params_.n_shards, 1u);
+    params_.lsh_bits = std::min(std::max(params_.lsh_bits, 1u), 64u);
+    shard_capacity = std::max<uint64_t>(params_.capacity / params_.n_shards, 1);
+    shards.reset(new Shard[params_.n_shards]);
+    if (params_.near_dist > 0) {
+      std::mt19937_64 gen(params_.seed);
+      std::normal_distribution<float> normal(0, 1);
+      hyperplanes.resize(params_.lsh_bits * dim);
+      for (auto &v : hyperplanes) {
+        v = normal(gen);
+      }
+    }
+    LOG(INFO) << "Query cache: " << params_.capacity << " entries, TTL " << params_.ttl_us << "us, near dist "
+              << params_.near_dist << " (" << (params_.near_dist > 0 ? params_.lsh_bits : 0)
+              << " LSH bits), max epoch lag " << params_.max_epoch_lag;
+  }
+
+  template<typename T, typename TagT>
+  uint64_t QueryCache<T, TagT>::hash(const T *query, uint64_t k, uint64_t l_search) const {
+    // FNV-1a over the query bytes, then k and L.
+    uint64_t h = 0xcbf29ce484222325ull;
+    const uint8_t *p = (const uint8_t *) query;
+    for (uint64_t i = 0; i < dim * sizeof(T); ++i) {
+      h = (h ^ p[i]) * 0x100000001b3ull;
+    }
+    h = (h ^ k) * 0x100000001b3ull;
+    return (h ^ l_search) * 0x100000001b3ull;
+  }
+
+  template<typename T, typename TagT>
+  uint64_t QueryCache<T, TagT>::signature(const T *query) const {
+    uint64_t sig = 0;
+    for (uint32_t b = 0; b < params_.lsh_bits; ++b) {
+      const float *plane = hyperplanes.data() + b * dim;
+      float dot = 0;
+      for (uint64_t d = 0; d < dim; ++d) {
+        dot += plane[d] * (float) query[d];
+      }
+      sig |= (uint64_t) (dot >= 0) << b;
+    }
+    return sig;
+  }
+
+  template<typename T, typename TagT>
+  bool QueryCache<T, TagT>::fresh(const Entry &e, uint64_t epoch, std::chrono::steady_clock::time_point now) {
+    if (epoch > e.epoch + params_.max_epoch_lag) {
+      n_stale.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    if (params_.ttl_us != 0 &&
+        (uint64_t) std::chrono::duration_cast<std::chrono::microseconds>(now - e.inserted).count() > params_.ttl_us) {
+      n_expired.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    return true;
+  }
+
+  template<typename T, typename TagT>
+  void QueryCache<T, TagT>::erase(Shard &s, EntryIter it) {
+    s.exact.erase(it->hash);
+    if (params_.near_dist > 0) {
+      auto b = s.buckets.find(it->sig);
+      if (b != s.buckets.end()) {
+        b->second.erase(std::remove(b->second.begin(), b->second.end(), it), b->second.end());
+        if (b->second.empty()) {
+          s.buckets.erase(b);
+        }
+      }
+    }
+    s.lru.erase(it);
+  }
+
+  template<typename T, typename TagT>
+  bool QueryCache<T, TagT>::lookup(const T *query, uint64_t k, uint64_t l_search, uint64_t epoch,
+                                   std::vector<TagT> &tags, std::vector<float> &dists) {
+    const bool near = params_.near_dist > 0;
+    const uint64_t h = hash(query, k, l_search), sig = near ? signature(query) : 0;
+    Shard &s = shards[(near ? sig : h) % params_.n_shards];
+    const auto now = std::chrono::steady_clock::now();
+
+    std::lock_guard<std::mutex> lk(s.lock);
+    EntryIter hit = s.lru.end();
+    auto ex = s.exact.find(h);
+    if (ex != s.exact.end()) {
+      const Entry &e = *ex->second;
+      if (e.k == k && e.l_search == l_search && memcmp(e.query.data(), query, dim * sizeof(T)) == 0) {
+        if (fresh(e, epoch, now)) {
+          hit = ex->second;
+          n_exact_hits.fetch_add(1, std::memory_order_relaxed);
+        } else {
+          erase(s, ex->second);
+        }
+      }
+    }
+    if (hit == s.lru.end() && near) {
+      auto b = s.buckets.find(sig);
+      if (b != s.buckets.end()) {
+        float best = params_.near_dist;
+        std::vector<EntryIter> dropped;
+        for (EntryIter it : b->second) {
+          if (it->k != k || it->l_search != l_search) {
+            continue;
+          }
+          if (!fresh(*it, epoch, now)) {
+            dropped.push_back(it);
+            continue;
+          }
+          float dist = 0;
+          for (uint64_t d = 0; d < dim; ++d) {
+            float diff = (float) query[d] - (float) it->query[d];
+            dist += diff * diff;
+          }
+          if (dist <= best) {
+            best = dist;
+            hit = it;
+          }
+        }
+        for (EntryIter it : dropped) {
+          erase(s, it);  // may drop the bucket, which is not used past this point.
+        }
+        if (hit != s.lru.end()) {
+          n_near_hits.fetch_add(1, std::memory_order_relaxed);
+        }
+      }
+    }
+    if (hit == s.lru.end()) {
+      n_misses.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    s.lru.splice(s.lru.begin(), s.lru, hit);
+    tags = hit->tags;
+    dists = hit->dists;
+    return true;
+  }
+
+  template<typename T, typename TagT>
+  void QueryCache<T, TagT>::insert(const T *query, uint64_t k, uint64_t l_search, uint64_t epoch, const TagT *tags,
+                                   const float *dists, uint64_t n) {
+    const bool near = params_.near_dist > 0;
+    Entry e;
+    e.hash = hash(query, k, l_search);
+    e.sig = near ? signature(query) : 0;
+    e.k = k;
+    e.l_search = l_search;
+    e.epoch = epoch;
+    e.inserted = std::chrono::steady_clock::now();
+    e.query.assign(query, query + dim);
+    e.tags.assign(tags, tags + n);
+    e.dists.assign(dists, dists + n);
+    Shard &s = shards[(near ? e.sig : e.hash) % params_.n_shards];
+
+    std::lock_guard<std::mutex> lk(s.lock);
+    auto ex = s.exact.find(e.hash);
+    if (ex != s.exact.end()) {
+      erase(s, ex->second);  // the same query (or a colliding one) is replaced.
+    }
+    s.lru.push_front(std::move(e));
+    EntryIter it = s.lru.begin();
+    s.exact[it->hash] = it;
+    if (near) {
+      auto &bucket = s.buckets[it->sig];
+      bucket.push_back(it);
+      if (bucket.size() > kMaxBucketEntries) {
+        erase(s, bucket.front());
+        n_evictions.fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+    while (s.lru.size() > shard_capacity) {
+      erase(s, std::prev(s.lru.end()));
+      n_evictions.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  template<typename T, typename TagT>
+  void QueryCache<T, TagT>::clear() {
+    for (uint32_t i = 0; i < params_.n_shards; ++i) {
+      std::lock_guard<std::mutex> lk(shards[i].lock);
+      shards[i].lru.clear();
+      shards[i].exact.clear();
+      shards[i].buckets.clear();
+    }
+  }
+
+  template<typename T, typename TagT>
+  QueryCacheStats QueryCache<T, TagT>::stats() const {
+    QueryCacheStats st;
+    st.exact_hits = n_exact_hits.load();
+    st.near_hits = n_near_hits.load();
+    st.misses = n_misses.load();
+    st.expired = n_expired.load();
+    st.stale = n_stale.load();
+    st.evictions = n_evictions.load();
+    for (uint32_t i = 0; i < params_.n_shards; ++i) {
+      std::lock_guard<std::mutex> lk(shards[i].lock);
+      st.entries += shards[i].lru.size();
+    }
+    return st;
+  }
+
+  template class QueryCache<float>;
+  template class QueryCache<_s8>;
+  template class QueryCache<_u8>;
+}  // namespace pipeann
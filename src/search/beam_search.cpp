@@ -1,7 +1,10 @@
 #include "aligned_file_reader.h"
 #include "libcuckoo/cuckoohash_map.hh"
 #include "observability.h"
+#include "page_trace.h"
+#include "query_trace.h"
 #include "ssd_index.h"
+#include "telemetry.h"
 #include <malloc.h>
 #include <algorithm>
 #include <filesystem>
@@ -23,16 +26,14 @@
 
 namespace pipeann {
   template<typename T, typename TagT>
-  void SSDIndex<T, TagT>::do_beam_search(const T *query1, uint32_t mem_L, uint32_t l_search, const uint32_t beam_width,
+  void SSDIndex<T, TagT>::do_beam_search(const T *query1, uint32_t mem_L, uint32_t l_search, uint32_t beam_width,
                                          std::vector<Neighbor> &expanded_nodes_info,
                                          tsl::robin_map<uint32_t, T *> *coord_map, QueryStats *stats,
                                          tsl::robin_set<uint32_t> *exclude_nodes /* tags */, bool dyn_search_l,
-                                         std::vector<uint64_t> *passthrough_page_ref) {
+                                         std::vector<uint64_t> *passthrough_page_ref, const _u64 k_search) {
     pipeann::set_io_context(pipeann::IoContext::SEARCH);
     PIPANN_PROBE_QUERY_START(l_search);
-
-    std::cout << "[observability] -------> beam earch" << std::endl;
-
+    page_trace_query_begin();
 
     uint32_t original_l_search = l_search;
     auto diskSearchBegin = std::chrono::high_resolution_clock::now();
@@ -55,8 +56,10 @@ namespace pipeann {
     _u64 &sector_scratch_idx = query_buf->sector_idx;
 
     // query <-> PQ chunk centers distances
+    PhaseTimer phases;
     float *pq_dists = query_buf->aligned_pqtable_dist_scratch;
     pq_table.populate_chunk_distances(query, pq_dists);
+    phases.mark(kPhasePqSetup);
 
     // query <-> neighbor list
     float *dist_scratch = query_buf->aligned_dist_scratch;
@@ -64,11 +67,11 @@ namespace pipeann {
 
     // lambda to batch compute query<-> node distances in PQ space
     auto compute_dists = [this, pq_coord_scratch, pq_dists](const unsigned *ids, const _u64 n_ids, float *dists_out) {
-      ::aggregate_coords(ids, n_ids, this->data.data(), this->n_chunks, pq_coord_scratch);
+      this->aggregate_pq_codes(ids, n_ids, pq_coord_scratch);
       ::pq_dist_lookup(pq_coord_scratch, n_ids, this->n_chunks, pq_dists, dists_out);
     };
 
-    Timer query_timer, io_timer, cpu_timer;
+    Timer query_timer;
     std::vector<Neighbor> retset;
     retset.resize(mem_L + 10 * l_search);
     tsl::robin_set<_u64> visited(4096);
@@ -81,6 +84,7 @@ namespace pipeann {
     unsigned cur_list_size = 0;
     auto compute_and_add_to_retset = [&](const unsigned *node_ids, const _u64 n_ids) {
       compute_dists(node_ids, n_ids, dist_scratch);
+      phases.mark(kPhasePqScore);
       for (_u64 i = 0; i < n_ids; ++i) {
         retset[cur_list_size].id = node_ids[i];
         retset[cur_list_size].distance = dist_scratch[i];
@@ -89,10 +93,12 @@ namespace pipeann {
       }
     };
 
+    phases.skip();
     if (mem_L) {
       std::vector<unsigned> mem_tags(mem_L);
       std::vector<float> mem_dists(mem_L);
       mem_index_->search_with_tags(query, mem_L, mem_L, mem_tags.data(), mem_dists.data());
+      phases.mark(kPhaseHead);
       compute_and_add_to_retset(mem_tags.data(), std::min((unsigned) mem_L, (unsigned) l_search));
     } else {
       // Do not use optimized start point.
@@ -100,6 +106,14 @@ namespace pipeann {
     }
 
     std::sort(retset.begin(), retset.begin() + cur_list_size);
+    if (k_search != 0 && adaptive_budget_ != nullptr) {
+      _u64 budget_l = l_search, budget_w = beam_width;
+      adaptive_budget_->apply(retset.data(), cur_list_size, k_search, budget_l, budget_w);
+      l_search = original_l_search = (uint32_t) budget_l;
+      beam_width = (uint32_t) std::min<_u64>(budget_w, MAX_N_SECTOR_READS);
+      cur_list_size = std::min(cur_list_size, l_search);
+    }
+    phases.mark(kPhasePool);
 
     unsigned cmps = 0;
     unsigned hops = 0;
@@ -111,11 +125,19 @@ namespace pipeann {
     using fnhood_t = std::tuple<unsigned, unsigned, char *>;
     std::vector<fnhood_t> frontier_nhoods;
     std::vector<IORequest> frontier_read_reqs;
+    std::vector<IORequest> attached_reqs;  // reads of other queries this one waits for.
     std::vector<uint32_t> vec_rdlocks;
 
     std::vector<uint64_t> new_page_ref{};
     std::vector<uint64_t> &page_ref = passthrough_page_ref ? *passthrough_page_ref : new_page_ref;
 
+    RefinePool dropped;
+    dropped.reset(k_search != 0 && refine_codes_ != nullptr ? refine_r_ : 0);
+    EarlyStop early_stop;
+    if (k_search != 0) {
+      early_stop.init(early_stop_model_.get(), early_stop_trace_, k_search);
+    }
+
     while (k < cur_list_size) {
       auto nk = cur_list_size;
       // clear iteration state
@@ -136,6 +158,7 @@ namespace pipeann {
         }
         marker++;
       }
+      phases.mark(kPhasePool);
 
       // read nhoods of frontier ids
       std::vector<uint32_t> locked;
@@ -143,11 +166,14 @@ namespace pipeann {
         if (stats != nullptr)
           stats->n_hops++;
         locked = this->lock_idx(idx_lock_table, kInvalidID, frontier, true);
+        phases.mark(kPhaseLock);
         for (_u64 i = 0; i < frontier.size(); i++) {
           uint32_t id = frontier[i];
           uint32_t loc = this->id2loc(id);
           uint32_t page_id = loc_sector_no(loc);
           PIPANN_PROBE_EXPAND_NODE(id, page_id);
+          trace_event(kTrExpand, id, page_id);
+          page_trace_read(page_id, hops);
           uint64_t offset = page_id * SECTOR_LEN;
           auto sector_buf = sector_scratch + sector_scratch_idx * size_per_io;
           fnhood_t fnhood = std::make_tuple(id, loc, sector_buf);
@@ -160,17 +186,28 @@ namespace pipeann {
           }
           num_ios++;
         }
-        io_timer.reset();
+        serve_pinned(frontier_read_reqs, stats);
+        coalesce_reads(frontier_read_reqs, attached_reqs, stats);
+        trace_ios(kTrIoSubmit, frontier_read_reqs);
+        phases.mark(kPhaseSubmit);
+        // synchronous: cache lookups and submission are charged to the wait.
+        if (!frontier_read_reqs.empty()) {
 #ifdef DIRECT_READ_CC
-        reader->read(frontier_read_reqs, ctx);
+          reader->read(frontier_read_reqs, ctx);
 #else
-        reader->read_alloc(frontier_read_reqs, ctx, &page_ref);
+          reader->read_alloc(frontier_read_reqs, ctx, &page_ref);
 #endif
-
-        if (stats != nullptr) {
-          stats->io_us += (double) io_timer.elapsed();
         }
+        for (auto &req : frontier_read_reqs) {
+          publish_read(req);  // before waiting: other queries may wait for ours.
+        }
+        trace_ios(kTrIoComplete, frontier_read_reqs);
+        phases.mark(kPhaseWait);
         this->unlock_idx(idx_lock_table, locked);
+        phases.mark(kPhaseLock);
+        // unlocked first: the leaders may be waiting for a writer that waits for our locks.
+        wait_attached(attached_reqs);
+        phases.mark(kPhaseWait);
       }
 
       for (auto &frontier_nhood : frontier_nhoods) {
@@ -190,18 +227,21 @@ namespace pipeann {
           coord_map->insert(std::make_pair(id, node_fp_coords_copy));
         }
         full_retset.push_back(Neighbor(id, cur_expanded_dist, true));
+        phases.mark(kPhaseExact);
 
         unsigned *node_nbrs = (node_buf + 1);
 
         // compute node_nbrs <-> query dist in PQ space
-        cpu_timer.reset();
-        compute_dists(node_nbrs, nnbrs, dist_scratch);
+        if (inline_pq_chunks != 0) {
+          ::pq_dist_lookup(offset_to_node_nbr_codes(node_disk_buf), nnbrs, n_chunks, pq_dists, dist_scratch);
+        } else {
+          compute_dists(node_nbrs, nnbrs, dist_scratch);
+        }
         if (stats != nullptr) {
           stats->n_cmps += (double) nnbrs;
-          stats->cpu_us += (double) cpu_timer.elapsed();
         }
+        phases.mark(kPhasePqScore);
 
-        cpu_timer.reset();
         // process prefetch-ed nhood
         for (_u64 m = 0; m < nnbrs; ++m) {
           unsigned id = node_nbrs[m];
@@ -218,8 +258,13 @@ namespace pipeann {
             if (stats != nullptr) {
               stats->n_cmps++;
             }
-            if (dist >= retset[cur_list_size - 1].distance && (cur_list_size == l_search))
+            if (dist >= retset[cur_list_size - 1].distance && (cur_list_size == l_search)) {
+              dropped.offer(Neighbor(id, dist, true));
               continue;
+            }
+            if (cur_list_size == l_search && retset[cur_list_size - 1].flag) {
+              dropped.offer(retset[cur_list_size - 1]);  // pushed out unexpanded.
+            }
             Neighbor nn(id, dist, true);
             // variable search_L for deleted nodes.
             // Return position in sorted list where nn inserted.
@@ -256,10 +301,7 @@ namespace pipeann {
           // cur is the stopped index (cur + 1 is the length it should be)
           l_search = std::max(original_l_search, cur + 1);
         }
-
-        if (stats != nullptr) {
-          stats->cpu_us += (double) cpu_timer.elapsed();
-        }
+        phases.mark(kPhasePool);
       }
 
       // update best inserted position
@@ -269,8 +311,18 @@ namespace pipeann {
         k = nk;  // k is the best position in retset updated in this round.
       else
         ++k;
+      trace_candidates(retset.data(), cur_list_size);
 
       hops++;
+      if (early_stop.enabled()) {
+        unsigned first = 0;
+        while (first < cur_list_size && !retset[first].flag) {
+          ++first;
+        }
+        if (early_stop.after_hop(retset.data(), cur_list_size, first, full_retset)) {
+          break;
+        }
+      }
       if (stats != nullptr && stats->n_current_used != 0) {
         auto diskSearchEnd = std::chrono::high_resolution_clock::now();
         double elapsedSeconds =
@@ -279,9 +331,13 @@ namespace pipeann {
           break;
       }
     }
+    if (k_search != 0 && refine_codes_ != nullptr) {
+      refine_candidates(query, retset.data(), cur_list_size, dropped, full_retset, query_buf, ctx, stats, phases);
+    }
     // re-sort by distance
     std::sort(full_retset.begin(), full_retset.end(),
               [](const Neighbor &left, const Neighbor &right) { return left < right; });
+    phases.mark(kPhasePool);
 
     if (passthrough_page_ref == nullptr) {
       reader->deref(&page_ref, ctx);
@@ -290,11 +346,12 @@ namespace pipeann {
     PIPANN_PROBE_QUERY_DONE(
         (uint64_t) query_timer.elapsed(),
         stats != nullptr ? (uint64_t) stats->n_ios : 0,
-        0);
+        stats != nullptr ? (uint64_t) stats->n_hops : 0);
     push_query_buf(query_buf);
 
     if (stats != nullptr) {
       stats->total_us = (double) query_timer.elapsed();
+      phases.finish(stats);
     }
   }
 
@@ -302,17 +359,25 @@ namespace pipeann {
   size_t SSDIndex<T, TagT>::beam_search(const T *query, const _u64 k_search, const _u32 mem_L, const _u64 l_search,
                                         TagT *res_tags, float *distances, const _u64 beam_width, QueryStats *stats,
                                         tsl::robin_set<uint32_t> *deleted_nodes, bool dyn_search_l) {
+    uint64_t start_cycles = read_cycles();
+    QueryStats local_stats;
+    if (stats == nullptr) {
+      stats = &local_stats;
+    }
+    trace_query_begin(BEAM_SEARCH, (uint32_t) l_search, (uint32_t) beam_width);
     // iterate to fixed point
     std::shared_lock lk(merge_lock);
     std::vector<Neighbor> expanded_nodes_info;
     this->do_beam_search(query, mem_L, (_u32) l_search, (_u32) beam_width, expanded_nodes_info, nullptr, stats,
-                         deleted_nodes, dyn_search_l);
+                         deleted_nodes, dyn_search_l, nullptr, k_search);
     _u64 res_count = 0;
     for (uint32_t i = 0; i < l_search && res_count < k_search && i < expanded_nodes_info.size(); i++) {
       res_tags[res_count] = id2tag(expanded_nodes_info[i].id);
       distances[res_count] = expanded_nodes_info[i].distance;
       res_count++;
     }
+    trace_query_end(*stats);
+    telemetry_record_query(*stats, read_cycles() - start_cycles);
     return res_count;
   }
 
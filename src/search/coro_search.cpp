@@ -2,6 +2,7 @@
 #include "libcuckoo/cuckoohash_map.hh"
 #include "observability.h"
 #include "ssd_index.h"
+#include "telemetry.h"
 #include <malloc.h>
 #include <algorithm>
 #include <filesystem>
@@ -9,8 +10,11 @@
 #include <omp.h>
 #include <chrono>
 #include <cmath>
+#include <condition_variable>
 #include <cstdint>
+#include <deque>
 #include <limits>
+#include <thread>
 #include <tuple>
 #include "timer.h"
 #include "tsl/robin_map.h"
@@ -22,195 +26,372 @@
 #include <sys/syscall.h>
 #include "linux_aligned_file_reader.h"
 
+#if defined(PQ_FP16_TABLES) && !defined(__F16C__)
+#error "PQ_FP16_TABLES needs F16C (-mf16c)"
+#endif
+
 namespace pipeann {
   template<typename T, typename TagT>
-  size_t SSDIndex<T, TagT>::coro_search(T **queries, const _u64 k_search, const _u32 mem_L, const _u64 l_search,
-                                        TagT **res_tags, float **res_dists, const _u64 beam_width, int N) {
-    // beam search with intra-thread parallelism.
-    static constexpr int kMaxCoroPerThread = 8;
+  struct alignas(SECTOR_LEN) SSDIndex<T, TagT>::CoroQuery {
     static constexpr int kMaxVectorDim = 512;
-    struct alignas(SECTOR_LEN) CoroDataOne {
-      // buffer.
-      char sectors[SECTOR_LEN * 128];
-      T query[kMaxVectorDim];
-      _u8 pq_coord_scratch[32768 * 32];
-      float pq_dists[32768];
-      T data_buf[ROUND_UP(1024 * kMaxVectorDim, 256)];
-      float dist_scratch[512];
-      _u64 data_buf_idx;
-      _u64 sector_idx;
-
-      // search state.
-      std::vector<Neighbor> full_retset;
-      std::vector<Neighbor> retset;
-      tsl::robin_set<_u64> visited;
-
-      std::vector<unsigned> frontier;
-      using fnhood_t = std::tuple<unsigned, unsigned, char *>;
-      std::vector<fnhood_t> frontier_nhoods;
-      std::vector<IORequest> frontier_read_reqs;
-
-      SSDIndex<T> *parent;
-      unsigned cur_list_size, cmps, k;
-
-      // std::cout << "beamwidth to be optimized for each L value" << std::endl;
-
-
-      void compute_dists(const unsigned *ids, const _u64 n_ids, float *dists_out) {
-        ::aggregate_coords(ids, n_ids, parent->data.data(), parent->n_chunks, pq_coord_scratch);
-        ::pq_dist_lookup(pq_coord_scratch, n_ids, parent->n_chunks, pq_dists, dists_out);
-      };
+    static constexpr int kMaxCoroBatch = 8;  // queries per coro_search call.
+
+    // buffer.
+    char sectors[SECTOR_LEN * 128];
+    T query[kMaxVectorDim];
+    _u8 pq_coord_scratch[32768 * 32];
+#ifdef PQ_FP16_TABLES
+    uint16_t pq_dists[32768];  // divided by pq_scale.
+    float pq_scale;
+#else
+    float pq_dists[32768];
+#endif
+    T data_buf[ROUND_UP(1024 * kMaxVectorDim, 256)];
+    float dist_scratch[512];
+    _u64 data_buf_idx;
+    _u64 sector_idx;
+
+    // search state.
+    std::vector<Neighbor> full_retset;
+    std::vector<Neighbor> retset;
+    tsl::robin_set<_u64> visited;
+
+    std::vector<unsigned> frontier;
+    using fnhood_t = std::tuple<unsigned, unsigned, char *>;
+    std::vector<fnhood_t> frontier_nhoods;
+    std::vector<IORequest> frontier_read_reqs;
+    std::vector<IORequest> attached_reqs;  // reads of other queries this one waits for.
+    std::vector<IORequest *> leading;      // unpublished reads of frontier_read_reqs (see coalesce_read).
+    std::vector<uint32_t> locked;  // frontier ids read-locked while their reads are in flight.
+    bool lock_busy;                // a writer held a frontier id; the batch is issued on a later turn.
+
+    SSDIndex<T, TagT> *parent;
+    _u64 l_search, beam_width;  // this query's budget (see AdaptiveBudget).
+    unsigned cur_list_size, cmps, k;
+    unsigned n_ios, n_hops, n_coalesced, n_cache_hits;
+    PhaseTimer phases;  // this query's share of the thread's time.
+    EarlyStop early_stop;
+
+    void pq_lookup(const _u8 *codes, const _u64 n, float *dists_out) {
+#ifdef PQ_FP16_TABLES
+      ::pq_dist_lookup(codes, n, parent->n_chunks, pq_dists, pq_scale, dists_out);
+#else
+      ::pq_dist_lookup(codes, n, parent->n_chunks, pq_dists, dists_out);
+#endif
+    }
 
-      void print() {
-        LOG(INFO) << "Full retset size " << full_retset.size() << " retset size: " << retset.size()
-                  << " visited size: " << visited.size() << " frontier size: " << frontier.size()
-                  << " frontier nhood size: " << frontier_nhoods.size()
-                  << " frontier read reqs size: " << frontier_read_reqs.size();
-      }
+    void compute_dists(const unsigned *ids, const _u64 n_ids, float *dists_out) {
+      parent->aggregate_pq_codes(ids, n_ids, pq_coord_scratch);
+      pq_lookup(pq_coord_scratch, n_ids, dists_out);
+    };
+
+    void print() {
+      LOG(INFO) << "Full retset size " << full_retset.size() << " retset size: " << retset.size()
+                << " visited size: " << visited.size() << " frontier size: " << frontier.size()
+                << " frontier nhood size: " << frontier_nhoods.size()
+                << " frontier read reqs size: " << frontier_read_reqs.size();
+    }
+
+    void reset() {
+      data_buf_idx = 0;
+      sector_idx = 0;
+      visited.clear();  // does not deallocate memory.
+      retset.resize(4096);
+      retset.clear();
+      full_retset.clear();
+      cur_list_size = cmps = k = 0;
+      n_ios = n_hops = n_coalesced = n_cache_hits = 0;
+      lock_busy = false;
+      phases = PhaseTimer();
+    }
 
-      void reset() {
-        data_buf_idx = 0;
-        sector_idx = 0;
-        visited.clear();  // does not deallocate memory.
-        retset.resize(4096);
-        retset.clear();
-        full_retset.clear();
-        cur_list_size = cmps = k = 0;
+    void compute_and_add_to_retset(const unsigned *node_ids, const _u64 n_ids) {
+      compute_dists(node_ids, n_ids, dist_scratch);
+      phases.mark(kPhasePqScore);
+      for (_u64 i = 0; i < n_ids; ++i) {
+        auto &item = retset[cur_list_size];
+        item.id = node_ids[i];
+        item.distance = dist_scratch[i];
+        item.flag = true;
+        cur_list_size++;
+        visited.insert(node_ids[i]);
       }
+    };
 
-      void compute_and_add_to_retset(const unsigned *node_ids, const _u64 n_ids) {
-        compute_dists(node_ids, n_ids, dist_scratch);
-        for (_u64 i = 0; i < n_ids; ++i) {
-          auto &item = retset[cur_list_size];
-          item.id = node_ids[i];
-          item.distance = dist_scratch[i];
-          item.flag = true;
-          cur_list_size++;
-          visited.insert(node_ids[i]);
+    void issue_next_io_batch(const _u64 beam_width, void *ctx) {
+      if (search_ends()) {
+        return;
+      }
+      // clear iteration state
+      frontier.clear();
+      frontier_nhoods.clear();
+      frontier_read_reqs.clear();
+      sector_idx = 0;
+      lock_busy = false;
+
+      _u32 marker = k;
+      while (marker < cur_list_size && frontier.size() < beam_width) {
+        if (retset[marker].flag) {
+          frontier.push_back(retset[marker].id);
         }
-      };
-
-      void issue_next_io_batch(const _u64 beam_width, void *ctx) {
-        if (search_ends()) {
+        marker++;
+      }
+      phases.mark(kPhasePool);
+
+      // read nhoods of frontier ids
+      if (!frontier.empty()) {
+        // held until the reads finish, so never waited for: blocking here would stall every query of this
+        // thread, including those whose locks the writer waits for. Retried on the next turn instead.
+        lock_busy = !parent->try_rdlock_idx(parent->idx_lock_table, frontier, locked);
+        phases.mark(kPhaseLock);
+        if (lock_busy) {
+          frontier.clear();
           return;
         }
-        // clear iteration state
-        frontier.clear();
-        frontier_nhoods.clear();
-        frontier_read_reqs.clear();
-        sector_idx = 0;
-
-        _u32 marker = k;
-        _u32 num_seen = 0;
-        while (marker < cur_list_size && frontier.size() < beam_width && num_seen < beam_width) {
-          if (retset[marker].flag) {
-            num_seen++;
-            frontier.push_back(retset[marker].id);
-            retset[marker].flag = false;
+        for (_u32 i = k, n_taken = 0; n_taken < frontier.size(); ++i) {
+          if (retset[i].flag) {
+            retset[i].flag = false;
+            ++n_taken;
           }
-          marker++;
         }
-
-        // read nhoods of frontier ids
-        std::vector<uint32_t> locked;
-        if (!frontier.empty()) {
-          for (_u64 i = 0; i < frontier.size(); i++) {
-            uint32_t loc = frontier[i];
-            uint64_t offset = parent->loc_sector_no(loc) * SECTOR_LEN;
-            auto sector_buf = sectors + sector_idx * parent->size_per_io;
-            fnhood_t fnhood = std::make_tuple(loc, loc, sector_buf);
-            sector_idx++;
-            frontier_nhoods.push_back(fnhood);
-            frontier_read_reqs.emplace_back(IORequest(offset, parent->size_per_io, sector_buf, 0, 0));
-          }
+        n_hops++;
+        n_ios += frontier.size();
+        for (_u64 i = 0; i < frontier.size(); i++) {
+          uint32_t id = frontier[i];
+          uint32_t loc = parent->id2loc(id);
+          uint64_t offset = parent->loc_sector_no(loc) * SECTOR_LEN;
+          auto sector_buf = sectors + sector_idx * parent->size_per_io;
+          fnhood_t fnhood = std::make_tuple(id, loc, sector_buf);
+          sector_idx++;
+          frontier_nhoods.push_back(fnhood);
+          frontier_read_reqs.emplace_back(IORequest(offset, parent->size_per_io, sector_buf, 0, 0));
+        }
+        size_t n_pinned = parent->serve_pinned(frontier_read_reqs, nullptr);
+        n_ios -= n_pinned;
+        n_cache_hits += n_pinned;
+        size_t n_attached = parent->coalesce_reads(frontier_read_reqs, attached_reqs, nullptr);
+        n_ios -= n_attached;
+        n_coalesced += n_attached;
+        if (!frontier_read_reqs.empty()) {
           parent->reader->send_io(frontier_read_reqs, ctx, false);
         }
-      }
-
-      bool io_finished(void *ctx) {
-        parent->reader->poll(ctx);
-        for (auto &req : frontier_read_reqs) {
-          if (!req.finished) {
-            return false;
+        if (parent->inflight_reads_ != nullptr) {
+          for (auto &req : frontier_read_reqs) {
+            leading.push_back(&req);
           }
         }
-        return true;
+        phases.mark(kPhaseSubmit);
       }
+    }
 
-      void explore_frontier(uint64_t l_search) {
-        auto nk = cur_list_size;
-
-        for (auto &frontier_nhood : frontier_nhoods) {
-          auto [id, loc, sector_buf] = frontier_nhood;
-          char *node_disk_buf = parent->offset_to_loc(sector_buf, loc);
-          unsigned *node_buf = parent->offset_to_node_nhood(node_disk_buf);
-          _u64 nnbrs = (_u64) (*node_buf);
-          T *node_fp_coords = parent->offset_to_node_coords(node_disk_buf);
-
-          T *node_fp_coords_copy = data_buf + (data_buf_idx * parent->aligned_dim);
-          data_buf_idx++;
-          memcpy(node_fp_coords_copy, node_fp_coords, parent->data_dim * sizeof(T));
-          float cur_expanded_dist =
-              parent->dist_cmp->compare(query, node_fp_coords_copy, (unsigned) parent->aligned_dim);
+    bool io_finished(void *ctx) {
+      parent->reader->poll(ctx);
+      if (!leading.empty()) {
+        parent->publish_finished(leading);  // before waiting: other queries may wait for ours.
+      }
+      for (auto &req : frontier_read_reqs) {
+        if (!req.finished) {
+          return false;
+        }
+      }
+      for (auto &req : attached_reqs) {
+        if (!__atomic_load_n(&req.finished, __ATOMIC_ACQUIRE)) {
+          return false;
+        }
+      }
+      parent->unlock_idx(parent->idx_lock_table, locked);
+      locked.clear();
+      return true;
+    }
 
-          Neighbor n(id, cur_expanded_dist, true);
-          full_retset.push_back(n);
+    // ends the search if no unexpanded candidate is closer than bound (PQ distance).
+    void stop_if_beyond(float bound) {
+      for (unsigned i = k; i < cur_list_size; ++i) {
+        if (retset[i].flag) {
+          if (retset[i].distance > bound) {
+            k = cur_list_size;
+          }
+          return;
+        }
+      }
+    }
 
-          unsigned *node_nbrs = (node_buf + 1);
-          // compute node_nbrs <-> query dist in PQ space
+    void explore_frontier(uint64_t l_search) {
+      auto nk = cur_list_size;
+
+      for (auto &frontier_nhood : frontier_nhoods) {
+        auto [id, loc, sector_buf] = frontier_nhood;
+        char *node_disk_buf = parent->offset_to_loc(sector_buf, loc);
+        unsigned *node_buf = parent->offset_to_node_nhood(node_disk_buf);
+        _u64 nnbrs = (_u64) (*node_buf);
+        T *node_fp_coords = parent->offset_to_node_coords(node_disk_buf);
+
+        T *node_fp_coords_copy = data_buf + (data_buf_idx * parent->aligned_dim);
+        data_buf_idx++;
+        memcpy(node_fp_coords_copy, node_fp_coords, parent->data_dim * sizeof(T));
+        float cur_expanded_dist =
+            parent->dist_cmp->compare(query, node_fp_coords_copy, (unsigned) parent->aligned_dim);
+
+        Neighbor n(id, cur_expanded_dist, true);
+        full_retset.push_back(n);
+        phases.mark(kPhaseExact);
+
+        unsigned *node_nbrs = (node_buf + 1);
+        // compute node_nbrs <-> query dist in PQ space
+        if (parent->inline_pq_chunks != 0) {
+          pq_lookup(parent->offset_to_node_nbr_codes(node_disk_buf), nnbrs, dist_scratch);
+        } else {
           compute_dists(node_nbrs, nnbrs, dist_scratch);
+        }
+        phases.mark(kPhasePqScore);
 
-          // process prefetch-ed nhood
-          for (_u64 m = 0; m < nnbrs; ++m) {
-            unsigned id = node_nbrs[m];
-            if (visited.find(id) != visited.end()) {
+        // process prefetch-ed nhood
+        for (_u64 m = 0; m < nnbrs; ++m) {
+          unsigned id = node_nbrs[m];
+          if (visited.find(id) != visited.end()) {
+            continue;
+          } else {
+            visited.insert(id);
+            cmps++;
+            float dist = dist_scratch[m];
+            if (dist >= retset[cur_list_size - 1].distance && (cur_list_size == l_search))
               continue;
-            } else {
-              visited.insert(id);
-              cmps++;
-              float dist = dist_scratch[m];
-              if (dist >= retset[cur_list_size - 1].distance && (cur_list_size == l_search))
-                continue;
-              Neighbor nn(id, dist, true);
-              // variable search_L for deleted nodes.
-              // Return position in sorted list where nn inserted.
-
-              auto r = InsertIntoPool(retset.data(), cur_list_size, nn);
-
-              if (cur_list_size < l_search) {
-                ++cur_list_size;
-              }
+            Neighbor nn(id, dist, true);
+            // variable search_L for deleted nodes.
+            // Return position in sorted list where nn inserted.
+
+            auto r = InsertIntoPool(retset.data(), cur_list_size, nn);
 
-              if (r < nk)
-                nk = r;
+            if (cur_list_size < l_search) {
+              ++cur_list_size;
             }
+
+            if (r < nk)
+              nk = r;
           }
         }
+        phases.mark(kPhasePool);
+      }
 
-        if (nk <= k)
-          k = nk;  // k is the best position in retset updated in this round.
-        else
-          ++k;
+      if (nk <= k)
+        k = nk;  // k is the best position in retset updated in this round.
+      else
+        ++k;
+      if (early_stop.enabled()) {
+        unsigned first = 0;
+        while (first < cur_list_size && !retset[first].flag) {
+          ++first;
+        }
+        if (early_stop.after_hop(retset.data(), cur_list_size, first, full_retset)) {
+          k = cur_list_size;
+        }
       }
+    }
 
-      bool search_ends() {
-        // this->print();
-        return k >= cur_list_size;
+    // builds the PQ distance tables of queries[0..n) into their slots in one batch.
+    static void populate_pq_dists(SSDIndex<T, TagT> *parent, const T *const *queries, CoroQuery *slots, int n) {
+#ifdef PQ_FP16_TABLES
+      uint16_t *tables[kMaxCoroBatch] = {};
+      float scales[kMaxCoroBatch];
+#else
+      float *tables[kMaxCoroBatch] = {};
+#endif
+      for (int v = 0; v < n; ++v) {
+        tables[v] = slots[v].pq_dists;
       }
-    };
+#ifdef PQ_FP16_TABLES
+      parent->pq_table.populate_chunk_distances_batch_fp16(queries, n, tables, scales);
+      for (int v = 0; v < n; ++v) {
+        slots[v].pq_scale = scales[v];
+      }
+#else
+      parent->pq_table.populate_chunk_distances_batch(queries, n, tables);
+#endif
+    }
 
-    struct alignas(4096) CoroData {
-      CoroDataOne data[kMaxCoroPerThread];
-      CoroData(SSDIndex<T> *parent) {
-        for (int i = 0; i < kMaxCoroPerThread; ++i) {
-          data[i].parent = parent;
-        }
+    // resets the state and seeds retset from the in-memory index (mem_L > 0) or the medoid. pq_ready: the PQ
+    // distance tables were built by populate_pq_dists.
+    void init(const T *q, const _u32 mem_L, const _u64 l_search, const _u64 beam_width, const _u64 k_search,
+              bool pq_ready = false) {
+      memcpy(query, q, parent->data_dim * sizeof(T));
+      _mm_prefetch((char *) data_buf, _MM_HINT_T1);
+      reset();
+      early_stop.init(parent->early_stop_model_.get(), parent->early_stop_trace_, k_search);
+
+      // query <-> PQ chunk centers distances
+      if (!pq_ready) {
+#ifdef PQ_FP16_TABLES
+        populate_pq_dists(parent, &q, this, 1);
+#else
+        parent->pq_table.populate_chunk_distances(query, pq_dists);
+#endif
+      }
+      phases.mark(kPhasePqSetup);
+
+      if (mem_L) {
+        std::vector<unsigned> mem_tags(mem_L);
+        std::vector<float> mem_dists(mem_L);
+        parent->mem_index_->search_with_tags(query, mem_L, mem_L, mem_tags.data(), mem_dists.data());
+        phases.mark(kPhaseHead);
+        compute_and_add_to_retset(mem_tags.data(), std::min((unsigned) mem_L, (unsigned) l_search));
+      } else {
+        // Do not use optimized start point.
+        _u32 best_medoid = parent->medoids[0];
+        compute_and_add_to_retset(&best_medoid, 1);
       }
+      std::sort(retset.begin(), retset.begin() + cur_list_size);
+      this->l_search = l_search;
+      this->beam_width = beam_width;
+      if (parent->adaptive_budget_ != nullptr) {
+        parent->adaptive_budget_->apply(retset.data(), cur_list_size, k_search, this->l_search, this->beam_width);
+        this->beam_width = std::min<_u64>(this->beam_width, sizeof(sectors) / SECTOR_LEN);
+        cur_list_size = std::min<unsigned>(cur_list_size, this->l_search);
+      }
+      phases.mark(kPhasePool);
+    }
+
+    // re-sorts full_retset by distance and deduplicates it; returns the number of results to report.
+    _u64 finalize(const _u64 k_search) {
+      early_stop.finish();
+      std::sort(full_retset.begin(), full_retset.end(),
+                [](const Neighbor &left, const Neighbor &right) { return left < right; });
+      full_retset.erase(std::unique(full_retset.begin(), full_retset.end(),
+                                    [](const Neighbor &left, const Neighbor &right) { return left.id == right.id; }),
+                        full_retset.end());
+      return std::min(k_search, (_u64) full_retset.size());
+    }
+
+    // stats->total_us must be set.
+    void add_stats(QueryStats *stats) {
+      stats->n_ios += n_ios;
+      stats->n_4k += n_ios;
+      stats->n_hops += n_hops;
+      stats->n_cmps += cmps;
+      stats->n_coalesced += n_coalesced;
+      stats->n_cache_hits += n_cache_hits;
+      phases.finish(stats);
+    }
+
+    bool search_ends() {
+      // this->print();
+      return k >= cur_list_size;
+    }
+  };
+
+
+  template<typename T, typename TagT>
+  size_t SSDIndex<T, TagT>::coro_search(T **queries, const _u64 k_search, const _u32 mem_L, const _u64 l_search,
+                                        TagT **res_tags, float **res_dists, const _u64 beam_width, int N,
+                                        QueryStats *stats) {
+    // beam search with intra-thread parallelism.
+    static constexpr int kMaxCoroPerThread = CoroQuery::kMaxCoroBatch;
+    struct alignas(4096) CoroData {
+      CoroQuery data[kMaxCoroPerThread];
     };
 
     static __thread CoroData *data;
     if (unlikely(data == nullptr)) {
-      data = new CoroData(this);
+      data = new CoroData();
     }
 
     if (unlikely(N > kMaxCoroPerThread)) {
@@ -223,47 +404,28 @@ namespace pipeann {
     }
 
     pipeann::set_io_context(pipeann::IoContext::SEARCH);
+    uint64_t start_cycles = read_cycles();
+    Timer batch_timer;
 
     // do not use the thread data's buf.
     QueryBuffer<T> *thread_data = pop_query_buf(queries[0]);
     void *ctx = reader->get_ctx();
-    // lambda to batch compute query<-> node distances in PQ space
 
+    // one batched table build for all queries, charged to them evenly.
+    uint64_t pq_start = read_cycles();
+    CoroQuery::populate_pq_dists(this, queries, data->data, N);
+    uint64_t pq_cycles = (read_cycles() - pq_start) / N;
     for (int v = 0; v < N; ++v) {
-      auto &coro_data = data->data[v];
-      auto &query1 = queries[v];
-      memcpy(coro_data.query, query1, this->data_dim * sizeof(T));
-
-      auto &query = coro_data.query;
-
-      // pointers to buffers for data
-      T *data_buf = coro_data.data_buf;
-      _mm_prefetch((char *) data_buf, _MM_HINT_T1);
-
-      // query <-> PQ chunk centers distances
-      float *pq_dists = coro_data.pq_dists;
-      pq_table.populate_chunk_distances(query, pq_dists);
-
-      coro_data.reset();
-
-      _u32 best_medoid = medoids[0];
-
-      if (mem_L) {
-        std::vector<unsigned> mem_tags(mem_L);
-        std::vector<float> mem_dists(mem_L);
-        mem_index_->search_with_tags(query, mem_L, mem_L, mem_tags.data(), mem_dists.data());
-        coro_data.compute_and_add_to_retset(mem_tags.data(), std::min((unsigned) mem_L, (unsigned) l_search));
-      } else {
-        // Do not use optimized start point.
-        coro_data.compute_and_add_to_retset(&best_medoid, 1);
-      }
-      std::sort(coro_data.retset.begin(), coro_data.retset.begin() + coro_data.cur_list_size);
+      data->data[v].parent = this;  // the thread's slots are shared by all indexes it searches.
+      data->data[v].init(queries[v], mem_L, l_search, beam_width, k_search, true);
+      data->data[v].phases.add(kPhasePqSetup, pq_cycles);
     }
 
     // SEARCH!
     for (int i = 0; i < N; ++i) {
       auto &coro_data = data->data[i];
-      coro_data.issue_next_io_batch(beam_width, ctx);
+      coro_data.phases.skip();
+      coro_data.issue_next_io_batch(coro_data.beam_width, ctx);
     }
 
     bool all_finished = false;
@@ -273,39 +435,273 @@ namespace pipeann {
         auto &coro_data = data->data[i];
         if (!coro_data.search_ends()) {
           all_finished = false;
-          if (!coro_data.io_finished(ctx)) {
+          coro_data.phases.skip();
+          bool ready = coro_data.io_finished(ctx);
+          coro_data.phases.mark(kPhaseWait);
+          if (!ready) {
             continue;
           }
-          // LOG(INFO) << "Full retset size: " << coro_data.full_retset.size();
-          coro_data.explore_frontier(l_search);
-          coro_data.issue_next_io_batch(beam_width, ctx);
+          if (!coro_data.lock_busy) {
+            coro_data.explore_frontier(coro_data.l_search);
+          }
+          coro_data.issue_next_io_batch(coro_data.beam_width, ctx);
         }
       }
     }
 
     for (int v = 0; v < N; ++v) {
-      // re-sort by distance
       auto &full_retset = data->data[v].full_retset;
-      std::sort(full_retset.begin(), full_retset.end(),
-                [](const Neighbor &left, const Neighbor &right) { return left < right; });
-
-      _u64 t = 0;
-      for (_u64 i = 0; i < full_retset.size() && t < k_search; i++) {
-        if (i > 0 && full_retset[i].id == full_retset[i - 1].id) {
-          continue;  // deduplicate.
-        }
-        res_tags[v][t] = full_retset[i].id;  // use ID to replace tags
+      _u64 n_res = data->data[v].finalize(k_search);
+      for (_u64 t = 0; t < n_res; t++) {
+        res_tags[v][t] = full_retset[t].id;  // use ID to replace tags
         if (res_dists[v] != nullptr) {
-          res_dists[v][t] = full_retset[i].distance;
+          res_dists[v][t] = full_retset[t].distance;
         }
-        t++;
       }
     }
 
     this->push_query_buf(thread_data);
+    if (stats != nullptr) {
+      // every query of the batch returns when the batch does.
+      double batch_us = (double) batch_timer.elapsed();
+      for (int v = 0; v < N; ++v) {
+        stats[v].total_us = batch_us;
+        data->data[v].add_stats(&stats[v]);
+      }
+    }
+    // count the batch and its thread time.
+    TelemetrySlot &slot = telemetry_slot();
+    slot.add(kTmQueries, N);
+    slot.add(kTmQueryCycles, read_cycles() - start_cycles);
+    return 0;
+  }
+
+  // Engine behind search_async. Each worker owns up to slots_per_worker CoroQuery slots and its own IO ring;
+  // unlike coro_search, which runs a fixed batch to completion, a worker admits a queued query as soon as a
+  // slot frees up, so the ring stays busy under a steady arrival rate.
+  template<typename T, typename TagT>
+  class SSDIndex<T, TagT>::AsyncEngine {
+   public:
+    struct Request {
+      std::vector<T> query;
+      AsyncSearchParams params;
+      AsyncSearchCallback<TagT> callback;
+      Timer timer;  // started at submission.
+    };
+
+    AsyncEngine(SSDIndex<T, TagT> *parent, uint32_t n_workers, uint32_t slots_per_worker)
+        : parent(parent), slots_per_worker(slots_per_worker) {
+      for (uint32_t i = 0; i < n_workers; ++i) {
+        workers.emplace_back([this]() { this->worker_loop(); });
+      }
+    }
+
+    // drains the queue before joining.
+    ~AsyncEngine() {
+      {
+        std::lock_guard<std::mutex> lk(lock);
+        stopping = true;
+      }
+      cv.notify_all();
+      for (auto &w : workers) {
+        w.join();
+      }
+    }
+
+    void submit(Request *req) {
+      {
+        std::lock_guard<std::mutex> lk(lock);
+        pending.push_back(req);
+        n_pending.fetch_add(1, std::memory_order_release);
+      }
+      cv.notify_one();
+    }
+
+   private:
+    void worker_loop() {
+      pipeann::set_io_context(pipeann::IoContext::SEARCH);
+      void *ctx = parent->reader->get_ctx();
+      std::vector<std::unique_ptr<CoroQuery>> slots(slots_per_worker);  // allocated on first use.
+      std::vector<Request *> active(slots_per_worker, nullptr);
+      uint32_t n_active = 0;
+      QueryBuffer<T> *thread_data = nullptr;  // held while busy, as coro_search does per batch.
+      uint64_t busy_cycles = 0;
+
+      while (true) {
+        // admit queued queries into free slots; sleep when idle.
+        if (n_active < slots_per_worker && (n_active == 0 || n_pending.load(std::memory_order_acquire) > 0)) {
+          std::vector<std::pair<uint32_t, Request *>> admitted;
+          {
+            std::unique_lock<std::mutex> lk(lock);
+            if (n_active == 0 && pending.empty()) {
+              if (thread_data != nullptr) {
+                parent->push_query_buf(thread_data);
+                thread_data = nullptr;
+                telemetry_slot().add(kTmQueryCycles, read_cycles() - busy_cycles);
+              }
+              cv.wait(lk, [this]() { return stopping || !pending.empty(); });
+              if (pending.empty()) {
+                break;  // stopping, and nothing left to drain.
+              }
+            }
+            for (uint32_t i = 0; i < slots_per_worker && !pending.empty(); ++i) {
+              if (active[i] == nullptr) {
+                admitted.emplace_back(i, pending.front());
+                pending.pop_front();
+                n_pending.fetch_sub(1, std::memory_order_relaxed);
+              }
+            }
+          }
+          if (thread_data == nullptr && !admitted.empty()) {
+            thread_data = parent->pop_query_buf(nullptr);
+            busy_cycles = read_cycles();
+          }
+          for (auto &[i, req] : admitted) {
+            if (slots[i] == nullptr) {
+              slots[i].reset(new CoroQuery());
+              slots[i]->parent = parent;
+            }
+            CoroQuery &q = *slots[i];
+            q.init(req->query.data(), req->params.mem_L, req->params.l_search, req->params.beam_width,
+                   req->params.k_search);
+            q.issue_next_io_batch(q.beam_width, ctx);
+            active[i] = req;
+            n_active++;
+          }
+        }
+
+        for (uint32_t i = 0; i < slots_per_worker; ++i) {
+          Request *req = active[i];
+          if (req == nullptr) {
+            continue;
+          }
+          CoroQuery &q = *slots[i];
+          if (!q.search_ends()) {
+            q.phases.skip();
+            bool ready = q.io_finished(ctx);
+            q.phases.mark(kPhaseWait);
+            if (!ready) {
+              continue;
+            }
+            if (!q.lock_busy) {
+              q.explore_frontier(q.l_search);
+              if (req->params.stop_dist != nullptr && q.n_hops >= req->params.stop_min_hops) {
+                q.stop_if_beyond(req->params.stop_dist->load(std::memory_order_relaxed));
+              }
+            }
+            q.issue_next_io_batch(q.beam_width, ctx);
+            if (!q.search_ends()) {
+              continue;
+            }
+          }
+          complete(q, req);
+          active[i] = nullptr;
+          n_active--;
+        }
+      }
+    }
+
+    void complete(CoroQuery &q, Request *req) {
+      AsyncSearchResult<TagT> res;
+      _u64 n_res = q.finalize(req->params.k_search);
+      res.tags.resize(n_res);
+      res.dists.resize(n_res);
+      for (_u64 t = 0; t < n_res; ++t) {
+        res.tags[t] = parent->id2tag(q.full_retset[t].id);
+        res.dists[t] = q.full_retset[t].distance;
+      }
+      res.stats.total_us = (double) req->timer.elapsed();
+      q.add_stats(&res.stats);
+      telemetry_slot().add(kTmQueries, 1);
+      req->callback(std::move(res));
+      delete req;
+    }
+
+    SSDIndex<T, TagT> *parent;
+    uint32_t slots_per_worker;
+    std::vector<std::thread> workers;
+
+    std::mutex lock;  // guards pending and stopping.
+    std::condition_variable cv;
+    std::deque<Request *> pending;
+    std::atomic<uint64_t> n_pending{0};  // lets busy workers skip the lock when nothing is queued.
+    bool stopping = false;
+  };
+
+  template<typename T, typename TagT>
+  int SSDIndex<T, TagT>::start_async_engine(uint32_t n_workers, uint32_t queries_per_worker) {
+    std::lock_guard<std::mutex> lk(async_engine_lock_);
+    if (async_engine_ != nullptr) {
+      LOG(ERROR) << "Async search engine already running";
+      return -1;
+    }
+    n_workers = std::max(n_workers, 1u);
+    queries_per_worker = std::max(queries_per_worker, 1u);
+    LOG(INFO) << "Async search engine: " << n_workers << " workers, " << queries_per_worker << " queries per worker.";
+    async_engine_ = new AsyncEngine(this, n_workers, queries_per_worker);
     return 0;
   }
 
+  template<typename T, typename TagT>
+  void SSDIndex<T, TagT>::stop_async_engine() {
+    std::lock_guard<std::mutex> lk(async_engine_lock_);
+    delete async_engine_;
+    async_engine_ = nullptr;
+  }
+
+  template<typename T, typename TagT>
+  void SSDIndex<T, TagT>::search_async(const T *query, const AsyncSearchParams &params,
+                                       AsyncSearchCallback<TagT> callback) {
+    if (unlikely(this->data_dim > CoroQuery::kMaxVectorDim)) {
+      LOG(ERROR) << "data_dim " << this->data_dim << " > " << CoroQuery::kMaxVectorDim;
+      exit(-1);
+    }
+    std::shared_ptr<QueryCache<T, TagT>> cache = std::atomic_load(&query_cache_);
+    if (cache != nullptr && params.stop_dist == nullptr) {
+      const uint64_t epoch = update_epoch();
+      AsyncSearchResult<TagT> res;
+      if (cache->lookup(query, params.k_search, params.l_search, epoch, res.tags, res.dists)) {
+        callback(std::move(res));
+        return;
+      }
+      std::vector<T> key(query, query + this->data_dim);
+      callback = [cache, key = std::move(key), params, epoch, cb = std::move(callback)](AsyncSearchResult<TagT> &&r) {
+        cache->insert(key.data(), params.k_search, params.l_search, epoch, r.tags.data(), r.dists.data(),
+                      r.tags.size());
+        cb(std::move(r));
+      };
+    }
+
+    auto req = new typename AsyncEngine::Request();
+    req->query.assign(query, query + this->data_dim);
+    if (data_is_normalized) {
+      // Data has been normalized. Normalize search vector too.
+      float norm = pipeann::compute_l2_norm(query, this->data_dim);
+      for (uint32_t i = 0; i < this->data_dim; i++) {
+        req->query[i] = query[i] / norm;
+      }
+    }
+    req->params = params;
+    req->params.l_search = std::max(params.l_search, params.k_search);
+    req->callback = std::move(callback);
+
+    std::lock_guard<std::mutex> lk(async_engine_lock_);
+    if (async_engine_ == nullptr) {
+      uint32_t n_workers = std::min((uint32_t) max_nthreads, std::max(std::thread::hardware_concurrency(), 1u));
+      async_engine_ = new AsyncEngine(this, n_workers, 8);
+    }
+    async_engine_->submit(req);
+  }
+
+  template<typename T, typename TagT>
+  std::future<AsyncSearchResult<TagT>> SSDIndex<T, TagT>::search_async(const T *query,
+                                                                       const AsyncSearchParams &params) {
+    auto promise = std::make_shared<std::promise<AsyncSearchResult<TagT>>>();
+    auto future = promise->get_future();
+    search_async(query, params, [promise](AsyncSearchResult<TagT> &&res) { promise->set_value(std::move(res)); });
+    return future;
+  }
+
   template class SSDIndex<float>;
   template class SSDIndex<_s8>;
   template class SSDIndex<_u8>;
@@ -0,0 +1,336 @@
+#include "aligned_file_reader.h"
+#include "ssd_index.h"
+#include "telemetry.h"
+#include <malloc.h>
+#include <algorithm>
+
+#include <omp.h>
+#include <cstdint>
+#include <shared_mutex>
+#include <tuple>
+#include "timer.h"
+#include "tsl/robin_set.h"
+#include "utils.h"
+
+namespace pipeann {
+  namespace {
+    // queries a thread advances in lockstep. Larger batches share more reads but their PQ tables (1KB per
+    // chunk per query) fall out of cache; 64 keeps a 32-chunk batch within about 2MB.
+    constexpr uint64_t kOfflineBatch = 64;
+    constexpr uint64_t kOfflineReadsPerSubmit = 128;  // within the per-thread ring depth.
+  }  // namespace
+
+  // Per-query state of batch_search_offline. Sector buffers belong to the batch, not to the query.
+  template<typename T, typename TagT>
+  struct SSDIndex<T, TagT>::OfflineQuery {
+    T *query = nullptr;  // aligned_dim, zero-padded; a slice of the thread's query block.
+    std::vector<float> pq_dists;
+    std::vector<Neighbor> retset, full_retset;
+    tsl::robin_set<uint32_t> visited;
+    unsigned cur_list_size = 0, k = 0;
+    std::vector<std::tuple<uint32_t, uint32_t, uint32_t>> frontier;  // (id, loc, page of this round).
+    QueryStats stats;
+    PhaseTimer phases;
+
+    bool search_ends() const {
+      return k >= cur_list_size;
+    }
+  };
+
+  template<typename T, typename TagT>
+  size_t SSDIndex<T, TagT>::batch_search_offline(const T *queries, const _u64 n_queries, const _u64 k_search,
+                                                 const _u32 mem_L, const _u64 l_search, TagT *res_tags,
+                                                 float *res_dists, const _u64 beam_width, uint32_t num_threads,
+                                                 QueryStats *stats) {
+    std::shared_lock lk(merge_lock);
+    if (num_threads == 0) {
+      num_threads = omp_get_max_threads();
+    }
+    // smaller batches when there are too few queries to keep every thread busy.
+    const uint64_t batch = std::max<uint64_t>(1, std::min(kOfflineBatch, n_queries / num_threads));
+    const uint64_t n_batches = DIV_ROUND_UP(n_queries, batch);
+#pragma omp parallel num_threads(num_threads)
+    {
+      pipeann::set_io_context(pipeann::IoContext::SEARCH);
+      std::vector<OfflineQuery> slots(batch);
+#pragma omp for schedule(dynamic, 1)
+      for (uint64_t b = 0; b < n_batches; ++b) {
+        const uint64_t first = b * batch, n = std::min(batch, n_queries - first);
+        search_offline_batch(queries + first * data_dim, n, k_search, mem_L, l_search, res_tags + first * k_search,
+                             res_dists == nullptr ? nullptr : res_dists + first * k_search, beam_width, slots.data(),
+                             stats == nullptr ? nullptr : stats + first);
+      }
+    }
+    return n_queries;
+  }
+
+  template<typename T, typename TagT>
+  void SSDIndex<T, TagT>::search_offline_batch(const T *queries, const _u64 n, const _u64 k_search,
+                                               const _u32 mem_L, const _u64 l_search, TagT *res_tags,
+                                               float *res_dists, const _u64 beam_width, OfflineQuery *slots,
+                                               QueryStats *stats) {
+    uint64_t start_cycles = read_cycles();
+    Timer batch_timer;
+    void *ctx = reader->get_ctx();
+
+    // batch-wide scratch; the page buffer holds every distinct sector of a round.
+    T *query_block = nullptr, *coords = nullptr;
+    char *pages = nullptr;
+    pipeann::alloc_aligned((void **) &query_block, n * aligned_dim * sizeof(T), 8 * sizeof(T));
+    pipeann::alloc_aligned((void **) &coords, aligned_dim * sizeof(T), 8 * sizeof(T));
+    pipeann::alloc_aligned((void **) &pages, n * beam_width * size_per_io, SECTOR_LEN);
+    memset(query_block, 0, n * aligned_dim * sizeof(T));
+    memset(coords, 0, aligned_dim * sizeof(T));
+    std::vector<_u8> pq_coord_scratch(32768 * 32);
+    std::vector<float> dist_scratch(std::max<_u64>({512, mem_L, max_degree}));
+
+    // queries and their PQ tables, built in one batch.
+    std::vector<const T *> query_ptrs(n);
+    std::vector<float *> tables(n);
+    for (uint64_t v = 0; v < n; ++v) {
+      OfflineQuery &q = slots[v];
+      q.query = query_block + v * aligned_dim;
+      const T *src = queries + v * data_dim;
+      if (data_is_normalized) {
+        float norm = pipeann::compute_l2_norm(src, this->data_dim);
+        for (uint32_t i = 0; i < this->data_dim; i++) {
+          q.query[i] = src[i] / norm;
+        }
+      } else {
+        memcpy(q.query, src, data_dim * sizeof(T));
+      }
+      q.pq_dists.resize(256 * n_chunks);
+      query_ptrs[v] = q.query;
+      tables[v] = q.pq_dists.data();
+    }
+    uint64_t pq_start = read_cycles();
+    pq_table.populate_chunk_distances_batch(query_ptrs.data(), n, tables.data());
+    uint64_t pq_cycles = (read_cycles() - pq_start) / n;
+
+    auto compute_dists = [&](OfflineQuery &q, const unsigned *ids, const _u64 n_ids) {
+      aggregate_pq_codes(ids, n_ids, pq_coord_scratch.data());
+      ::pq_dist_lookup(pq_coord_scratch.data(), n_ids, n_chunks, q.pq_dists.data(), dist_scratch.data());
+    };
+
+    std::vector<uint32_t> active;
+    for (uint64_t v = 0; v < n; ++v) {
+      OfflineQuery &q = slots[v];
+      q.stats = QueryStats();
+      q.phases = PhaseTimer();
+      q.phases.add(kPhasePqSetup, pq_cycles);
+      q.retset.resize(l_search + 1);
+      q.full_retset.clear();
+      q.visited.clear();
+      q.cur_list_size = q.k = 0;
+
+      std::vector<unsigned> seeds;
+      if (mem_L) {
+        seeds.resize(mem_L);
+        std::vector<float> mem_dists(mem_L);
+        mem_index_->search_with_tags(q.query, mem_L, mem_L, seeds.data(), mem_dists.data());
+        seeds.resize(std::min<_u64>(mem_L, l_search));
+        q.phases.mark(kPhaseHead);
+      } else {
+        seeds.push_back(medoids[0]);
+      }
+      compute_dists(q, seeds.data(), seeds.size());
+      for (uint64_t i = 0; i < seeds.size(); ++i) {
+        q.retset[q.cur_list_size++] = Neighbor(seeds[i], dist_scratch[i], true);
+        q.visited.insert(seeds[i]);
+      }
+      std::sort(q.retset.begin(), q.retset.begin() + q.cur_list_size);
+      q.phases.mark(kPhasePqScore);
+      active.push_back((uint32_t) v);
+    }
+
+    struct Want {
+      uint64_t sector;
+      uint32_t slot, idx;  // the query and its frontier entry.
+    };
+    std::vector<Want> wants;
+    std::vector<uint32_t> ids, waiters, order;
+    std::vector<uint8_t> ordered(n);
+    std::vector<IORequest> reqs, disk_reqs;
+    std::vector<bool> pinned;
+    std::vector<uint64_t> page_ref;
+    while (!active.empty()) {
+      // 1. gather the frontiers of all active queries, and resolve their locations under the locks held
+      // until the reads finish.
+      ids.clear();
+      for (auto v : active) {
+        OfflineQuery &q = slots[v];
+        q.phases.skip();
+        q.frontier.clear();
+        for (unsigned marker = q.k; marker < q.cur_list_size && q.frontier.size() < beam_width; ++marker) {
+          if (q.retset[marker].flag) {
+            q.retset[marker].flag = false;
+            ids.push_back(q.retset[marker].id);
+            q.frontier.emplace_back(q.retset[marker].id, 0, 0);
+          }
+        }
+        if (!q.frontier.empty()) {
+          q.stats.n_hops++;
+        }
+        q.phases.mark(kPhasePool);
+      }
+      auto locked = lock_idx(idx_lock_table, kInvalidID, ids, true);
+      wants.clear();
+      for (auto v : active) {
+        auto &frontier = slots[v].frontier;
+        for (uint32_t f = 0; f < frontier.size(); ++f) {
+          auto &[id, loc, page] = frontier[f];
+          loc = id2loc(id);
+          wants.push_back({loc_sector_no(loc), v, f});
+        }
+      }
+
+      // 2. one read per distinct sector, in sector order.
+      uint64_t io_start = read_cycles();
+      std::sort(wants.begin(), wants.end(), [](const Want &a, const Want &b) {
+        return a.sector != b.sector ? a.sector < b.sector : a.slot < b.slot;
+      });
+      reqs.clear();
+      waiters.clear();
+      order.clear();
+      for (auto &w : wants) {
+        auto &[id, loc, page] = slots[w.slot].frontier[w.idx];
+        if (reqs.empty() || reqs.back().offset != w.sector * SECTOR_LEN) {
+          char *buf = pages + reqs.size() * size_per_io;
+          reqs.emplace_back(IORequest(w.sector * SECTOR_LEN, size_per_io, buf, u_loc_offset(loc), max_node_len));
+          waiters.push_back(0);
+        }
+        page = (uint32_t) reqs.size() - 1;
+        waiters.back()++;
+        if (!ordered[w.slot]) {
+          ordered[w.slot] = 1;  // queries in the order of the first page they wait on.
+          order.push_back(w.slot);
+        }
+      }
+      for (auto v : active) {
+        if (!ordered[v]) {
+          order.push_back(v);  // nothing to read; its k still advances.
+        }
+        ordered[v] = 0;
+      }
+      pinned.assign(reqs.size(), false);
+      disk_reqs.clear();
+      for (uint64_t p = 0; p < reqs.size(); ++p) {
+        pinned[p] = serve_pinned(reqs[p], nullptr);
+        if (!pinned[p]) {
+          disk_reqs.push_back(reqs[p]);
+        }
+      }
+      for (uint64_t i = 0; i < disk_reqs.size(); i += kOfflineReadsPerSubmit) {
+        std::vector<IORequest> chunk(disk_reqs.begin() + i,
+                                     disk_reqs.begin() + std::min(disk_reqs.size(), i + kOfflineReadsPerSubmit));
+#ifdef DIRECT_READ_CC
+        reader->read(chunk, ctx);
+#else
+        reader->read_alloc(chunk, ctx, &page_ref);
+#endif
+      }
+      unlock_idx(idx_lock_table, locked);
+      telemetry_slot().add(kTmCoalescedReads, wants.size() - reqs.size());
+      // every query waited for the whole round.
+      uint64_t io_cycles = (read_cycles() - io_start) / active.size();
+      for (auto v : active) {
+        slots[v].phases.add(kPhaseWait, io_cycles);
+      }
+
+      // 3. expand, query by query in the order of their pages, so that queries sharing pages run back to
+      // back; a query's nodes are visited in sector order.
+      for (auto v : order) {
+        OfflineQuery &q = slots[v];
+        q.phases.skip();
+        std::sort(q.frontier.begin(), q.frontier.end(),
+                  [](const auto &a, const auto &b) { return std::get<2>(a) < std::get<2>(b); });
+        unsigned nk = q.cur_list_size;
+        for (uint64_t f = 0; f < q.frontier.size(); ++f) {
+          auto [id, loc, p] = q.frontier[f];
+          // reads are shared evenly among the queries waiting on them.
+          const double share = 1.0 / waiters[p];
+          (pinned[p] ? q.stats.n_cache_hits : q.stats.n_ios) += share;
+          q.stats.n_4k += pinned[p] ? 0 : share;
+          q.stats.n_coalesced += 1 - share;
+          if (f + 1 < q.frontier.size()) {
+            auto [next_id, next_loc, next_page] = q.frontier[f + 1];
+            _mm_prefetch(offset_to_loc(pages + next_page * size_per_io, next_loc), _MM_HINT_T0);
+          }
+
+          char *node_disk_buf = offset_to_loc(pages + p * size_per_io, loc);
+          unsigned *node_buf = offset_to_node_nhood(node_disk_buf);
+          _u64 nnbrs = (_u64) (*node_buf);
+          memcpy(coords, offset_to_node_coords(node_disk_buf), data_dim * sizeof(T));
+          q.full_retset.push_back(Neighbor(id, dist_cmp->compare(q.query, coords, (unsigned) aligned_dim), true));
+          q.phases.mark(kPhaseExact);
+
+          unsigned *node_nbrs = node_buf + 1;
+          if (inline_pq_chunks != 0) {
+            ::pq_dist_lookup(offset_to_node_nbr_codes(node_disk_buf), nnbrs, n_chunks, q.pq_dists.data(),
+                             dist_scratch.data());
+          } else {
+            compute_dists(q, node_nbrs, nnbrs);
+          }
+          q.phases.mark(kPhasePqScore);
+
+          for (_u64 m = 0; m < nnbrs; ++m) {
+            unsigned nbr = node_nbrs[m];
+            if (!q.visited.insert(nbr).second) {
+              continue;
+            }
+            q.stats.n_cmps++;
+            float dist = dist_scratch[m];
+            if (dist >= q.retset[q.cur_list_size - 1].distance && q.cur_list_size == l_search) {
+              continue;
+            }
+            auto r = InsertIntoPool(q.retset.data(), q.cur_list_size, Neighbor(nbr, dist, true));
+            if (q.cur_list_size < l_search) {
+              ++q.cur_list_size;
+            }
+            nk = std::min(nk, r);
+          }
+          q.phases.mark(kPhasePool);
+        }
+        if (nk <= q.k) {
+          q.k = nk;  // k is the best position in retset updated in this round.
+        } else {
+          ++q.k;
+        }
+      }
+      reader->deref(&page_ref, ctx);
+      page_ref.clear();
+      active.erase(std::remove_if(active.begin(), active.end(), [&](uint32_t v) { return slots[v].search_ends(); }),
+                   active.end());
+    }
+
+    double batch_us = (double) batch_timer.elapsed();
+    for (uint64_t v = 0; v < n; ++v) {
+      OfflineQuery &q = slots[v];
+      q.phases.skip();
+      std::sort(q.full_retset.begin(), q.full_retset.end());
+      for (uint64_t t = 0; t < k_search && t < q.full_retset.size(); ++t) {
+        res_tags[v * k_search + t] = id2tag(q.full_retset[t].id);
+        if (res_dists != nullptr) {
+          res_dists[v * k_search + t] = q.full_retset[t].distance;
+        }
+      }
+      if (stats != nullptr) {
+        // every query of the batch returns when the batch does.
+        stats[v] = q.stats;
+        stats[v].total_us = batch_us;
+        q.phases.finish(&stats[v]);
+      }
+    }
+    pipeann::aligned_free(query_block);
+    pipeann::aligned_free(coords);
+    pipeann::aligned_free(pages);
+
+    TelemetrySlot &slot = telemetry_slot();
+    slot.add(kTmQueries, n);
+    slot.add(kTmQueryCycles, read_cycles() - start_cycles);
+  }
+
+  template class SSDIndex<float>;
+  template class SSDIndex<_s8>;
+  template class SSDIndex<_u8>;
+}  // namespace pipeann
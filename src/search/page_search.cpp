@@ -1,7 +1,10 @@
 #include "aligned_file_reader.h"
 #include "libcuckoo/cuckoohash_map.hh"
 #include "observability.h"
+#include "page_trace.h"
+#include "query_trace.h"
 #include "ssd_index.h"
+#include "telemetry.h"
 #include <malloc.h>
 #include <algorithm>
 #include <filesystem>
@@ -107,9 +110,13 @@ namespace pipeann {
                                         TagT *res_tags, float *distances, const _u64 beam_width, QueryStats *stats) {
     pipeann::set_io_context(pipeann::IoContext::SEARCH);
     PIPANN_PROBE_QUERY_START(l_search);
-
-    std::cout << "[observability] -------> page_search" << std::endl;
-
+    uint64_t start_cycles = read_cycles();
+    QueryStats local_stats;
+    if (stats == nullptr) {
+      stats = &local_stats;
+    }
+    trace_query_begin(PAGE_SEARCH, (uint32_t) l_search, (uint32_t) beam_width);
+    page_trace_query_begin();
 
     QueryBuffer<T> *query_buf = pop_query_buf(query1);
     void *ctx = reader->get_ctx();
@@ -132,14 +139,16 @@ namespace pipeann {
     _u64 &sector_scratch_idx = query_buf->sector_idx;
 
     // query <-> PQ chunk centers distances
+    PhaseTimer phases;
     float *pq_dists = query_buf->aligned_pqtable_dist_scratch;
     pq_table.populate_chunk_distances(query, pq_dists);
+    phases.mark(kPhasePqSetup);
 
     // query <-> neighbor list
     float *dist_scratch = query_buf->aligned_dist_scratch;
     _u8 *pq_coord_scratch = query_buf->aligned_pq_coord_scratch;
 
-    Timer query_timer, io_timer, cpu_timer;
+    Timer query_timer;
     std::vector<Neighbor> retset(4096);
     tsl::robin_set<_u64> &visited = *(query_buf->visited);
     tsl::robin_set<unsigned> &page_visited = *(query_buf->page_visited);
@@ -152,7 +161,7 @@ namespace pipeann {
     // lambda to batch compute query<-> node distances in PQ space
     auto compute_pq_dists = [this, pq_coord_scratch, pq_dists](const unsigned *ids, const _u64 n_ids,
                                                                float *dists_out) {
-      ::aggregate_coords(ids, n_ids, this->data.data(), this->n_chunks, pq_coord_scratch);
+      this->aggregate_pq_codes(ids, n_ids, pq_coord_scratch);
       ::pq_dist_lookup(pq_coord_scratch, n_ids, this->n_chunks, pq_dists, dists_out);
     };
 
@@ -161,21 +170,32 @@ namespace pipeann {
       memcpy(node_fp_coords_copy, node_buf, data_dim * sizeof(T));
       float cur_expanded_dist = dist_cmp->compare(query, node_fp_coords_copy, (unsigned) aligned_dim);
       full_retset.push_back(Neighbor(id, cur_expanded_dist, true));
+      phases.mark(kPhaseExact);
       return cur_expanded_dist;
     };
 
     auto compute_and_push_nbrs = [&](const char *node_buf, unsigned &nk) {
       unsigned *node_nbrs = offset_to_node_nhood(node_buf);
       unsigned nnbrs = *(node_nbrs++);
+      const _u8 *nbr_codes = inline_pq_chunks != 0 ? offset_to_node_nbr_codes(node_buf) : nullptr;
       unsigned nbors_cand_size = 0;
       for (unsigned m = 0; m < nnbrs; ++m) {
         if (visited.find(node_nbrs[m]) == visited.end()) {
+          if (nbr_codes != nullptr) {
+            memcpy(pq_coord_scratch + nbors_cand_size * n_chunks, nbr_codes + m * n_chunks, n_chunks);
+          }
           node_nbrs[nbors_cand_size++] = node_nbrs[m];
           visited.insert(node_nbrs[m]);
         }
       }
+      phases.mark(kPhasePool);
       if (nbors_cand_size) {
-        compute_pq_dists(node_nbrs, nbors_cand_size, dist_scratch);
+        if (nbr_codes != nullptr) {
+          ::pq_dist_lookup(pq_coord_scratch, nbors_cand_size, n_chunks, pq_dists, dist_scratch);
+        } else {
+          compute_pq_dists(node_nbrs, nbors_cand_size, dist_scratch);
+        }
+        phases.mark(kPhasePqScore);
         for (unsigned m = 0; m < nbors_cand_size; ++m) {
           const int nbor_id = node_nbrs[m];
           const float nbor_dist = dist_scratch[m];
@@ -194,11 +214,13 @@ namespace pipeann {
           if (r < nk)
             nk = r;
         }
+        phases.mark(kPhasePool);
       }
     };
 
     auto compute_and_add_to_retset = [&](const unsigned *node_ids, const _u64 n_ids) {
       compute_pq_dists(node_ids, n_ids, dist_scratch);
+      phases.mark(kPhasePqScore);
       for (_u64 i = 0; i < n_ids; ++i) {
         retset[cur_list_size].id = node_ids[i];
         retset[cur_list_size].distance = dist_scratch[i];
@@ -207,20 +229,20 @@ namespace pipeann {
       }
     };
 
-    // stats.
-    stats->io_us = 0;
-    stats->cpu_us = 0;
     // search in in-memory index.
+    phases.skip();
     if (mem_L) {
       std::vector<unsigned> mem_tags(mem_L);
       std::vector<float> mem_dists(mem_L);
       mem_index_->search_with_tags(query, mem_L, mem_L, mem_tags.data(), mem_dists.data());
+      phases.mark(kPhaseHead);
       compute_and_add_to_retset(mem_tags.data(), std::min((unsigned) mem_L, (unsigned) l_search));
     } else {
       compute_and_add_to_retset(&best_medoid, 1);
     }
 
     std::sort(retset.begin(), retset.begin() + cur_list_size);
+    phases.mark(kPhasePool);
 
     unsigned num_ios = 0;
     unsigned k = 0;
@@ -233,6 +255,7 @@ namespace pipeann {
     frontier_nhoods.reserve(2 * beam_width);
     std::vector<IORequest> frontier_read_reqs;
     frontier_read_reqs.reserve(2 * beam_width);
+    std::vector<IORequest> attached_reqs;  // reads of other queries this one waits for.
 
     using io_ss_t = std::tuple<unsigned, unsigned, PageArr>;  // <node_id, page_id, page_layout>
     std::vector<io_ss_t> last_io_snapshot;
@@ -240,6 +263,9 @@ namespace pipeann {
 
     std::vector<char> last_pages(SECTOR_LEN * beam_width * 2);
 
+    EarlyStop early_stop;
+    early_stop.init(early_stop_model_.get(), early_stop_trace_, k_search);
+
     // search on disk.
     while (k < cur_list_size) {
       unsigned nk = cur_list_size;
@@ -265,6 +291,7 @@ namespace pipeann {
         }
         marker++;
       }
+      phases.mark(kPhasePool);
 
       // read nhoods of frontier ids
       std::vector<uint32_t> locked, page_locked;
@@ -275,11 +302,14 @@ namespace pipeann {
 
         locked = this->lock_idx(idx_lock_table, kInvalidID, frontier, true);
         page_locked = this->lock_page_idx(page_idx_lock_table, kInvalidID, frontier, true);
+        phases.mark(kPhaseLock);
 
         for (_u64 i = 0; i < frontier.size(); i++) {
           auto id = frontier[i];
           uint64_t page_id = id2page(id);
           PIPANN_PROBE_EXPAND_NODE(id, page_id);
+          trace_event(kTrExpand, id, page_id);
+          page_trace_read(page_id, (uint32_t) stats->n_hops - 1);
           auto buf = sector_scratch + sector_scratch_idx * size_per_io;
           PageArr layout;
           if (unlikely(!page_layout.find(page_id, layout))) {
@@ -299,7 +329,11 @@ namespace pipeann {
           num_ios++;
         }
 
-        n_ios = reader->send_read_no_alloc(frontier_read_reqs, ctx);
+        serve_pinned(frontier_read_reqs, stats);
+        coalesce_reads(frontier_read_reqs, attached_reqs, stats);
+        trace_ios(kTrIoSubmit, frontier_read_reqs);
+        n_ios = frontier_read_reqs.empty() ? 0 : reader->send_read_no_alloc(frontier_read_reqs, ctx);
+        phases.mark(kPhaseSubmit);
       }
 
       // compute remaining nodes in the pages that are fetched in the previous
@@ -336,19 +370,25 @@ namespace pipeann {
       auto cpu1_ed = std::chrono::high_resolution_clock::now();
       stats->cpu_us1 += std::chrono::duration_cast<std::chrono::microseconds>(cpu1_ed - cpu1_st).count();
 
-      auto io_time_st = std::chrono::high_resolution_clock::now();
       // get last submitted io results, blocking
+      phases.skip();
       if (!frontier.empty()) {
         for (int i = 0; i < n_ios; ++i) {
           reader->poll_wait(ctx);
         }
+        for (auto &req : frontier_read_reqs) {
+          publish_read(req);  // before waiting: other queries may wait for ours.
+        }
+        trace_ios(kTrIoComplete, frontier_read_reqs);
+        phases.mark(kPhaseWait);
         this->unlock_page_idx(page_idx_lock_table, page_locked);
         this->unlock_idx(idx_lock_table, locked);
+        phases.mark(kPhaseLock);
+        // unlocked first: the leaders may be waiting for a writer that waits for our locks.
+        wait_attached(attached_reqs);
+        phases.mark(kPhaseWait);
       }
-      auto io_time_ed = std::chrono::high_resolution_clock::now();
-      stats->io_us += std::chrono::duration_cast<std::chrono::microseconds>(io_time_ed - io_time_st).count();
 
-      auto cpu_st = std::chrono::high_resolution_clock::now();
       // compute only the desired vectors in the pages - one for each page
       // postpone remaining vectors to the next round
       for (auto &[id, pid, layout, sector_buf] : frontier_nhoods) {
@@ -365,18 +405,27 @@ namespace pipeann {
           }
         }
       }
-      auto cpu_ed = std::chrono::high_resolution_clock::now();
-      stats->cpu_us += std::chrono::duration_cast<std::chrono::microseconds>(cpu_ed - cpu_st).count();
 
       // update best inserted position
       if (nk <= k)
         k = nk;  // k is the best position in retset updated in this round.
       else
         ++k;
+      trace_candidates(retset.data(), cur_list_size);
+      if (early_stop.enabled()) {
+        unsigned first = 0;
+        while (first < cur_list_size && !retset[first].flag) {
+          ++first;
+        }
+        if (early_stop.after_hop(retset.data(), cur_list_size, first, full_retset)) {
+          break;  // the rest of the pages read last round stays unexpanded.
+        }
+      }
     }
 
     std::sort(full_retset.begin(), full_retset.end(),
               [](const Neighbor &left, const Neighbor &right) { return left < right; });
+    phases.mark(kPhasePool);
 
     // copy k_search values
     _u64 t = 0;
@@ -399,7 +448,10 @@ namespace pipeann {
 
     if (stats != nullptr) {
       stats->total_us = (double) query_timer.elapsed();
+      phases.finish(stats);
     }
+    trace_query_end(*stats);
+    telemetry_record_query(*stats, read_cycles() - start_cycles);
     return t;
   }
 
@@ -2,7 +2,10 @@
 #include "libcuckoo/cuckoohash_map.hh"
 #include "neighbor.h"
 #include "observability.h"
+#include "page_trace.h"
+#include "query_trace.h"
 #include "ssd_index.h"
+#include "telemetry.h"
 #include <malloc.h>
 #include <algorithm>
 
@@ -37,19 +40,22 @@ namespace pipeann {
     }
 
     bool finished() {
-      return read_req->finished;
+      return __atomic_load_n(&read_req->finished, __ATOMIC_ACQUIRE);  // may be set by another query.
     }
   };
 
   template<typename T, typename TagT>
-  size_t SSDIndex<T, TagT>::pipe_search(const T *query1, const _u64 k_search, const _u32 mem_L, const _u64 l_search,
-                                        TagT *res_tags, float *distances, const _u64 beam_width, QueryStats *stats) {
+  size_t SSDIndex<T, TagT>::pipe_search(const T *query1, const _u64 k_search, const _u32 mem_L, _u64 l_search,
+                                        TagT *res_tags, float *distances, _u64 beam_width, QueryStats *stats) {
     pipeann::set_io_context(pipeann::IoContext::SEARCH);
     PIPANN_PROBE_QUERY_START(l_search);
-
-    // std::cout << "[observability] -------> pipe_search" << std::endl;
-
-    // std::cout << "beamwidth to be optimized for each L value" << std::endl;
+    uint64_t start_cycles = read_cycles();
+    QueryStats local_stats;
+    if (stats == nullptr) {
+      stats = &local_stats;
+    }
+    trace_query_begin(PIPE_SEARCH, (uint32_t) l_search, (uint32_t) beam_width);
+    page_trace_query_begin();
 
     QueryBuffer<T> *query_buf = pop_query_buf(query1);
 #ifdef USE_AIO
@@ -90,51 +96,69 @@ namespace pipeann {
     full_retset.reserve(l_search * 10);
 
     // query <-> PQ chunk centers distances
+    PhaseTimer phases;
     float *pq_dists = query_buf->aligned_pqtable_dist_scratch;
 
 #ifndef OVERLAP_INIT
     pq_table.populate_chunk_distances(query, pq_dists);  // overlap with the first I/O.
+    phases.mark(kPhasePqSetup);
 #endif
 
     // lambda to batch compute query<-> node distances in PQ space
     auto compute_pq_dists = [this, pq_coord_scratch, pq_dists](const unsigned *ids, const _u64 n_ids,
                                                                float *dists_out) {
-      ::aggregate_coords(ids, n_ids, this->data.data(), this->n_chunks, pq_coord_scratch);
+      this->aggregate_pq_codes(ids, n_ids, pq_coord_scratch);
       ::pq_dist_lookup(pq_coord_scratch, n_ids, this->n_chunks, pq_dists, dists_out);
     };
 
+    RefinePool dropped;
+    dropped.reset(refine_codes_ != nullptr ? refine_r_ : 0);
+
     auto compute_exact_dists_and_push = [&](const char *node_buf, const unsigned id) -> float {
       T *node_fp_coords_copy = data_buf;
       memcpy(node_fp_coords_copy, node_buf, data_dim * sizeof(T));
       float cur_expanded_dist = dist_cmp->compare(query, node_fp_coords_copy, (unsigned) aligned_dim);
       full_retset.push_back(Neighbor(id, cur_expanded_dist, true));
+      phases.mark(kPhaseExact);
       return cur_expanded_dist;
     };
 
-    uint64_t n_computes = 0;
     auto compute_and_push_nbrs = [&](const char *node_buf, unsigned &nk) {
       unsigned *node_nbrs = offset_to_node_nhood(node_buf);
       unsigned nnbrs = *(node_nbrs++);
+      const _u8 *nbr_codes = inline_pq_chunks != 0 ? offset_to_node_nbr_codes(node_buf) : nullptr;
       unsigned nbors_cand_size = 0;
       for (unsigned m = 0; m < nnbrs; ++m) {
         if (visited.find(node_nbrs[m]) == visited.end()) {
+          if (nbr_codes != nullptr) {
+            memcpy(pq_coord_scratch + nbors_cand_size * n_chunks, nbr_codes + m * n_chunks, n_chunks);
+          }
           node_nbrs[nbors_cand_size++] = node_nbrs[m];
           visited.insert(node_nbrs[m]);
         }
       }
 
-      n_computes += nbors_cand_size;
+      phases.mark(kPhasePool);
       if (nbors_cand_size) {
-        // auto cpu1_st = std::chrono::high_resolution_clock::now();
-        compute_pq_dists(node_nbrs, nbors_cand_size, dist_scratch);
+        if (nbr_codes != nullptr) {
+          ::pq_dist_lookup(pq_coord_scratch, nbors_cand_size, n_chunks, pq_dists, dist_scratch);
+        } else {
+          compute_pq_dists(node_nbrs, nbors_cand_size, dist_scratch);
+        }
+        phases.mark(kPhasePqScore);
         for (unsigned m = 0; m < nbors_cand_size; ++m) {
           const int nbor_id = node_nbrs[m];
           const float nbor_dist = dist_scratch[m];
           if (stats != nullptr) {
             stats->n_cmps++;
           }
-          if (nbor_dist >= retset[cur_list_size - 1].distance && (cur_list_size == l_search))
+          if (nbor_dist >= retset[cur_list_size - 1].distance && (cur_list_size == l_search)) {
+            dropped.offer(Neighbor(nbor_id, nbor_dist, true));
             continue;
+          }
+          if (cur_list_size == l_search && !retset[cur_list_size - 1].visited) {
+            dropped.offer(retset[cur_list_size - 1]);  // pushed out unexpanded.
+          }
           Neighbor nn(nbor_id, nbor_dist, true);
           // Return position in sorted list where nn inserted
           auto r = InsertIntoPool(retset.data(), cur_list_size, nn);  // may be overflow in retset...
@@ -149,8 +173,7 @@ namespace pipeann {
           if (r < nk)
             nk = r;
         }
-        // auto cpu1_ed = std::chrono::high_resolution_clock::now();
-        // stats->cpu_us1 += std::chrono::duration_cast<std::chrono::microseconds>(cpu1_ed - cpu1_st).count();
+        phases.mark(kPhasePool);
       }
     };
 
@@ -161,13 +184,8 @@ namespace pipeann {
       }
     };
 
-    // stats.
-    stats->io_us = 0;
-    stats->io_us1 = 0;
-    stats->cpu_us = 0;
-    stats->cpu_us1 = 0;
-    stats->cpu_us2 = 0;
     // search in in-memory index.
+    phases.skip();
 
 #ifdef DYN_PIPE_WIDTH
     int64_t cur_beam_width = 4;  // before converge.
@@ -180,67 +198,100 @@ namespace pipeann {
 #ifdef OVERLAP_INIT
     if (mem_L) {
       mem_index_->search_with_tags_fast(query, mem_L, mem_tags.data(), mem_dists.data());
+      phases.mark(kPhaseHead);
       add_to_retset(mem_tags.data(), std::min((_u64) mem_L, l_search), mem_dists.data());
     } else {
       // cannot overlap.
       pq_table.populate_chunk_distances_nt(query, pq_dists);
+      phases.mark(kPhasePqSetup);
       compute_pq_dists(&medoids[0], 1, dist_scratch);
+      phases.mark(kPhasePqScore);
       add_to_retset(&medoids[0], 1, dist_scratch);
     }
 #else
     if (mem_L) {
       mem_index_->search_with_tags_fast(query, mem_L, mem_tags.data(), mem_dists.data());
+      phases.mark(kPhaseHead);
       compute_pq_dists(mem_tags.data(), mem_L, dist_scratch);
+      phases.mark(kPhasePqScore);
       add_to_retset(mem_tags.data(), std::min((_u64) mem_L, l_search), dist_scratch);
     } else {
       compute_pq_dists(&medoids[0], 1, dist_scratch);
+      phases.mark(kPhasePqScore);
       add_to_retset(&medoids[0], 1, dist_scratch);
     }
     std::sort(retset.begin(), retset.begin() + cur_list_size);
 #endif
+    if (adaptive_budget_ != nullptr) {
+      adaptive_budget_->apply(retset.data(), cur_list_size, k_search, l_search, beam_width);
+      beam_width = std::min<_u64>(beam_width, MAX_N_SECTOR_READS);
+      cur_list_size = std::min<unsigned>(cur_list_size, l_search);
+#ifndef DYN_PIPE_WIDTH
+      cur_beam_width = beam_width;
+#endif
+    }
+    phases.mark(kPhasePool);
 
     std::queue<io_t> on_flight_ios;
+    std::vector<IORequest *> leading;  // in-flight reads other queries may attach to (see coalesce_read).
     auto send_read_req = [&](Neighbor &item) -> bool {
       item.flag = false;
+      phases.mark(kPhasePool);
 
       // lock the corresponding page.
-      this->lock_idx(idx_lock_table, item.id, std::vector<uint32_t>(), true);
+      this->rdlock_idx_publishing(idx_lock_table, item.id, ctx, leading);
+      phases.mark(kPhaseLock);
       const unsigned loc = id2loc(item.id), pid = loc_sector_no(loc);
       PIPANN_PROBE_EXPAND_NODE(item.id, pid);
+      trace_event(kTrExpand, item.id, pid);
+      page_trace_read(pid, (uint32_t) stats->n_hops);
 
       uint64_t &cur_buf_idx = query_buf->sector_idx;
       auto buf = sector_scratch + cur_buf_idx * size_per_io;
       auto &req = query_buf->reqs[cur_buf_idx];
       req = IORequest(static_cast<_u64>(pid) * SECTOR_LEN, size_per_io, buf, u_loc_offset(loc), max_node_len);
-      reader->send_read_no_alloc(req, ctx);
-
-      on_flight_ios.push(io_t{item, pid, loc, &req});
-      cur_buf_idx = (cur_buf_idx + 1) % MAX_N_SECTOR_READS;
-
       if (stats != nullptr) {
         stats->n_ios++;
       }
+      if (!serve_pinned(req, stats) && !coalesce_read(req, stats)) {
+        trace_event(kTrIoSubmit, req.offset, req.len);
+        reader->send_read_no_alloc(req, ctx);
+        if (inflight_reads_ != nullptr) {
+          leading.push_back(&req);
+        }
+      }
+      phases.mark(kPhaseSubmit);
+
+      on_flight_ios.push(io_t{item, pid, loc, &req});
+      cur_buf_idx = (cur_buf_idx + 1) % MAX_N_SECTOR_READS;
       return true;
     };
 
     std::unordered_map<unsigned, char *> id_buf_map;
     auto poll_all = [&]() -> std::pair<int, int> {
       // poll once.
+      phases.mark(kPhasePool);
       reader->poll_all(ctx);
+      if (!leading.empty()) {
+        publish_finished(leading);  // not only the front: another query may wait for any of them.
+      }
       unsigned n_in = 0, n_out = 0;
       while (!on_flight_ios.empty() && on_flight_ios.front().finished()) {
         io_t &io = on_flight_ios.front();
+        trace_event(kTrIoComplete, io.read_req->offset, io.read_req->len);
         id_buf_map.insert(std::make_pair(io.nbr.id, offset_to_loc((char *) io.read_req->buf, io.loc)));
         io.nbr.distance <= retset[cur_list_size - 1].distance ? ++n_in : ++n_out;
+        phases.mark(kPhaseWait);
         // unlock the corresponding page.
         this->unlock_idx(idx_lock_table, io.nbr.id);
+        phases.mark(kPhaseLock);
         on_flight_ios.pop();
       }
+      phases.mark(kPhaseWait);
       return std::make_pair(n_in, n_out);
     };
 
     auto send_best_read_req = [&](uint32_t n) -> bool {
-      // auto io_st = std::chrono::high_resolution_clock::now();
       unsigned n_sent = 0, marker = 0;
       while (marker < cur_list_size && n_sent < n) {
         while (marker < cur_list_size /* pool size */ &&
@@ -254,13 +305,10 @@ namespace pipeann {
         }
         n_sent += send_read_req(retset[marker]);
       }
-      // auto io_ed = std::chrono::high_resolution_clock::now();
-      // stats->io_us += std::chrono::duration_cast<std::chrono::microseconds>(io_ed - io_st).count();
       return n_sent != 0;  // nothing to send.
     };
 
     auto calc_best_node = [&]() -> int {  // if converged.
-      // auto cpu_st = std::chrono::high_resolution_clock::now();
       unsigned marker = 0, nk = cur_list_size, first_unvisited_eager = cur_list_size;
       /* calculate one from "already read" */
       for (marker = 0; marker < cur_list_size; ++marker) {
@@ -269,8 +317,11 @@ namespace pipeann {
           retset[marker].visited = true;
           auto it = id_buf_map.find(retset[marker].id);
           auto [id, buf] = *it;
+          stats->n_hops++;  // one node expanded per step.
+          phases.mark(kPhasePool);
           compute_exact_dists_and_push(buf, id);
           compute_and_push_nbrs(buf, nk);
+          trace_candidates(retset.data(), cur_list_size);
           break;
         }
       }
@@ -283,9 +334,8 @@ namespace pipeann {
           break;
         }
       }
+      phases.mark(kPhasePool);
       return first_unvisited_eager;
-      // auto cpu_ed = std::chrono::high_resolution_clock::now();
-      // stats->cpu_us += std::chrono::duration_cast<std::chrono::microseconds>(cpu_ed - cpu_st).count();
     };
 
     auto get_first_unvisited = [&]() -> int {
@@ -322,21 +372,25 @@ namespace pipeann {
 #ifdef OVERLAP_INIT
     if (likely(mem_L != 0)) {
       pq_table.populate_chunk_distances_nt(query, pq_dists);  // overlap with the first I/O.
+      phases.mark(kPhasePqSetup);
       compute_pq_dists(mem_tags.data(), mem_L, dist_scratch);
+      phases.mark(kPhasePqScore);
       for (unsigned i = 0; i < cur_list_size; ++i) {
         retset[i].distance = dist_scratch[i];
       }
       std::sort(retset.begin(), retset.begin() + cur_list_size);
+      phases.mark(kPhasePool);
     }
 #endif
 
 #ifndef STATIC_POLICY
     int cur_n_in = 0, cur_tot = 0;
 #endif
+    EarlyStop early_stop;
+    early_stop.init(early_stop_model_.get(), early_stop_trace_, k_search);
 
     while (get_first_unvisited() != -1) {
       // poll to heap (best-effort) -> calc best from heap (skip if heap is empty) -> send IO (if can send) -> ...
-      // auto io1_st = std::chrono::high_resolution_clock::now();
       auto [n_in, n_out] = poll_all();
       std::ignore = n_in;
       std::ignore = n_out;
@@ -367,17 +421,38 @@ namespace pipeann {
         send_best_read_req(1);
 #endif
       }
-      // auto io1_ed = std::chrono::high_resolution_clock::now();
-      // stats->io_us1 += std::chrono::duration_cast<std::chrono::microseconds>(io1_ed - io1_st).count();
+      const double hops_before = stats->n_hops;
       marker = calc_best_node();
       max_marker = std::max(max_marker, marker);
+      if (early_stop.enabled() && stats->n_hops != hops_before) {
+        int first = get_first_unvisited();
+        if (early_stop.after_hop(retset.data(), cur_list_size, first < 0 ? cur_list_size : (unsigned) first,
+                                 full_retset)) {
+          while (!on_flight_ios.empty()) {
+            poll_all();  // the buffers and page locks are still in use.
+          }
+          break;
+        }
+      }
     }
     auto cpu2_ed = std::chrono::high_resolution_clock::now();
     stats->cpu_us2 = std::chrono::duration_cast<std::chrono::microseconds>(cpu2_ed - cpu2_st).count();
-    stats->cpu_us = n_computes;
+
+    if (inflight_reads_ != nullptr) {
+      while (!on_flight_ios.empty()) {
+        poll_all();  // other queries may wait for our reads, or still copy into our buffers.
+      }
+    }
+    if (refine_codes_ != nullptr) {
+      while (!on_flight_ios.empty()) {
+        poll_all();  // the refine read shares the ring.
+      }
+      refine_candidates(query, retset.data(), cur_list_size, dropped, full_retset, query_buf, ctx, stats, phases);
+    }
 
     std::sort(full_retset.begin(), full_retset.end(),
               [](const Neighbor &left, const Neighbor &right) { return left < right; });
+    phases.mark(kPhasePool);
 
     // copy k_search values
     _u64 t = 0;
@@ -400,7 +475,10 @@ namespace pipeann {
 
     if (stats != nullptr) {
       stats->total_us = (double) query_timer.elapsed();
+      phases.finish(stats);
     }
+    trace_query_end(*stats);
+    telemetry_record_query(*stats, read_cycles() - start_cycles);
     return t;
   }
 
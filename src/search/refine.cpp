@@ -0,0 +1,97 @@
+#include "aligned_file_reader.h"
+#include "ssd_index.h"
+#include "telemetry.h"
+#include <algorithm>
+#include <vector>
+
+#include "tsl/robin_set.h"
+#include "utils.h"
+
+namespace pipeann {
+  template<typename T, typename TagT>
+  int SSDIndex<T, TagT>::load_refine_codes(const std::string &path, uint32_t refine_r, bool in_memory) {
+    auto codes = std::make_unique<RefineCodes<T>>();
+    if (codes->load(path, data_dim, in_memory) != 0) {
+      return -1;
+    }
+    if (codes->num_points() < num_points) {
+      LOG(WARNING) << "Refine codes cover " << codes->num_points() << " of " << num_points
+                   << " points; the rest are not reranked.";
+    }
+    refine_codes_ = std::move(codes);
+    refine_r_ = std::min<uint32_t>(refine_r, MAX_N_SECTOR_READS);
+    LOG(INFO) << "Reranking the best " << refine_r_ << " unexpanded candidates of each query.";
+    return 0;
+  }
+
+  template<typename T, typename TagT>
+  void SSDIndex<T, TagT>::refine_candidates(const T *query, const Neighbor *retset, unsigned cur_list_size,
+                                            const RefinePool &dropped, std::vector<Neighbor> &full_retset,
+                                            QueryBuffer<T> *query_buf, void *ctx, QueryStats *stats,
+                                            PhaseTimer &phases) {
+    const RefineCodes<T> &codes = *refine_codes_;
+    tsl::robin_set<uint32_t> seen(full_retset.size() * 2);
+    for (auto &nbr : full_retset) {
+      seen.insert(nbr.id);
+    }
+    std::vector<Neighbor> cands(dropped.candidates());
+    cands.insert(cands.end(), retset, retset + cur_list_size);
+    std::sort(cands.begin(), cands.end());
+    std::vector<uint32_t> ids;
+    for (size_t i = 0; i < cands.size() && ids.size() < refine_r_; ++i) {
+      if (cands[i].id < codes.num_points() && seen.insert(cands[i].id).second) {
+        ids.push_back(cands[i].id);
+      }
+    }
+    phases.mark(kPhasePool);
+    if (ids.empty()) {
+      return;
+    }
+
+    // on disk: one batched read of the distinct sectors holding the codes.
+    std::vector<const uint8_t *> id_codes(ids.size());
+    if (codes.in_memory()) {
+      for (size_t i = 0; i < ids.size(); ++i) {
+        id_codes[i] = codes.code(ids[i]);
+      }
+    } else {
+      std::vector<uint64_t> sectors(ids.size());
+      for (size_t i = 0; i < ids.size(); ++i) {
+        sectors[i] = codes.code_offset(ids[i]) / SECTOR_LEN;
+      }
+      std::vector<uint64_t> uniq(sectors);
+      std::sort(uniq.begin(), uniq.end());
+      uniq.erase(std::unique(uniq.begin(), uniq.end()), uniq.end());
+      std::vector<IORequest> reqs;
+      reqs.reserve(uniq.size());
+      for (size_t i = 0; i < uniq.size(); ++i) {
+        char *buf = query_buf->sector_scratch + i * SECTOR_LEN;
+        reqs.emplace_back(uniq[i] * SECTOR_LEN, SECTOR_LEN, buf, uniq[i] * SECTOR_LEN, SECTOR_LEN);
+      }
+      phases.mark(kPhaseSubmit);
+      reader->read_fd(codes.fd(), reqs, ctx);
+      phases.mark(kPhaseWait);
+      for (size_t i = 0; i < ids.size(); ++i) {
+        size_t slot = std::lower_bound(uniq.begin(), uniq.end(), sectors[i]) - uniq.begin();
+        id_codes[i] = (const uint8_t *) query_buf->sector_scratch + slot * SECTOR_LEN +
+                      codes.code_offset(ids[i]) % SECTOR_LEN;
+      }
+      if (stats != nullptr) {
+        stats->n_ios += reqs.size();
+        stats->n_4k += reqs.size();
+      }
+    }
+
+    // the coordinate scratch is free once the search loop ends; its padding past data_dim stays zero.
+    T *decoded = query_buf->coord_scratch;
+    for (size_t i = 0; i < ids.size(); ++i) {
+      codes.decode(id_codes[i], decoded);
+      full_retset.push_back(Neighbor(ids[i], dist_cmp->compare(query, decoded, (unsigned) aligned_dim), true));
+    }
+    phases.mark(kPhaseExact);
+  }
+
+  template class SSDIndex<float>;
+  template class SSDIndex<_s8>;
+  template class SSDIndex<_u8>;
+}  // namespace pipeann
@@ -0,0 +1,203 @@
+#include "sharded_index.h"
+
+#include <algorithm>
+#include <limits>
+#include <mutex>
+
+#include "emulated_aligned_file_reader.h"
+#include "log.h"
+#include "neighbor.h"
+#include "timer.h"
+
+namespace pipeann {
+  // State of one query across its shards; the last shard to answer merges and calls back.
+  template<typename T, typename TagT>
+  struct ShardedIndex<T, TagT>::Gather {
+    std::mutex lock;  // guards merged and stats.
+    std::vector<NeighborTag<TagT>> merged;
+    QueryStats stats;
+    std::atomic<uint32_t> remaining;
+    std::atomic<float> stop_dist{std::numeric_limits<float>::max()};
+    uint64_t k_search;
+    AsyncSearchCallback<TagT> callback;
+    Timer timer;
+  };
+
+  template<typename T, typename TagT>
+  ShardedIndex<T, TagT>::ShardedIndex(Metric metric, Parameters *insert_params)
+      : metric(metric), insert_params(insert_params), insert_policy(tag_range_policy()) {
+  }
+
+  template<typename T, typename TagT>
+  ShardedIndex<T, TagT>::~ShardedIndex() {
+    for (auto &s : shards) {
+      s->index->stop_async_engine();  // finish in-flight queries before any shard goes away.
+    }
+  }
+
+  template<typename T, typename TagT>
+  int ShardedIndex<T, TagT>::add_shard(const std::string &index_prefix, uint32_t num_threads, TagT tag_offset,
+                                       uint32_t async_workers) {
+    std::unique_ptr<Shard> s(new Shard());
+    if (runtime == nullptr) {
+      s->reader.reset(new_aligned_file_reader());
+    }
+    std::shared_ptr<AlignedFileReader> &reader = runtime != nullptr ? runtime->new_reader() : s->reader;
+    s->index.reset(new SSDIndex<T, TagT>(metric, reader, false, true, insert_params));
+    if (runtime != nullptr) {
+      s->index->set_runtime(runtime);
+    }
+    if (s->index->load(index_prefix.c_str(), num_threads, true, false) != 0) {
+      LOG(ERROR) << "Cannot load shard " << index_prefix;
+      return -1;
+    }
+    if (!shards.empty() && s->index->data_dim != shards[0]->index->data_dim) {
+      LOG(ERROR) << "Shard " << index_prefix << " has dimension " << s->index->data_dim << ", expected "
+                 << shards[0]->index->data_dim;
+      return -1;
+    }
+    s->tag_offset = tag_offset;
+    s->index->start_async_engine(async_workers);
+    LOG(INFO) << "Shard " << shards.size() << ": " << index_prefix << ", " << s->index->num_points
+              << " points, tag offset " << tag_offset;
+    shards.push_back(std::move(s));
+    return (int) shards.size() - 1;
+  }
+
+  template<typename T, typename TagT>
+  void ShardedIndex<T, TagT>::search_async(const T *query, const AsyncSearchParams &params,
+                                           AsyncSearchCallback<TagT> callback) {
+    if (shards.empty()) {
+      callback(AsyncSearchResult<TagT>());  // nothing to search; no shard would ever call back.
+      return;
+    }
+    auto gather = std::make_shared<Gather>();
+    gather->remaining.store(shards.size());
+    gather->k_search = params.k_search;
+    gather->callback = std::move(callback);
+    gather->merged.reserve(params.k_search * shards.size());
+
+    AsyncSearchParams shard_params = params;
+    if (early_stop_slack > 0) {
+      shard_params.stop_dist = &gather->stop_dist;  // gather outlives every shard's query.
+    }
+    const float slack = early_stop_slack;
+    for (auto &s : shards) {
+      const TagT tag_offset = s->tag_offset;
+      s->index->search_async(query, shard_params, [gather, tag_offset, slack](AsyncSearchResult<TagT> &&res) {
+        {
+          std::lock_guard<std::mutex> lk(gather->lock);
+          for (size_t i = 0; i < res.tags.size(); ++i) {
+            gather->merged.emplace_back(res.tags[i] + tag_offset, res.dists[i]);
+          }
+          gather->stats.n_ios += res.stats.n_ios;
+          gather->stats.n_4k += res.stats.n_4k;
+          gather->stats.n_cache_hits += res.stats.n_cache_hits;
+          gather->stats.n_coalesced += res.stats.n_coalesced;
+          gather->stats.n_hops += res.stats.n_hops;
+          gather->stats.n_cmps += res.stats.n_cmps;
+          for (uint32_t p = 0; p < kNumQueryPhases; ++p) {
+            gather->stats.phase_us[p] += res.stats.phase_us[p];
+          }
+        }
+        if (slack > 0 && res.dists.size() >= gather->k_search) {
+          // a full top-k from this shard bounds what the others can still contribute.
+          float bound = res.dists[gather->k_search - 1] * slack;
+          float cur = gather->stop_dist.load();
+          while (bound < cur && !gather->stop_dist.compare_exchange_weak(cur, bound)) {
+          }
+        }
+        if (gather->remaining.fetch_sub(1) != 1) {
+          return;
+        }
+        AsyncSearchResult<TagT> out;
+        auto &merged = gather->merged;
+        size_t n = std::min((size_t) gather->k_search, merged.size());
+        std::partial_sort(merged.begin(), merged.begin() + n, merged.end());
+        for (size_t i = 0; i < n; ++i) {
+          out.tags.push_back(merged[i].tag);
+          out.dists.push_back(merged[i].dist);
+        }
+        out.stats = gather->stats;
+        out.stats.total_us = (double) gather->timer.elapsed();
+        gather->callback(std::move(out));
+      });
+    }
+  }
+
+  template<typename T, typename TagT>
+  std::future<AsyncSearchResult<TagT>> ShardedIndex<T, TagT>::search_async(const T *query,
+                                                                           const AsyncSearchParams &params) {
+    auto promise = std::make_shared<std::promise<AsyncSearchResult<TagT>>>();
+    auto future = promise->get_future();
+    search_async(query, params, [promise](AsyncSearchResult<TagT> &&res) { promise->set_value(std::move(res)); });
+    return future;
+  }
+
+  template<typename T, typename TagT>
+  size_t ShardedIndex<T, TagT>::search(const T *query, const AsyncSearchParams &params, TagT *res_tags,
+                                       float *res_dists, QueryStats *stats) {
+    AsyncSearchResult<TagT> res = search_async(query, params).get();
+    std::copy(res.tags.begin(), res.tags.end(), res_tags);
+    if (res_dists != nullptr) {
+      std::copy(res.dists.begin(), res.dists.end(), res_dists);
+    }
+    if (stats != nullptr) {
+      *stats = res.stats;
+    }
+    return res.tags.size();
+  }
+
+  template<typename T, typename TagT>
+  int ShardedIndex<T, TagT>::insert(const T *point, const TagT &tag) {
+    if (insert_params == nullptr || shards.empty()) {
+      LOG(ERROR) << "Inserts need insert_params and at least one shard";
+      return -1;
+    }
+    uint32_t s = insert_policy(point, tag, *this);
+    if (s >= shards.size() || tag < shards[s]->tag_offset) {
+      LOG(ERROR) << "Tag " << tag << " cannot go to shard " << s;
+      return -1;
+    }
+    return shards[s]->index->insert_in_place(point, tag - shards[s]->tag_offset);
+  }
+
+  template<typename T, typename TagT>
+  typename ShardedIndex<T, TagT>::InsertPolicy ShardedIndex<T, TagT>::tag_range_policy() {
+    return [](const T *, TagT tag, const ShardedIndex &index) {
+      // shard 0 when no shard starts at or below tag; insert() then rejects the tag.
+      uint32_t best = 0;
+      bool found = false;
+      for (uint32_t i = 0; i < index.num_shards(); ++i) {
+        if (index.shard_tag_offset(i) <= tag && (!found || index.shard_tag_offset(i) >= index.shard_tag_offset(best))) {
+          best = i;
+          found = true;
+        }
+      }
+      return best;
+    };
+  }
+
+  template<typename T, typename TagT>
+  typename ShardedIndex<T, TagT>::InsertPolicy ShardedIndex<T, TagT>::round_robin_policy() {
+    auto next = std::make_shared<std::atomic<uint32_t>>(0);
+    return [next](const T *, TagT, const ShardedIndex &index) { return next->fetch_add(1) % index.num_shards(); };
+  }
+
+  template<typename T, typename TagT>
+  typename ShardedIndex<T, TagT>::InsertPolicy ShardedIndex<T, TagT>::least_loaded_policy() {
+    return [](const T *, TagT, const ShardedIndex &index) {
+      uint32_t best = 0;
+      for (uint32_t i = 1; i < index.num_shards(); ++i) {
+        if (index.shard(i).num_points < index.shard(best).num_points) {
+          best = i;
+        }
+      }
+      return best;
+    };
+  }
+
+  template class ShardedIndex<float>;
+  template class ShardedIndex<_s8>;
+  template class ShardedIndex<_u8>;
+}  // namespace pipeann
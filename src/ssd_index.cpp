@@ -3,10 +3,15 @@
 #include <malloc.h>
 
 #include <omp.h>
+#include <algorithm>
 #include <cmath>
+#include <thread>
 #include "liburing/io_uring.h"
+#include "page_trace.h"
 #include "parameters.h"
 #include "query_buf.h"
+#include "query_trace.h"
+#include "telemetry.h"
 #include "timer.h"
 #include "utils.h"
 
@@ -32,6 +37,9 @@ namespace pipeann {
   SSDIndex<T, TagT>::SSDIndex(pipeann::Metric m, std::shared_ptr<AlignedFileReader> &fileReader, bool single_file_index,
                               bool tags, Parameters *params)
       : reader(fileReader), data_is_normalized(false), enable_tags(tags) {
+    telemetry_start_from_env();
+    trace_start_from_env();
+    page_trace_start_from_env();
     if (m == pipeann::Metric::COSINE) {
       if (std::is_floating_point<T>::value) {
         LOG(INFO) << "Cosine metric chosen for (normalized) float data."
@@ -62,9 +70,13 @@ namespace pipeann {
 
   template<typename T, typename TagT>
   SSDIndex<T, TagT>::~SSDIndex() {
+    this->stop_async_engine();  // its workers hold query buffers and the reader.
     LOG(INFO) << "Lock table size: " << this->idx_lock_table.size();
     LOG(INFO) << "Page cache size: " << v2::cache.cache.size();
 
+    while (this->n_runtime_bg_tasks_.load() != 0) {
+      std::this_thread::yield();  // the runtime's write-back threads still use this index.
+    }
     if (load_flag) {
       this->destroy_thread_data();
       reader->close();
@@ -77,11 +89,16 @@ namespace pipeann {
 
   template<typename T, typename TagT>
   void SSDIndex<T, TagT>::init_buffers(_u64 n_threads) {
+    if (this->runtime_ != nullptr) {
+      LOG(INFO) << "Using the shared runtime's query buffers and write-back threads.";
+      load_flag = true;
+      return;
+    }
     _u64 n_buffers = n_threads * 2;
     LOG(INFO) << "Init buffers for " << n_threads << " threads, setup " << n_buffers << " buffers.";
     for (uint64_t i = 0; i < n_buffers; i++) {
       QueryBuffer<T> *data = new QueryBuffer<T>();
-      this->init_query_buf(*data);
+      this->init_query_buf(*data, this->aligned_dim);
       this->thread_data_bufs.push_back(data);
       this->thread_data_queue.push(data);
     }
@@ -107,13 +124,7 @@ namespace pipeann {
   void SSDIndex<T, TagT>::destroy_thread_data() {
     // TODO(gh): destruct thread_queue and other readers.
     for (auto &buf : this->thread_data_bufs) {
-      pipeann::aligned_free((void *) buf->coord_scratch);
-      pipeann::aligned_free((void *) buf->sector_scratch);
-      pipeann::aligned_free((void *) buf->aligned_pq_coord_scratch);
-      pipeann::aligned_free((void *) buf->aligned_pqtable_dist_scratch);
-      pipeann::aligned_free((void *) buf->aligned_dist_scratch);
-      pipeann::aligned_free((void *) buf->aligned_query_T);
-      pipeann::aligned_free((void *) buf->update_buf);
+      this->free_query_buf(*buf);
     }
   }
 
@@ -123,6 +134,10 @@ namespace pipeann {
       LOG(ERROR) << "mem_index_path is needed";
       exit(1);
     }
+    if (!keep_pq_codes) {
+      LOG(ERROR) << "In-memory entry points need the PQ codes in memory (set_keep_pq_codes(true))";
+      exit(1);
+    }
     mem_index_ = std::make_unique<pipeann::Index<T, uint32_t>>(metric, query_dim, 0, false, false, true);
     mem_index_->load(mem_index_path.c_str());
   }
@@ -161,15 +176,6 @@ namespace pipeann {
       READ_U64(index_metadata, max_node_len);
       READ_U64(index_metadata, nnodes_per_sector);
       data_dim = disk_ndims;
-      max_degree = ((max_node_len - data_dim * sizeof(T)) / sizeof(unsigned)) - 1;
-      if (max_degree != this->range) {
-        LOG(ERROR) << "Range mismatch: " << max_degree << " vs " << this->range << ", setting range to " << max_degree;
-        this->range = max_degree;
-      }
-
-      LOG(INFO) << "Meta-data: # nodes per sector: " << nnodes_per_sector << ", max node len (bytes): " << max_node_len
-                << ", max node degree: " << max_degree << ", npts: " << nr << ", dim: " << nc
-                << " disk_nnodes: " << disk_nnodes << " disk_ndims: " << disk_ndims;
 
       if (nnodes_per_sector > this->kMaxElemInAPage) {
         LOG(ERROR) << "nnodes_per_sector: " << nnodes_per_sector << " is greater than " << this->kMaxElemInAPage
@@ -188,6 +194,21 @@ namespace pipeann {
       READ_U64(index_metadata, tags_offset);
       READ_U64(index_metadata, pq_pivots_offset);
       READ_U64(index_metadata, pq_vectors_offset);
+      if (nr > kInlinePqMetaIdx) {
+        READ_U64(index_metadata, this->inline_pq_chunks);
+      }
+
+      // node: [coords][nnbrs][nbrs * max_degree][nbr PQ codes * max_degree, if inline]
+      max_degree = (max_node_len - data_dim * sizeof(T) - sizeof(unsigned)) / (sizeof(unsigned) + inline_pq_chunks);
+      if (max_degree != this->range) {
+        LOG(ERROR) << "Range mismatch: " << max_degree << " vs " << this->range << ", setting range to " << max_degree;
+        this->range = max_degree;
+      }
+
+      LOG(INFO) << "Meta-data: # nodes per sector: " << nnodes_per_sector << ", max node len (bytes): " << max_node_len
+                << ", max node degree: " << max_degree << ", inline PQ bytes per neighbor: " << inline_pq_chunks
+                << ", npts: " << nr << ", dim: " << nc << " disk_nnodes: " << disk_nnodes
+                << " disk_ndims: " << disk_ndims;
 
       LOG(INFO) << "Tags offset: " << tags_offset << " PQ Pivots offset: " << pq_pivots_offset
                 << " PQ Vectors offset: " << pq_vectors_offset;
@@ -224,7 +245,28 @@ namespace pipeann {
               << " PQ Pivots offset: " << pq_pivots_offset << " PQ Vectors offset: " << pq_vectors_offset;
 
     size_t npts_u64, nchunks_u64;
-    pipeann::load_bin<_u8>(pq_compressed_vectors, data, npts_u64, nchunks_u64, pq_vectors_offset);
+    if (this->inline_pq_chunks != 0 && !this->keep_pq_codes) {
+      std::ifstream pq_reader(pq_compressed_vectors, std::ios::binary);
+      _u32 npts_u32, nchunks_u32;
+      READ_U32(pq_reader, npts_u32);
+      READ_U32(pq_reader, nchunks_u32);
+      npts_u64 = npts_u32;
+      nchunks_u64 = nchunks_u32;
+      this->medoid_pq_code.resize(nchunks_u64);
+      pq_reader.seekg(2 * sizeof(_u32) + medoid_id_on_file * nchunks_u64, std::ios::beg);
+      pq_reader.read((char *) this->medoid_pq_code.data(), nchunks_u64);
+      LOG(INFO) << "Inline PQ layout: only the medoid's PQ code is kept in memory.";
+    } else {
+      if (!this->keep_pq_codes) {
+        LOG(INFO) << "PQ codes stay in memory: " << disk_index_file << " has no inline neighbor codes.";
+      }
+      pipeann::load_bin<_u8>(pq_compressed_vectors, data, npts_u64, nchunks_u64, pq_vectors_offset);
+    }
+    if (this->inline_pq_chunks != 0 && this->inline_pq_chunks != nchunks_u64) {
+      LOG(ERROR) << "Inline PQ codes have " << this->inline_pq_chunks << " bytes, " << pq_compressed_vectors
+                 << " has " << nchunks_u64;
+      return -1;
+    }
     this->num_points = this->init_num_pts = npts_u64;
     this->n_chunks = nchunks_u64;
 
@@ -250,6 +292,11 @@ namespace pipeann {
 
     // read index metadata
     // open AlignedFileReader handle to index_file
+    if (this->runtime_ != nullptr && this->aligned_dim > this->runtime_->max_aligned_dim()) {
+      LOG(ERROR) << "Index dimension " << this->aligned_dim << " exceeds the runtime's "
+                 << this->runtime_->max_aligned_dim();
+      return -1;
+    }
     std::string index_fname(disk_index_file);
     reader->open(index_fname, true, false);
     this->init_buffers(num_threads);
@@ -269,10 +316,147 @@ namespace pipeann {
     num_medoids = 1;
     medoids = new uint32_t[1];
     medoids[0] = (_u32) (medoid_id_on_file);
+
+    std::string profile_file = iprefix + "_search.profile";
+    has_search_profile_ = file_exists(profile_file) && search_profile_.load(profile_file) == 0;
     LOG(INFO) << "SSDIndex loaded successfully.";
     return 0;
   }
 
+  template<typename T, typename TagT>
+  AsyncSearchParams SSDIndex<T, TagT>::default_search_params() const {
+    AsyncSearchParams params;
+    if (has_search_profile_) {
+      params.k_search = search_profile_.k;
+      params.mem_L = mem_index_ != nullptr ? search_profile_.mem_L : 0;
+      params.l_search = search_profile_.l_search;
+      params.beam_width = search_profile_.beam_width;
+    }
+    return params;
+  }
+
+  template<typename T, typename TagT>
+  int SSDIndex<T, TagT>::load_pinned_pages(const std::string &list_path, uint64_t max_pages) {
+    auto pages = std::make_unique<PinnedPages>();
+    if (pages->load(list_path, _disk_index_file, max_pages) != 0) {
+      return -1;
+    }
+    pinned_epoch_ = update_epoch();
+    pinned_pages_ = std::move(pages);
+    return 0;
+  }
+
+  template<typename T, typename TagT>
+  bool SSDIndex<T, TagT>::serve_pinned(IORequest &req, QueryStats *stats) {
+    if (pinned_pages_ == nullptr || update_epoch() != pinned_epoch_ || req.len % SECTOR_LEN != 0) {
+      return false;
+    }
+    const uint64_t first = req.offset / SECTOR_LEN, n = req.len / SECTOR_LEN;
+    for (uint64_t i = 0; i < n; ++i) {
+      if (pinned_pages_->find(first + i) == nullptr) {
+        return false;
+      }
+    }
+    for (uint64_t i = 0; i < n; ++i) {
+      memcpy((char *) req.buf + i * SECTOR_LEN, pinned_pages_->find(first + i), SECTOR_LEN);
+    }
+    req.finished = true;
+    telemetry_slot().add(kTmPinnedHits);
+    if (stats != nullptr) {
+      stats->n_ios--;
+      stats->n_cache_hits++;
+    }
+    return true;
+  }
+
+  template<typename T, typename TagT>
+  size_t SSDIndex<T, TagT>::serve_pinned(std::vector<IORequest> &reqs, QueryStats *stats) {
+    if (pinned_pages_ == nullptr) {
+      return 0;
+    }
+    size_t n = reqs.size();
+    reqs.erase(std::remove_if(reqs.begin(), reqs.end(), [&](IORequest &req) { return serve_pinned(req, stats); }),
+               reqs.end());
+    return n - reqs.size();
+  }
+
+  template<typename T, typename TagT>
+  bool SSDIndex<T, TagT>::coalesce_read(IORequest &req, QueryStats *stats) {
+    if (inflight_reads_ == nullptr ||
+        !inflight_reads_->attach_or_lead(req.offset / SECTOR_LEN, req.len, req.buf, &req.finished, update_epoch())) {
+      return false;
+    }
+    telemetry_slot().add(kTmCoalescedReads);
+    if (stats != nullptr) {
+      stats->n_ios--;
+      stats->n_coalesced++;
+    }
+    return true;
+  }
+
+  template<typename T, typename TagT>
+  size_t SSDIndex<T, TagT>::coalesce_reads(std::vector<IORequest> &reqs, std::vector<IORequest> &attached,
+                                           QueryStats *stats) {
+    attached.clear();
+    if (inflight_reads_ == nullptr) {
+      return 0;
+    }
+    attached.reserve(reqs.size());  // no reallocation below: the table holds &attached[i].finished.
+    reqs.erase(std::remove_if(reqs.begin(), reqs.end(),
+                              [&](IORequest &req) {
+                                attached.push_back(req);
+                                if (coalesce_read(attached.back(), stats)) {
+                                  return true;
+                                }
+                                attached.pop_back();
+                                return false;
+                              }),
+               reqs.end());
+    return attached.size();
+  }
+
+  template<typename T, typename TagT>
+  void SSDIndex<T, TagT>::publish_finished(std::vector<IORequest *> &leading) {
+    leading.erase(std::remove_if(leading.begin(), leading.end(),
+                                 [&](IORequest *req) {
+                                   if (!__atomic_load_n(&req->finished, __ATOMIC_ACQUIRE)) {
+                                     return false;
+                                   }
+                                   publish_read(*req);
+                                   return true;
+                                 }),
+                  leading.end());
+  }
+
+  template<typename T, typename TagT>
+  void SSDIndex<T, TagT>::rdlock_idx_publishing(v2::SparseLockTable<uint64_t> &lock_table, uint32_t id, void *ctx,
+                                                std::vector<IORequest *> &leading) {
+#ifndef READ_ONLY_TESTS
+    while (lock_table.tryrdlock(id) != 0) {
+      if (!leading.empty()) {
+        reader->poll_all(ctx);
+        publish_finished(leading);
+      }
+      thread_pause();
+    }
+#endif
+  }
+
+  template<typename T, typename TagT>
+  void SSDIndex<T, TagT>::wait_attached(const std::vector<IORequest> &attached) {
+    // the leader may run on our core: spin briefly, then yield to it.
+    constexpr uint32_t kSpinsBeforeYield = 256;
+    for (auto &req : attached) {
+      for (uint32_t spins = 0; !__atomic_load_n(&req.finished, __ATOMIC_ACQUIRE); ++spins) {
+        if (spins < kSpinsBeforeYield) {
+          _mm_pause();
+        } else {
+          std::this_thread::yield();
+        }
+      }
+    }
+  }
+
   template<typename T, typename TagT>
   _u64 SSDIndex<T, TagT>::return_nd() {
     return this->num_points;
@@ -29,15 +29,24 @@ namespace pipeann {
                                         const tsl::robin_set<TagT> &deleted_nodes_set, uint32_t nthreads,
                                         const uint32_t &n_sampled_nbrs) {
     pipeann::set_io_context(pipeann::IoContext::COMPACTION);
+    if (this->data.empty()) {
+      LOG(ERROR) << "Merges need the PQ codes in memory (set_keep_pq_codes(true))";
+      return;
+    }
     if (nthreads == 0) {
       nthreads = this->max_nthreads;
     }
 
     void *ctx = reader->get_ctx();
 
-    while (!bg_tasks.empty()) {
+    while (!bg_tasks.empty() || n_runtime_bg_tasks_.load() != 0) {
       sleep(5);  // simple way to wait for background IO thread.
     }
+    while (thread_pq_bufs.size() < nthreads) {  // not preallocated with a shared runtime.
+      uint8_t *thread_pq_buf;
+      pipeann::alloc_aligned((void **) &thread_pq_buf, 16ul << 20, 256);
+      thread_pq_bufs.push_back(thread_pq_buf);
+    }
     std::string disk_index_out = out_path_prefix + "_disk.index";
     // Note that the index is immutable currently.
     // Step 1: populate neighborhoods, allocate IDs.
@@ -180,16 +189,18 @@ namespace pipeann {
           this->prune_neighbors_pq(pool, nhood, thread_pq_buf);
         }
 
-        // map to new IDs.
-        for (auto &nbr : nhood) {
-          nbr = id_map.find(nbr);
-        }
-
         // write neighbors.
         uint64_t new_id = id_map.find(id);
         uint64_t off = new_id % kVecInWBuf;
         auto page_wbuf = wbuf + (off / nnodes_per_sector) * SECTOR_LEN;
         auto loc_wbuf = offset_to_loc(page_wbuf, off);
+        this->write_nbr_codes(loc_wbuf, nhood.data(), nhood.size());  // codes are indexed by old IDs.
+
+        // map to new IDs.
+        for (auto &nbr : nhood) {
+          nbr = id_map.find(nbr);
+        }
+
         DiskNode<T> w_node(new_id, offset_to_node_coords(loc_wbuf), offset_to_node_nhood(loc_wbuf));
         memcpy(w_node.coords, node.coords, data_dim * sizeof(T));
         w_node.nnbrs = nhood.size();
@@ -262,6 +273,10 @@ namespace pipeann {
     output_metadata.push_back(this->num_frozen_points);
     output_metadata.push_back(this->frozen_location);
     output_metadata.push_back(file_size);
+    if (this->inline_pq_chunks != 0) {
+      output_metadata.resize(kInlinePqMetaIdx, file_size);
+      output_metadata.push_back(this->inline_pq_chunks);
+    }
     LOG(INFO) << "New metadata: " << "num points: " << new_npoints << " data dim: " << this->data_dim
               << " medoid: " << new_medoid << " max node len: " << this->max_node_len;
     LOG(INFO) << "Nnodes per sector: " << nnodes_per_sector << " num frozen points: " << this->num_frozen_points
@@ -312,6 +327,11 @@ namespace pipeann {
     while (!this->empty_pages.empty()) {
       this->empty_pages.pop();
     }
+    if (refine_codes_ != nullptr) {
+      LOG(INFO) << "Dropping the refine codes, IDs changed in the merge.";
+      refine_codes_.reset();
+    }
+    update_epoch_.fetch_add(1, std::memory_order_release);
     merge_lock.unlock();
     return;
   }
@@ -2,6 +2,7 @@
 #include "libcuckoo/cuckoohash_map.hh"
 #include "observability.h"
 #include "ssd_index.h"
+#include "telemetry.h"
 #include <malloc.h>
 #include <algorithm>
 #include <filesystem>
@@ -24,6 +25,11 @@
 namespace pipeann {
   template<typename T, typename TagT>
   int SSDIndex<T, TagT>::insert_in_place(const T *point, const TagT &tag, tsl::robin_set<uint32_t> *deletion_set) {
+    if (unlikely(this->data.empty())) {
+      LOG(ERROR) << "Inserts need the PQ codes in memory (set_keep_pq_codes(true))";
+      return -1;
+    }
+    uint64_t start_cycles = read_cycles();
     QueryBuffer<T> *read_data = this->pop_query_buf(nullptr);
     void *ctx = reader->get_ctx();
 
@@ -138,6 +144,7 @@ namespace pipeann {
     target_node.nnbrs = new_nhood.size();
     *(target_node.nbrs - 1) = target_node.nnbrs;
     memcpy(target_node.nbrs, new_nhood.data(), new_nhood.size() * sizeof(uint32_t));
+    this->write_nbr_codes(node_buf, new_nhood.data(), new_nhood.size());
     tags.insert_or_assign(target_id, tag);
 
     // update the neighbors
@@ -202,6 +209,7 @@ namespace pipeann {
       *(w_nbr_node.nbrs - 1) = (_u32) nhood.size();  // write to buf
       memcpy(w_nbr_node.coords, r_nbr_node.coords, data_dim * sizeof(T));
       memcpy(w_nbr_node.nbrs, nhood.data(), w_nbr_node.nnbrs * sizeof(uint32_t));
+      this->write_nbr_codes(w_node_buf, nhood.data(), nhood.size());
     }
 
     std::vector<uint64_t> write_page_ref;
@@ -239,8 +247,16 @@ namespace pipeann {
           .pages_to_unlock = std::move(pages_locked),
           .pages_to_deref = std::move(write_page_ref),
       };
-      bg_tasks.push(bg_task);
-      bg_tasks.push_notify_all();
+      if (runtime_ != nullptr) {
+        n_runtime_bg_tasks_.fetch_add(1);
+        runtime_->write_back([this, bg_task]() {
+          this->commit_bg_task(bg_task, reader->get_ctx());
+          n_runtime_bg_tasks_.fetch_sub(1);
+        });
+      } else {
+        bg_tasks.push(bg_task);
+        bg_tasks.push_notify_all();
+      }
     } else {
       v2::unlockReqs(this->page_lock_table, pages_locked);
     }
@@ -253,6 +269,10 @@ namespace pipeann {
     reader->deref(&page_ref, ctx);
     this->push_query_buf(read_data);
 #endif
+    update_epoch_.fetch_add(1, std::memory_order_release);
+    TelemetrySlot &slot = telemetry_slot();
+    slot.add(kTmInserts);
+    slot.add(kTmInsertCycles, read_cycles() - start_cycles);
     return target_id;
   }
 
@@ -272,11 +292,7 @@ namespace pipeann {
         task = bg_tasks.pop();
       }
 
-      reader->write(task->writes, ctx);
-      v2::unlockReqs(this->page_lock_table, task->pages_to_unlock);
-      reader->deref(&task->pages_to_deref, ctx);
-      this->push_query_buf(task->thread_data);
-      delete task;
+      this->commit_bg_task(task, ctx);
       ++n_tasks;
 
       if (timer.elapsed() >= 5000000) {
@@ -288,6 +304,15 @@ namespace pipeann {
     }
   }
 
+  template<class T, class TagT>
+  void SSDIndex<T, TagT>::commit_bg_task(BgTask *task, void *ctx) {
+    reader->write(task->writes, ctx);
+    v2::unlockReqs(this->page_lock_table, task->pages_to_unlock);
+    reader->deref(&task->pages_to_deref, ctx);
+    this->push_query_buf(task->thread_data);
+    delete task;
+  }
+
   template class SSDIndex<float>;
   template class SSDIndex<_s8>;
   template class SSDIndex<_u8>;
@@ -3,6 +3,7 @@
 #include "tsl/robin_set.h"
 #include "utils.h"
 #include "v2/dynamic_index.h"
+#include <chrono>
 #include <csignal>
 #include <cstdint>
 #include <mutex>
@@ -26,7 +27,7 @@
 #include "ssd_index.h"
 #include "parameters.h"
 
-#include "linux_aligned_file_reader.h"
+#include "emulated_aligned_file_reader.h"
 
 namespace pipeann {
   void copy_index(const std::string &prefix_in, const std::string &prefix_out) {
@@ -84,7 +85,7 @@ namespace pipeann {
     _disk_index_prefix_out = disk_prefix_out;
     _dist_comp = dist;
 
-    reader.reset(new LinuxAlignedFileReader());
+    reader.reset(new_aligned_file_reader());
     _disk_index = new pipeann::SSDIndex<T, TagT>(this->_dist_metric, reader, false, true, &_paras_disk);
 
 #ifndef NO_POLLUTE_ORIGINAL
@@ -129,16 +130,30 @@ namespace pipeann {
 
   template<typename T, typename TagT>
   int DynamicSSDIndex<T, TagT>::insert(const T *point, const TagT &tag) {
+    auto start = std::chrono::steady_clock::now();
     std::shared_lock<std::shared_timed_mutex> lock(_merge_lock);  // prevent merge during insert
     journal->append(v2::TxType::kInsert, tag);
     auto *deletion_set = &deletion_sets[active_delete_set];
-    return _disk_index->insert_in_place(point, tag, deletion_set);
+    int ret = _disk_index->insert_in_place(point, tag, deletion_set);
+    _update_epoch.fetch_add(1, std::memory_order_release);
+    insert_latency_ns.record(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+    return ret;
   }
 
   template<typename T, typename TagT>
   void DynamicSSDIndex<T, TagT>::search(const T *query, const uint64_t K, const uint32_t mem_L, const uint64_t search_L,
                                         const uint32_t beam_width, TagT *tags, float *distances, QueryStats *stats,
                                         bool dyn_search_l) {
+    QueryStats local_stats;
+    if (stats == nullptr) {
+      stats = &local_stats;
+    }
+    std::shared_ptr<QueryCache<T, TagT>> cache = std::atomic_load(&query_cache);
+    const uint64_t epoch = update_epoch();
+    if (cache != nullptr && search_cached(*cache, query, K, search_L, epoch, tags, distances, stats)) {
+      return;
+    }
     std::vector<TagT> result_tags(4096);
     std::vector<float> result_distances(4096);
     auto *deletion_set = &deletion_sets[active_delete_set];
@@ -153,6 +168,7 @@ namespace pipeann {
       n = _disk_index->pipe_search(query, search_L, mem_L, search_L, result_tags.data(), result_distances.data(),
                                    beam_width, stats);
     }
+    search_stats.record(*stats);
     std::vector<NeighborTag<TagT>> best_vec;
     for (size_t i = 0; i < n; i++) {
       best_vec.emplace_back(result_tags[i], result_distances[i]);
@@ -167,14 +183,48 @@ namespace pipeann {
         pos++;
       }
       if (pos == K) {
-        return;
+        break;
       }
     }
     // LOG(INFO) << "Failed to find enough tags after " << i + 1 << " attempts";
+    if (cache != nullptr) {
+      cache->insert(query, K, search_L, epoch, tags, distances, pos);
+    }
+  }
+
+  template<typename T, typename TagT>
+  bool DynamicSSDIndex<T, TagT>::search_cached(QueryCache<T, TagT> &cache, const T *query, const uint64_t K,
+                                               const uint64_t search_L, uint64_t epoch, TagT *tags,
+                                               float *distances, QueryStats *stats) {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<TagT> hit_tags;
+    std::vector<float> hit_dists;
+    if (!cache.lookup(query, K, search_L, epoch, hit_tags, hit_dists)) {
+      return false;
+    }
+    {
+      // an entry within the epoch lag may predate deletes; search again rather than return fewer results.
+      std::shared_lock<std::shared_timed_mutex> lock(delete_lock);
+      auto *deletion_set = &deletion_sets[active_delete_set];
+      for (auto &tag : hit_tags) {
+        if (deletion_set->find(tag) != deletion_set->end()) {
+          return false;
+        }
+      }
+    }
+    std::copy(hit_tags.begin(), hit_tags.end(), tags);
+    std::copy(hit_dists.begin(), hit_dists.end(), distances);
+    *stats = QueryStats();
+    stats->total_us =
+        (double) std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start)
+            .count();
+    search_stats.record(*stats);
+    return true;
   }
 
   template<typename T, typename TagT>
   void DynamicSSDIndex<T, TagT>::lazy_delete(const TagT &tag) {
+    auto start = std::chrono::steady_clock::now();
     std::unique_lock<std::shared_timed_mutex> lock(delete_lock);
     journal->append(v2::TxType::kDelete, tag);
 
@@ -186,6 +236,30 @@ namespace pipeann {
       deletion_sets[active_delete_set].insert(tag);
       deleted_tags[active_delete_set].push_back(tag);
     }
+    _update_epoch.fetch_add(1, std::memory_order_release);
+    delete_latency_ns.record(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+  }
+
+  template<typename T, typename TagT>
+  void DynamicSSDIndex<T, TagT>::log_stats() {
+    QueryStatsSnapshot snap = search_stats.snapshot();
+    HdrHistogram ins = insert_latency_ns.snapshot(), del = delete_latency_ns.snapshot();
+    LOG(INFO) << "Search: " << snap.latency_ns.count() << " queries, latency(us) mean " << snap.latency_ns.mean() / 1e3
+              << " p50 " << snap.latency_ns.percentile(50) / 1e3 << " p99 " << snap.latency_ns.percentile(99) / 1e3
+              << " p99.9 " << snap.latency_ns.percentile(99.9) / 1e3 << ", IOs mean " << snap.n_ios.mean() << " p99 "
+              << snap.n_ios.percentile(99) << ", hops mean " << snap.n_hops.mean() << ", cmps mean "
+              << snap.n_cmps.mean();
+    LOG(INFO) << "Insert: " << ins.count() << " ops, latency(us) p50 " << ins.percentile(50) / 1e3 << " p99 "
+              << ins.percentile(99) / 1e3 << "; Delete: " << del.count() << " ops, latency(us) p50 "
+              << del.percentile(50) / 1e3 << " p99 " << del.percentile(99) / 1e3;
+  }
+
+  template<typename T, typename TagT>
+  void DynamicSSDIndex<T, TagT>::reset_stats() {
+    search_stats.reset();
+    insert_latency_ns.reset();
+    delete_latency_ns.reset();
   }
 
   template<typename T, typename TagT>
@@ -207,6 +281,7 @@ namespace pipeann {
   template<typename T, typename TagT>
   void DynamicSSDIndex<T, TagT>::final_merge(const uint32_t &nthreads, const uint32_t &n_sampled_nbrs) {
     std::unique_lock<std::shared_timed_mutex> lock(_merge_lock);  // only one merge at a time
+    log_stats();
     // _disk_index_in -> _disk_index_out
     save_del_set();
     pipeann::Timer timer;
@@ -215,6 +290,7 @@ namespace pipeann {
     // TODO(gh): do we really need to reload disk index?
     std::swap(_disk_index_prefix_in, _disk_index_prefix_out);
     _disk_index->reload(_disk_index_prefix_in.c_str(), _num_threads);
+    _update_epoch.fetch_add(1, std::memory_order_release);
     LOG(INFO) << "Merge time : " << timer.elapsed() / 1000 << " ms";
   }
 
@@ -0,0 +1,59 @@
+#include "adaptive_budget.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace pipeann {
+  AdaptiveBudget::AdaptiveBudget(const AdaptiveBudgetParams &params) : params_(params) {
+    params_.spread = std::min(std::max(params_.spread, 0.0f), 1.0f);
+    params_.window = std::max(params_.window, 1u);
+    params_.n_entries = std::max(params_.n_entries, 1u);
+    recent.reserve(params_.window);
+  }
+
+  float AdaptiveBudget::difficulty(const Neighbor *entries, unsigned n, unsigned n_entries) {
+    n = std::min(n, n_entries);
+    if (n == 0) {
+      return 0;
+    }
+    if (n == 1) {
+      return entries[0].distance;
+    }
+    float sum = 0;
+    for (unsigned i = 0; i < n; ++i) {
+      sum += entries[i].distance;
+    }
+    return sum > 0 ? entries[0].distance * n / sum : 1.0f;
+  }
+
+  void AdaptiveBudget::apply(const Neighbor *entries, unsigned n, uint64_t k_search, uint64_t &l_search,
+                             uint64_t &beam_width) {
+    const float d = difficulty(entries, n, params_.n_entries);
+    float rank = 0.5f;
+    bool ready;
+    {
+      std::lock_guard<std::mutex> lk(lock);
+      ready = n_seen >= std::max(params_.min_samples, 1u);
+      if (ready) {
+        uint32_t below = 0, equal = 0;
+        for (float r : recent) {
+          below += r < d;
+          equal += r == d;
+        }
+        rank = (below + 0.5f * equal) / recent.size();
+      }
+      if (recent.size() < params_.window) {
+        recent.push_back(d);
+      } else {
+        recent[n_seen % params_.window] = d;
+      }
+      ++n_seen;
+    }
+    if (!ready) {
+      return;
+    }
+    const float scale = 1.0f + params_.spread * (2 * rank - 1);
+    l_search = std::max<uint64_t>(k_search, (uint64_t) std::lround(l_search * scale));
+    beam_width = std::max<uint64_t>(1, (uint64_t) std::lround(beam_width * scale));
+  }
+}  // namespace pipeann
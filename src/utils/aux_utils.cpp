@@ -1,8 +1,11 @@
 #include <algorithm>
 #include <atomic>
 #include <cassert>
+#include <filesystem>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <limits>
 #include <set>
 #include <string>
 #include <vector>
@@ -656,6 +659,175 @@ namespace pipeann {
     LOG(INFO) << "Output file written.";
   }
 
+  template<typename T>
+  int create_inline_pq_layout(const std::string &in_prefix, const std::string &out_prefix) {
+    std::string in_disk = in_prefix + "_disk.index", out_disk = out_prefix + "_disk.index";
+    if (in_prefix == out_prefix) {
+      LOG(ERROR) << "Output prefix must differ from the input prefix.";
+      return -1;
+    }
+    if (file_exists(in_prefix + "_partition.bin.aligned")) {
+      LOG(ERROR) << "Only ID-ordered indexes convert; run the page layout partitioning on the output instead.";
+      return -1;
+    }
+
+    std::unique_ptr<_u64[]> meta;
+    size_t nr, nc;
+    pipeann::load_bin<_u64>(in_disk, meta, nr, nc, 0);
+    if (nr > kInlinePqMetaIdx && meta[kInlinePqMetaIdx] != 0) {
+      LOG(ERROR) << in_disk << " already stores inline PQ codes.";
+      return -1;
+    }
+    _u64 npts = meta[0], ndims = meta[1], max_node_len = meta[3], nnodes_per_sector = meta[4];
+    _u64 coord_bytes = ndims * sizeof(T);
+    _u64 max_degree = (max_node_len - coord_bytes) / sizeof(unsigned) - 1;
+
+    std::unique_ptr<_u8[]> codes;
+    size_t n_codes, n_chunks;
+    pipeann::load_bin<_u8>(in_prefix + "_pq_compressed.bin", codes, n_codes, n_chunks);
+    if (n_codes < npts) {
+      LOG(ERROR) << "PQ codes cover " << n_codes << " of " << npts << " points.";
+      return -1;
+    }
+
+    // node: [coords][nnbrs][nbrs * max_degree][nbr PQ codes * max_degree]
+    _u64 new_node_len = max_node_len + max_degree * n_chunks;
+    _u64 new_nnodes_per_sector = SECTOR_LEN / new_node_len;  // 0 if new_node_len > SECTOR_LEN
+    _u64 in_unit = nnodes_per_sector > 0 ? SECTOR_LEN : ROUND_UP(max_node_len, SECTOR_LEN);
+    _u64 out_unit = new_nnodes_per_sector > 0 ? SECTOR_LEN : ROUND_UP(new_node_len, SECTOR_LEN);
+    _u64 in_per_unit = std::max(nnodes_per_sector, (_u64) 1), out_per_unit = std::max(new_nnodes_per_sector, (_u64) 1);
+    _u64 n_out_units = DIV_ROUND_UP(npts, out_per_unit);
+    _u64 disk_index_file_size = SECTOR_LEN + n_out_units * out_unit;
+    LOG(INFO) << "Inline PQ layout: max node len " << max_node_len << "B -> " << new_node_len
+              << "B, nodes per sector " << nnodes_per_sector << " -> " << new_nnodes_per_sector << ", " << n_chunks
+              << " code bytes per neighbor.";
+
+    _u64 blk_size = 64 * 1024 * 1024;
+    cached_ifstream in_reader;
+    in_reader.open(in_disk, blk_size, SECTOR_LEN);
+    std::remove(out_disk.c_str());
+    cached_ofstream out_writer;
+    out_writer.open(out_disk, blk_size);
+    std::unique_ptr<char[]> in_buf = std::make_unique<char[]>(in_unit);
+    std::unique_ptr<char[]> out_buf = std::make_unique<char[]>(out_unit);
+    memset(out_buf.get(), 0, out_unit);
+    out_writer.write(out_buf.get(), SECTOR_LEN);  // metadata, written at the end.
+
+    for (_u64 id = 0; id < npts; ++id) {
+      if (id % in_per_unit == 0) {
+        in_reader.read(in_buf.get(), in_unit);
+      }
+      const char *in_node = in_buf.get() + (id % in_per_unit) * max_node_len;
+      char *out_node = out_buf.get() + (id % out_per_unit) * new_node_len;
+      memcpy(out_node, in_node, max_node_len);
+      _u64 nnbrs = std::min((_u64) * (const unsigned *) (in_node + coord_bytes), max_degree);
+      const unsigned *nbrs = (const unsigned *) (in_node + coord_bytes + sizeof(unsigned));
+      _u8 *nbr_codes = (_u8 *) out_node + max_node_len;
+      for (_u64 i = 0; i < nnbrs; ++i) {
+        memcpy(nbr_codes + i * n_chunks, codes.get() + (_u64) nbrs[i] * n_chunks, n_chunks);
+      }
+      if ((id + 1) % out_per_unit == 0 || id + 1 == npts) {
+        out_writer.write(out_buf.get(), out_unit);
+        memset(out_buf.get(), 0, out_unit);
+      }
+    }
+    in_reader.close();
+    out_writer.close();
+
+    std::vector<_u64> out_meta(meta.get(), meta.get() + 7);  // npts .. frozen location.
+    out_meta[3] = new_node_len;
+    out_meta[4] = new_nnodes_per_sector;
+    out_meta.resize(kInlinePqMetaIdx, disk_index_file_size);
+    out_meta.push_back(n_chunks);
+    pipeann::save_bin<_u64>(out_disk, out_meta.data(), out_meta.size(), 1, 0);
+
+    for (const std::string suffix : {"_pq_pivots.bin", "_pq_compressed.bin", "_disk.index.tags"}) {
+      if (file_exists(in_prefix + suffix)) {
+        std::filesystem::copy_file(in_prefix + suffix, out_prefix + suffix,
+                                   std::filesystem::copy_options::overwrite_existing);
+      }
+    }
+    LOG(INFO) << "Wrote " << out_disk << ", " << disk_index_file_size / (1 << 20) << "MB.";
+    return 0;
+  }
+
+  template<typename T>
+  int create_refine_codes(const std::string &prefix) {
+    std::string disk_index = prefix + "_disk.index", out_file = prefix + "_sq8.bin";
+    if (file_exists(prefix + "_partition.bin.aligned")) {
+      LOG(ERROR) << "Only ID-ordered indexes are supported.";
+      return -1;
+    }
+    std::unique_ptr<_u64[]> meta;
+    size_t nr, nc;
+    pipeann::load_bin<_u64>(disk_index, meta, nr, nc, 0);
+    _u64 npts = meta[0], ndims = meta[1], max_node_len = meta[3], nnodes_per_sector = meta[4];
+    if (ndims > SECTOR_LEN) {
+      LOG(ERROR) << "Refine codes need at most " << SECTOR_LEN << " dimensions, the index has " << ndims;
+      return -1;
+    }
+    _u64 in_unit = nnodes_per_sector > 0 ? SECTOR_LEN : ROUND_UP(max_node_len, SECTOR_LEN);
+    _u64 in_per_unit = std::max(nnodes_per_sector, (_u64) 1);
+    _u64 blk_size = 64 * 1024 * 1024;
+    std::unique_ptr<char[]> in_buf = std::make_unique<char[]>(in_unit);
+
+    // reads every node's coordinates in ID order.
+    auto for_each_vector = [&](const std::function<void(_u64, const T *)> &fn) {
+      cached_ifstream in_reader;
+      in_reader.open(disk_index, blk_size, SECTOR_LEN);
+      for (_u64 id = 0; id < npts; ++id) {
+        if (id % in_per_unit == 0) {
+          in_reader.read(in_buf.get(), in_unit);
+        }
+        fn(id, (const T *) (in_buf.get() + (id % in_per_unit) * max_node_len));
+      }
+      in_reader.close();
+    };
+
+    std::vector<float> mins(ndims, std::numeric_limits<float>::max());
+    std::vector<float> maxs(ndims, std::numeric_limits<float>::lowest());
+    for_each_vector([&](_u64, const T *coords) {
+      for (_u64 d = 0; d < ndims; ++d) {
+        mins[d] = std::min(mins[d], (float) coords[d]);
+        maxs[d] = std::max(maxs[d], (float) coords[d]);
+      }
+    });
+    std::vector<float> scales(ndims);
+    for (_u64 d = 0; d < ndims; ++d) {
+      scales[d] = maxs[d] > mins[d] ? (maxs[d] - mins[d]) / 255.0f : 1.0f;
+    }
+
+    // header: [npts][dim][header_sectors][mins][scales], then whole codes per sector.
+    _u64 header_sectors = DIV_ROUND_UP(3 * sizeof(_u64) + 2 * ndims * sizeof(float), SECTOR_LEN);
+    _u64 codes_per_sector = SECTOR_LEN / ndims;
+    std::vector<char> header(header_sectors * SECTOR_LEN, 0);
+    _u64 head[3] = {npts, ndims, header_sectors};
+    memcpy(header.data(), head, sizeof(head));
+    memcpy(header.data() + sizeof(head), mins.data(), ndims * sizeof(float));
+    memcpy(header.data() + sizeof(head) + ndims * sizeof(float), scales.data(), ndims * sizeof(float));
+
+    std::remove(out_file.c_str());
+    cached_ofstream out_writer;
+    out_writer.open(out_file, blk_size);
+    out_writer.write(header.data(), header.size());
+    std::vector<char> sector(SECTOR_LEN, 0);
+    for_each_vector([&](_u64 id, const T *coords) {
+      _u8 *code = (_u8 *) sector.data() + (id % codes_per_sector) * ndims;
+      for (_u64 d = 0; d < ndims; ++d) {
+        float c = std::round(((float) coords[d] - mins[d]) / scales[d]);
+        code[d] = (_u8) std::min(std::max(c, 0.0f), 255.0f);
+      }
+      if ((id + 1) % codes_per_sector == 0 || id + 1 == npts) {
+        out_writer.write(sector.data(), SECTOR_LEN);
+        std::fill(sector.begin(), sector.end(), 0);
+      }
+    });
+    out_writer.close();
+    LOG(INFO) << "Wrote " << out_file << ": " << npts << " codes of " << ndims << "B, "
+              << (header_sectors + DIV_ROUND_UP(npts, codes_per_sector)) * SECTOR_LEN / (1 << 20) << "MB.";
+    return 0;
+  }
+
   template<typename T, typename TagT>
   bool build_disk_index(const char *dataPath, const char *indexFilePath, const char *indexBuildParameters,
                         pipeann::Metric _compareMetric, bool single_file_index, const char *tag_file) {
@@ -945,6 +1117,13 @@ namespace pipeann {
   //     const std::string &pq_pivots_file, const std::string &pq_compressed_vectors_file, bool single_file_index,
   //     const std::string &output_file);
 
+  template int create_inline_pq_layout<int8_t>(const std::string &in_prefix, const std::string &out_prefix);
+  template int create_inline_pq_layout<uint8_t>(const std::string &in_prefix, const std::string &out_prefix);
+  template int create_inline_pq_layout<float>(const std::string &in_prefix, const std::string &out_prefix);
+  template int create_refine_codes<int8_t>(const std::string &prefix);
+  template int create_refine_codes<uint8_t>(const std::string &prefix);
+  template int create_refine_codes<float>(const std::string &prefix);
+
   template bool build_disk_index<int8_t, uint32_t>(const char *dataFilePath, const char *indexFilePath,
                                                    const char *indexBuildParameters, pipeann::Metric _compareMetric,
                                                    bool singleFileIndex, const char *tag_file);
@@ -0,0 +1,144 @@
+#include "early_stop.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+
+#include "log.h"
+
+namespace pipeann {
+  namespace {
+    constexpr uint32_t kMaxStableHops = 16;
+    constexpr float kMinGap = -1.0f, kMaxGap = 4.0f, kMaxFrontierPos = 4.0f;
+  }  // namespace
+
+  int EarlyStopModel::load(const std::string &path) {
+    std::ifstream in(path);
+    if (!in.is_open()) {
+      LOG(ERROR) << "Cannot open early-stop model " << path;
+      return -1;
+    }
+    std::string line, key;
+    uint32_t n_weights = 0;
+    while (std::getline(in, line)) {
+      std::istringstream ss(line);
+      if (!(ss >> key) || key[0] == '#') {
+        continue;
+      }
+      if (key == "threshold") {
+        ss >> threshold;
+      } else if (key == "min_hops") {
+        ss >> min_hops;
+      } else if (key == "bias") {
+        ss >> bias;
+      } else if (key == "weights") {
+        while (n_weights < kNumEarlyStopFeatures && ss >> weights[n_weights]) {
+          ++n_weights;
+        }
+      }
+    }
+    if (n_weights != kNumEarlyStopFeatures) {
+      LOG(ERROR) << "Early-stop model " << path << " has " << n_weights << " weights, expected "
+                 << kNumEarlyStopFeatures;
+      return -1;
+    }
+    LOG(INFO) << "Early-stop model " << path << ": threshold " << threshold << ", min hops " << min_hops;
+    return 0;
+  }
+
+  int EarlyStopModel::save(const std::string &path) const {
+    std::ofstream out(path);
+    if (!out.is_open()) {
+      LOG(ERROR) << "Cannot write early-stop model " << path;
+      return -1;
+    }
+    out << "# features: log_hops stable_hops topk_churn frontier_gap frontier_pos\n";
+    out << "threshold " << threshold << "\nmin_hops " << min_hops << "\nbias " << bias << "\nweights";
+    for (uint32_t i = 0; i < kNumEarlyStopFeatures; ++i) {
+      out << " " << weights[i];
+    }
+    out << "\n";
+    return out.good() ? 0 : -1;
+  }
+
+  float EarlyStopModel::predict(const float *features) const {
+    float z = bias;
+    for (uint32_t i = 0; i < kNumEarlyStopFeatures; ++i) {
+      z += weights[i] * features[i];
+    }
+    return 1.0f / (1.0f + std::exp(-z));
+  }
+
+  void EarlyStop::init(const EarlyStopModel *model, EarlyStopTrace *trace, uint64_t k_search) {
+    finish();  // the previous query of a reused slot.
+    this->model = model;
+    this->trace = trace;
+    k = std::max<uint64_t>(k_search, 1);
+    hops = stable_hops = 0;
+    prev_topk.clear();
+  }
+
+  bool EarlyStop::after_hop(const Neighbor *retset, unsigned cur_list_size, unsigned first_unexpanded,
+                            const std::vector<Neighbor> &expanded) {
+    if (!enabled() || cur_list_size == 0) {
+      return false;
+    }
+    ++hops;
+    const unsigned kk = (unsigned) std::min<uint64_t>(k, cur_list_size);
+    cur_topk.resize(kk);
+    for (unsigned i = 0; i < kk; ++i) {
+      cur_topk[i] = retset[i].id;
+    }
+    std::sort(cur_topk.begin(), cur_topk.end());
+    unsigned kept = 0;
+    for (unsigned i = 0, j = 0; i < cur_topk.size() && j < prev_topk.size();) {
+      if (cur_topk[i] == prev_topk[j]) {
+        ++kept, ++i, ++j;
+      } else {
+        cur_topk[i] < prev_topk[j] ? ++i : ++j;
+      }
+    }
+    const unsigned changed = kk - kept;
+    stable_hops = changed != 0 ? 0 : std::min(stable_hops + 1, kMaxStableHops);
+    prev_topk.swap(cur_topk);
+
+    float f[kNumEarlyStopFeatures];
+    f[kEsLogHops] = std::log2(1.0f + hops);
+    f[kEsStableHops] = (float) stable_hops;
+    f[kEsTopkChurn] = (float) changed / (float) k;
+    const float kth = retset[kk - 1].distance;
+    if (first_unexpanded < cur_list_size) {
+      float gap = (retset[first_unexpanded].distance - kth) / std::max(std::fabs(kth), 1e-6f);
+      f[kEsFrontierGap] = std::min(std::max(gap, kMinGap), kMaxGap);
+    } else {
+      f[kEsFrontierGap] = kMaxGap;  // nothing left to expand.
+    }
+    f[kEsFrontierPos] = std::min((float) first_unexpanded / (float) k, kMaxFrontierPos);
+
+    if (trace != nullptr) {
+      rec.features.emplace_back();
+      std::copy(f, f + kNumEarlyStopFeatures, rec.features.back().begin());
+      std::vector<Neighbor> sorted(expanded);
+      std::sort(sorted.begin(), sorted.end());
+      sorted.erase(std::unique(sorted.begin(), sorted.end(),
+                               [](const Neighbor &a, const Neighbor &b) { return a.id == b.id; }),
+                   sorted.end());
+      rec.topk.emplace_back();
+      for (size_t i = 0; i < std::min<size_t>(k, sorted.size()); ++i) {
+        rec.topk.back().push_back(sorted[i].id);
+      }
+      return false;
+    }
+    return hops >= model->min_hops && model->predict(f) >= model->threshold;
+  }
+
+  void EarlyStop::finish() {
+    if (trace != nullptr) {
+      std::lock_guard<std::mutex> lk(trace->lock);
+      trace->queries.push_back(std::move(rec));
+    }
+    trace = nullptr;
+    rec = EarlyStopTrace::Query();
+  }
+}  // namespace pipeann
@@ -0,0 +1,447 @@
+#include "emulated_aligned_file_reader.h"
+#include "linux_aligned_file_reader.h"
+#include "observability.h"
+#include "query_trace.h"
+#include "telemetry.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <thread>
+#include <unordered_set>
+#include <sys/stat.h>
+
+namespace {
+  inline uint64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+  }
+
+  const char *kDistNames[] = {"fixed", "uniform", "normal", "lognormal", "bimodal"};
+}  // namespace
+
+namespace emuctx {
+  static thread_local void *ctx = nullptr;
+  // bumped by deregister_all_threads(), which frees every thread's context at once; a thread whose context
+  // is from an older epoch registers a new one instead of touching the freed one.
+  static std::atomic<uint64_t> epoch{0};
+  static thread_local uint64_t ctx_epoch = 0;
+  static std::mutex registry_lock;
+  static std::unordered_set<void *> registry;
+  static int n_readers = 0;  // under registry_lock; the last reader to go frees the contexts.
+};
+
+SSDEmulatorConfig SSDEmulatorConfig::parse(const std::string &spec) {
+  SSDEmulatorConfig config;
+  std::stringstream ss(spec);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    if (item.empty()) {
+      continue;
+    }
+    auto pos = item.find('=');
+    if (pos == std::string::npos) {
+      LOG(ERROR) << "Invalid SSD emulator option (expect key=value): " << item;
+      exit(-1);
+    }
+    std::string key = item.substr(0, pos), value = item.substr(pos + 1);
+    if (key == "dist") {
+      auto it = std::find(std::begin(kDistNames), std::end(kDistNames), value);
+      if (it == std::end(kDistNames)) {
+        LOG(ERROR) << "Unknown latency distribution: " << value;
+        exit(-1);
+      }
+      config.dist = (LatencyDist) (it - std::begin(kDistNames));
+    } else if (key == "lat_us") {
+      config.read_lat_us = std::stod(value);
+    } else if (key == "spread_us") {
+      config.lat_spread_us = std::stod(value);
+    } else if (key == "tail_prob") {
+      config.tail_prob = std::stod(value);
+    } else if (key == "tail_us") {
+      config.tail_lat_us = std::stod(value);
+    } else if (key == "write_us") {
+      config.write_lat_us = std::stod(value);
+    } else if (key == "qd_penalty_us") {
+      config.qd_penalty_us = std::stod(value);
+    } else if (key == "channels") {
+      config.n_channels = std::max(1, std::stoi(value));
+    } else if (key == "iops") {
+      config.max_iops = std::stod(value);
+    } else if (key == "bw_mbps") {
+      config.max_bw_mbps = std::stod(value);
+    } else if (key == "seed") {
+      config.seed = std::stoull(value);
+    } else {
+      LOG(ERROR) << "Unknown SSD emulator option: " << key;
+      exit(-1);
+    }
+  }
+  return config;
+}
+
+std::string SSDEmulatorConfig::to_string() const {
+  std::stringstream ss;
+  ss << "dist=" << kDistNames[dist] << ",lat_us=" << read_lat_us << ",spread_us=" << lat_spread_us
+     << ",tail_prob=" << tail_prob << ",tail_us=" << tail_lat_us << ",write_us=" << write_lat_us
+     << ",qd_penalty_us=" << qd_penalty_us << ",channels=" << n_channels << ",iops=" << max_iops
+     << ",bw_mbps=" << max_bw_mbps << ",seed=" << seed;
+  return ss.str();
+}
+
+EmulatedAlignedFileReader::EmulatedAlignedFileReader(const SSDEmulatorConfig &config) : config_(config) {
+  channel_free_ns_.assign(config_.n_channels, 0);
+  {
+    std::lock_guard<std::mutex> guard(emuctx::registry_lock);
+    ++emuctx::n_readers;
+  }
+  LOG(INFO) << "Using emulated SSD: " << config_.to_string();
+}
+
+EmulatedAlignedFileReader::~EmulatedAlignedFileReader() {
+  close();
+  bool last;
+  {
+    std::lock_guard<std::mutex> guard(emuctx::registry_lock);
+    last = --emuctx::n_readers == 0;
+  }
+  if (last) {
+    deregister_all_threads();  // no reader left, so no IO is in flight on any context.
+  }
+}
+
+void *EmulatedAlignedFileReader::get_ctx(int flag) {
+  if (unlikely(emuctx::ctx == nullptr || emuctx::ctx_epoch != emuctx::epoch.load(std::memory_order_acquire))) {
+    register_thread(flag);
+  }
+  return emuctx::ctx;
+}
+
+void EmulatedAlignedFileReader::register_thread(int flag) {
+  std::lock_guard<std::mutex> guard(emuctx::registry_lock);
+  uint64_t epoch = emuctx::epoch.load(std::memory_order_acquire);
+  if (emuctx::ctx == nullptr || emuctx::ctx_epoch != epoch) {
+    auto ctx = new EmuCtx();
+    ctx->rng.seed(config_.seed * 1000003 + n_threads_.fetch_add(1));
+    emuctx::registry.insert(ctx);
+    emuctx::ctx = ctx;
+    emuctx::ctx_epoch = epoch;
+  }
+}
+
+void EmulatedAlignedFileReader::deregister_thread() {
+  std::lock_guard<std::mutex> guard(emuctx::registry_lock);
+  if (emuctx::ctx != nullptr && emuctx::ctx_epoch == emuctx::epoch.load(std::memory_order_acquire)) {
+    emuctx::registry.erase(emuctx::ctx);
+    delete (EmuCtx *) emuctx::ctx;
+  }
+  emuctx::ctx = nullptr;
+}
+
+// Frees every thread's context. The caller makes sure no IO is in flight; threads that use the reader
+// afterwards get a fresh context.
+void EmulatedAlignedFileReader::deregister_all_threads() {
+  std::lock_guard<std::mutex> guard(emuctx::registry_lock);
+  for (auto ctx : emuctx::registry) {
+    delete (EmuCtx *) ctx;
+  }
+  emuctx::registry.clear();
+  emuctx::epoch.fetch_add(1, std::memory_order_release);
+  emuctx::ctx = nullptr;
+}
+
+void EmulatedAlignedFileReader::open(const std::string &fname, bool enable_writes, bool enable_create) {
+  std::unique_lock<std::shared_mutex> guard(image_lock_);
+  free(image_);
+  image_ = nullptr;
+  image_size_ = image_capacity_ = 0;
+
+  int fd = ::open(fname.c_str(), O_RDONLY | (enable_create ? O_CREAT : 0), 0644);
+  if (fd == -1) {
+    LOG(ERROR) << "Emulated SSD: cannot open " << fname << ": " << strerror(errno);
+    crash();
+  }
+  struct stat st;
+  fstat(fd, &st);
+  image_size_ = st.st_size;
+  image_capacity_ = ROUND_UP(std::max<uint64_t>(image_size_, SECTOR_LEN), SECTOR_LEN);
+  image_ = (char *) aligned_alloc(SECTOR_LEN, image_capacity_);
+  memset(image_ + image_size_, 0, image_capacity_ - image_size_);
+  for (uint64_t done = 0; done < image_size_;) {
+    ssize_t ret = ::pread(fd, image_ + done, std::min<uint64_t>(image_size_ - done, 1ull << 30), done);
+    if (ret <= 0) {
+      LOG(ERROR) << "Emulated SSD: failed to load " << fname << ": " << strerror(errno);
+      crash();
+    }
+    done += ret;
+  }
+  ::close(fd);
+  LOG(INFO) << "Emulated SSD: loaded " << image_size_ << " bytes of " << fname << " into memory.";
+}
+
+void EmulatedAlignedFileReader::close() {
+  std::unique_lock<std::shared_mutex> guard(image_lock_);
+  free(image_);
+  image_ = nullptr;
+  image_size_ = image_capacity_ = 0;
+}
+
+double EmulatedAlignedFileReader::sample_latency_us(EmuCtx *ctx, bool write) {
+  if (write) {
+    return config_.write_lat_us;
+  }
+  const double mean = config_.read_lat_us, spread = config_.lat_spread_us;
+  double lat = mean;
+  switch (config_.dist) {
+    case SSDEmulatorConfig::FIXED:
+      break;
+    case SSDEmulatorConfig::UNIFORM:
+      lat = std::uniform_real_distribution<double>(mean - spread, mean + spread)(ctx->rng);
+      break;
+    case SSDEmulatorConfig::NORMAL:
+      lat = std::normal_distribution<double>(mean, spread)(ctx->rng);
+      break;
+    case SSDEmulatorConfig::LOGNORMAL: {
+      // Parameterized by mean and stddev of the resulting distribution.
+      double sigma2 = std::log(1 + (spread * spread) / (mean * mean));
+      lat = std::lognormal_distribution<double>(std::log(mean) - sigma2 / 2, std::sqrt(sigma2))(ctx->rng);
+      break;
+    }
+    case SSDEmulatorConfig::BIMODAL:
+      if (std::uniform_real_distribution<double>(0, 1)(ctx->rng) < config_.tail_prob) {
+        lat = config_.tail_lat_us;
+      } else {
+        lat = std::normal_distribution<double>(mean, spread)(ctx->rng);
+      }
+      break;
+  }
+  return std::max(lat, 1.0);
+}
+
+uint64_t EmulatedAlignedFileReader::submit(EmuCtx *ctx, IORequest &req, bool write, int fd) {
+  const uint64_t now = now_ns();
+  pipeann::telemetry_slot().add_io(write, 1, req.len);
+  if (fd != -1) {
+    ssize_t ret = write ? ::pwrite(fd, req.buf, req.len, req.offset) : ::pread(fd, req.buf, req.len, req.offset);
+    if (ret < 0) {
+      LOG(ERROR) << "Failed " << strerror(errno) << " fd " << fd << " offset " << req.offset << " len " << req.len;
+    }
+  } else if (write) {
+    std::shared_lock<std::shared_mutex> guard(image_lock_);
+    if (req.offset + req.len > image_capacity_) {
+      guard.unlock();
+      std::unique_lock<std::shared_mutex> grow_guard(image_lock_);
+      if (req.offset + req.len > image_capacity_) {
+        uint64_t new_capacity = ROUND_UP(std::max(image_capacity_ * 2, req.offset + req.len), SECTOR_LEN);
+        char *new_image = (char *) aligned_alloc(SECTOR_LEN, new_capacity);
+        memcpy(new_image, image_, image_capacity_);
+        memset(new_image + image_capacity_, 0, new_capacity - image_capacity_);
+        free(image_);
+        image_ = new_image;
+        image_capacity_ = new_capacity;
+      }
+      memcpy(image_ + req.offset, req.buf, req.len);
+      image_size_ = std::max(image_size_, req.offset + req.len);
+    } else {
+      // Concurrent writers to the same page are serialized by the index's page locks.
+      memcpy(image_ + req.offset, req.buf, req.len);
+      if (req.offset + req.len > image_size_) {
+        guard.unlock();
+        std::unique_lock<std::shared_mutex> size_guard(image_lock_);
+        image_size_ = std::max(image_size_, req.offset + req.len);
+      }
+    }
+  } else {
+    std::shared_lock<std::shared_mutex> guard(image_lock_);
+    uint64_t avail = req.offset < image_capacity_ ? std::min(req.len, image_capacity_ - req.offset) : 0;
+    memcpy(req.buf, image_ + req.offset, avail);
+    memset((char *) req.buf + avail, 0, req.len - avail);
+  }
+  (write ? n_writes_ : n_reads_).fetch_add(1, std::memory_order_relaxed);
+
+  const double service_ns = sample_latency_us(ctx, write) * 1000;
+  std::lock_guard<std::mutex> guard(device_lock_);
+  while (!in_flight_.empty() && in_flight_.top() <= now) {
+    in_flight_.pop();
+  }
+  double start = (double) now;
+  if (config_.max_iops > 0) {
+    start = std::max(start, iops_gate_ns_);
+    iops_gate_ns_ = start + 1e9 / config_.max_iops;
+  }
+  if (config_.max_bw_mbps > 0) {
+    start = std::max(start, bw_gate_ns_);
+    bw_gate_ns_ = start + (double) req.len * 1e9 / (config_.max_bw_mbps * (1 << 20));
+  }
+  auto channel = std::min_element(channel_free_ns_.begin(), channel_free_ns_.end());
+  double begin = std::max(start, (double) *channel);
+  uint64_t complete = (uint64_t) (begin + service_ns + config_.qd_penalty_us * 1000 * in_flight_.size());
+  *channel = complete;
+  in_flight_.push(complete);
+  return complete;
+}
+
+void EmulatedAlignedFileReader::wait_until(uint64_t ns) {
+  constexpr uint64_t kSpinThresholdNs = 100000;
+  uint64_t now = now_ns();
+  if (ns > now + kSpinThresholdNs) {
+    std::this_thread::sleep_for(std::chrono::nanoseconds(ns - now - kSpinThresholdNs / 2));
+  }
+  while (now_ns() < ns) {
+    thread_pause();
+  }
+}
+
+void EmulatedAlignedFileReader::complete_blocking(EmuCtx *ctx, std::vector<IORequest> &reqs, bool write, int fd) {
+  uint64_t last = 0;
+  for (auto &req : reqs) {
+    last = std::max(last, submit(ctx, req, write, fd));
+  }
+  wait_until(last);
+}
+
+void EmulatedAlignedFileReader::read(std::vector<IORequest> &read_reqs, void *ctx, bool async) {
+  complete_blocking((EmuCtx *) ctx, read_reqs, false, -1);
+}
+
+void EmulatedAlignedFileReader::write(std::vector<IORequest> &write_reqs, void *ctx, bool async) {
+  complete_blocking((EmuCtx *) ctx, write_reqs, true, -1);
+}
+
+void EmulatedAlignedFileReader::read_fd(int fd, std::vector<IORequest> &read_reqs, void *ctx) {
+  complete_blocking((EmuCtx *) ctx, read_reqs, false, fd);
+}
+
+void EmulatedAlignedFileReader::write_fd(int fd, std::vector<IORequest> &write_reqs, void *ctx) {
+  complete_blocking((EmuCtx *) ctx, write_reqs, true, fd);
+}
+
+void EmulatedAlignedFileReader::send_io(IORequest &req, void *ctx, bool write) {
+  EmuCtx *emu = (EmuCtx *) ctx;
+  req.finished = false;
+  emu->pending.push(PendingIO{submit(emu, req, write), &req});
+}
+
+void EmulatedAlignedFileReader::send_io(std::vector<IORequest> &reqs, void *ctx, bool write) {
+  for (auto &req : reqs) {
+    send_io(req, ctx, write);
+  }
+}
+
+int EmulatedAlignedFileReader::poll(void *ctx) {
+  EmuCtx *emu = (EmuCtx *) ctx;
+  if (emu->pending.empty() || emu->pending.top().complete_ns > now_ns()) {
+    return -EAGAIN;  // not finished yet.
+  }
+  emu->pending.top().req->finished = true;
+  emu->pending.pop();
+  return 0;
+}
+
+void EmulatedAlignedFileReader::poll_all(void *ctx) {
+  EmuCtx *emu = (EmuCtx *) ctx;
+  uint64_t now = now_ns();
+  while (!emu->pending.empty() && emu->pending.top().complete_ns <= now) {
+    emu->pending.top().req->finished = true;
+    emu->pending.pop();
+  }
+}
+
+void EmulatedAlignedFileReader::poll_wait(void *ctx) {
+  EmuCtx *emu = (EmuCtx *) ctx;
+  if (emu->pending.empty()) {
+    LOG(ERROR) << "poll_wait() called with no IO in flight.";
+    return;
+  }
+  wait_until(emu->pending.top().complete_ns);
+  emu->pending.top().req->finished = true;
+  emu->pending.pop();
+}
+
+int EmulatedAlignedFileReader::send_read_no_alloc(IORequest &req, void *ctx) {
+  uint64_t page_id = req.offset / SECTOR_LEN;
+#ifndef READ_ONLY_TESTS
+  if (v2::cache.get(page_id, (uint8_t *) req.buf)) {
+    PIPANN_PROBE_TIER_HIT(page_id);
+    pipeann::telemetry_slot().add(pipeann::kTmTierHits);
+    pipeann::trace_event(pipeann::kTrTierHit, page_id);
+    req.finished = true;
+    return 1;
+  }
+#endif
+  PIPANN_PROBE_TIER_MISS(page_id);
+  PIPANN_PROBE_READ_PAGE_REQUEST(page_id, req.offset);
+  pipeann::telemetry_slot().add(pipeann::kTmTierMisses);
+  pipeann::trace_event(pipeann::kTrTierMiss, page_id);
+  send_io(req, ctx, false);
+  return 1;
+}
+
+int EmulatedAlignedFileReader::send_read_no_alloc(std::vector<IORequest> &reqs, void *ctx) {
+  int n_ios = 0;
+  for (auto &req : reqs) {
+#ifndef READ_ONLY_TESTS
+    if (v2::cache.get(req.offset / SECTOR_LEN, (uint8_t *) req.buf)) {
+      PIPANN_PROBE_TIER_HIT(req.offset / SECTOR_LEN);
+      pipeann::telemetry_slot().add(pipeann::kTmTierHits);
+      pipeann::trace_event(pipeann::kTrTierHit, req.offset / SECTOR_LEN);
+      req.finished = true;
+      continue;
+    }
+#endif
+    PIPANN_PROBE_TIER_MISS(req.offset / SECTOR_LEN);
+    PIPANN_PROBE_READ_PAGE_REQUEST(req.offset / SECTOR_LEN, req.offset);
+    pipeann::telemetry_slot().add(pipeann::kTmTierMisses);
+    pipeann::trace_event(pipeann::kTrTierMiss, req.offset / SECTOR_LEN);
+    send_io(req, ctx, false);
+    ++n_ios;
+  }
+  return n_ios;
+}
+
+void EmulatedAlignedFileReader::read_alloc(std::vector<IORequest> &read_reqs, void *ctx,
+                                           std::vector<uint64_t> *page_ref) {
+#ifndef READ_ONLY_TESTS
+  std::vector<IORequest> disk_read_reqs;
+  for (auto &req : read_reqs) {
+    if (req.offset % SECTOR_LEN != 0) {
+      LOG(ERROR) << "Unaligned read offset: " << req.offset << ", len: " << req.len;
+      crash();
+    }
+    if (!v2::cache.get(req.offset / SECTOR_LEN, (uint8_t *) req.buf, true)) {
+      pipeann::trace_event(pipeann::kTrTierMiss, req.offset / SECTOR_LEN);
+      disk_read_reqs.push_back(req);
+    } else {
+      pipeann::trace_event(pipeann::kTrTierHit, req.offset / SECTOR_LEN);
+    }
+  }
+  pipeann::telemetry_slot().add(pipeann::kTmTierMisses, disk_read_reqs.size());
+  pipeann::telemetry_slot().add(pipeann::kTmTierHits, read_reqs.size() - disk_read_reqs.size());
+
+  if (disk_read_reqs.size() > 0) {
+    read(disk_read_reqs, ctx);
+    for (auto &req : disk_read_reqs) {
+      v2::cache.put(req.offset / SECTOR_LEN, (uint8_t *) req.buf, true);
+    }
+  }
+
+  if (page_ref != nullptr) {
+    for (auto &req : read_reqs) {
+      page_ref->push_back(req.offset / SECTOR_LEN);
+    }
+  }
+#else
+  read(read_reqs, ctx);
+#endif
+}
+
+AlignedFileReader *new_aligned_file_reader() {
+  const char *spec = std::getenv("PIPEANN_SSD_EMULATOR");
+  if (spec != nullptr) {
+    return new EmulatedAlignedFileReader(SSDEmulatorConfig::parse(spec));
+  }
+  return new LinuxAlignedFileReader();
+}
@@ -0,0 +1,42 @@
+#include "inflight_reads.h"
+
+#include <cstring>
+
+namespace pipeann {
+  bool InflightReads::attach_or_lead(uint64_t sector, uint64_t len, void *buf, bool *finished, uint64_t epoch) {
+    Shard &s = shard(sector);
+    std::lock_guard<std::mutex> guard(s.mu);
+    auto it = s.reads.find(sector);
+    if (it == s.reads.end()) {
+      s.reads.insert({sector, Entry{buf, len, epoch, {}}});
+      return false;
+    }
+    if (it->second.len != len || it->second.epoch != epoch) {
+      return false;  // read it separately; the in-flight page may predate an update.
+    }
+    __atomic_store_n(finished, false, __ATOMIC_RELAXED);
+    it.value().waiters.push_back({buf, finished});
+    return true;
+  }
+
+  void InflightReads::complete(uint64_t sector, const void *buf) {
+    std::vector<Waiter> waiters;
+    uint64_t len;
+    {
+      Shard &s = shard(sector);
+      std::lock_guard<std::mutex> guard(s.mu);
+      auto it = s.reads.find(sector);
+      if (it == s.reads.end() || it->second.leader != buf) {
+        return;
+      }
+      waiters.swap(it.value().waiters);
+      len = it->second.len;
+      s.reads.erase(it);
+    }
+    // new readers of sector lead a new read from here on; the waiters are no longer reachable by others.
+    for (auto &w : waiters) {
+      memcpy(w.buf, buf, len);
+      __atomic_store_n(w.finished, true, __ATOMIC_RELEASE);
+    }
+  }
+}  // namespace pipeann
@@ -1,6 +1,8 @@
 #ifndef USE_AIO
 #include "linux_aligned_file_reader.h"
 #include "observability.h"
+#include "query_trace.h"
+#include "telemetry.h"
 
 #include <cassert>
 #include <cstdint>
@@ -123,6 +125,7 @@ void LinuxAlignedFileReader::close() {
 
 void LinuxAlignedFileReader::read(std::vector<IORequest> &read_reqs, void *ctx, bool async) {
   assert(this->file_desc != -1);
+  pipeann::telemetry_record_ios(read_reqs, false);
   execute_io(ctx, this->file_desc, read_reqs);
   if (async == true) {
     std::cerr << "async only supported in Windows for now." << std::endl;
@@ -131,6 +134,7 @@ void LinuxAlignedFileReader::read(std::vector<IORequest> &read_reqs, void *ctx,
 
 void LinuxAlignedFileReader::write(std::vector<IORequest> &write_reqs, void *ctx, bool async) {
   assert(this->file_desc != -1);
+  pipeann::telemetry_record_ios(write_reqs, true);
   execute_io(ctx, this->file_desc, write_reqs, 0, true);
   if (async == true) {
     std::cerr << "async only supported in Windows for now." << std::endl;
@@ -139,15 +143,18 @@ void LinuxAlignedFileReader::write(std::vector<IORequest> &write_reqs, void *ctx
 
 void LinuxAlignedFileReader::read_fd(int fd, std::vector<IORequest> &read_reqs, void *ctx) {
   assert(this->file_desc != -1);
+  pipeann::telemetry_record_ios(read_reqs, false);
   execute_io(ctx, fd, read_reqs);
 }
 
 void LinuxAlignedFileReader::write_fd(int fd, std::vector<IORequest> &write_reqs, void *ctx) {
   assert(this->file_desc != -1);
+  pipeann::telemetry_record_ios(write_reqs, true);
   execute_io(ctx, fd, write_reqs, 0, true);
 }
 
 void LinuxAlignedFileReader::send_io(IORequest &req, void *ctx, bool write) {
+  pipeann::telemetry_slot().add_io(write, 1, req.len);
   io_uring *ring = (io_uring *) ctx;
   auto sqe = io_uring_get_sqe(ring);
   req.finished = false;
@@ -161,6 +168,7 @@ void LinuxAlignedFileReader::send_io(IORequest &req, void *ctx, bool write) {
 }
 
 void LinuxAlignedFileReader::send_io(std::vector<IORequest> &reqs, void *ctx, bool write) {
+  pipeann::telemetry_record_ios(reqs, write);
   io_uring *ring = (io_uring *) ctx;
   for (uint64_t j = 0; j < reqs.size(); j++) {
     auto sqe = io_uring_get_sqe(ring);
@@ -231,6 +239,8 @@ void LinuxAlignedFileReader::poll_wait(void *ctx) {
 
 #else
 #include "linux_aligned_file_reader.h"
+#include "query_trace.h"
+#include "telemetry.h"
 
 #include <libaio.h>
 #include <cassert>
@@ -369,6 +379,7 @@ void LinuxAlignedFileReader::close() {
 
 void LinuxAlignedFileReader::read(std::vector<IORequest> &read_reqs, void *ctx, bool async) {
   assert(this->file_desc != -1);
+  pipeann::telemetry_record_ios(read_reqs, false);
   execute_io(ctx, this->file_desc, read_reqs);
   if (async == true) {
     std::cerr << "async only supported in Windows for now." << std::endl;
@@ -377,6 +388,7 @@ void LinuxAlignedFileReader::read(std::vector<IORequest> &read_reqs, void *ctx,
 
 void LinuxAlignedFileReader::write(std::vector<IORequest> &write_reqs, void *ctx, bool async) {
   assert(this->file_desc != -1);
+  pipeann::telemetry_record_ios(write_reqs, true);
   execute_io(ctx, this->file_desc, write_reqs, 0, true);
   if (async == true) {
     std::cerr << "async only supported in Windows for now." << std::endl;
@@ -385,15 +397,18 @@ void LinuxAlignedFileReader::write(std::vector<IORequest> &write_reqs, void *ctx
 
 void LinuxAlignedFileReader::read_fd(int fd, std::vector<IORequest> &read_reqs, void *ctx) {
   assert(this->file_desc != -1);
+  pipeann::telemetry_record_ios(read_reqs, false);
   execute_io(ctx, fd, read_reqs);
 }
 
 void LinuxAlignedFileReader::write_fd(int fd, std::vector<IORequest> &write_reqs, void *ctx) {
   assert(this->file_desc != -1);
+  pipeann::telemetry_record_ios(write_reqs, true);
   execute_io(ctx, fd, write_reqs, 0, true);
 }
 
 void LinuxAlignedFileReader::send_io(std::vector<IORequest> &reqs, void *ctx, bool write) {
+  pipeann::telemetry_record_ios(reqs, write);
   uint64_t n_ops = std::min(reqs.size(), (uint64_t) MAX_EVENTS);
   std::vector<iocb_t *> cbs(n_ops, nullptr);
   std::vector<struct iocb> cb(n_ops);
@@ -419,6 +434,7 @@ void LinuxAlignedFileReader::send_io(std::vector<IORequest> &reqs, void *ctx, bo
 }
 
 void LinuxAlignedFileReader::send_io(IORequest &req, void *ctx, bool write) {
+  pipeann::telemetry_slot().add_io(write, 1, req.len);
   iocb_t cb;
   req.finished = false;  // reset finished flag
   if (write) {
@@ -491,9 +507,13 @@ int LinuxAlignedFileReader::send_read_no_alloc(IORequest &req, void *ring) {
   if (!v2::cache.get(req.offset / SECTOR_LEN, (uint8_t *) req.buf)) {
     PIPANN_PROBE_TIER_MISS(page_id);
     PIPANN_PROBE_READ_PAGE_REQUEST(page_id, req.offset);
+    pipeann::telemetry_slot().add(pipeann::kTmTierMisses);
+    pipeann::trace_event(pipeann::kTrTierMiss, page_id);
     send_io(req, ring, false);
   } else {
     PIPANN_PROBE_TIER_HIT(page_id);
+    pipeann::telemetry_slot().add(pipeann::kTmTierHits);
+    pipeann::trace_event(pipeann::kTrTierHit, page_id);
     req.finished = true;
   }
 #else
@@ -507,6 +527,7 @@ int LinuxAlignedFileReader::send_read_no_alloc(IORequest &req, void *ring) {
 int LinuxAlignedFileReader::send_read_no_alloc(std::vector<IORequest> &reqs, void *ring) {
 #ifndef READ_ONLY_TESTS
   std::vector<IORequest> disk_read_reqs;
+  pipeann::TelemetrySlot &slot = pipeann::telemetry_slot();
   for (auto &req : reqs) {
     if (req.offset % SECTOR_LEN != 0 || req.len != SECTOR_LEN) {
       LOG(ERROR) << "Unaligned read offset: " << req.offset << ", len: " << req.len;
@@ -516,8 +537,12 @@ int LinuxAlignedFileReader::send_read_no_alloc(std::vector<IORequest> &reqs, voi
       PIPANN_PROBE_TIER_MISS(page_id);
       PIPANN_PROBE_READ_PAGE_REQUEST(page_id, req.offset);
       disk_read_reqs.push_back(req);
+      slot.add(pipeann::kTmTierMisses);
+      pipeann::trace_event(pipeann::kTrTierMiss, page_id);
     } else {
       PIPANN_PROBE_TIER_HIT(page_id);
+      slot.add(pipeann::kTmTierHits);
+      pipeann::trace_event(pipeann::kTrTierHit, page_id);
     }
   }
   send_io(disk_read_reqs, ring, false);
@@ -544,9 +569,14 @@ void LinuxAlignedFileReader::read_alloc(std::vector<IORequest> &read_reqs, void
       crash();
     }
     if (!v2::cache.get(req.offset / SECTOR_LEN, (uint8_t *) req.buf, true)) {
+      pipeann::trace_event(pipeann::kTrTierMiss, req.offset / SECTOR_LEN);
       disk_read_reqs.push_back(req);
+    } else {
+      pipeann::trace_event(pipeann::kTrTierHit, req.offset / SECTOR_LEN);
     }
   }
+  pipeann::telemetry_slot().add(pipeann::kTmTierMisses, disk_read_reqs.size());
+  pipeann::telemetry_slot().add(pipeann::kTmTierHits, read_reqs.size() - disk_read_reqs.size());
 
   if (disk_read_reqs.size() > 0) {
     read(disk_read_reqs, ctx);
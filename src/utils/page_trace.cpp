@@ -0,0 +1,167 @@
+#include "page_trace.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "log.h"
+
+namespace pipeann {
+  namespace {
+    constexpr size_t kFlushRecords = 16384;
+
+    struct PageTraceBuffer {
+      std::mutex lock;  // the owner appends under it; page_trace_stop() flushes under it.
+      std::vector<PageAccess> records;
+      uint32_t thread = 0;
+      bool owned = false;
+    };
+
+    struct PageTraceRegistry {
+      std::mutex lock;  // guards file and buffers.
+      FILE *file = nullptr;
+      std::vector<std::unique_ptr<PageTraceBuffer>> buffers;
+      std::atomic<uint32_t> next_query_id{0};
+    };
+
+    PageTraceRegistry &page_trace_registry() {
+      static PageTraceRegistry *reg = new PageTraceRegistry();  // never destroyed: threads may exit after main().
+      return *reg;
+    }
+
+    // caller holds buf.lock.
+    void flush_locked(PageTraceBuffer &buf) {
+      if (buf.records.empty()) {
+        return;
+      }
+      PageTraceRegistry &reg = page_trace_registry();
+      std::lock_guard<std::mutex> lk(reg.lock);
+      if (reg.file != nullptr &&
+          fwrite(buf.records.data(), sizeof(PageAccess), buf.records.size(), reg.file) != buf.records.size()) {
+        LOG(ERROR) << "Short write to page trace file";
+      }
+      buf.records.clear();
+    }
+
+    // The calling thread's buffer; handed to the next new thread when this one exits.
+    struct PageTraceOwner {
+      PageTraceBuffer *buf = nullptr;
+
+      ~PageTraceOwner() {
+        if (buf == nullptr) {
+          return;
+        }
+        std::lock_guard<std::mutex> lk(buf->lock);
+        flush_locked(*buf);
+        std::lock_guard<std::mutex> rlk(page_trace_registry().lock);
+        buf->owned = false;
+      }
+
+      PageTraceBuffer &get() {
+        if (__builtin_expect(buf != nullptr, 1)) {
+          return *buf;
+        }
+        PageTraceRegistry &reg = page_trace_registry();
+        std::lock_guard<std::mutex> lk(reg.lock);
+        for (auto &b : reg.buffers) {
+          if (!b->owned) {
+            buf = b.get();
+            break;
+          }
+        }
+        if (buf == nullptr) {
+          reg.buffers.emplace_back(new PageTraceBuffer());
+          buf = reg.buffers.back().get();
+          buf->thread = reg.buffers.size() - 1;
+          buf->records.reserve(kFlushRecords);
+        }
+        buf->owned = true;
+        return *buf;
+      }
+    };
+
+    // Flushes and closes the trace at exit.
+    struct PageTraceCloser {
+      ~PageTraceCloser() {
+        page_trace_stop();
+      }
+    };
+  }  // namespace
+
+  int page_trace_start(const std::string &path) {
+    PageTraceRegistry &reg = page_trace_registry();
+    std::lock_guard<std::mutex> lk(reg.lock);
+    if (reg.file != nullptr) {
+      LOG(ERROR) << "Page trace already running";
+      return -1;
+    }
+    reg.file = fopen(path.c_str(), "wb");
+    if (reg.file == nullptr) {
+      LOG(ERROR) << "Cannot create page trace file " << path;
+      return -1;
+    }
+    PageTraceFileHeader hdr;
+    memcpy(hdr.magic, kPageTraceMagic, sizeof(hdr.magic));
+    hdr.version = 1;
+    hdr.record_size = sizeof(PageAccess);
+    fwrite(&hdr, sizeof(hdr), 1, reg.file);
+    page_trace_enabled_flag.store(true, std::memory_order_release);
+    LOG(INFO) << "Page access trace to " << path;
+    return 0;
+  }
+
+  void page_trace_stop() {
+    PageTraceRegistry &reg = page_trace_registry();
+    page_trace_enabled_flag.store(false, std::memory_order_release);
+    std::vector<PageTraceBuffer *> buffers;
+    {
+      std::lock_guard<std::mutex> lk(reg.lock);
+      for (auto &b : reg.buffers) {
+        buffers.push_back(b.get());
+      }
+    }
+    for (auto *b : buffers) {
+      std::lock_guard<std::mutex> lk(b->lock);
+      flush_locked(*b);
+    }
+    std::lock_guard<std::mutex> lk(reg.lock);
+    if (reg.file != nullptr) {
+      fclose(reg.file);
+      reg.file = nullptr;
+    }
+  }
+
+  void page_trace_start_from_env() {
+    static std::once_flag once;
+    std::call_once(once, []() {
+      const char *env = getenv("PIPEANN_PAGE_TRACE");
+      if (env == nullptr || env[0] == '\0') {
+        return;
+      }
+      if (page_trace_start(env) == 0) {
+        static PageTraceCloser closer;
+      }
+    });
+  }
+
+  uint32_t page_trace_next_query_id() {
+    return page_trace_registry().next_query_id.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void page_trace_record(uint64_t page_id, uint32_t hop) {
+    thread_local PageTraceOwner owner;
+    PageTraceBuffer &buf = owner.get();
+    uint64_t now =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    std::lock_guard<std::mutex> lk(buf.lock);
+    buf.records.push_back(PageAccess{now, tls_page_trace_query, (uint32_t) page_id, hop, buf.thread});
+    if (buf.records.size() >= kFlushRecords) {
+      flush_locked(buf);
+    }
+  }
+}  // namespace pipeann
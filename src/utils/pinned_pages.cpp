@@ -0,0 +1,82 @@
+#include "pinned_pages.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#include "log.h"
+#include "utils.h"
+
+namespace pipeann {
+  PinnedPages::~PinnedPages() {
+    if (buf != nullptr) {
+      if (locked_) {
+        ::munlock(buf, buf_len);
+      }
+      pipeann::aligned_free(buf);
+    }
+  }
+
+  int PinnedPages::load(const std::string &list_path, const std::string &disk_index_path, uint64_t max_pages) {
+    std::ifstream list(list_path);
+    if (!list.is_open()) {
+      LOG(ERROR) << "Cannot open hot page list " << list_path;
+      return -1;
+    }
+    int fd = ::open(disk_index_path.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd == -1 || ::fstat(fd, &st) != 0) {
+      LOG(ERROR) << "Cannot open " << disk_index_path << " to pin pages";
+      if (fd != -1) {
+        ::close(fd);
+      }
+      return -1;
+    }
+    const uint64_t n_sectors = (uint64_t) st.st_size / kSectorLen;
+
+    // sector 0 is the metadata; searches never read it.
+    std::vector<uint64_t> sectors;
+    std::string line;
+    while (std::getline(list, line) && (max_pages == 0 || sectors.size() < max_pages)) {
+      std::istringstream fields(line);
+      uint64_t sector;
+      if (fields >> sector && sector > 0 && sector < n_sectors) {
+        sectors.push_back(sector);
+      }
+    }
+
+    buf_len = std::max<uint64_t>(sectors.size(), 1) * kSectorLen;
+    pipeann::alloc_aligned((void **) &buf, buf_len, kSectorLen);
+    slots.reserve(sectors.size());
+    for (auto sector : sectors) {
+      if (slots.find(sector) != slots.end()) {
+        continue;
+      }
+      char *page = buf + slots.size() * kSectorLen;
+      if (::pread(fd, page, kSectorLen, sector * kSectorLen) != (ssize_t) kSectorLen) {
+        LOG(ERROR) << "Cannot read sector " << sector << " of " << disk_index_path;
+        ::close(fd);
+        return -1;
+      }
+      slots.insert({sector, (uint32_t) slots.size()});
+    }
+    ::close(fd);
+
+    locked_ = ::mlock(buf, buf_len) == 0;
+    if (!locked_) {
+      LOG(WARNING) << "mlock of " << buf_len << "B failed (" << ::strerror(errno)
+                   << "); pinned pages may be swapped out. Raise RLIMIT_MEMLOCK (ulimit -l).";
+    }
+    LOG(INFO) << "Pinned " << slots.size() << " hot pages (" << bytes() / 1048576.0 << " MiB, "
+              << 100.0 * slots.size() / std::max<uint64_t>(n_sectors - 1, 1) << "% of the index) from " << list_path
+              << (locked_ ? ", locked in memory" : "");
+    return 0;
+  }
+}  // namespace pipeann
@@ -0,0 +1,303 @@
+#include "query_trace.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "log.h"
+#include "telemetry.h"
+
+namespace pipeann {
+  TraceRing::TraceRing(size_t capacity) {
+    size_t cap = 1;
+    while (cap < capacity) {
+      cap <<= 1;
+    }
+    buf_.resize(cap);
+    mask_ = cap - 1;
+  }
+
+  bool TraceRing::push(const TraceEvent *events, size_t n) {
+    uint64_t head = head_.load(std::memory_order_relaxed);
+    uint64_t tail = tail_.load(std::memory_order_acquire);
+    if (n > buf_.size() - (head - tail)) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    for (size_t i = 0; i < n; ++i) {
+      buf_[(head + i) & mask_] = events[i];
+    }
+    head_.store(head + n, std::memory_order_release);
+    return true;
+  }
+
+  size_t TraceRing::drain(std::vector<TraceEvent> &out) {
+    uint64_t tail = tail_.load(std::memory_order_relaxed);
+    uint64_t head = head_.load(std::memory_order_acquire);
+    for (uint64_t i = tail; i < head; ++i) {
+      out.push_back(buf_[i & mask_]);
+    }
+    tail_.store(head, std::memory_order_release);
+    return head - tail;
+  }
+
+  namespace {
+    struct TraceRegistry {
+      std::mutex lock;  // guards rings/owned and serializes consumers.
+      std::vector<std::unique_ptr<TraceRing>> rings;
+      std::vector<bool> owned;
+      TraceConfig cfg;
+      std::atomic<uint64_t> next_query_id{0};
+    };
+
+    TraceRegistry &trace_registry() {
+      static TraceRegistry *reg = new TraceRegistry();  // never destroyed: threads may exit after main().
+      return *reg;
+    }
+
+    // Per-thread state; the ring outlives the thread and is handed to the next new thread.
+    struct TraceThread {
+      int64_t ring_idx = -1;
+      TraceRing *ring = nullptr;
+      bool force_next = false;
+      uint16_t reason = 0;
+      uint64_t query_id = 0;
+      std::vector<TraceEvent> staged;
+
+      ~TraceThread() {
+        if (ring_idx >= 0) {
+          TraceRegistry &reg = trace_registry();
+          std::lock_guard<std::mutex> lk(reg.lock);
+          reg.owned[ring_idx] = false;
+        }
+        tls_trace_active = false;
+      }
+
+      void acquire_ring() {
+        TraceRegistry &reg = trace_registry();
+        std::lock_guard<std::mutex> lk(reg.lock);
+        for (size_t i = 0; i < reg.rings.size(); ++i) {
+          if (!reg.owned[i]) {
+            ring_idx = i;
+            break;
+          }
+        }
+        if (ring_idx < 0) {
+          ring_idx = reg.rings.size();
+          reg.rings.emplace_back(new TraceRing(reg.cfg.ring_events));
+          reg.owned.push_back(false);
+        }
+        reg.owned[ring_idx] = true;
+        ring = reg.rings[ring_idx].get();
+      }
+    };
+
+    TraceThread &trace_thread() {
+      thread_local TraceThread t;
+      return t;
+    }
+
+    // Background drainer; the function-local static below stops it (with a final drain) at exit.
+    class TraceDrainer {
+     public:
+      ~TraceDrainer() {
+        if (!thread_.joinable()) {
+          return;
+        }
+        {
+          std::lock_guard<std::mutex> lk(mu_);
+          stop_ = true;
+        }
+        cv_.notify_all();
+        thread_.join();
+        trace_drain(path_);
+      }
+
+      void start(const std::string &path, uint64_t interval_ms) {
+        path_ = path;
+        interval_ms_ = interval_ms;
+        thread_ = std::thread([this]() {
+          std::unique_lock<std::mutex> lk(mu_);
+          while (!cv_.wait_for(lk, std::chrono::milliseconds(interval_ms_), [this]() { return stop_; })) {
+            lk.unlock();
+            trace_drain(path_);
+            lk.lock();
+          }
+        });
+      }
+
+     private:
+      std::string path_;
+      uint64_t interval_ms_ = 1000;
+      std::mutex mu_;
+      std::condition_variable cv_;
+      bool stop_ = false;
+      std::thread thread_;
+    };
+  }  // namespace
+
+  void trace_configure(const TraceConfig &cfg) {
+    TraceRegistry &reg = trace_registry();
+    {
+      std::lock_guard<std::mutex> lk(reg.lock);
+      reg.cfg = cfg;  // ring_events only applies to rings created afterwards.
+    }
+    cycles_per_second();  // calibrate outside the first traced query.
+    trace_enabled_flag.store(true, std::memory_order_release);
+  }
+
+  void trace_disable() {
+    trace_enabled_flag.store(false, std::memory_order_release);
+  }
+
+  void trace_flag_next_query() {
+    trace_thread().force_next = true;
+  }
+
+  uint32_t trace_n_candidates() {
+    return trace_registry().cfg.n_candidates;
+  }
+
+  void trace_begin_slow(uint16_t mode, uint32_t l_search, uint32_t beam_width) {
+    TraceRegistry &reg = trace_registry();
+    TraceThread &t = trace_thread();
+    t.query_id = reg.next_query_id.fetch_add(1, std::memory_order_relaxed);
+    t.reason = 0;
+    if (t.force_next) {
+      t.reason |= kTrReasonFlagged;
+      t.force_next = false;
+    }
+    if (reg.cfg.sample_every != 0 && t.query_id % reg.cfg.sample_every == 0) {
+      t.reason |= kTrReasonSampled;
+    }
+    // Unsampled queries are still staged when a slow threshold is set: slowness is only known at the end.
+    if (t.reason == 0 && reg.cfg.slow_us == 0) {
+      return;
+    }
+    if (t.ring == nullptr) {
+      t.acquire_ring();
+    }
+    t.staged.clear();
+    tls_trace_active = true;
+    trace_push(kTrQueryBegin, l_search | ((uint64_t) t.ring_idx << 32), beam_width, mode);
+  }
+
+  void trace_end_slow(const QueryStats &stats) {
+    TraceRegistry &reg = trace_registry();
+    TraceThread &t = trace_thread();
+    if (reg.cfg.slow_us != 0 && stats.total_us >= reg.cfg.slow_us) {
+      t.reason |= kTrReasonSlow;
+    }
+    tls_trace_active = false;
+    if (t.reason == 0) {
+      return;
+    }
+    uint64_t a = (uint64_t) stats.n_ios | ((uint64_t) stats.n_hops << 32);
+    t.staged.push_back(TraceEvent{read_cycles(), t.query_id, a, (uint32_t) stats.total_us, kTrQueryEnd, t.reason});
+    t.ring->push(t.staged.data(), t.staged.size());
+  }
+
+  void trace_push(uint16_t type, uint64_t a, uint32_t b, uint16_t arg) {
+    TraceThread &t = trace_thread();
+    t.staged.push_back(TraceEvent{read_cycles(), t.query_id, a, b, type, arg});
+  }
+
+  uint64_t trace_dropped() {
+    TraceRegistry &reg = trace_registry();
+    std::lock_guard<std::mutex> lk(reg.lock);
+    uint64_t n = 0;
+    for (auto &ring : reg.rings) {
+      n += ring->dropped();
+    }
+    return n;
+  }
+
+  int64_t trace_drain(const std::string &path) {
+    TraceRegistry &reg = trace_registry();
+    std::vector<TraceEvent> events;
+    {
+      std::lock_guard<std::mutex> lk(reg.lock);
+      for (auto &ring : reg.rings) {
+        ring->drain(events);
+      }
+    }
+
+    FILE *f = fopen(path.c_str(), "ab");
+    if (f == nullptr) {
+      LOG(ERROR) << "Cannot open trace file " << path;
+      return -1;
+    }
+    bool ok = true;
+    if (ftell(f) == 0) {
+      TraceFileHeader hdr;
+      memcpy(hdr.magic, kTraceMagic, sizeof(hdr.magic));
+      hdr.version = 1;
+      hdr.event_size = sizeof(TraceEvent);
+      hdr.cycles_per_second = cycles_per_second();
+      ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1;
+    }
+    if (ok && !events.empty()) {
+      ok = fwrite(events.data(), sizeof(TraceEvent), events.size(), f) == events.size();
+    }
+    fclose(f);
+    if (!ok) {
+      LOG(ERROR) << "Short write to trace file " << path;
+      return -1;
+    }
+    return events.size();
+  }
+
+  void trace_start_from_env() {
+    static std::once_flag once;
+    std::call_once(once, []() {
+      const char *env = getenv("PIPEANN_TRACE");
+      if (env == nullptr || env[0] == '\0') {
+        return;
+      }
+      // "<file>[,key=value]..."
+      std::string spec(env);
+      size_t comma = spec.find(',');
+      std::string path = spec.substr(0, comma);
+      TraceConfig cfg;
+      uint64_t interval_ms = 1000;
+      while (comma != std::string::npos) {
+        size_t next = spec.find(',', comma + 1);
+        std::string opt = spec.substr(comma + 1, next == std::string::npos ? std::string::npos : next - comma - 1);
+        comma = next;
+        size_t eq = opt.find('=');
+        if (eq == std::string::npos) {
+          LOG(ERROR) << "Ignoring PIPEANN_TRACE option " << opt;
+          continue;
+        }
+        std::string key = opt.substr(0, eq);
+        uint64_t val = std::stoull(opt.substr(eq + 1));
+        if (key == "sample") {
+          cfg.sample_every = val;
+        } else if (key == "slow_us") {
+          cfg.slow_us = val;
+        } else if (key == "cands") {
+          cfg.n_candidates = val;
+        } else if (key == "ring") {
+          cfg.ring_events = std::max<uint64_t>(val, 1024);
+        } else if (key == "interval_ms") {
+          interval_ms = std::max<uint64_t>(val, 10);
+        } else {
+          LOG(ERROR) << "Ignoring PIPEANN_TRACE option " << opt;
+        }
+      }
+      if (cfg.sample_every == 0 && cfg.slow_us == 0) {
+        LOG(WARNING) << "PIPEANN_TRACE has neither sample= nor slow_us=; only flagged queries are traced";
+      }
+      remove(path.c_str());
+      trace_configure(cfg);
+      static TraceDrainer drainer;
+      drainer.start(path, interval_ms);
+      LOG(INFO) << "Query tracing to " << path << " (sample=" << cfg.sample_every << ", slow_us=" << cfg.slow_us
+                << ", cands=" << cfg.n_candidates << ")";
+    });
+  }
+}  // namespace pipeann
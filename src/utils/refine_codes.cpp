@@ -0,0 +1,80 @@
+#include "refine_codes.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <type_traits>
+
+#include "log.h"
+#include "utils.h"
+
+namespace pipeann {
+  template<typename T>
+  RefineCodes<T>::~RefineCodes() {
+    if (fd_ != -1) {
+      ::close(fd_);
+    }
+  }
+
+  template<typename T>
+  int RefineCodes<T>::load(const std::string &path, uint64_t dim, bool in_memory) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in.is_open()) {
+      LOG(ERROR) << "Cannot open refine codes " << path;
+      return -1;
+    }
+    uint64_t file_dim = 0;
+    in.read((char *) &npts, sizeof(uint64_t));
+    in.read((char *) &file_dim, sizeof(uint64_t));
+    in.read((char *) &header_sectors, sizeof(uint64_t));
+    if (!in || file_dim != dim || dim == 0 || dim > kSectorLen) {
+      LOG(ERROR) << "Refine codes " << path << " have dimension " << file_dim << ", index has " << dim;
+      return -1;
+    }
+    this->dim = dim;
+    codes_per_sector = kSectorLen / dim;
+    mins.resize(dim);
+    scales.resize(dim);
+    in.read((char *) mins.data(), dim * sizeof(float));
+    in.read((char *) scales.data(), dim * sizeof(float));
+
+    if (in_memory) {
+      codes.resize(npts * dim);
+      std::vector<char> sector(kSectorLen);
+      in.seekg(header_sectors * kSectorLen, std::ios::beg);
+      for (uint64_t id = 0; id < npts; id += codes_per_sector) {
+        in.read(sector.data(), kSectorLen);
+        uint64_t n = std::min(codes_per_sector, npts - id);
+        memcpy(codes.data() + id * dim, sector.data(), n * dim);
+      }
+    } else {
+      fd_ = ::open(path.c_str(), O_DIRECT | O_RDONLY | O_LARGEFILE);
+      if (fd_ == -1) {
+        LOG(ERROR) << "Cannot open refine codes " << path << " for direct reads";
+        return -1;
+      }
+    }
+    if (!in) {
+      LOG(ERROR) << "Refine codes " << path << " are truncated";
+      return -1;
+    }
+    LOG(INFO) << "Refine codes " << path << ": " << npts << " points, " << dim << "B each, "
+              << (in_memory ? "in memory" : "read on demand");
+    return 0;
+  }
+
+  template<typename T>
+  void RefineCodes<T>::decode(const uint8_t *code, T *out) const {
+    for (uint64_t d = 0; d < dim; ++d) {
+      float x = mins[d] + scales[d] * code[d];
+      out[d] = std::is_floating_point<T>::value ? (T) x : (T) std::lround(x);
+    }
+  }
+
+  template class RefineCodes<float>;
+  template class RefineCodes<_s8>;
+  template class RefineCodes<_u8>;
+}  // namespace pipeann
@@ -0,0 +1,62 @@
+#include "search_profile.h"
+
+#include <fstream>
+#include <sstream>
+
+#include "log.h"
+
+namespace pipeann {
+  int SearchProfile::load(const std::string &path) {
+    std::ifstream in(path);
+    if (!in.is_open()) {
+      LOG(ERROR) << "Cannot open search profile " << path;
+      return -1;
+    }
+    std::string line, key;
+    while (std::getline(in, line)) {
+      std::istringstream ss(line);
+      if (!(ss >> key) || key[0] == '#') {
+        continue;
+      }
+      if (key == "mode") {
+        ss >> mode;
+      } else if (key == "mem_L") {
+        ss >> mem_L;
+      } else if (key == "l_search") {
+        ss >> l_search;
+      } else if (key == "beam_width") {
+        ss >> beam_width;
+      } else if (key == "k") {
+        ss >> k;
+      } else if (key == "threads") {
+        ss >> threads;
+      } else if (key == "recall") {
+        ss >> recall;
+      } else if (key == "p99_us") {
+        ss >> p99_us;
+      } else if (key == "qps") {
+        ss >> qps;
+      }
+    }
+    if (mode < 0 || mode > 4 || l_search == 0 || beam_width == 0) {
+      LOG(ERROR) << "Search profile " << path << " has mode " << mode << ", L " << l_search << ", beam width "
+                 << beam_width;
+      return -1;
+    }
+    LOG(INFO) << "Search profile " << path << ": mode " << mode << ", mem_L " << mem_L << ", L " << l_search
+              << ", beam width " << beam_width;
+    return 0;
+  }
+
+  int SearchProfile::save(const std::string &path) const {
+    std::ofstream out(path);
+    if (!out.is_open()) {
+      LOG(ERROR) << "Cannot write search profile " << path;
+      return -1;
+    }
+    out << "mode " << mode << "\nmem_L " << mem_L << "\nl_search " << l_search << "\nbeam_width " << beam_width
+        << "\n# measured by tune_search\nk " << k << "\nthreads " << threads << "\nrecall " << recall << "\np99_us "
+        << p99_us << "\nqps " << qps << "\n";
+    return out.good() ? 0 : -1;
+  }
+}  // namespace pipeann
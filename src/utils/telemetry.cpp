@@ -0,0 +1,312 @@
+#include "telemetry.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "log.h"
+
+namespace pipeann {
+  namespace {
+    const char *kCounterNames[kTmNumCounters][2] = {
+        {"pipeann_queries_total", "Search queries completed."},
+        {"pipeann_query_seconds_total", "Thread time spent in search queries."},
+        {"pipeann_hops_total", "Graph search hops (node/page expansions)."},
+        {"pipeann_distance_cmps_total", "PQ distance comparisons."},
+        {"pipeann_tier_hits_total", "Page reads served by the in-memory page cache."},
+        {"pipeann_tier_misses_total", "Page reads sent to the device."},
+        {"pipeann_pinned_hits_total", "Page reads served by pinned hot pages."},
+        {"pipeann_coalesced_reads_total", "Page reads served by another query's in-flight read."},
+        {"pipeann_inserts_total", "Inserted vectors."},
+        {"pipeann_insert_seconds_total", "Thread time spent in inserts."},
+    };
+    const char *kContextNames[kTmNumContexts] = {"search", "prefetch", "insert", "compaction", "other"};
+    const char *kIoNames[kTmNumIoFields][2] = {
+        {"pipeann_read_ios_total", "Read IOs issued, by IO context."},
+        {"pipeann_read_bytes_total", "Bytes read, by IO context."},
+        {"pipeann_write_ios_total", "Write IOs issued, by IO context."},
+        {"pipeann_write_bytes_total", "Bytes written, by IO context."},
+    };
+
+    struct Registry {
+      std::mutex lock;
+      std::vector<TelemetrySlot *> live;
+      TelemetrySlot exited;  // sums of the slots of exited threads, under lock.
+    };
+
+    Registry &registry() {
+      static Registry *reg = new Registry();  // never destroyed: threads may exit after main().
+      return *reg;
+    }
+
+    void accumulate(const TelemetrySlot &slot, TelemetrySnapshot &snap) {
+      for (uint32_t c = 0; c < kTmNumCounters; ++c) {
+        snap.counters[c] += slot.counters[c].load(std::memory_order_relaxed);
+      }
+      for (uint32_t ctx = 0; ctx < kTmNumContexts; ++ctx) {
+        for (uint32_t f = 0; f < kTmNumIoFields; ++f) {
+          snap.io[ctx][f] += slot.io[ctx][f].load(std::memory_order_relaxed);
+        }
+      }
+    }
+
+    // Owns the calling thread's slot; folds it into Registry::exited on thread exit.
+    struct SlotOwner {
+      std::unique_ptr<TelemetrySlot> slot{new TelemetrySlot()};
+      ~SlotOwner() {
+        Registry &reg = registry();
+        std::lock_guard<std::mutex> lk(reg.lock);
+        for (uint32_t c = 0; c < kTmNumCounters; ++c) {
+          reg.exited.counters[c].fetch_add(slot->counters[c].load(std::memory_order_relaxed));
+        }
+        for (uint32_t ctx = 0; ctx < kTmNumContexts; ++ctx) {
+          for (uint32_t f = 0; f < kTmNumIoFields; ++f) {
+            reg.exited.io[ctx][f].fetch_add(slot->io[ctx][f].load(std::memory_order_relaxed));
+          }
+        }
+        for (auto it = reg.live.begin(); it != reg.live.end(); ++it) {
+          if (*it == slot.get()) {
+            reg.live.erase(it);
+            break;
+          }
+        }
+        tls_telemetry_slot = nullptr;
+      }
+    };
+
+    void append_metric(std::ostringstream &os, const char *name, const char *help, const char *type) {
+      os << "# HELP " << name << " " << help << "\n# TYPE " << name << " " << type << "\n";
+    }
+
+    bool write_all(int fd, const std::string &s) {
+      size_t off = 0;
+      while (off < s.size()) {
+        ssize_t n = ::write(fd, s.data() + off, s.size() - off);
+        if (n < 0 && errno == EINTR) {
+          continue;
+        }
+        if (n <= 0) {
+          return false;
+        }
+        off += n;
+      }
+      return true;
+    }
+  }  // namespace
+
+  double cycles_per_second() {
+    static double hz = []() {
+      auto t0 = std::chrono::steady_clock::now();
+      uint64_t c0 = read_cycles();
+      std::this_thread::sleep_for(std::chrono::milliseconds(20));
+      auto t1 = std::chrono::steady_clock::now();
+      uint64_t c1 = read_cycles();
+      double secs = std::chrono::duration<double>(t1 - t0).count();
+      return (double) (c1 - c0) / secs;
+    }();
+    return hz;
+  }
+
+  void PhaseTimer::finish(QueryStats *stats) const {
+    double us_per_cycle = 1e6 / cycles_per_second();
+    double tracked = 0;
+    for (uint32_t p = 0; p < kNumQueryPhases; ++p) {
+      if (p != kPhaseOther) {
+        stats->phase_us[p] += cycles_[p] * us_per_cycle;
+        tracked += stats->phase_us[p];
+      }
+    }
+    stats->phase_us[kPhaseOther] = std::max(0.0, stats->total_us - tracked);
+    stats->head_us = stats->phase_us[kPhaseHead];
+    stats->io_us = stats->phase_us[kPhaseSubmit] + stats->phase_us[kPhaseWait];
+    stats->cpu_us = stats->phase_us[kPhasePqSetup] + stats->phase_us[kPhasePqScore] + stats->phase_us[kPhaseExact] +
+                    stats->phase_us[kPhasePool];
+  }
+
+  TelemetrySlot *register_telemetry_slot() {
+    thread_local SlotOwner owner;
+    Registry &reg = registry();
+    std::lock_guard<std::mutex> lk(reg.lock);
+    reg.live.push_back(owner.slot.get());
+    tls_telemetry_slot = owner.slot.get();
+    return tls_telemetry_slot;
+  }
+
+  StreamingHistogram &telemetry_query_latency() {
+    static StreamingHistogram *hist = new StreamingHistogram();
+    return *hist;
+  }
+
+  TelemetrySnapshot telemetry_snapshot() {
+    TelemetrySnapshot snap;
+    Registry &reg = registry();
+    {
+      std::lock_guard<std::mutex> lk(reg.lock);
+      accumulate(reg.exited, snap);
+      for (auto *slot : reg.live) {
+        accumulate(*slot, snap);
+      }
+      snap.n_threads = reg.live.size();
+    }
+    snap.cycles_per_second = cycles_per_second();
+    telemetry_query_latency().snapshot_into(snap.query_latency_ns);
+    return snap;
+  }
+
+  std::string TelemetrySnapshot::to_prometheus() const {
+    std::ostringstream os;
+    for (uint32_t c = 0; c < kTmNumCounters; ++c) {
+      append_metric(os, kCounterNames[c][0], kCounterNames[c][1], "counter");
+      if (c == kTmQueryCycles || c == kTmInsertCycles) {
+        os << kCounterNames[c][0] << " " << counters[c] / cycles_per_second << "\n";
+      } else {
+        os << kCounterNames[c][0] << " " << counters[c] << "\n";
+      }
+    }
+    for (uint32_t f = 0; f < kTmNumIoFields; ++f) {
+      append_metric(os, kIoNames[f][0], kIoNames[f][1], "counter");
+      for (uint32_t ctx = 0; ctx < kTmNumContexts; ++ctx) {
+        os << kIoNames[f][0] << "{context=\"" << kContextNames[ctx] << "\"} " << io[ctx][f] << "\n";
+      }
+    }
+    append_metric(os, "pipeann_query_latency_seconds", "Search latency.", "summary");
+    for (double q : {0.5, 0.9, 0.99, 0.999}) {
+      os << "pipeann_query_latency_seconds{quantile=\"" << q << "\"} "
+         << query_latency_ns.percentile(q * 100) / 1e9 << "\n";
+    }
+    os << "pipeann_query_latency_seconds_sum " << query_latency_ns.mean() * query_latency_ns.count() / 1e9 << "\n";
+    os << "pipeann_query_latency_seconds_count " << query_latency_ns.count() << "\n";
+    append_metric(os, "pipeann_telemetry_threads", "Threads holding a telemetry slot.", "gauge");
+    os << "pipeann_telemetry_threads " << n_threads << "\n";
+    return os.str();
+  }
+
+  TelemetryExporter::~TelemetryExporter() {
+    stop();
+  }
+
+  int TelemetryExporter::start(const std::string &target, uint64_t interval_ms) {
+    if (thread_.joinable()) {
+      LOG(ERROR) << "Telemetry exporter already running";
+      return -1;
+    }
+    interval_ms_ = std::max<uint64_t>(interval_ms, 10);
+    if (target.rfind("file:", 0) == 0) {
+      unix_ = false;
+      path_ = target.substr(5);
+    } else if (target.rfind("unix:", 0) == 0) {
+      unix_ = true;
+      path_ = target.substr(5);
+    } else {
+      LOG(ERROR) << "Unknown telemetry target " << target << ", expected file:<path> or unix:<path>";
+      return -1;
+    }
+
+    if (unix_) {
+      sockaddr_un addr;
+      memset(&addr, 0, sizeof(addr));
+      addr.sun_family = AF_UNIX;
+      if (path_.size() >= sizeof(addr.sun_path)) {
+        LOG(ERROR) << "Socket path too long: " << path_;
+        return -1;
+      }
+      strncpy(addr.sun_path, path_.c_str(), sizeof(addr.sun_path) - 1);
+      listen_fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+      unlink(path_.c_str());
+      if (listen_fd_ < 0 || bind(listen_fd_, (sockaddr *) &addr, sizeof(addr)) != 0 || listen(listen_fd_, 16) != 0) {
+        LOG(ERROR) << "Cannot listen on " << path_ << ": " << strerror(errno);
+        if (listen_fd_ >= 0) {
+          ::close(listen_fd_);
+          listen_fd_ = -1;
+        }
+        return -1;
+      }
+    }
+    stop_.store(false);
+    thread_ = std::thread([this]() { unix_ ? run_unix() : run_file(); });
+    LOG(INFO) << "Telemetry exporter started: " << target;
+    return 0;
+  }
+
+  void TelemetryExporter::stop() {
+    if (!thread_.joinable()) {
+      return;
+    }
+    stop_.store(true);
+    thread_.join();
+    if (listen_fd_ >= 0) {
+      ::close(listen_fd_);
+      listen_fd_ = -1;
+      unlink(path_.c_str());
+    }
+  }
+
+  void TelemetryExporter::run_file() {
+    pipeann::set_io_context(IoContext::OTHER);
+    std::string tmp = path_ + ".tmp";
+    while (!stop_.load()) {
+      std::string text = telemetry_snapshot().to_prometheus();
+      FILE *f = fopen(tmp.c_str(), "w");
+      if (f == nullptr || fwrite(text.data(), 1, text.size(), f) != text.size()) {
+        LOG(ERROR) << "Cannot write " << tmp;
+      }
+      if (f != nullptr) {
+        fclose(f);
+        rename(tmp.c_str(), path_.c_str());
+      }
+      for (uint64_t waited = 0; waited < interval_ms_ && !stop_.load(); waited += 10) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      }
+    }
+  }
+
+  void TelemetryExporter::run_unix() {
+    pipeann::set_io_context(IoContext::OTHER);
+    while (!stop_.load()) {
+      pollfd pfd = {listen_fd_, POLLIN, 0};
+      if (::poll(&pfd, 1, 100) <= 0) {
+        continue;
+      }
+      int fd = accept4(listen_fd_, nullptr, nullptr, SOCK_CLOEXEC);
+      if (fd < 0) {
+        continue;
+      }
+      write_all(fd, telemetry_snapshot().to_prometheus());
+      ::close(fd);
+    }
+  }
+
+  void telemetry_start_from_env() {
+    static std::once_flag once;
+    std::call_once(once, []() {
+      const char *env = getenv("PIPEANN_TELEMETRY");
+      if (env == nullptr || env[0] == '\0') {
+        return;
+      }
+      // "<target>[,interval_ms=N]"
+      std::string spec(env), target = spec;
+      uint64_t interval_ms = 1000;
+      size_t comma = spec.find(',');
+      if (comma != std::string::npos) {
+        target = spec.substr(0, comma);
+        std::string opt = spec.substr(comma + 1);
+        if (opt.rfind("interval_ms=", 0) == 0) {
+          interval_ms = std::stoull(opt.substr(12));
+        }
+      }
+      static TelemetryExporter *exporter = new TelemetryExporter();  // lives until exit.
+      exporter->start(target, interval_ms);
+    });
+  }
+}  // namespace pipeann
@@ -0,0 +1,451 @@
+// Replays a PIPEANN_PAGE_TRACE file (see include/page_trace.h) against page cache policies.
+//
+//   cache_sim <page_trace> [--capacities P1,P2,..] [--capacity-pct X1,X2,..] [--policies lru,lfu,arc,2q,bfs,opt]
+//             [--disk-index <path> --data-type float|uint8|int8] [--warmup F]
+//
+// Capacities are in pages (--capacities) or in percent of the distinct pages in the trace
+// (--capacity-pct, default 1,2,5,10,20,50). All threads share one simulated cache, fed in timestamp order.
+// bfs pins the pages of a BFS from the entry point (needs --disk-index); opt is Belady's bound.
+// The first F (default 0) of the accesses warm the caches and are not counted.
+#include "graph_stats.h"
+#include "page_trace.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <list>
+#include <memory>
+#include <queue>
+#include <set>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+using pipeann::PageAccess;
+
+namespace {
+  // LRU-ordered set of pages; front is the most recent.
+  class LruList {
+   public:
+    bool contains(uint32_t page) const {
+      return pos_.count(page) != 0;
+    }
+    size_t size() const {
+      return list_.size();
+    }
+    void push_front(uint32_t page) {
+      list_.push_front(page);
+      pos_[page] = list_.begin();
+    }
+    void touch(uint32_t page) {
+      list_.splice(list_.begin(), list_, pos_[page]);
+    }
+    void erase(uint32_t page) {
+      auto it = pos_.find(page);
+      list_.erase(it->second);
+      pos_.erase(it);
+    }
+    uint32_t pop_back() {
+      uint32_t page = list_.back();
+      pos_.erase(page);
+      list_.pop_back();
+      return page;
+    }
+
+   private:
+    std::list<uint32_t> list_;
+    std::unordered_map<uint32_t, std::list<uint32_t>::iterator> pos_;
+  };
+
+  class Policy {
+   public:
+    virtual ~Policy() = default;
+    // i is the position of the access in the replayed sequence. Returns true on hit.
+    virtual bool access(uint32_t page, size_t i) = 0;
+  };
+
+  class LruPolicy : public Policy {
+   public:
+    explicit LruPolicy(size_t capacity) : capacity_(capacity) {
+    }
+    bool access(uint32_t page, size_t) override {
+      if (lru_.contains(page)) {
+        lru_.touch(page);
+        return true;
+      }
+      if (lru_.size() >= capacity_) {
+        lru_.pop_back();
+      }
+      lru_.push_front(page);
+      return false;
+    }
+
+   private:
+    size_t capacity_;
+    LruList lru_;
+  };
+
+  // In-cache LFU (counts are dropped on eviction), LRU among equal counts.
+  class LfuPolicy : public Policy {
+   public:
+    explicit LfuPolicy(size_t capacity) : capacity_(capacity) {
+    }
+    bool access(uint32_t page, size_t i) override {
+      auto it = entries_.find(page);
+      if (it != entries_.end()) {
+        order_.erase({it->second.first, it->second.second, page});
+        it->second = {it->second.first + 1, i};
+        order_.insert({it->second.first, i, page});
+        return true;
+      }
+      if (entries_.size() >= capacity_) {
+        auto victim = order_.begin();
+        entries_.erase(std::get<2>(*victim));
+        order_.erase(victim);
+      }
+      entries_[page] = {1, i};
+      order_.insert({1, i, page});
+      return false;
+    }
+
+   private:
+    size_t capacity_;
+    std::unordered_map<uint32_t, std::pair<uint64_t, size_t>> entries_;  // page -> (count, last access).
+    std::set<std::tuple<uint64_t, size_t, uint32_t>> order_;
+  };
+
+  // Adaptive Replacement Cache (Megiddo & Modha, FAST'03).
+  class ArcPolicy : public Policy {
+   public:
+    explicit ArcPolicy(size_t capacity) : c_(capacity) {
+    }
+    bool access(uint32_t page, size_t) override {
+      if (t1_.contains(page)) {
+        t1_.erase(page);
+        t2_.push_front(page);
+        return true;
+      }
+      if (t2_.contains(page)) {
+        t2_.touch(page);
+        return true;
+      }
+      if (b1_.contains(page)) {
+        p_ = std::min<double>(c_, p_ + std::max<double>((double) b2_.size() / b1_.size(), 1));
+        replace(false);
+        b1_.erase(page);
+        t2_.push_front(page);
+        return false;
+      }
+      if (b2_.contains(page)) {
+        p_ = std::max<double>(0, p_ - std::max<double>((double) b1_.size() / b2_.size(), 1));
+        replace(true);
+        b2_.erase(page);
+        t2_.push_front(page);
+        return false;
+      }
+      size_t l1 = t1_.size() + b1_.size(), total = l1 + t2_.size() + b2_.size();
+      if (l1 == c_) {
+        if (t1_.size() < c_) {
+          b1_.pop_back();
+          replace(false);
+        } else {
+          t1_.pop_back();
+        }
+      } else if (total >= c_) {
+        if (total == 2 * c_) {
+          b2_.pop_back();
+        }
+        replace(false);
+      }
+      t1_.push_front(page);
+      return false;
+    }
+
+   private:
+    void replace(bool in_b2) {
+      if (t1_.size() > 0 && ((in_b2 && t1_.size() == (size_t) p_) || t1_.size() > p_)) {
+        b1_.push_front(t1_.pop_back());
+      } else if (t2_.size() > 0) {
+        b2_.push_front(t2_.pop_back());
+      }
+    }
+
+    size_t c_;
+    double p_ = 0;
+    LruList t1_, t2_, b1_, b2_;
+  };
+
+  // Full 2Q (Johnson & Shasha, VLDB'94) with Kin = 25% and Kout = 50% of the capacity.
+  class TwoQPolicy : public Policy {
+   public:
+    explicit TwoQPolicy(size_t capacity)
+        : c_(capacity), kin_(std::max<size_t>(capacity / 4, 1)), kout_(std::max<size_t>(capacity / 2, 1)) {
+    }
+    bool access(uint32_t page, size_t) override {
+      if (am_.contains(page)) {
+        am_.touch(page);
+        return true;
+      }
+      if (a1in_.contains(page)) {
+        return true;
+      }
+      reclaim();
+      if (a1out_.contains(page)) {
+        a1out_.erase(page);
+        am_.push_front(page);
+      } else {
+        a1in_.push_front(page);
+      }
+      return false;
+    }
+
+   private:
+    void reclaim() {
+      if (am_.size() + a1in_.size() < c_) {
+        return;
+      }
+      if (a1in_.size() > kin_ || am_.size() == 0) {
+        a1out_.push_front(a1in_.pop_back());
+        if (a1out_.size() > kout_) {
+          a1out_.pop_back();
+        }
+      } else {
+        am_.pop_back();
+      }
+    }
+
+    size_t c_, kin_, kout_;
+    LruList a1in_, a1out_, am_;
+  };
+
+  // Static pinning of the first capacity pages in a given order; never changes.
+  class PinnedPolicy : public Policy {
+   public:
+    PinnedPolicy(const std::vector<uint32_t> &order, size_t capacity)
+        : pinned_(order.begin(), order.begin() + std::min(capacity, order.size())) {
+    }
+    bool access(uint32_t page, size_t) override {
+      return pinned_.count(page) != 0;
+    }
+
+   private:
+    std::unordered_set<uint32_t> pinned_;
+  };
+
+  // Belady's MIN: evicts the page whose next use is furthest away.
+  class OptPolicy : public Policy {
+   public:
+    OptPolicy(const std::vector<size_t> &next_use, size_t capacity) : next_use_(next_use), capacity_(capacity) {
+    }
+    bool access(uint32_t page, size_t i) override {
+      size_t next = next_use_[i];
+      auto it = resident_.find(page);
+      if (it != resident_.end()) {
+        order_.erase({it->second, page});
+        it->second = next;
+        order_.insert({next, page});
+        return true;
+      }
+      if (resident_.size() >= capacity_) {
+        auto victim = std::prev(order_.end());
+        resident_.erase(victim->second);
+        order_.erase(victim);
+      }
+      resident_[page] = next;
+      order_.insert({next, page});
+      return false;
+    }
+
+   private:
+    const std::vector<size_t> &next_use_;
+    size_t capacity_;
+    std::unordered_map<uint32_t, size_t> resident_;
+    std::set<std::pair<size_t, uint32_t>> order_;
+  };
+
+  // Page order of a BFS over the graph from its entry point, as used to pick the pages to pin.
+  std::vector<uint32_t> bfs_page_order(const pipeann::DiskIndexGraph &g) {
+    std::vector<uint32_t> order;
+    std::vector<bool> node_seen(g.nnodes, false);
+    std::unordered_set<uint32_t> page_seen;
+    std::queue<unsigned> frontier;
+    frontier.push(g.entry_point);
+    node_seen[g.entry_point] = true;
+    while (!frontier.empty()) {
+      unsigned id = frontier.front();
+      frontier.pop();
+      uint32_t page = (uint32_t) g.page_of(id);
+      if (page_seen.insert(page).second) {
+        order.push_back(page);
+      }
+      for (unsigned nbr : g.adj[id]) {
+        if (nbr < g.nnodes && !node_seen[nbr]) {
+          node_seen[nbr] = true;
+          frontier.push(nbr);
+        }
+      }
+    }
+    return order;
+  }
+
+  std::vector<std::string> split(const std::string &s) {
+    std::vector<std::string> out;
+    std::stringstream ss(s);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+      out.push_back(item);
+    }
+    return out;
+  }
+
+  std::vector<double> parse_list(const std::string &s) {
+    std::vector<double> out;
+    for (auto &item : split(s)) {
+      out.push_back(std::stod(item));
+    }
+    return out;
+  }
+}  // namespace
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    std::cerr << "Usage: " << argv[0]
+              << " <page_trace> [--capacities P1,P2,..] [--capacity-pct X1,X2,..] [--policies lru,lfu,arc,2q,bfs,opt]"
+                 " [--disk-index <path> --data-type float|uint8|int8] [--warmup F]"
+              << std::endl;
+    return 1;
+  }
+  std::string path = argv[1], disk_index, data_type = "float", policies = "lru,lfu,arc,2q,bfs,opt";
+  std::vector<double> capacities, capacity_pct = {1, 2, 5, 10, 20, 50};
+  double warmup = 0;
+  for (int i = 2; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--capacities" && i + 1 < argc) {
+      capacities = parse_list(argv[++i]);
+    } else if (arg == "--capacity-pct" && i + 1 < argc) {
+      capacity_pct = parse_list(argv[++i]);
+    } else if (arg == "--policies" && i + 1 < argc) {
+      policies = argv[++i];
+    } else if (arg == "--disk-index" && i + 1 < argc) {
+      disk_index = argv[++i];
+    } else if (arg == "--data-type" && i + 1 < argc) {
+      data_type = argv[++i];
+    } else if (arg == "--warmup" && i + 1 < argc) {
+      warmup = std::stod(argv[++i]);
+    } else {
+      std::cerr << "Unknown argument " << arg << std::endl;
+      return 1;
+    }
+  }
+
+  std::ifstream in(path, std::ios::binary);
+  pipeann::PageTraceFileHeader hdr;
+  if (!in.read((char *) &hdr, sizeof(hdr)) ||
+      memcmp(hdr.magic, pipeann::kPageTraceMagic, sizeof(hdr.magic)) != 0) {
+    std::cerr << path << " is not a page trace file" << std::endl;
+    return 1;
+  }
+  if (hdr.record_size != sizeof(PageAccess)) {
+    std::cerr << "Unsupported record size " << hdr.record_size << " (version " << hdr.version << ")" << std::endl;
+    return 1;
+  }
+  std::vector<PageAccess> recs;
+  PageAccess r;
+  while (in.read((char *) &r, sizeof(r))) {
+    recs.push_back(r);
+  }
+  if (recs.empty()) {
+    std::cerr << "Empty trace" << std::endl;
+    return 1;
+  }
+  // per-thread chunks are appended as they fill; restore the global order.
+  std::stable_sort(recs.begin(), recs.end(),
+                   [](const PageAccess &a, const PageAccess &b) { return a.ts_ns < b.ts_ns; });
+
+  std::vector<size_t> next_use(recs.size(), std::numeric_limits<size_t>::max());
+  std::unordered_map<uint32_t, size_t> last_seen;
+  std::unordered_set<uint32_t> queries;
+  for (size_t i = recs.size(); i-- > 0;) {
+    auto it = last_seen.find(recs[i].page_id);
+    if (it != last_seen.end()) {
+      next_use[i] = it->second;
+    }
+    last_seen[recs[i].page_id] = i;
+    queries.insert(recs[i].query_id);
+  }
+  size_t n_distinct = last_seen.size();
+  size_t first_counted = std::min(recs.size() - 1, (size_t) (warmup * recs.size()));
+  size_t n_counted = recs.size() - first_counted;
+  std::unordered_set<uint32_t> counted_queries;
+  for (size_t i = first_counted; i < recs.size(); ++i) {
+    counted_queries.insert(recs[i].query_id);
+  }
+
+  std::vector<uint32_t> bfs_order;
+  if (!disk_index.empty()) {
+    pipeann::DiskIndexDataType dt = data_type == "uint8"  ? pipeann::DiskIndexDataType::kUint8
+                                    : data_type == "int8" ? pipeann::DiskIndexDataType::kInt8
+                                                          : pipeann::DiskIndexDataType::kFloat;
+    pipeann::DiskIndexGraph graph;
+    if (!pipeann::load_graph_from_disk_index(disk_index, dt, &graph)) {
+      std::cerr << "Cannot load graph from " << disk_index << std::endl;
+      return 1;
+    }
+    bfs_order = bfs_page_order(graph);
+  }
+
+  std::vector<size_t> caps;
+  for (double c : capacities) {
+    caps.push_back((size_t) c);
+  }
+  if (capacities.empty()) {
+    for (double pct : capacity_pct) {
+      caps.push_back(std::max<size_t>(1, (size_t) (pct / 100 * n_distinct)));
+    }
+  }
+
+  std::vector<std::string> names = split(policies);
+  if (std::find(names.begin(), names.end(), "bfs") != names.end() && bfs_order.empty()) {
+    std::cerr << "bfs needs --disk-index; skipped" << std::endl;
+    names.erase(std::find(names.begin(), names.end(), "bfs"));
+  }
+
+  printf("%zu accesses (%zu counted), %zu queries, %zu distinct pages, %.2f IOs/query without cache\n", recs.size(),
+         n_counted, queries.size(), n_distinct, (double) n_counted / counted_queries.size());
+  printf("%6s %10s %10s %9s %12s %12s\n", "Policy", "Pages", "MB", "HitRatio", "IOsSaved", "IOs/query");
+  for (size_t cap : caps) {
+    for (auto &name : names) {
+      std::unique_ptr<Policy> policy;
+      if (name == "lru") {
+        policy.reset(new LruPolicy(cap));
+      } else if (name == "lfu") {
+        policy.reset(new LfuPolicy(cap));
+      } else if (name == "arc") {
+        policy.reset(new ArcPolicy(cap));
+      } else if (name == "2q") {
+        policy.reset(new TwoQPolicy(cap));
+      } else if (name == "bfs") {
+        policy.reset(new PinnedPolicy(bfs_order, cap));
+      } else if (name == "opt") {
+        policy.reset(new OptPolicy(next_use, cap));
+      } else {
+        std::cerr << "Unknown policy " << name << std::endl;
+        return 1;
+      }
+      uint64_t hits = 0;
+      for (size_t i = 0; i < recs.size(); ++i) {
+        bool hit = policy->access(recs[i].page_id, i);
+        hits += (hit && i >= first_counted);
+      }
+      printf("%6s %10zu %10.1f %9.4f %12" PRIu64 " %12.2f\n", name.c_str(), cap, cap * 4096.0 / (1 << 20),
+             (double) hits / n_counted, hits, (double) (n_counted - hits) / counted_queries.size());
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,26 @@
+#include <iostream>
+#include <string>
+
+#include "aux_utils.h"
+#include "utils.h"
+
+// Rewrites a disk index so that every node record carries its neighbors' PQ codes (see
+// pipeann::create_inline_pq_layout); searches on the output need no in-memory PQ array.
+
+int main(int argc, char **argv) {
+  if (argc != 4) {
+    std::cout << "Usage: " << argv[0] << " <index_type (float/int8/uint8)> <input_index_prefix> <output_index_prefix>"
+              << std::endl;
+    return -1;
+  }
+  std::string type = argv[1];
+  if (type == "float") {
+    return pipeann::create_inline_pq_layout<float>(argv[2], argv[3]);
+  } else if (type == "int8") {
+    return pipeann::create_inline_pq_layout<int8_t>(argv[2], argv[3]);
+  } else if (type == "uint8") {
+    return pipeann::create_inline_pq_layout<uint8_t>(argv[2], argv[3]);
+  }
+  std::cout << "Unsupported index type. Use float or int8 or uint8" << std::endl;
+  return -1;
+}
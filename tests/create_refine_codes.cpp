@@ -0,0 +1,25 @@
+#include <iostream>
+#include <string>
+
+#include "aux_utils.h"
+#include "utils.h"
+
+// Writes <index_prefix>_sq8.bin, the 8-bit scalar-quantized vectors that searches use to rerank their best
+// unexpanded candidates (see pipeann::create_refine_codes and SSDIndex::load_refine_codes).
+
+int main(int argc, char **argv) {
+  if (argc != 3) {
+    std::cout << "Usage: " << argv[0] << " <index_type (float/int8/uint8)> <index_prefix>" << std::endl;
+    return -1;
+  }
+  std::string type = argv[1];
+  if (type == "float") {
+    return pipeann::create_refine_codes<float>(argv[2]);
+  } else if (type == "int8") {
+    return pipeann::create_refine_codes<int8_t>(argv[2]);
+  } else if (type == "uint8") {
+    return pipeann::create_refine_codes<uint8_t>(argv[2]);
+  }
+  std::cout << "Unsupported index type. Use float or int8 or uint8" << std::endl;
+  return -1;
+}
@@ -0,0 +1,252 @@
+// Decodes a PIPEANN_TRACE file (see include/query_trace.h).
+//
+//   decode_query_trace <trace_file> [--top N] [--query ID] [--all]
+//
+// Default: one summary line per traced query, slowest first (top N, default 20).
+// --query ID prints the full event timeline of one query; --all prints every timeline.
+#include "query_trace.h"
+#include "ssd_index.h"
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using pipeann::TraceEvent;
+
+namespace {
+  const char *kModeNames[] = {"beam", "page", "pipe", "coro"};
+
+  struct QuerySummary {
+    uint64_t id = 0;
+    uint32_t thread = 0, l_search = 0, beam_width = 0, mode = 0, reason = 0;
+    double total_us = 0, ios = 0, hops = 0;
+    uint64_t expansions = 0, tier_hits = 0, tier_misses = 0, n_io_waits = 0;
+    double io_wait_sum_us = 0, io_wait_max_us = 0;
+    double first_io_us = -1;  // submit time of the first IO, relative to query begin.
+    bool complete = false;
+  };
+
+  std::string reason_str(uint32_t reason) {
+    std::string s;
+    if (reason & pipeann::kTrReasonSampled) {
+      s += "sampled,";
+    }
+    if (reason & pipeann::kTrReasonSlow) {
+      s += "slow,";
+    }
+    if (reason & pipeann::kTrReasonFlagged) {
+      s += "flagged,";
+    }
+    if (!s.empty()) {
+      s.pop_back();
+    }
+    return s;
+  }
+
+  float bits_to_float(uint32_t bits) {
+    float f;
+    memcpy(&f, &bits, sizeof(f));
+    return f;
+  }
+
+  QuerySummary summarize(const std::vector<TraceEvent> &evs, double us_per_cycle) {
+    QuerySummary q;
+    q.id = evs.front().query_id;
+    uint64_t t0 = evs.front().ts;
+    // IO completions are matched to the oldest outstanding submit of the same offset.
+    std::unordered_map<uint64_t, std::deque<uint64_t>> submitted;
+    for (auto &e : evs) {
+      double rel_us = (double) (e.ts - t0) * us_per_cycle;
+      switch (e.type) {
+        case pipeann::kTrQueryBegin:
+          q.l_search = (uint32_t) e.a;
+          q.thread = (uint32_t) (e.a >> 32);
+          q.beam_width = e.b;
+          q.mode = e.arg;
+          break;
+        case pipeann::kTrQueryEnd:
+          q.ios = (double) (uint32_t) e.a;
+          q.hops = (double) (e.a >> 32);
+          q.total_us = e.b;
+          q.reason = e.arg;
+          q.complete = true;
+          break;
+        case pipeann::kTrExpand:
+          ++q.expansions;
+          break;
+        case pipeann::kTrTierHit:
+          ++q.tier_hits;
+          break;
+        case pipeann::kTrTierMiss:
+          ++q.tier_misses;
+          break;
+        case pipeann::kTrIoSubmit:
+          submitted[e.a].push_back(e.ts);
+          if (q.first_io_us < 0) {
+            q.first_io_us = rel_us;
+          }
+          break;
+        case pipeann::kTrIoComplete: {
+          auto it = submitted.find(e.a);
+          if (it != submitted.end() && !it->second.empty()) {
+            double wait_us = (double) (e.ts - it->second.front()) * us_per_cycle;
+            it->second.pop_front();
+            q.io_wait_sum_us += wait_us;
+            q.io_wait_max_us = std::max(q.io_wait_max_us, wait_us);
+            ++q.n_io_waits;
+          }
+          break;
+        }
+        default:
+          break;
+      }
+    }
+    return q;
+  }
+
+  void print_timeline(const std::vector<TraceEvent> &evs, double us_per_cycle) {
+    uint64_t t0 = evs.front().ts;
+    std::unordered_map<uint64_t, std::deque<uint64_t>> submitted;
+    uint32_t snapshot = 0;
+    for (size_t i = 0; i < evs.size(); ++i) {
+      auto &e = evs[i];
+      double rel_us = (double) (e.ts - t0) * us_per_cycle;
+      switch (e.type) {
+        case pipeann::kTrQueryBegin:
+          printf("%10.1f us  begin     mode=%s L=%u W=%u thread=%u\n", rel_us, kModeNames[e.arg & 3],
+                 (uint32_t) e.a, e.b, (uint32_t) (e.a >> 32));
+          break;
+        case pipeann::kTrQueryEnd:
+          printf("%10.1f us  end       total=%u us ios=%u hops=%u [%s]\n", rel_us, e.b, (uint32_t) e.a,
+                 (uint32_t) (e.a >> 32), reason_str(e.arg).c_str());
+          break;
+        case pipeann::kTrExpand:
+          printf("%10.1f us  expand    node=%" PRIu64 " page=%u\n", rel_us, e.a, e.b);
+          break;
+        case pipeann::kTrTierHit:
+          printf("%10.1f us  tier-hit  page=%" PRIu64 "\n", rel_us, e.a);
+          break;
+        case pipeann::kTrTierMiss:
+          printf("%10.1f us  tier-miss page=%" PRIu64 "\n", rel_us, e.a);
+          break;
+        case pipeann::kTrIoSubmit:
+          submitted[e.a].push_back(e.ts);
+          printf("%10.1f us  io-submit page=%" PRIu64 " len=%u\n", rel_us, e.a / SECTOR_LEN, e.b);
+          break;
+        case pipeann::kTrIoComplete: {
+          double wait_us = -1;
+          auto it = submitted.find(e.a);
+          if (it != submitted.end() && !it->second.empty()) {
+            wait_us = (double) (e.ts - it->second.front()) * us_per_cycle;
+            it->second.pop_front();
+          }
+          printf("%10.1f us  io-done   page=%" PRIu64 " wait=%.1f us\n", rel_us, e.a / SECTOR_LEN, wait_us);
+          break;
+        }
+        case pipeann::kTrCandidate: {
+          // one line per snapshot: rank 0 starts it, the following candidates continue it.
+          printf("%10.1f us  cands#%-3u", rel_us, snapshot++);
+          size_t j = i;
+          for (; j < evs.size() && evs[j].type == pipeann::kTrCandidate && (j == i || evs[j].arg != 0); ++j) {
+            printf(" %" PRIu64 ":%.4g", evs[j].a, bits_to_float(evs[j].b));
+          }
+          printf("\n");
+          i = j - 1;
+          break;
+        }
+        default:
+          printf("%10.1f us  unknown   type=%u\n", rel_us, e.type);
+          break;
+      }
+    }
+  }
+}  // namespace
+
+int main(int argc, char **argv) {
+  if (argc < 2) {
+    std::cerr << "Usage: " << argv[0] << " <trace_file> [--top N] [--query ID] [--all]" << std::endl;
+    return 1;
+  }
+  std::string path = argv[1];
+  size_t top = 20;
+  int64_t query = -1;
+  bool all = false;
+  for (int i = 2; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--top" && i + 1 < argc) {
+      top = std::stoul(argv[++i]);
+    } else if (arg == "--query" && i + 1 < argc) {
+      query = std::stoll(argv[++i]);
+    } else if (arg == "--all") {
+      all = true;
+    } else {
+      std::cerr << "Unknown argument " << arg << std::endl;
+      return 1;
+    }
+  }
+
+  std::ifstream in(path, std::ios::binary);
+  pipeann::TraceFileHeader hdr;
+  if (!in.read((char *) &hdr, sizeof(hdr)) || memcmp(hdr.magic, pipeann::kTraceMagic, sizeof(hdr.magic)) != 0) {
+    std::cerr << path << " is not a query trace file" << std::endl;
+    return 1;
+  }
+  if (hdr.event_size != sizeof(TraceEvent)) {
+    std::cerr << "Unsupported event size " << hdr.event_size << " (version " << hdr.version << ")" << std::endl;
+    return 1;
+  }
+  double us_per_cycle = 1e6 / hdr.cycles_per_second;
+
+  // Events of one query are contiguous in the file.
+  std::map<uint64_t, std::vector<TraceEvent>> queries;
+  TraceEvent e;
+  uint64_t n_events = 0;
+  while (in.read((char *) &e, sizeof(e))) {
+    queries[e.query_id].push_back(e);
+    ++n_events;
+  }
+
+  std::vector<QuerySummary> sums;
+  for (auto &[id, evs] : queries) {
+    QuerySummary q = summarize(evs, us_per_cycle);
+    if (!q.complete) {
+      continue;  // truncated (should not happen: queries are committed whole).
+    }
+    sums.push_back(q);
+    if (all || (int64_t) id == query) {
+      printf("=== query %" PRIu64 " ===\n", id);
+      print_timeline(evs, us_per_cycle);
+      printf("\n");
+    }
+  }
+  if (query >= 0) {
+    if (queries.find(query) == queries.end()) {
+      std::cerr << "Query " << query << " not in trace" << std::endl;
+      return 1;
+    }
+    return 0;
+  }
+
+  std::sort(sums.begin(), sums.end(),
+            [](const QuerySummary &a, const QuerySummary &b) { return a.total_us > b.total_us; });
+  printf("%" PRIu64 " events, %zu queries (%.3f GHz TSC)\n", n_events, sums.size(), hdr.cycles_per_second / 1e9);
+  printf("%10s %6s %5s %4s %4s %10s %6s %6s %6s %6s %6s %10s %10s %10s  %s\n", "Query", "Thread", "Mode", "L", "W",
+         "Total(us)", "IOs", "Hops", "Expand", "Hits", "Misses", "1stIO(us)", "IOwait(us)", "MaxIO(us)", "Reason");
+  for (size_t i = 0; i < std::min(top, sums.size()); ++i) {
+    auto &q = sums[i];
+    printf("%10" PRIu64 " %6u %5s %4u %4u %10.0f %6.0f %6.0f %6" PRIu64 " %6" PRIu64 " %6" PRIu64
+           " %10.1f %10.1f %10.1f  %s\n",
+           q.id, q.thread, kModeNames[q.mode & 3], q.l_search, q.beam_width, q.total_us, q.ios, q.hops,
+           q.expansions, q.tier_hits, q.tier_misses, q.first_io_us,
+           q.n_io_waits ? q.io_wait_sum_us / q.n_io_waits : 0.0, q.io_wait_max_us, reason_str(q.reason).c_str());
+  }
+  return 0;
+}
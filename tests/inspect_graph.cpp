@@ -30,6 +30,9 @@ int main(int argc, char **argv) {
   size_t adjacency_sample = 0;
   size_t max_neighbors_per_node = 20;
   size_t small_graph = 0;
+  bool locality = false;
+  std::string hot_pages_file;
+  pipeann::LocalityOptions locality_opts;
 
   for (int i = 1; i < argc; i++) {
     std::string arg = argv[i];
@@ -59,17 +62,50 @@ int main(int argc, char **argv) {
         std::cerr << "Error: --small-graph requires a positive number (got \"" << val << "\").\n";
         return 1;
       }
+    } else if (arg == "--locality") {
+      locality = true;
+    } else if (arg == "--partition" && i + 1 < argc) {
+      locality_opts.partition_file = argv[++i];
+    } else if (arg == "--hot-pages" && i + 1 < argc) {
+      hot_pages_file = argv[++i];
+      locality = true;
+    } else if (arg == "--hot-page-count" && i + 1 < argc) {
+      const char *val = argv[++i];
+      if (!parse_positive_size(val, &locality_opts.hot_pages)) {
+        std::cerr << "Error: --hot-page-count requires a positive number (got \"" << val << "\").\n";
+        return 1;
+      }
+    } else if (arg == "--no-bfs") {
+      locality_opts.bfs = false;
+    } else if (arg == "--threads" && i + 1 < argc) {
+      const char *val = argv[++i];
+      size_t nt = 0;
+      if (!parse_positive_size(val, &nt)) {
+        std::cerr << "Error: --threads requires a positive number (got \"" << val << "\").\n";
+        return 1;
+      }
+      locality_opts.num_threads = static_cast<unsigned>(nt);
     } else if (arg == "--help" || arg == "-h") {
       std::cerr << "Usage: " << argv[0]
                 << " (--graph-file <path> | --index-file <path> | --disk-index <path> --data-type <type>)\n"
                    "       [--adjacency-sample N] [--max-neighbors M] [--small-graph N]\n"
+                   "       [--locality [--partition <path>] [--threads N] [--no-bfs]]\n"
+                   "       [--hot-pages <out> [--hot-page-count N]]\n"
                    "  --graph-file <path>   Raw graph file (as written by save_graph at offset 0).\n"
                    "  --index-file <path>   Single-file unified index (graph at 4KB).\n"
                    "  --disk-index <path>   On-disk SSD index (*_disk.index). Requires --data-type.\n"
                    "  --data-type <type>    For --disk-index only: float, uint8, or int8.\n"
                    "  --adjacency-sample N  Print neighbor lists for first N nodes (default: 0 = off).\n"
                    "  --max-neighbors M     Cap neighbors per node in adjacency sample (default: 20).\n"
-                   "  --small-graph N       Print first N nodes with out-neighbors and referenced_by (default: 0 = off).\n";
+                   "  --small-graph N       Print first N nodes with out-neighbors and referenced_by (default: 0 = off).\n"
+                   "  --locality            For --disk-index only: page co-location, in-degree, hub pages,\n"
+                   "                        BFS hops from the medoid, pages per expansion, slot fragmentation.\n"
+                   "  --partition <path>    Page layout (*_partition.bin.aligned) of the disk index (default: none).\n"
+                   "  --threads N           Threads for --locality (default: all cores).\n"
+                   "  --no-bfs              Skip the BFS part of --locality (it reads every reachable page twice).\n"
+                   "  --hot-pages <out>     With --locality: rank pages by in-degree weighted by hops from the medoid\n"
+                   "                        and write them, hottest first, for SSDIndex::load_pinned_pages.\n"
+                   "  --hot-page-count N    Pages to rank for --hot-pages (default: 1024).\n";
       return 0;
     }
   }
@@ -83,6 +119,19 @@ int main(int argc, char **argv) {
     std::cerr << "Error: provide exactly one of --graph-file, --index-file, or --disk-index.\n";
     return 1;
   }
+  if (!hot_pages_file.empty()) {
+    if (!locality_opts.bfs) {
+      std::cerr << "Error: --hot-pages needs the BFS part of --locality (drop --no-bfs).\n";
+      return 1;
+    }
+    if (locality_opts.hot_pages == 0) {
+      locality_opts.hot_pages = 1024;
+    }
+  }
+  if (locality && mode != 4) {
+    std::cerr << "Error: --locality requires --disk-index.\n";
+    return 1;
+  }
   if (mode == 4 && data_type_str.empty()) {
     std::cerr << "Error: --disk-index requires --data-type (float, uint8, or int8).\n";
     return 1;
@@ -175,5 +224,22 @@ int main(int argc, char **argv) {
     }
   }
 
+  if (locality) {
+    std::cout << std::endl;
+    pipeann::LocalityStats ls;
+    if (!pipeann::compute_locality_from_disk_index(path, disk_data_type, locality_opts, &ls)) {
+      std::cerr << "Error: locality analysis failed (read error, multi-sector nodes or bad partition file).\n";
+      return 1;
+    }
+    pipeann::print_locality_report(ls, std::cout);
+    if (!hot_pages_file.empty()) {
+      if (!pipeann::save_hot_pages(ls, hot_pages_file)) {
+        std::cerr << "Error: could not write " << hot_pages_file << "\n";
+        return 1;
+      }
+      std::cout << "Wrote " << ls.hot_pages.size() << " hot pages to " << hot_pages_file << std::endl;
+    }
+  }
+
   return 0;
 }
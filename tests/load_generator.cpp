@@ -0,0 +1,448 @@
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "concurrent_queue.h"
+#include "emulated_aligned_file_reader.h"
+#include "hdr_histogram.h"
+#include "log.h"
+#include "ssd_index.h"
+#include "utils.h"
+#include "v2/dynamic_index.h"
+
+// Open-loop load generator: requests arrive on a schedule (Poisson, uniform or
+// a replayed trace) independent of completions, and latency is measured from
+// the *intended* arrival time, so queueing delay is included and an overloaded
+// server is not hidden by coordinated omission.
+//
+// For every target QPS in the sweep, prints per-operation throughput and
+// latency percentiles (us). Steps run back to back on the same index, so with
+// inserts/deletes the index keeps changing across steps.
+
+namespace {
+  using Clock = std::chrono::steady_clock;
+  enum OpType { OP_SEARCH = 0, OP_INSERT = 1, OP_DELETE = 2, OP_NUM };
+  const char *kOpNames[OP_NUM] = {"search", "insert", "delete"};
+
+  struct Options {
+    std::string type, index_prefix, query_bin, metric = "l2";
+    std::vector<double> qps_list = {1000};
+    double duration_s = 10, warmup_s = 1;
+    std::string arrival = "poisson", trace_file;
+    double mix[OP_NUM] = {100, 0, 0};
+    std::string insert_bin;
+    int64_t insert_tag_start = -1;
+    uint32_t workers = 16, mode = 2, L = 40, beam_width = 4, K = 10, mem_L = 0;
+    uint64_t max_backlog = 1000000, seed = 0;
+    std::string csv_file, hgrm_prefix;
+  };
+
+  struct Request {
+    uint64_t intended_ns;  // offset from step start.
+    uint32_t op;
+  };
+
+  struct WorkerStats {
+    pipeann::HdrHistogram latency[OP_NUM];  // completion - intended arrival, ns.
+    pipeann::HdrHistogram queueing;         // start - intended arrival, ns (all ops).
+    uint64_t last_completion_ns = 0;
+  };
+
+  // Trace: one arrival per line, "<arrival_us> [s|i|d]", sorted by arrival.
+  bool load_trace(const std::string &path, std::vector<double> &arrivals_us, std::vector<int> &ops) {
+    std::ifstream in(path);
+    if (!in.is_open()) {
+      return false;
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+      std::istringstream ss(line);
+      double t;
+      std::string op;
+      if (line.empty() || line[0] == '#' || !(ss >> t)) {
+        continue;
+      }
+      arrivals_us.push_back(t);
+      ops.push_back(!(ss >> op) ? -1 : (op[0] == 'i' ? OP_INSERT : (op[0] == 'd' ? OP_DELETE : OP_SEARCH)));
+    }
+    return arrivals_us.size() >= 2;
+  }
+
+  std::vector<Request> build_schedule(const Options &opt, double qps, const std::vector<double> &trace_us,
+                                      const std::vector<int> &trace_ops, std::mt19937_64 &rng) {
+    std::vector<Request> sched;
+    const uint64_t end_ns = (uint64_t) ((opt.warmup_s + opt.duration_s) * 1e9);
+    std::discrete_distribution<int> op_dist(opt.mix, opt.mix + OP_NUM);
+    std::exponential_distribution<double> gap_dist(qps / 1e9);
+    sched.reserve((size_t) (qps * (opt.warmup_s + opt.duration_s) * 1.1) + 16);
+
+    if (!trace_us.empty()) {
+      // Replay the trace shape, time-scaled to the target mean rate; loop it if short.
+      double span_us = trace_us.back() - trace_us.front();
+      double trace_qps = (trace_us.size() - 1) / (span_us / 1e6);
+      double scale = trace_qps / qps;
+      double period_ns = (span_us + span_us / (trace_us.size() - 1)) * 1e3 * scale;
+      for (uint64_t round = 0;; ++round) {
+        for (size_t i = 0; i < trace_us.size(); ++i) {
+          uint64_t t = (uint64_t) (round * period_ns + (trace_us[i] - trace_us.front()) * 1e3 * scale);
+          if (t >= end_ns) {
+            return sched;
+          }
+          sched.push_back({t, (uint32_t) (trace_ops[i] >= 0 ? trace_ops[i] : op_dist(rng))});
+        }
+      }
+    }
+
+    double t = 0;
+    while (true) {
+      t += opt.arrival == "uniform" ? 1e9 / qps : gap_dist(rng);
+      if (t >= end_ns) {
+        break;
+      }
+      sched.push_back({(uint64_t) t, (uint32_t) op_dist(rng)});
+    }
+    return sched;
+  }
+
+  void print_usage(const char *prog) {
+    std::cout << "Usage: " << prog << " <type[int8/uint8/float]> <index_prefix> <query_bin> [options]\n"
+              << "  --qps <q1,q2,...>        target arrival rates to sweep (default 1000)\n"
+              << "  --duration <s>           measured seconds per step (default 10)\n"
+              << "  --warmup <s>             unmeasured seconds before each step (default 1)\n"
+              << "  --arrival <poisson|uniform|trace:<file>>\n"
+              << "                           trace lines are \"<arrival_us> [s|i|d]\", rescaled to each QPS\n"
+              << "  --mix <search:insert:delete>  operation weights (default 100:0:0)\n"
+              << "  --insert-data <bin>      vectors to insert (required for inserts)\n"
+              << "  --insert-tag-start <n>   first inserted tag (default: #points in the index)\n"
+              << "  --workers <n>            server threads (default 16)\n"
+              << "  --mode <0|1|2>           beam / page / pipe search (default 2)\n"
+              << "  --L <n> --beam <n> --K <n> --mem-L <n> --metric <l2|cosine>\n"
+              << "  --max-backlog <n>        arrivals beyond this many queued requests are dropped\n"
+              << "  --csv <file>             append one row per (QPS, op)\n"
+              << "  --hgrm <prefix>          write <prefix>_<qps>_<op>.hgrm percentile distributions\n"
+              << "  --seed <n>\n"
+              << "Inserts/deletes run on a DynamicSSDIndex (deletes remove tags 0, 1, 2, ...)." << std::endl;
+  }
+
+  bool parse_options(int argc, char **argv, Options &opt) {
+    if (argc < 4) {
+      return false;
+    }
+    opt.type = argv[1];
+    opt.index_prefix = argv[2];
+    opt.query_bin = argv[3];
+    for (int i = 4; i < argc; ++i) {
+      std::string arg = argv[i];
+      if (i + 1 >= argc) {
+        std::cout << "Missing value for " << arg << std::endl;
+        return false;
+      }
+      std::string val = argv[++i];
+      if (arg == "--qps") {
+        opt.qps_list.clear();
+        std::stringstream ss(val);
+        std::string tok;
+        while (std::getline(ss, tok, ',')) {
+          opt.qps_list.push_back(std::stod(tok));
+        }
+      } else if (arg == "--duration") {
+        opt.duration_s = std::stod(val);
+      } else if (arg == "--warmup") {
+        opt.warmup_s = std::stod(val);
+      } else if (arg == "--arrival") {
+        opt.arrival = val;
+        if (val.rfind("trace:", 0) == 0) {
+          opt.arrival = "trace";
+          opt.trace_file = val.substr(6);
+        } else if (val != "poisson" && val != "uniform") {
+          std::cout << "Unknown arrival process: " << val << std::endl;
+          return false;
+        }
+      } else if (arg == "--mix") {
+        if (sscanf(val.c_str(), "%lf:%lf:%lf", &opt.mix[0], &opt.mix[1], &opt.mix[2]) != 3) {
+          std::cout << "Bad --mix: " << val << std::endl;
+          return false;
+        }
+      } else if (arg == "--insert-data") {
+        opt.insert_bin = val;
+      } else if (arg == "--insert-tag-start") {
+        opt.insert_tag_start = std::stoll(val);
+      } else if (arg == "--workers") {
+        opt.workers = std::max(1, std::stoi(val));
+      } else if (arg == "--mode") {
+        opt.mode = std::stoi(val);
+      } else if (arg == "--L") {
+        opt.L = std::stoi(val);
+      } else if (arg == "--beam") {
+        opt.beam_width = std::stoi(val);
+      } else if (arg == "--K") {
+        opt.K = std::stoi(val);
+      } else if (arg == "--mem-L") {
+        opt.mem_L = std::stoi(val);
+      } else if (arg == "--metric") {
+        opt.metric = val;
+      } else if (arg == "--max-backlog") {
+        opt.max_backlog = std::stoull(val);
+      } else if (arg == "--csv") {
+        opt.csv_file = val;
+      } else if (arg == "--hgrm") {
+        opt.hgrm_prefix = val;
+      } else if (arg == "--seed") {
+        opt.seed = std::stoull(val);
+      } else {
+        std::cout << "Unknown option: " << arg << std::endl;
+        return false;
+      }
+    }
+    if (opt.mode > PIPE_SEARCH) {
+      std::cout << "Only modes 0-2 are supported: coroutine search batches queries per thread." << std::endl;
+      return false;
+    }
+    return !opt.qps_list.empty() && opt.duration_s > 0;
+  }
+}  // namespace
+
+template<typename T>
+int run_load(const Options &opt) {
+  using TagT = uint32_t;
+  pipeann::Metric metric = opt.metric == "cosine" ? pipeann::Metric::COSINE : pipeann::Metric::L2;
+
+  T *queries = nullptr;
+  size_t n_queries, query_dim;
+  pipeann::load_bin<T>(opt.query_bin, queries, n_queries, query_dim);
+
+  std::vector<double> trace_us;
+  std::vector<int> trace_ops;
+  if (opt.arrival == "trace" && !load_trace(opt.trace_file, trace_us, trace_ops)) {
+    LOG(ERROR) << "Cannot load a trace with at least two arrivals from " << opt.trace_file;
+    return -1;
+  }
+  bool trace_updates = false;
+  for (int op : trace_ops) {
+    trace_updates |= op == OP_INSERT || op == OP_DELETE;
+  }
+  const bool dynamic = opt.mix[OP_INSERT] > 0 || opt.mix[OP_DELETE] > 0 || trace_updates;
+
+  std::shared_ptr<AlignedFileReader> reader;
+  std::unique_ptr<pipeann::SSDIndex<T, TagT>> static_index;
+  std::unique_ptr<pipeann::Distance<T>> dist_cmp;
+  std::unique_ptr<pipeann::DynamicSSDIndex<T, TagT>> dyn_index;
+  uint64_t n_points = 0;
+  if (dynamic) {
+    pipeann::Parameters paras;
+    paras.Set<unsigned>("L_disk", 128);
+    paras.Set<unsigned>("R_disk", 0);
+    paras.Set<float>("alpha_disk", 1.2);
+    paras.Set<unsigned>("C", 384);
+    paras.Set<unsigned>("beamwidth", opt.beam_width);
+    paras.Set<unsigned>("nodes_to_cache", 0);
+    paras.Set<unsigned>("num_threads", opt.workers);
+    dist_cmp.reset(pipeann::get_distance_function<T>(metric));
+    dyn_index.reset(new pipeann::DynamicSSDIndex<T, TagT>(paras, opt.index_prefix, opt.index_prefix + "_loadgen",
+                                                          dist_cmp.get(), metric, opt.mode, opt.mem_L != 0));
+    n_points = dyn_index->_disk_index->num_points;
+  } else {
+    reader.reset(new_aligned_file_reader());
+    static_index.reset(new pipeann::SSDIndex<T, TagT>(metric, reader, SearchMode(opt.mode), true));
+    int res = static_index->load(opt.index_prefix.c_str(), opt.workers, true, opt.mode != BEAM_SEARCH);
+    if (res != 0) {
+      return res;
+    }
+    if (opt.mem_L != 0) {
+      static_index->load_mem_index(metric, query_dim, opt.index_prefix + "_mem.index");
+    }
+    n_points = static_index->num_points;
+  }
+
+  T *insert_data = nullptr;
+  size_t n_insert = 0, insert_dim = 0;
+  if (opt.mix[OP_INSERT] > 0 || trace_updates) {
+    if (opt.insert_bin.empty()) {
+      LOG(ERROR) << "Inserts require --insert-data";
+      return -1;
+    }
+    pipeann::load_bin<T>(opt.insert_bin, insert_data, n_insert, insert_dim);
+    if (insert_dim != query_dim) {
+      LOG(ERROR) << "Insert data dimension " << insert_dim << " != query dimension " << query_dim;
+      return -1;
+    }
+  }
+  const uint64_t tag_start = opt.insert_tag_start >= 0 ? (uint64_t) opt.insert_tag_start : n_points;
+  std::atomic<uint64_t> n_inserted{0}, n_deleted{0};
+
+  auto execute = [&](uint32_t op, uint64_t seq, TagT *res_tags, float *res_dists) {
+    pipeann::QueryStats stats;
+    if (op == OP_INSERT) {
+      uint64_t i = n_inserted.fetch_add(1);
+      dyn_index->insert(insert_data + (i % n_insert) * query_dim, (TagT) (tag_start + i));
+    } else if (op == OP_DELETE) {
+      dyn_index->lazy_delete((TagT) (n_deleted.fetch_add(1) % n_points));
+    } else if (dynamic) {
+      dyn_index->search(queries + (seq % n_queries) * query_dim, opt.K, opt.mem_L, opt.L, opt.beam_width, res_tags,
+                        res_dists, &stats, true);
+    } else {
+      const T *q = queries + (seq % n_queries) * query_dim;
+      if (opt.mode == PIPE_SEARCH) {
+        static_index->pipe_search(q, opt.K, opt.mem_L, opt.L, res_tags, res_dists, opt.beam_width, &stats);
+      } else if (opt.mode == PAGE_SEARCH) {
+        static_index->page_search(q, opt.K, opt.mem_L, opt.L, res_tags, res_dists, opt.beam_width, &stats);
+      } else {
+        static_index->beam_search(q, opt.K, opt.mem_L, opt.L, res_tags, res_dists, opt.beam_width, &stats, nullptr,
+                                  false);
+      }
+    }
+  };
+
+  std::ofstream csv;
+  if (!opt.csv_file.empty()) {
+    csv.open(opt.csv_file, std::ios::app);
+    csv.seekp(0, std::ios::end);
+    if (csv.tellp() == 0) {  // only a new or empty file gets the header; later runs append rows under it.
+      csv << "target_qps,op,count,dropped,achieved_qps,mean_us,p50_us,p90_us,p99_us,p999_us,max_us,queue_p99_us\n";
+    }
+  }
+
+  std::cout.setf(std::ios_base::fixed, std::ios_base::floatfield);
+  std::cout.precision(1);
+  std::cout << std::setw(11) << "TargetQPS" << std::setw(8) << "Op" << std::setw(10) << "Count" << std::setw(9)
+            << "Dropped" << std::setw(12) << "Achieved" << std::setw(11) << "Mean(us)" << std::setw(11) << "P50"
+            << std::setw(11) << "P90" << std::setw(11) << "P99" << std::setw(11) << "P99.9" << std::setw(11) << "Max"
+            << std::setw(12) << "QueueP99" << std::endl;
+  std::cout << std::string(128, '=') << std::endl;
+
+  std::mt19937_64 rng(opt.seed);
+  const uint64_t warmup_ns = (uint64_t) (opt.warmup_s * 1e9);
+  uint64_t seq_base = 0;
+  for (double qps : opt.qps_list) {
+    std::vector<Request> sched = build_schedule(opt, qps, trace_us, trace_ops, rng);
+    pipeann::ConcurrentQueue<int64_t> queue(-1);
+    std::vector<WorkerStats> wstats(opt.workers);
+    std::atomic<uint64_t> n_done{0};
+    std::atomic<bool> dispatch_done{false};
+    Clock::time_point start = Clock::now() + std::chrono::milliseconds(1);
+    auto now_ns = [&]() {
+      return (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count();
+    };
+
+    std::vector<std::thread> workers;
+    for (uint32_t w = 0; w < opt.workers; ++w) {
+      workers.emplace_back([&, w]() {
+        std::vector<TagT> res_tags(opt.K);
+        std::vector<float> res_dists(opt.K);
+        WorkerStats &ws = wstats[w];
+        while (true) {
+          int64_t idx = queue.pop();
+          if (idx == -1) {
+            if (dispatch_done.load(std::memory_order_acquire) && queue.empty()) {
+              break;
+            }
+            queue.wait_for_push_notify();
+            continue;
+          }
+          const Request &req = sched[idx];
+          uint64_t begin = now_ns();
+          execute(req.op, seq_base + idx, res_tags.data(), res_dists.data());
+          uint64_t end = now_ns();
+          n_done.fetch_add(1, std::memory_order_relaxed);
+          if (req.intended_ns >= warmup_ns) {
+            ws.latency[req.op].record(end - req.intended_ns);
+            ws.queueing.record(begin - req.intended_ns);
+            ws.last_completion_ns = std::max(ws.last_completion_ns, end);
+          }
+        }
+      });
+    }
+
+    // Dispatch on schedule; sleep when far from the next arrival, spin when close.
+    uint64_t n_dropped = 0, n_pushed = 0;
+    for (size_t i = 0; i < sched.size(); ++i) {
+      uint64_t t = sched[i].intended_ns;
+      uint64_t cur = now_ns();
+      if (cur + 200000 < t) {
+        std::this_thread::sleep_for(std::chrono::nanoseconds(t - cur - 100000));
+      }
+      while (now_ns() < t) {
+      }
+      if (n_pushed - n_done.load(std::memory_order_relaxed) >= opt.max_backlog) {
+        n_dropped += sched[i].intended_ns >= warmup_ns;
+        continue;
+      }
+      queue.push((int64_t) i);
+      queue.push_notify_one();
+      ++n_pushed;
+    }
+    dispatch_done.store(true, std::memory_order_release);
+    queue.push_notify_all();
+    for (auto &t : workers) {
+      t.join();
+    }
+    seq_base += sched.size();
+
+    pipeann::HdrHistogram latency[OP_NUM], queueing;
+    uint64_t last_ns = warmup_ns;
+    for (auto &ws : wstats) {
+      for (int op = 0; op < OP_NUM; ++op) {
+        latency[op].merge(ws.latency[op]);
+      }
+      queueing.merge(ws.queueing);
+      last_ns = std::max(last_ns, ws.last_completion_ns);
+    }
+    // Measured window: end of warmup to the later of the last arrival and the last completion.
+    double window_s = std::max((double) (last_ns - warmup_ns), opt.duration_s * 1e9) / 1e9;
+    for (int op = 0; op < OP_NUM; ++op) {
+      const auto &h = latency[op];
+      if (h.count() == 0) {
+        continue;
+      }
+      double achieved = h.count() / window_s;
+      std::cout << std::setw(11) << qps << std::setw(8) << kOpNames[op] << std::setw(10) << h.count() << std::setw(9)
+                << n_dropped << std::setw(12) << achieved << std::setw(11) << h.mean() / 1e3 << std::setw(11)
+                << h.percentile(50) / 1e3 << std::setw(11) << h.percentile(90) / 1e3 << std::setw(11)
+                << h.percentile(99) / 1e3 << std::setw(11) << h.percentile(99.9) / 1e3 << std::setw(11)
+                << h.max() / 1e3 << std::setw(12) << queueing.percentile(99) / 1e3 << std::endl;
+      if (csv.is_open()) {
+        csv << qps << "," << kOpNames[op] << "," << h.count() << "," << n_dropped << "," << achieved << ","
+            << h.mean() / 1e3 << "," << h.percentile(50) / 1e3 << "," << h.percentile(90) / 1e3 << ","
+            << h.percentile(99) / 1e3 << "," << h.percentile(99.9) / 1e3 << "," << h.max() / 1e3 << ","
+            << queueing.percentile(99) / 1e3 << "\n";
+      }
+      if (!opt.hgrm_prefix.empty()) {
+        std::ofstream out(opt.hgrm_prefix + "_" + std::to_string((uint64_t) qps) + "_" + kOpNames[op] + ".hgrm");
+        h.print_percentiles(out, 1e3);
+      }
+    }
+  }
+
+  if (dynamic) {
+    dyn_index->log_stats();  // index-side (service time) percentiles over the whole sweep.
+  }
+  delete[] queries;
+  delete[] insert_data;
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  Options opt;
+  if (!parse_options(argc, argv, opt)) {
+    print_usage(argv[0]);
+    return -1;
+  }
+  if (opt.type == "float") {
+    return run_load<float>(opt);
+  } else if (opt.type == "int8") {
+    return run_load<int8_t>(opt);
+  } else if (opt.type == "uint8") {
+    return run_load<uint8_t>(opt);
+  }
+  std::cout << "Unsupported type: " << opt.type << ". Use float/int8/uint8" << std::endl;
+  return -1;
+}
@@ -121,8 +121,8 @@ void sync_search_kernel(T *query, size_t query_num, size_t query_aligned_dim, co
     }
   }
 
-  std::vector<double> latency_stats(query_num, 0);
-  pipeann::QueryStats *stats = new pipeann::QueryStats[query_num];
+  pipeann::QueryStatsRecorder recorder;
+  pipeann::StreamingHistogram latency_ns;  // wall-clock, including delete-set filtering.
   std::string recall_string = "Recall@" + std::to_string(recall_at);
   std::cout << std::setw(4) << "Ls" << std::setw(12) << "QPS " << std::setw(18) << "Mean Lat" << std::setw(12)
             << "50 Lat" << std::setw(12) << "90 Lat" << std::setw(12) << "95 Lat" << std::setw(12) << "99 Lat"
@@ -136,12 +136,13 @@ void sync_search_kernel(T *query, size_t query_num, size_t query_aligned_dim, co
   for (int64_t i = 0; i < (int64_t) query_num; i++) {
     auto qs = std::chrono::high_resolution_clock::now();
     // stats[i].n_current_used = 8;
+    pipeann::QueryStats stats;
     sync_index.search(query + i * query_aligned_dim, recall_at, 0, L, beam_width, query_result_tags + i * recall_at,
-                      query_result_dists + i * recall_at, stats + i, true);
+                      query_result_dists + i * recall_at, &stats, true);
+    recorder.record(stats);
 
     auto qe = std::chrono::high_resolution_clock::now();
-    std::chrono::duration<double> diff = qe - qs;
-    latency_stats[i] = diff.count() * 1000;
+    latency_ns.record(std::chrono::duration_cast<std::chrono::nanoseconds>(qe - qs).count());
     std::this_thread::sleep_for(std::chrono::milliseconds(2));
   }
   auto e = std::chrono::high_resolution_clock::now();
@@ -158,23 +159,20 @@ void sync_search_kernel(T *query, size_t query_num, size_t query_aligned_dim, co
 
   std::cout << "search current time: " << current_time << std::endl;
 
-  float mean_ios =
-      (float) pipeann::get_mean_stats(stats, query_num, [](const pipeann::QueryStats &stats) { return stats.n_ios; });
-
-  std::sort(latency_stats.begin(), latency_stats.end());
-  std::cout << std::setw(4) << L << std::setw(12) << qps << std::setw(18)
-            << ((float) std::accumulate(latency_stats.begin(), latency_stats.end(), 0.0f)) / (float) query_num
-            << std::setw(12) << (float) latency_stats[(_u64) (0.50 * ((double) query_num))] << std::setw(12)
-            << (float) latency_stats[(_u64) (0.90 * ((double) query_num))] << std::setw(12)
-            << (float) latency_stats[(_u64) (0.95 * ((double) query_num))] << std::setw(12)
-            << (float) latency_stats[(_u64) (0.99 * ((double) query_num))] << std::setw(12)
-            << (float) latency_stats[(_u64) (0.999 * ((double) query_num))] << std::setw(12) << recall << std::setw(12)
+  float mean_ios = (float) recorder.snapshot().n_ios.mean();
+
+  // latency in ms.
+  pipeann::HdrHistogram lat = latency_ns.snapshot();
+  std::cout << std::setw(4) << L << std::setw(12) << qps << std::setw(18) << (float) (lat.mean() / 1e6) << std::setw(12)
+            << (float) (lat.percentile(50) / 1e6) << std::setw(12) << (float) (lat.percentile(90) / 1e6)
+            << std::setw(12) << (float) (lat.percentile(95) / 1e6) << std::setw(12)
+            << (float) (lat.percentile(99) / 1e6) << std::setw(12) << (float) (lat.percentile(99.9) / 1e6)
+            << std::setw(12) << recall << std::setw(12)
             << mean_ios << std::endl;
   disk_io = mean_ios;
 
   delete[] query_result_dists;
   delete[] query_result_tags;
-  delete[] stats;
 }
 
 template<typename T, typename TagT>
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cstring>
 #include <omp.h>
 #include <ssd_index.h>
@@ -7,6 +8,7 @@
 
 #include "log.h"
 #include "observability.h"
+#include "telemetry.h"
 #include "timer.h"
 #include "utils.h"
 #include "aux_utils.h"
@@ -14,10 +16,15 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
-#include "linux_aligned_file_reader.h"
+#include "emulated_aligned_file_reader.h"
 
 #define WARMUP false
 
+// search_async through the per-thread coroutine engine (not a SearchMode of the index itself).
+constexpr int kAsyncSearchMode = 4;
+// batch_search_offline over all queries at once (throughput only; latencies are per batch).
+constexpr int kOfflineSearchMode = 5;
+
 void print_stats(std::string category, std::vector<float> percentiles, std::vector<float> results) {
   std::cout << std::setw(20) << category << ": " << std::flush;
   for (uint32_t s = 0; s < percentiles.size(); s++) {
@@ -52,7 +59,7 @@ int search_disk_index(int argc, char **argv) {
   _u64 recall_at = std::atoi(argv[index++]);
   std::string dist_metric(argv[index++]);
   int search_mode = std::atoi(argv[index++]);
-  bool use_page_search = search_mode != 0;
+  bool use_page_search = search_mode != BEAM_SEARCH && search_mode != kOfflineSearchMode;
   _u32 mem_L = std::atoi(argv[index++]);
 
   pipeann::Metric m = dist_metric == "cosine" ? pipeann::Metric::COSINE : pipeann::Metric::L2;
@@ -64,7 +71,76 @@ int search_disk_index(int argc, char **argv) {
 
   bool calc_recall_flag = false;
 
+  // options (see usage) may come anywhere among the L values.
+  bool low_dram = false;
+  std::string early_stop_model;
+  uint32_t refine_r = 0;
+  bool refine_in_memory = false;
+  float adaptive_spread = 0;
+  std::string pin_list;
+  uint64_t pin_max_pages = 0;
+  bool coalesce_reads = false;
   for (int ctr = index; ctr < argc; ctr++) {
+    std::string arg(argv[ctr]);
+    if (arg == "--low-dram") {
+      low_dram = true;
+      continue;
+    }
+    if (arg == "--coalesce-reads") {
+      coalesce_reads = true;
+      continue;
+    }
+    if (arg == "--early-stop" && ctr + 1 < argc) {
+      early_stop_model = argv[++ctr];
+      continue;
+    }
+    if (arg == "--refine" && ctr + 1 < argc) {
+      // "R" or "R:mem", R > 0.
+      std::string spec = argv[++ctr];
+      char *end = nullptr;
+      unsigned long r = std::strtoul(spec.c_str(), &end, 10);
+      refine_in_memory = std::string(end) == ":mem";
+      if (end == spec.c_str() || r == 0 || r > UINT32_MAX || (*end != '\0' && !refine_in_memory)) {
+        std::cout << "Invalid --refine " << spec << ", expected R or R:mem with R > 0" << std::endl;
+        return -1;
+      }
+      refine_r = (uint32_t) r;
+      continue;
+    }
+    if (arg == "--adaptive-l" && ctr + 1 < argc) {
+      std::string spec = argv[++ctr];
+      char *end = nullptr;
+      adaptive_spread = std::strtof(spec.c_str(), &end);
+      if (end == spec.c_str() || *end != '\0' || !(adaptive_spread > 0 && adaptive_spread <= 1)) {
+        std::cout << "Invalid --adaptive-l " << spec << ", expected a spread in (0, 1]" << std::endl;
+        return -1;
+      }
+      continue;
+    }
+    if (arg == "--pin-pages" && ctr + 1 < argc) {
+      // "list" or "list:N".
+      std::string spec = argv[++ctr];
+      size_t colon = spec.rfind(':');
+      pin_list = spec.substr(0, colon);
+      if (colon != std::string::npos) {
+        std::string n = spec.substr(colon + 1);
+        char *end = nullptr;
+        pin_max_pages = std::strtoull(n.c_str(), &end, 10);
+        if (n.empty() || *end != '\0' || pin_max_pages == 0) {
+          std::cout << "Invalid --pin-pages " << spec << ", expected list or list:N with N > 0" << std::endl;
+          return -1;
+        }
+      }
+      continue;
+    }
+    if (arg.rfind("--", 0) == 0) {
+      std::cout << "Unknown option or missing value: " << arg << std::endl;
+      return -1;
+    }
+    if (arg == "auto") {
+      Lvec.push_back(0);  // the search profile's L, set after loading.
+      continue;
+    }
     _u64 curL = std::atoi(argv[ctr]);
     if (curL >= recall_at)
       Lvec.push_back(curL);
@@ -77,7 +153,7 @@ int search_disk_index(int argc, char **argv) {
 
   std::cout << "Search parameters: #threads: " << num_threads << ", ";
   if (beamwidth <= 0)
-    std::cout << "beamwidth to be optimized for each L value" << std::endl;
+    std::cout << "beamwidth from the index's search profile, if any" << std::endl;
   else
     std::cout << " beamwidth: " << beamwidth << std::endl;
 
@@ -99,16 +175,73 @@ int search_disk_index(int argc, char **argv) {
   }
 
   std::shared_ptr<AlignedFileReader> reader = nullptr;
-  reader.reset(new LinuxAlignedFileReader());
+  reader.reset(new_aligned_file_reader());
 
   std::unique_ptr<pipeann::SSDIndex<T>> _pFlashIndex(
       new pipeann::SSDIndex<T>(m, reader, SearchMode(search_mode), tags_flag));
 
+  if (low_dram) {
+    if (mem_L != 0) {
+      std::cout << "--low-dram drops the PQ codes that mem_L needs; use mem_L 0" << std::endl;
+      return -1;
+    }
+    _pFlashIndex->set_keep_pq_codes(false);  // inline-PQ indexes search without them.
+  }
   int res = _pFlashIndex->load(index_prefix_path.c_str(), num_threads, true, use_page_search);
   if (res != 0) {
     return res;
   }
 
+  // beam width 0 and L "auto" take the index's defaults, tuned by tune_search. Without a profile, beam width 0
+  // is passed through as before.
+  const pipeann::SearchProfile *profile = _pFlashIndex->search_profile();
+  bool auto_L = std::find(Lvec.begin(), Lvec.end(), 0) != Lvec.end();
+  if (auto_L && profile == nullptr) {
+    std::cout << "L \"auto\" needs " << index_prefix_path << "_search.profile" << std::endl;
+    return -1;
+  }
+  if (profile != nullptr && (beamwidth == 0 || auto_L)) {
+    if (profile->mode != search_mode || profile->mem_L != mem_L) {
+      LOG(WARNING) << "The profile was tuned for mode " << profile->mode << ", mem_L " << profile->mem_L;
+    }
+    pipeann::AsyncSearchParams defaults = _pFlashIndex->default_search_params();
+    beamwidth = beamwidth == 0 ? (_u32) defaults.beam_width : beamwidth;
+    for (auto &L : Lvec) {
+      L = L == 0 ? std::max(defaults.l_search, recall_at) : L;
+    }
+  }
+
+  // a model trained by train_early_stop for this search mode.
+  if (!early_stop_model.empty()) {
+    auto model = std::make_shared<pipeann::EarlyStopModel>();
+    if (model->load(early_stop_model) != 0) {
+      return -1;
+    }
+    _pFlashIndex->set_early_stop(model);
+  }
+
+  // per-query L and beam width from 1 - spread to 1 + spread times the configured ones, by query difficulty.
+  if (adaptive_spread > 0) {
+    pipeann::AdaptiveBudgetParams params;
+    params.spread = adaptive_spread;
+    _pFlashIndex->set_adaptive_budget(std::make_shared<pipeann::AdaptiveBudget>(params));
+  }
+
+  // rerank the best refine_r unexpanded candidates with <prefix>_sq8.bin (create_refine_codes).
+  if (refine_r != 0 &&
+      _pFlashIndex->load_refine_codes(index_prefix_path + "_sq8.bin", refine_r, refine_in_memory) != 0) {
+    return -1;
+  }
+
+  // serve the first pin_max_pages pages (0: all) of a hot page list (inspect_graph --hot-pages) from pinned
+  // memory.
+  if (!pin_list.empty() && _pFlashIndex->load_pinned_pages(pin_list, pin_max_pages) != 0) {
+    return -1;
+  }
+
+  // concurrent queries share their reads of a page instead of each reading it.
+  _pFlashIndex->set_read_coalescing(coalesce_reads);
+
   if (mem_L != 0) {
     auto mem_index_path = index_prefix_path + "_mem.index";
     LOG(INFO) << "Load memory index " << mem_index_path << " " << query_dim;
@@ -116,13 +249,16 @@ int search_disk_index(int argc, char **argv) {
   }
 
   omp_set_num_threads(num_threads);
+  if (search_mode == kAsyncSearchMode) {
+    _pFlashIndex->start_async_engine(num_threads);
+  }
 
   std::vector<std::vector<uint32_t>> query_result_ids(Lvec.size());
   std::vector<std::vector<uint32_t>> query_result_tags(Lvec.size());
   std::vector<std::vector<float>> query_result_dists(Lvec.size());
 
   auto run_tests = [&](uint32_t test_id, bool output) {
-    pipeann::QueryStats *stats = new pipeann::QueryStats[query_num];
+    pipeann::QueryStatsRecorder recorder;
     _u64 L = Lvec[test_id];
 
     query_result_ids[test_id].resize(recall_at * query_num);
@@ -136,44 +272,78 @@ int search_disk_index(int argc, char **argv) {
     if (search_mode == SearchMode::PIPE_SEARCH) {
 #pragma omp parallel for schedule(dynamic, 1)
       for (_s64 i = 0; i < (int64_t) query_num; i++) {
+        pipeann::QueryStats stats;
         _pFlashIndex->pipe_search(query + (i * query_dim), (uint64_t) recall_at, mem_L, (uint64_t) L,
                                   query_result_tags_32.data() + (i * recall_at),
                                   query_result_dists[test_id].data() + (i * recall_at), (uint64_t) beamwidth,
-                                  stats + i);
+                                  &stats);
+        recorder.record(stats);
       }
     } else if (search_mode == SearchMode::PAGE_SEARCH) {
 #pragma omp parallel for schedule(dynamic, 1)
       for (_s64 i = 0; i < (int64_t) query_num; i++) {
+        pipeann::QueryStats stats;
         _pFlashIndex->page_search(query + (i * query_dim), (uint64_t) recall_at, mem_L, (uint64_t) L,
                                   query_result_tags_32.data() + (i * recall_at),
                                   query_result_dists[test_id].data() + (i * recall_at), (uint64_t) beamwidth,
-                                  stats + i);
+                                  &stats);
+        recorder.record(stats);
       }
     } else if (search_mode == SearchMode::CORO_SEARCH) {
       constexpr uint64_t kBatchSize = 8;
       T *q[kBatchSize];
       uint32_t *res_tags[kBatchSize];
       float *res_dists[kBatchSize];
+      pipeann::QueryStats stats[kBatchSize];
       int N;
-#pragma omp parallel for schedule(dynamic, 1) private(q, res_tags, res_dists, N)
+#pragma omp parallel for schedule(dynamic, 1) private(q, res_tags, res_dists, stats, N)
       for (_s64 i = 0; i < (int64_t) query_num; i += kBatchSize) {
         N = std::min(kBatchSize, query_num - i);
         for (int v = 0; v < N; ++v) {
           q[v] = query + ((i + v) * query_dim);
           res_tags[v] = query_result_tags_32.data() + ((i + v) * recall_at);
           res_dists[v] = query_result_dists[test_id].data() + ((i + v) * recall_at);
+          stats[v] = pipeann::QueryStats();
         }
 
         _pFlashIndex->coro_search(q, (uint64_t) recall_at, mem_L, (uint64_t) L, res_tags, res_dists,
-                                  (uint64_t) beamwidth, N);
+                                  (uint64_t) beamwidth, N, stats);
+        for (int v = 0; v < N; ++v) {
+          recorder.record(stats[v]);
+        }
       }
     } else if (search_mode == SearchMode::BEAM_SEARCH) {
 #pragma omp parallel for schedule(dynamic, 1)
       for (_s64 i = 0; i < (int64_t) query_num; i++) {
+        pipeann::QueryStats stats;
         _pFlashIndex->beam_search(query + (i * query_dim), (uint64_t) recall_at, mem_L, (uint64_t) L,
                                   query_result_tags_32.data() + (i * recall_at),
-                                  query_result_dists[test_id].data() + (i * recall_at), (uint64_t) beamwidth, stats + i,
+                                  query_result_dists[test_id].data() + (i * recall_at), (uint64_t) beamwidth, &stats,
                                   nullptr, false);
+        recorder.record(stats);
+      }
+    } else if (search_mode == kAsyncSearchMode) {
+      pipeann::AsyncSearchParams params;
+      params.k_search = recall_at;
+      params.mem_L = mem_L;
+      params.l_search = L;
+      params.beam_width = beamwidth;
+      std::vector<std::future<pipeann::AsyncSearchResult<uint32_t>>> futures(query_num);
+      for (_u64 i = 0; i < query_num; i++) {
+        futures[i] = _pFlashIndex->search_async(query + (i * query_dim), params);
+      }
+      for (_u64 i = 0; i < query_num; i++) {
+        auto res = futures[i].get();
+        std::copy(res.tags.begin(), res.tags.end(), query_result_tags_32.data() + (i * recall_at));
+        std::copy(res.dists.begin(), res.dists.end(), query_result_dists[test_id].data() + (i * recall_at));
+        recorder.record(res.stats);
+      }
+    } else if (search_mode == kOfflineSearchMode) {
+      std::vector<pipeann::QueryStats> stats(query_num);
+      _pFlashIndex->batch_search_offline(query, query_num, recall_at, mem_L, L, query_result_tags_32.data(),
+                                         query_result_dists[test_id].data(), beamwidth, num_threads, stats.data());
+      for (auto &st : stats) {
+        recorder.record(st);
       }
     } else {
       std::cout << "Unknown search mode: " << search_mode << std::endl;
@@ -187,19 +357,11 @@ int search_disk_index(int argc, char **argv) {
     pipeann::convert_types<uint32_t, uint32_t>(query_result_tags_32.data(), query_result_tags[test_id].data(),
                                                (size_t) query_num, (size_t) recall_at);
 
-    float mean_latency = (float) pipeann::get_mean_stats(
-        stats, query_num, [](const pipeann::QueryStats &stats) { return stats.total_us; });
-
-    float latency_999 = (float) pipeann::get_percentile_stats(
-        stats, query_num, 0.999f, [](const pipeann::QueryStats &stats) { return stats.total_us; });
-
-    float mean_hops = (float) pipeann::get_mean_stats(stats, query_num,
-                                                      [](const pipeann::QueryStats &stats) { return stats.n_hops; });
-
-    float mean_ios =
-        (float) pipeann::get_mean_stats(stats, query_num, [](const pipeann::QueryStats &stats) { return stats.n_ios; });
-
-    delete[] stats;
+    pipeann::QueryStatsSnapshot snap = recorder.snapshot();
+    float mean_latency = (float) (snap.latency_ns.mean() / 1e3);
+    float latency_999 = (float) (snap.latency_ns.percentile(99.9) / 1e3);
+    float mean_hops = (float) snap.n_hops.mean();
+    float mean_ios = (float) snap.n_ios.mean();
 
     if (output) {
       float recall = 0;
@@ -215,8 +377,12 @@ int search_disk_index(int argc, char **argv) {
                 << mean_latency << std::setw(12) << latency_999 << std::setw(12) << mean_hops << std::setw(12)
                 << mean_ios;
       if (calc_recall_flag) {
-        std::cout << std::setw(12) << recall << std::endl;
+        std::cout << std::setw(12) << recall;
       }
+      for (uint32_t p = 0; p < pipeann::kNumQueryPhases; ++p) {
+        std::cout << std::setw(9) << snap.phase_ns[p].mean() / 1e3;
+      }
+      std::cout << std::endl;
     }
   };
 
@@ -233,19 +399,31 @@ int search_disk_index(int argc, char **argv) {
 
   std::string recall_string = "Recall@" + std::to_string(recall_at);
   std::cout << std::setw(6) << "L" << std::setw(12) << "I/O Width" << std::setw(12) << "QPS" << std::setw(12)
-            << "AvgLat(us)" << std::setw(12) << "P99 Lat" << std::setw(12) << "Mean Hops" << std::setw(12) << "Mean IOs"
-            << std::setw(12);
+            << "AvgLat(us)" << std::setw(12) << "P99 Lat" << std::setw(12) << "Mean Hops" << std::setw(12)
+            << "Mean IOs";
   if (calc_recall_flag) {
-    std::cout << std::setw(12) << recall_string << std::endl;
-  } else
-    std::cout << std::endl;
-  std::cout << "=============================================="
-               "==========================================="
-            << std::endl;
+    std::cout << std::setw(12) << recall_string;
+  }
+  // mean time per query phase (us), see pipeann::QueryPhase.
+  for (uint32_t p = 0; p < pipeann::kNumQueryPhases; ++p) {
+    std::cout << std::setw(9) << pipeann::kQueryPhaseNames[p];
+  }
+  std::cout << std::endl;
+  std::cout << std::string(6 + 12 * (calc_recall_flag ? 7 : 6) + 9 * pipeann::kNumQueryPhases, '=') << std::endl;
 
+  auto before = pipeann::telemetry_snapshot();
   for (uint32_t test_id = 0; test_id < Lvec.size(); test_id++) {
     run_tests(test_id, true);
   }
+  auto after = pipeann::telemetry_snapshot();
+  if (!pin_list.empty()) {
+    uint64_t pinned_hits = after.counters[pipeann::kTmPinnedHits] - before.counters[pipeann::kTmPinnedHits];
+    LOG(INFO) << "Pinned pages served " << pinned_hits << " reads (not in Mean IOs).";
+  }
+  if (coalesce_reads) {
+    uint64_t coalesced = after.counters[pipeann::kTmCoalescedReads] - before.counters[pipeann::kTmCoalescedReads];
+    LOG(INFO) << "Coalesced " << coalesced << " reads into other queries' in-flight reads (not in Mean IOs).";
+  }
   return 0;
 }
 
@@ -257,9 +435,22 @@ int main(int argc, char **argv) {
                  " <num_threads>  <pipeline width> "
                  " <query_file.bin>  <truthset.bin (use \"null\" for none)> "
                  " <K> <similarity (cosine/l2)> "
-                 " <search_mode(0 for beam search / 1 for page search / 2 for pipe search)> <mem_L (0 means not "
-                 "using mem index)> <L1> [L2] etc."
-              << std::endl;
+                 " <search_mode(0 for beam search / 1 for page search / 2 for pipe search / 3 for coro search /"
+                 " 4 for async search / 5 for offline batch search)> <mem_L (0 means not "
+                 "using mem index)> <L1 (\"auto\": from the search profile)> [L2] etc. [options]"
+              << std::endl
+              << "Options (anywhere after mem_L):" << std::endl
+              << "  --low-dram  drop the in-memory PQ codes of an inline-PQ index (needs mem_L 0)" << std::endl
+              << "  --early-stop <model>  stop queries early with a model from train_early_stop" << std::endl
+              << "  --refine <R[:mem]>  rerank the best R unexpanded candidates with <index_prefix>_sq8.bin"
+                 " (:mem keeps the codes in memory)"
+              << std::endl
+              << "  --adaptive-l <spread>  per-query L and beam width from 1 - spread to 1 + spread times the"
+                 " given ones, by query difficulty (spread in (0, 1])"
+              << std::endl
+              << "  --pin-pages <list[:N]>  serve the first N (default all) pages of a hot page list from memory"
+              << std::endl
+              << "  --coalesce-reads  let concurrent queries share their reads of the same page" << std::endl;
     exit(-1);
   }
 
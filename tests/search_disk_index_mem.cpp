@@ -19,7 +19,7 @@
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
-#include "linux_aligned_file_reader.h"
+#include "emulated_aligned_file_reader.h"
 
 #define WARMUP false
 
@@ -100,7 +100,7 @@ int search_disk_index(int argc, char **argv) {
   }
 
   std::shared_ptr<AlignedFileReader> reader = nullptr;
-  reader.reset(new LinuxAlignedFileReader());
+  reader.reset(new_aligned_file_reader());
 
   pipeann::Index<T> _pFlashIndex(m, query_dim, (uint64_t) 1e8, false, false, false);
   _pFlashIndex.load_from_disk_index(index_prefix_path);
@@ -0,0 +1,108 @@
+#include <chrono>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "aux_utils.h"
+#include "log.h"
+#include "percentile_stats.h"
+#include "sharded_index.h"
+#include "utils.h"
+
+// Searches several index shards as one ShardedIndex. Each shard is given as <prefix>[:tag_offset];
+// its IDs map to global tags as ID + tag_offset, so shards built from consecutive slices of a base
+// file take the slice's first row as offset and the truthset of the whole file applies. The shards
+// share one IndexRuntime, so their query buffers are allocated once for all of them.
+
+template<typename T>
+int search_sharded(int argc, char **argv) {
+  std::string query_bin = argv[2], gt_bin = argv[3];
+  uint32_t K = std::atoi(argv[4]), threads = std::atoi(argv[5]);
+  float slack = std::atof(argv[6]);
+  pipeann::AsyncSearchParams params;
+  params.k_search = K;
+  params.l_search = std::atoi(argv[7]);
+  params.beam_width = std::atoi(argv[8]);
+
+  T *query = nullptr;
+  size_t query_num, query_dim;
+  pipeann::load_bin<T>(query_bin, query, query_num, query_dim);
+
+  pipeann::ShardedIndex<T> index(pipeann::Metric::L2);
+  index.set_runtime(std::make_shared<pipeann::IndexRuntime<T>>(threads, query_dim));
+  for (int i = 9; i < argc; ++i) {
+    std::string arg = argv[i];
+    size_t colon = arg.rfind(':');
+    uint32_t offset = colon == std::string::npos ? 0 : std::stoul(arg.substr(colon + 1));
+    if (index.add_shard(arg.substr(0, colon), threads, offset, threads) < 0) {
+      delete[] query;
+      return -1;
+    }
+  }
+  index.set_early_stop(slack);
+
+  std::vector<uint32_t> res_tags(query_num * K, std::numeric_limits<uint32_t>::max());
+  pipeann::QueryStatsRecorder recorder;
+  auto run = [&]() {
+    std::vector<std::future<pipeann::AsyncSearchResult<uint32_t>>> futures(query_num);
+    for (size_t i = 0; i < query_num; ++i) {
+      futures[i] = index.search_async(query + i * query_dim, params);
+    }
+    for (size_t i = 0; i < query_num; ++i) {
+      auto res = futures[i].get();
+      std::copy(res.tags.begin(), res.tags.end(), res_tags.data() + i * K);
+      recorder.record(res.stats);
+    }
+  };
+  run();  // warm up.
+  recorder.reset();
+
+  auto s = std::chrono::steady_clock::now();
+  run();
+  double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - s).count();
+
+  pipeann::QueryStatsSnapshot snap = recorder.snapshot();
+  std::cout.setf(std::ios_base::fixed, std::ios_base::floatfield);
+  std::cout.precision(2);
+  std::cout << std::setw(8) << "Shards" << std::setw(8) << "Slack" << std::setw(12) << "QPS" << std::setw(12)
+            << "AvgLat(us)" << std::setw(12) << "Mean IOs" << std::setw(12) << "Recall@" + std::to_string(K)
+            << std::endl;
+  double recall = 0;
+  if (gt_bin != "null") {
+    uint32_t *gt_ids = nullptr, *gt_tags = nullptr;
+    float *gt_dists = nullptr;
+    size_t gt_num, gt_dim;
+    pipeann::load_truthset(gt_bin, gt_ids, gt_dists, gt_num, gt_dim, &gt_tags);
+    recall = pipeann::calculate_recall((_u32) query_num, gt_ids, gt_dists, (_u32) gt_dim, res_tags.data(), K, K);
+    delete[] gt_ids;
+    delete[] gt_dists;
+    delete[] gt_tags;
+  }
+  std::cout << std::setw(8) << index.num_shards() << std::setw(8) << slack << std::setw(12) << query_num / secs
+            << std::setw(12) << snap.latency_ns.mean() / 1e3 << std::setw(12) << snap.n_ios.mean() << std::setw(12)
+            << recall << std::endl;
+  delete[] query;
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 10) {
+    std::cout << "Usage: " << argv[0]
+              << " <index_type (float/int8/uint8)> <query_file.bin> <truthset.bin (\"null\" for none)> <K>"
+                 " <threads per shard> <early-stop slack (0 = off)> <L> <beam_width> <shard_prefix[:tag_offset]>..."
+              << std::endl;
+    return -1;
+  }
+  std::string type = argv[1];
+  if (type == "float") {
+    return search_sharded<float>(argc, argv);
+  } else if (type == "int8") {
+    return search_sharded<int8_t>(argc, argv);
+  } else if (type == "uint8") {
+    return search_sharded<uint8_t>(argc, argv);
+  }
+  std::cout << "Unsupported index type. Use float or int8 or uint8" << std::endl;
+  return -1;
+}
@@ -0,0 +1,360 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "aux_utils.h"
+#include "hdr_histogram.h"
+#include "log.h"
+#include "serve_protocol.h"
+#include "utils.h"
+
+// Client for serve_index. Runs, in this order and each only if asked for:
+// inserts, deletes, a reload, a search pass (with recall if a truthset is given)
+// and a stats dump. Every pass pipelines up to --depth requests per connection.
+
+namespace {
+  using Clock = std::chrono::steady_clock;
+  using namespace pipeann::serve;
+
+  struct Options {
+    std::string type, socket_path, query_bin, gt_bin, insert_bin;
+    uint32_t K = 10, L = 40, beam_width = 4, mem_L = 0, depth = 32, connections = 1;
+    uint32_t insert_tag_start = 0, delete_start = 0, delete_count = 0;
+    bool reload = false, stats = false;
+  };
+
+  void print_usage(const char *prog) {
+    std::cout << "Usage: " << prog << " <type[int8/uint8/float]> <socket_path> [options]\n"
+              << "  --query <bin>            search these queries\n"
+              << "  --gt <bin>               truthset for recall\n"
+              << "  --K <n> --L <n> --beam <n> --mem-L <n>\n"
+              << "  --depth <n>              in-flight requests per connection (default 32)\n"
+              << "  --connections <n>        parallel connections (default 1)\n"
+              << "  --insert <bin>           insert these vectors (dynamic index)\n"
+              << "  --insert-tag-start <n>   tag of the first inserted vector (default 0)\n"
+              << "  --delete <first:count>   delete tags first .. first+count-1 (dynamic index)\n"
+              << "  --reload <0|1>           reload (static) or merge and reload (dynamic) the index\n"
+              << "  --stats <0|1>            print the server's stats" << std::endl;
+  }
+
+  bool parse_options(int argc, char **argv, Options &opt) {
+    if (argc < 3) {
+      return false;
+    }
+    opt.type = argv[1];
+    opt.socket_path = argv[2];
+    for (int i = 3; i < argc; ++i) {
+      std::string arg = argv[i];
+      if (i + 1 >= argc) {
+        std::cout << "Missing value for " << arg << std::endl;
+        return false;
+      }
+      std::string val = argv[++i];
+      if (arg == "--query") {
+        opt.query_bin = val;
+      } else if (arg == "--gt") {
+        opt.gt_bin = val;
+      } else if (arg == "--K") {
+        opt.K = std::stoi(val);
+      } else if (arg == "--L") {
+        opt.L = std::stoi(val);
+      } else if (arg == "--beam") {
+        opt.beam_width = std::stoi(val);
+      } else if (arg == "--mem-L") {
+        opt.mem_L = std::stoi(val);
+      } else if (arg == "--depth") {
+        opt.depth = std::max(1, std::stoi(val));
+      } else if (arg == "--connections") {
+        opt.connections = std::max(1, std::stoi(val));
+      } else if (arg == "--insert") {
+        opt.insert_bin = val;
+      } else if (arg == "--insert-tag-start") {
+        opt.insert_tag_start = std::stoul(val);
+      } else if (arg == "--delete") {
+        if (sscanf(val.c_str(), "%u:%u", &opt.delete_start, &opt.delete_count) != 2) {
+          std::cout << "Bad --delete: " << val << std::endl;
+          return false;
+        }
+      } else if (arg == "--reload") {
+        opt.reload = std::stoi(val) != 0;
+      } else if (arg == "--stats") {
+        opt.stats = std::stoi(val) != 0;
+      } else {
+        std::cout << "Unknown option: " << arg << std::endl;
+        return false;
+      }
+    }
+    return true;
+  }
+
+  class Connection {
+   public:
+    ~Connection() {
+      if (fd >= 0) {
+        ::close(fd);
+      }
+    }
+
+    bool open(const std::string &path) {
+      fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+      sockaddr_un addr;
+      memset(&addr, 0, sizeof(addr));
+      addr.sun_family = AF_UNIX;
+      strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+      if (fd < 0 || ::connect(fd, (sockaddr *) &addr, sizeof(addr)) != 0) {
+        LOG(ERROR) << "Cannot connect to " << path << ": " << strerror(errno);
+        return false;
+      }
+      return true;
+    }
+
+    bool send(uint32_t op, uint64_t req_id, const std::vector<char> &body) {
+      RequestHeader hdr;
+      hdr.op = op;
+      hdr.req_id = req_id;
+      hdr.body_len = body.size();
+      return write_full(fd, &hdr, sizeof(hdr)) && (body.empty() || write_full(fd, body.data(), body.size()));
+    }
+
+    bool recv(ResponseHeader &hdr, std::vector<char> &body) {
+      if (!read_full(fd, &hdr, sizeof(hdr)) || hdr.magic != kMagic) {
+        return false;
+      }
+      body.resize(hdr.body_len);
+      return hdr.body_len == 0 || read_full(fd, body.data(), hdr.body_len);
+    }
+
+    // one request, waiting for its response.
+    bool call(uint32_t op, const std::vector<char> &body, ResponseHeader &hdr, std::vector<char> &resp) {
+      return send(op, 0, body) && recv(hdr, resp);
+    }
+
+   private:
+    int fd = -1;
+  };
+
+  struct PassResult {
+    pipeann::HdrHistogram latency_ns;
+    uint64_t n_failed = 0;
+  };
+
+  // Sends requests [0, n) over opt.connections connections, at most opt.depth in flight on each.
+  // make_body(i) builds request i; on_done(i, body) consumes a successful response.
+  template<typename MakeBody, typename OnDone>
+  bool run_pass(const Options &opt, uint32_t op, uint64_t n, MakeBody make_body, OnDone on_done, PassResult &res) {
+    std::vector<PassResult> per_conn(opt.connections);
+    std::vector<char> ok(opt.connections, 0);
+    std::vector<std::thread> threads;
+    for (uint32_t c = 0; c < opt.connections; ++c) {
+      threads.emplace_back([&, c]() {
+        Connection conn;
+        if (!conn.open(opt.socket_path)) {
+          return;
+        }
+        std::vector<Clock::time_point> sent(n);
+        uint64_t next = c, in_flight = 0;
+        ResponseHeader hdr;
+        std::vector<char> body;
+        while (next < n || in_flight > 0) {
+          while (next < n && in_flight < opt.depth) {
+            sent[next] = Clock::now();
+            if (!conn.send(op, next, make_body(next))) {
+              return;
+            }
+            next += opt.connections;
+            in_flight++;
+          }
+          if (!conn.recv(hdr, body)) {
+            return;
+          }
+          in_flight--;
+          per_conn[c].latency_ns.record(
+              std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - sent[hdr.req_id]).count());
+          if (hdr.status != kOk) {
+            per_conn[c].n_failed++;
+          } else {
+            on_done(hdr.req_id, body);
+          }
+        }
+        ok[c] = 1;
+      });
+    }
+    for (auto &t : threads) {
+      t.join();
+    }
+    for (auto &r : per_conn) {
+      res.latency_ns.merge(r.latency_ns);
+      res.n_failed += r.n_failed;
+    }
+    return std::all_of(ok.begin(), ok.end(), [](char v) { return v != 0; });
+  }
+
+  void print_pass(const std::string &name, const PassResult &res, double secs) {
+    const auto &h = res.latency_ns;
+    std::cout << std::setw(8) << name << std::setw(10) << h.count() << std::setw(9) << res.n_failed << std::setw(12)
+              << h.count() / secs << std::setw(11) << h.mean() / 1e3 << std::setw(11) << h.percentile(50) / 1e3
+              << std::setw(11) << h.percentile(99) / 1e3 << std::setw(11) << h.percentile(99.9) / 1e3 << std::endl;
+  }
+
+  template<typename T>
+  int run_client(const Options &opt) {
+    Connection conn;
+    ResponseHeader hdr;
+    std::vector<char> resp;
+    if (!conn.open(opt.socket_path) || !conn.call(kOpInfo, {}, hdr, resp) || resp.size() != sizeof(InfoBody)) {
+      LOG(ERROR) << "No valid reply from " << opt.socket_path;
+      return -1;
+    }
+    InfoBody info;
+    memcpy(&info, resp.data(), sizeof(info));
+    if (info.elem_size != sizeof(T)) {
+      LOG(ERROR) << "Server element size " << info.elem_size << " != " << sizeof(T) << " of " << opt.type;
+      return -1;
+    }
+    std::cout << "Server: dim " << info.dim << ", " << (info.dynamic ? "dynamic" : "static") << ", max batch "
+              << info.max_batch << std::endl;
+    const size_t vec_bytes = info.dim * sizeof(T);
+
+    std::cout.setf(std::ios_base::fixed, std::ios_base::floatfield);
+    std::cout.precision(1);
+    std::cout << std::setw(8) << "Op" << std::setw(10) << "Count" << std::setw(9) << "Failed" << std::setw(12)
+              << "Ops/s" << std::setw(11) << "Mean(us)" << std::setw(11) << "P50" << std::setw(11) << "P99"
+              << std::setw(11) << "P99.9" << std::endl;
+
+    auto timed_pass = [&](const std::string &name, uint32_t op, uint64_t n, auto make_body, auto on_done) {
+      PassResult res;
+      auto start = Clock::now();
+      bool ok = run_pass(opt, op, n, make_body, on_done, res);
+      print_pass(name, res, std::chrono::duration<double>(Clock::now() - start).count());
+      return ok;
+    };
+    auto ignore = [](uint64_t, const std::vector<char> &) {};
+
+    if (!opt.insert_bin.empty()) {
+      T *data = nullptr;
+      size_t npts, dim;
+      pipeann::load_bin<T>(opt.insert_bin, data, npts, dim);
+      if (dim != info.dim) {
+        LOG(ERROR) << "Insert data dimension " << dim << " != server dimension " << info.dim;
+        return -1;
+      }
+      auto make_body = [&](uint64_t i) {
+        std::vector<char> body(sizeof(uint32_t) + vec_bytes);
+        uint32_t tag = opt.insert_tag_start + i;
+        memcpy(body.data(), &tag, sizeof(tag));
+        memcpy(body.data() + sizeof(tag), data + i * dim, vec_bytes);
+        return body;
+      };
+      bool ok = timed_pass("insert", kOpInsert, npts, make_body, ignore);
+      delete[] data;
+      if (!ok) {
+        return -1;
+      }
+    }
+
+    if (opt.delete_count > 0) {
+      auto make_body = [&](uint64_t i) {
+        std::vector<char> body(sizeof(uint32_t));
+        uint32_t tag = opt.delete_start + i;
+        memcpy(body.data(), &tag, sizeof(tag));
+        return body;
+      };
+      if (!timed_pass("delete", kOpDelete, opt.delete_count, make_body, ignore)) {
+        return -1;
+      }
+    }
+
+    if (opt.reload) {
+      auto start = Clock::now();
+      if (!conn.call(kOpReload, {}, hdr, resp)) {
+        return -1;
+      }
+      std::cout << "Reload " << (hdr.status == kOk ? "done" : "failed") << " in "
+                << std::chrono::duration<double>(Clock::now() - start).count() << " s" << std::endl;
+    }
+
+    if (!opt.query_bin.empty()) {
+      T *queries = nullptr;
+      size_t nq, dim;
+      pipeann::load_bin<T>(opt.query_bin, queries, nq, dim);
+      if (dim != info.dim) {
+        LOG(ERROR) << "Query dimension " << dim << " != server dimension " << info.dim;
+        return -1;
+      }
+      SearchBody params;
+      params.k = opt.K;
+      params.L = std::max(opt.L, opt.K);
+      params.mem_L = opt.mem_L;
+      params.beam_width = opt.beam_width;
+      std::vector<uint32_t> results(nq * opt.K, std::numeric_limits<uint32_t>::max());
+
+      auto make_body = [&](uint64_t i) {
+        std::vector<char> body(sizeof(SearchBody) + vec_bytes);
+        memcpy(body.data(), &params, sizeof(params));
+        memcpy(body.data() + sizeof(params), queries + i * dim, vec_bytes);
+        return body;
+      };
+      auto on_done = [&](uint64_t i, const std::vector<char> &body) {
+        uint32_t cnt;
+        memcpy(&cnt, body.data(), sizeof(cnt));
+        memcpy(results.data() + i * opt.K, body.data() + sizeof(cnt), std::min(cnt, opt.K) * sizeof(uint32_t));
+      };
+      bool ok = timed_pass("search", kOpSearch, nq, make_body, on_done);
+      if (ok && !opt.gt_bin.empty()) {
+        uint32_t *gt_ids = nullptr, *gt_tags = nullptr;
+        float *gt_dists = nullptr;
+        size_t gt_num, gt_dim;
+        pipeann::load_truthset(opt.gt_bin, gt_ids, gt_dists, gt_num, gt_dim, &gt_tags);
+        if (gt_num != nq) {
+          LOG(ERROR) << "Truthset has " << gt_num << " queries, expected " << nq;
+        } else {
+          std::cout << "Recall@" << opt.K << ": "
+                    << pipeann::calculate_recall((_u32) nq, gt_ids, gt_dists, (_u32) gt_dim, results.data(), opt.K,
+                                                 opt.K)
+                    << std::endl;
+        }
+        delete[] gt_ids;
+        delete[] gt_dists;
+        delete[] gt_tags;
+      }
+      delete[] queries;
+      if (!ok) {
+        return -1;
+      }
+    }
+
+    if (opt.stats) {
+      if (!conn.call(kOpStats, {}, hdr, resp)) {
+        return -1;
+      }
+      std::cout << std::string(resp.begin(), resp.end());
+    }
+    return 0;
+  }
+}  // namespace
+
+int main(int argc, char **argv) {
+  Options opt;
+  if (!parse_options(argc, argv, opt)) {
+    print_usage(argv[0]);
+    return -1;
+  }
+  if (opt.type == "float") {
+    return run_client<float>(opt);
+  } else if (opt.type == "int8") {
+    return run_client<int8_t>(opt);
+  } else if (opt.type == "uint8") {
+    return run_client<uint8_t>(opt);
+  }
+  std::cout << "Unsupported type: " << opt.type << ". Use float/int8/uint8" << std::endl;
+  return -1;
+}
@@ -0,0 +1,702 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "emulated_aligned_file_reader.h"
+#include "hdr_histogram.h"
+#include "log.h"
+#include "query_cache.h"
+#include "serve_protocol.h"
+#include "ssd_index.h"
+#include "utils.h"
+#include "v2/dynamic_index.h"
+
+// Query-serving daemon: loads one index and serves search (and, for a
+// DynamicSSDIndex, insert/delete) over a Unix domain socket; see
+// include/serve_protocol.h for the wire format and serve_client for a client.
+//
+// Each connection has a reader thread that parses requests and queues them.
+// Search workers drain the queue in micro-batches of compatible queries (same
+// k/L/mem_L/beam width), which a static index runs as one coro_search call. A
+// worker holding a partial batch waits for more queries for at most --max-wait-us,
+// and only as long as the recent arrival rate suggests the batch will fill.
+// Reload swaps in a freshly loaded index (static) or merges deletes (dynamic)
+// while the old index keeps serving.
+
+namespace {
+  using Clock = std::chrono::steady_clock;
+  using namespace pipeann::serve;
+
+  constexpr uint32_t kMaxCoroBatch = 8;  // coro_search's kMaxCoroPerThread.
+  constexpr uint32_t kMaxSearchL = 4096;
+  constexpr uint32_t kMaxBeamWidth = 128;
+
+  struct Options {
+    std::string type, index_prefix, socket_path, metric = "l2";
+    bool dynamic = false, mem_index = false;
+    uint32_t threads = 8, max_batch = kMaxCoroBatch, max_wait_us = 200, mode = PIPE_SEARCH;
+    uint64_t cache_entries = 0, cache_ttl_ms = 0, cache_epoch_lag = 0;
+    float cache_near_dist = 0;
+  };
+
+  std::atomic<bool> g_stop{false};
+  int g_listen_fd = -1;
+
+  void on_signal(int) {
+    g_stop.store(true);
+    if (g_listen_fd >= 0) {
+      ::shutdown(g_listen_fd, SHUT_RDWR);  // unblocks accept().
+    }
+  }
+
+  void print_usage(const char *prog) {
+    std::cout << "Usage: " << prog << " <type[int8/uint8/float]> <index_prefix> <socket_path> [options]\n"
+              << "  --threads <n>            search workers (default 8)\n"
+              << "  --max-batch <n>          queries per search batch, at most 8 (default 8)\n"
+              << "  --max-wait-us <n>        longest a partial batch waits for more queries (default 200)\n"
+              << "  --dynamic <0|1>          serve a DynamicSSDIndex that accepts inserts/deletes (default 0)\n"
+              << "  --mode <0|1|2>           dynamic index search mode: beam / page / pipe (default 2)\n"
+              << "  --mem-index <0|1>        load <index_prefix>_mem.index for mem_L > 0 (default 0)\n"
+              << "  --metric <l2|cosine>\n"
+              << "  --cache <n>              cache the results of up to n queries (default 0: off)\n"
+              << "  --cache-near-dist <d>    also serve queries within squared L2 distance d of a cached one\n"
+              << "  --cache-ttl-ms <n>       cached results expire after n ms (default 0: never)\n"
+              << "  --cache-epoch-lag <n>    serve results up to n updates (or reloads) old (default 0)\n"
+              << "A static index runs batches with coro_search; a dynamic index searches one query at a time.\n"
+              << "SIGINT/SIGTERM stop accepting requests, finish the queued ones and exit." << std::endl;
+  }
+
+  bool parse_options(int argc, char **argv, Options &opt) {
+    if (argc < 4) {
+      return false;
+    }
+    opt.type = argv[1];
+    opt.index_prefix = argv[2];
+    opt.socket_path = argv[3];
+    for (int i = 4; i < argc; ++i) {
+      std::string arg = argv[i];
+      if (i + 1 >= argc) {
+        std::cout << "Missing value for " << arg << std::endl;
+        return false;
+      }
+      std::string val = argv[++i];
+      if (arg == "--threads") {
+        opt.threads = std::max(1, std::stoi(val));
+      } else if (arg == "--max-batch") {
+        opt.max_batch = std::min(std::max(1, std::stoi(val)), (int) kMaxCoroBatch);
+      } else if (arg == "--max-wait-us") {
+        opt.max_wait_us = std::max(0, std::stoi(val));
+      } else if (arg == "--dynamic") {
+        opt.dynamic = std::stoi(val) != 0;
+      } else if (arg == "--mode") {
+        opt.mode = std::stoi(val);
+      } else if (arg == "--mem-index") {
+        opt.mem_index = std::stoi(val) != 0;
+      } else if (arg == "--metric") {
+        opt.metric = val;
+      } else if (arg == "--cache") {
+        opt.cache_entries = std::stoull(val);
+      } else if (arg == "--cache-near-dist") {
+        opt.cache_near_dist = std::stof(val);
+      } else if (arg == "--cache-ttl-ms") {
+        opt.cache_ttl_ms = std::stoull(val);
+      } else if (arg == "--cache-epoch-lag") {
+        opt.cache_epoch_lag = std::stoull(val);
+      } else {
+        std::cout << "Unknown option: " << arg << std::endl;
+        return false;
+      }
+    }
+    if (opt.dynamic && opt.mode > PIPE_SEARCH) {
+      std::cout << "A dynamic index supports modes 0-2." << std::endl;
+      return false;
+    }
+    if (opt.socket_path.size() >= sizeof(sockaddr_un::sun_path)) {
+      std::cout << "Socket path too long: " << opt.socket_path << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+  // Closes the socket once the reader and every queued request are done with it.
+  struct Connection {
+    int fd;
+    std::mutex write_lock;  // one response at a time.
+
+    explicit Connection(int fd) : fd(fd) {
+    }
+    ~Connection() {
+      ::close(fd);
+    }
+
+    void respond(uint64_t req_id, uint32_t status, const void *body = nullptr, uint32_t body_len = 0) {
+      std::vector<char> msg(sizeof(ResponseHeader) + body_len);
+      ResponseHeader hdr;
+      hdr.status = status;
+      hdr.req_id = req_id;
+      hdr.body_len = body_len;
+      memcpy(msg.data(), &hdr, sizeof(hdr));
+      if (body_len > 0) {
+        memcpy(msg.data() + sizeof(hdr), body, body_len);
+      }
+      std::lock_guard<std::mutex> lk(write_lock);
+      write_full(fd, msg.data(), msg.size());  // a failed write means the client left; nothing to do.
+    }
+  };
+
+  struct Job {
+    std::shared_ptr<Connection> conn;
+    RequestHeader hdr;
+    std::vector<char> body;
+    Clock::time_point arrival;
+
+    const SearchBody &search() const {
+      return *(const SearchBody *) body.data();
+    }
+    bool batches_with(const Job &o) const {
+      return o.hdr.op == kOpSearch && memcmp(&search(), &o.search(), sizeof(SearchBody)) == 0;
+    }
+  };
+
+  // A static index with the reader it keeps a reference to; a reload builds a new one.
+  template<typename T>
+  struct LoadedIndex {
+    std::shared_ptr<AlignedFileReader> reader;
+    std::unique_ptr<pipeann::SSDIndex<T>> index;
+    uint64_t generation = 0;  // reloads so far; the query cache's epoch for a static index.
+  };
+
+  template<typename T>
+  class Server {
+   public:
+    explicit Server(const Options &opt) : opt(opt) {
+      metric = opt.metric == "cosine" ? pipeann::Metric::COSINE : pipeann::Metric::L2;
+    }
+
+    int load() {
+      if (opt.dynamic) {
+        pipeann::Parameters paras;
+        paras.Set<unsigned>("L_disk", 128);
+        paras.Set<unsigned>("R_disk", 0);
+        paras.Set<float>("alpha_disk", 1.2);
+        paras.Set<unsigned>("C", 384);
+        paras.Set<unsigned>("beamwidth", 4);
+        paras.Set<unsigned>("nodes_to_cache", 0);
+        paras.Set<unsigned>("num_threads", opt.threads);
+        dist_cmp.reset(pipeann::get_distance_function<T>(metric));
+        dyn_index.reset(new pipeann::DynamicSSDIndex<T>(paras, opt.index_prefix, opt.index_prefix + "_serve",
+                                                        dist_cmp.get(), metric, opt.mode, opt.mem_index));
+        dim = dyn_index->_disk_index->data_dim;
+        max_batch = 1;
+        init_cache();
+        dyn_index->set_query_cache(cache);  // epochs follow the index's inserts, deletes and merges.
+        return 0;
+      }
+      auto loaded = load_static();
+      if (loaded == nullptr) {
+        return -1;
+      }
+      dim = loaded->index->data_dim;
+      max_batch = opt.max_batch;
+      std::atomic_store(&static_index, loaded);
+      init_cache();
+      return 0;
+    }
+
+    int run() {
+      int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+      if (fd < 0) {
+        LOG(ERROR) << "socket() failed: " << strerror(errno);
+        return -1;
+      }
+      sockaddr_un addr;
+      memset(&addr, 0, sizeof(addr));
+      addr.sun_family = AF_UNIX;
+      strncpy(addr.sun_path, opt.socket_path.c_str(), sizeof(addr.sun_path) - 1);
+      ::unlink(opt.socket_path.c_str());
+      if (::bind(fd, (sockaddr *) &addr, sizeof(addr)) != 0 || ::listen(fd, 128) != 0) {
+        LOG(ERROR) << "Cannot listen on " << opt.socket_path << ": " << strerror(errno);
+        ::close(fd);
+        return -1;
+      }
+      g_listen_fd = fd;
+      std::signal(SIGINT, on_signal);
+      std::signal(SIGTERM, on_signal);
+
+      for (uint32_t i = 0; i < opt.threads; ++i) {
+        workers.emplace_back([this]() { this->worker_loop(); });
+      }
+      LOG(INFO) << "Serving " << opt.index_prefix << " (" << (opt.dynamic ? "dynamic" : "static") << ", dim " << dim
+                << ") on " << opt.socket_path << " with " << opt.threads << " workers, max batch " << max_batch
+                << ", max wait " << opt.max_wait_us << "us";
+
+      while (!g_stop.load()) {
+        int cfd = ::accept(fd, nullptr, nullptr);
+        if (cfd < 0) {
+          if (errno == EINTR || errno == ECONNABORTED) {
+            continue;
+          }
+          break;  // shut down by on_signal.
+        }
+        auto conn = std::make_shared<Connection>(cfd);
+        std::lock_guard<std::mutex> lk(conn_lock);
+        reap_readers();
+        conns.push_back(conn);
+        auto done = std::make_shared<std::atomic<bool>>(false);
+        readers.push_back({std::thread([this, conn, done]() {
+                             this->read_loop(conn);
+                             done->store(true);
+                           }),
+                           done});
+      }
+
+      // stop reading, drain the queue, then wait for a running reload.
+      LOG(INFO) << "Shutting down";
+      {
+        std::lock_guard<std::mutex> lk(conn_lock);
+        for (auto &w : conns) {
+          if (auto c = w.lock()) {
+            ::shutdown(c->fd, SHUT_RD);
+          }
+        }
+      }
+      for (auto &r : readers) {
+        r.thread.join();
+      }
+      {
+        std::lock_guard<std::mutex> lk(queue_lock);
+        stopping = true;
+      }
+      queue_cv.notify_all();
+      for (auto &t : workers) {
+        t.join();
+      }
+      if (reload_thread.joinable()) {
+        reload_thread.join();
+      }
+      ::close(fd);
+      ::unlink(opt.socket_path.c_str());
+      LOG(INFO) << stats_report();
+      return 0;
+    }
+
+   private:
+    struct Reader {
+      std::thread thread;
+      std::shared_ptr<std::atomic<bool>> done;
+    };
+
+    // joins the readers of closed connections; caller holds conn_lock.
+    void reap_readers() {
+      for (size_t i = 0; i < readers.size();) {
+        if (readers[i].done->load()) {
+          readers[i].thread.join();
+          readers[i] = std::move(readers.back());
+          readers.pop_back();
+        } else {
+          ++i;
+        }
+      }
+      conns.erase(std::remove_if(conns.begin(), conns.end(), [](const auto &c) { return c.expired(); }),
+                  conns.end());
+    }
+
+    void init_cache() {
+      if (opt.cache_entries == 0) {
+        return;
+      }
+      pipeann::QueryCacheParams params;
+      params.capacity = opt.cache_entries;
+      params.ttl_us = opt.cache_ttl_ms * 1000;
+      params.near_dist = opt.cache_near_dist;
+      params.max_epoch_lag = opt.cache_epoch_lag;
+      cache = std::make_shared<pipeann::QueryCache<T>>(dim, params);
+    }
+
+    std::shared_ptr<LoadedIndex<T>> load_static() {
+      auto loaded = std::make_shared<LoadedIndex<T>>();
+      loaded->reader.reset(new_aligned_file_reader());
+      loaded->index.reset(new pipeann::SSDIndex<T>(metric, loaded->reader, false, true));
+      if (loaded->index->load(opt.index_prefix.c_str(), opt.threads, true, false) != 0) {
+        return nullptr;
+      }
+      if (opt.mem_index) {
+        loaded->index->load_mem_index(metric, loaded->index->data_dim, opt.index_prefix + "_mem.index");
+      }
+      return loaded;
+    }
+
+    void read_loop(std::shared_ptr<Connection> conn) {
+      while (true) {
+        auto job = std::make_unique<Job>();
+        if (!read_full(conn->fd, &job->hdr, sizeof(job->hdr))) {
+          break;
+        }
+        if (job->hdr.magic != kMagic || job->hdr.body_len > kMaxBodyLen) {
+          LOG(ERROR) << "Bad request header, closing connection";
+          break;
+        }
+        job->body.resize(job->hdr.body_len);
+        if (job->hdr.body_len > 0 && !read_full(conn->fd, job->body.data(), job->hdr.body_len)) {
+          break;
+        }
+        job->conn = conn;
+        job->arrival = Clock::now();
+        dispatch(std::move(job));
+      }
+    }
+
+    // cheap requests are answered on the reader thread; the rest are queued.
+    void dispatch(std::unique_ptr<Job> job) {
+      Connection &c = *job->conn;
+      const uint64_t req_id = job->hdr.req_id;
+      const size_t vec_bytes = dim * sizeof(T);
+      switch (job->hdr.op) {
+        case kOpInfo: {
+          InfoBody info;
+          info.dim = dim;
+          info.elem_size = sizeof(T);
+          info.dynamic = opt.dynamic;
+          info.max_batch = max_batch;
+          c.respond(req_id, kOk, &info, sizeof(info));
+          return;
+        }
+        case kOpStats: {
+          std::string report = stats_report();
+          c.respond(req_id, kOk, report.data(), report.size());
+          return;
+        }
+        case kOpReload:
+          start_reload(std::move(job));
+          return;
+        case kOpSearch: {
+          if (job->body.size() != sizeof(SearchBody) + vec_bytes) {
+            c.respond(req_id, kBadRequest);
+            return;
+          }
+          const SearchBody &p = job->search();
+          bool has_mem_index = opt.dynamic ? opt.mem_index : static_index_now()->index->mem_index_ != nullptr;
+          if (p.k == 0 || p.L < p.k || p.L > kMaxSearchL || p.beam_width == 0 || p.beam_width > kMaxBeamWidth ||
+              (p.mem_L > 0 && !has_mem_index)) {
+            c.respond(req_id, kBadRequest);
+            return;
+          }
+          break;
+        }
+        case kOpInsert:
+        case kOpDelete: {
+          if (!opt.dynamic) {
+            c.respond(req_id, kUnsupported);
+            return;
+          }
+          size_t expected = sizeof(uint32_t) + (job->hdr.op == kOpInsert ? vec_bytes : 0);
+          if (job->body.size() != expected) {
+            c.respond(req_id, kBadRequest);
+            return;
+          }
+          break;
+        }
+        default:
+          c.respond(req_id, kBadRequest);
+          return;
+      }
+
+      {
+        std::lock_guard<std::mutex> lk(queue_lock);
+        // EWMA of the inter-arrival gap, used to size the batching wait.
+        if (last_arrival != Clock::time_point()) {
+          double gap_us = std::chrono::duration<double, std::micro>(job->arrival - last_arrival).count();
+          arrival_gap_us = 0.9 * arrival_gap_us + 0.1 * gap_us;
+        }
+        last_arrival = job->arrival;
+        queue.push_back(job.release());
+      }
+      queue_cv.notify_one();
+    }
+
+    // how long a batch of n may still wait for compatible queries.
+    std::chrono::microseconds batch_wait(size_t n) const {
+      if (arrival_gap_us >= opt.max_wait_us) {
+        return std::chrono::microseconds(0);  // arrivals too sparse to fill a batch in time.
+      }
+      return std::chrono::microseconds(
+          (int64_t) std::min((double) opt.max_wait_us, arrival_gap_us * (double) (max_batch - n)));
+    }
+
+    // pops the next job plus up to max_batch - 1 compatible searches; false when stopping with nothing queued.
+    bool next_batch(std::vector<Job *> &batch) {
+      static constexpr size_t kMaxScan = 64;  // bounds the scan under a deep backlog.
+      batch.clear();
+      std::unique_lock<std::mutex> lk(queue_lock);
+      queue_cv.wait(lk, [this]() { return stopping || !queue.empty(); });
+      if (queue.empty()) {
+        return false;
+      }
+      batch.push_back(queue.front());
+      queue.pop_front();
+      if (batch[0]->hdr.op != kOpSearch || max_batch == 1) {
+        return true;
+      }
+      const Clock::time_point start = Clock::now();
+      while (true) {
+        for (size_t i = 0; i < std::min(queue.size(), kMaxScan) && batch.size() < max_batch;) {
+          if (batch[0]->batches_with(*queue[i])) {
+            batch.push_back(queue[i]);
+            queue.erase(queue.begin() + i);
+          } else {
+            ++i;
+          }
+        }
+        if (batch.size() >= max_batch || stopping) {
+          return true;
+        }
+        Clock::time_point deadline = start + batch_wait(batch.size());
+        if (Clock::now() >= deadline) {
+          return true;
+        }
+        if (!queue.empty()) {
+          queue_cv.notify_one();  // what is left does not batch with us; hand it to another worker.
+        }
+        queue_cv.wait_until(lk, deadline);
+      }
+    }
+
+    void worker_loop() {
+      std::vector<Job *> batch;
+      while (next_batch(batch)) {
+        batch_size.record(batch.size());
+        if (batch[0]->hdr.op == kOpSearch) {
+          run_search(batch);
+        } else {
+          run_update(*batch[0]);
+        }
+        for (Job *job : batch) {
+          delete job;
+        }
+      }
+    }
+
+    void run_search(const std::vector<Job *> &batch) {
+      const SearchBody &p = batch[0]->search();
+      const int n = (int) batch.size();
+      std::vector<uint32_t> tags(n * p.k);
+      std::vector<float> dists(n * p.k);
+      std::vector<uint32_t> counts(n, p.k);
+      std::vector<pipeann::QueryStats> stats(n);
+
+      if (opt.dynamic) {
+        for (int v = 0; v < n; ++v) {
+          uint32_t *res_tags = tags.data() + v * p.k;
+          std::fill(res_tags, res_tags + p.k, kNoTag);  // search() may return fewer than k.
+          dyn_index->search((const T *) (batch[v]->body.data() + sizeof(SearchBody)), p.k, p.mem_L, p.L,
+                            p.beam_width, res_tags, dists.data() + v * p.k, &stats[v], true);
+          counts[v] = std::find(res_tags, res_tags + p.k, kNoTag) - res_tags;
+        }
+      } else {
+        std::shared_ptr<LoadedIndex<T>> loaded = static_index_now();  // keeps the index alive across a reload.
+        T *queries[kMaxCoroBatch];
+        uint32_t *res_tags[kMaxCoroBatch];
+        float *res_dists[kMaxCoroBatch];
+        int miss[kMaxCoroBatch], n_miss = 0;  // batch positions that still need a search.
+        for (int v = 0; v < n; ++v) {
+          const T *query = (const T *) (batch[v]->body.data() + sizeof(SearchBody));
+          if (cache != nullptr && cache_lookup(query, p, loaded->generation, v, tags, dists, counts)) {
+            continue;
+          }
+          queries[n_miss] = (T *) query;
+          res_tags[n_miss] = tags.data() + v * p.k;
+          res_dists[n_miss] = dists.data() + v * p.k;
+          miss[n_miss++] = v;
+        }
+        if (n_miss > 0) {
+          loaded->index->coro_search(queries, p.k, p.mem_L, p.L, res_tags, res_dists, p.beam_width, n_miss,
+                                     stats.data());
+        }
+        for (int m = n_miss - 1; m >= 0; --m) {
+          std::swap(stats[m], stats[miss[m]]);  // coro_search fills stats[0, n_miss).
+          for (uint32_t i = 0; i < p.k; ++i) {
+            res_tags[m][i] = loaded->index->id2tag(res_tags[m][i]);  // coro_search returns IDs.
+          }
+          if (cache != nullptr) {
+            cache->insert(queries[m], p.k, p.L, loaded->generation, res_tags[m], res_dists[m], p.k);
+          }
+        }
+      }
+
+      std::vector<char> body;
+      for (int v = 0; v < n; ++v) {
+        search_stats.record(stats[v]);
+        uint32_t cnt = counts[v];
+        body.resize(sizeof(uint32_t) + cnt * (sizeof(uint32_t) + sizeof(float)));
+        memcpy(body.data(), &cnt, sizeof(cnt));
+        memcpy(body.data() + sizeof(cnt), tags.data() + v * p.k, cnt * sizeof(uint32_t));
+        memcpy(body.data() + sizeof(cnt) + cnt * sizeof(uint32_t), dists.data() + v * p.k, cnt * sizeof(float));
+        finish(*batch[v], body);
+      }
+    }
+
+    // serves query v of a batch from the cache; stats stay zero (no IO).
+    bool cache_lookup(const T *query, const SearchBody &p, uint64_t epoch, int v, std::vector<uint32_t> &tags,
+                      std::vector<float> &dists, std::vector<uint32_t> &counts) {
+      std::vector<uint32_t> hit_tags;
+      std::vector<float> hit_dists;
+      if (!cache->lookup(query, p.k, p.L, epoch, hit_tags, hit_dists)) {
+        return false;
+      }
+      std::copy(hit_tags.begin(), hit_tags.end(), tags.begin() + v * p.k);
+      std::copy(hit_dists.begin(), hit_dists.end(), dists.begin() + v * p.k);
+      counts[v] = hit_tags.size();
+      return true;
+    }
+
+    void run_update(Job &job) {
+      uint32_t tag;
+      memcpy(&tag, job.body.data(), sizeof(tag));
+      if (job.hdr.op == kOpInsert) {
+        dyn_index->insert((const T *) (job.body.data() + sizeof(tag)), tag);
+      } else {
+        dyn_index->lazy_delete(tag);
+      }
+      finish(job, {});
+    }
+
+    // counts the request before answering it, so a stats request sent afterwards includes it.
+    void finish(const Job &job, const std::vector<char> &body) {
+      op_latency_ns[job.hdr.op == kOpSearch ? 0 : 1].record(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - job.arrival).count());
+      job.conn->respond(job.hdr.req_id, kOk, body.data(), body.size());
+    }
+
+    // runs in the background; searches keep going on the old index until the swap.
+    void start_reload(std::unique_ptr<Job> job) {
+      std::lock_guard<std::mutex> lk(reload_lock);
+      if (reloading.exchange(true)) {
+        job->conn->respond(job->hdr.req_id, kBusy);
+        return;
+      }
+      if (reload_thread.joinable()) {
+        reload_thread.join();
+      }
+      reload_thread = std::thread([this, job = std::shared_ptr<Job>(std::move(job))]() {
+        auto start = Clock::now();
+        uint32_t status = kOk;
+        if (opt.dynamic) {
+          dyn_index->final_merge(opt.threads);
+        } else {
+          auto loaded = load_static();
+          if (loaded == nullptr || loaded->index->data_dim != dim) {
+            LOG(ERROR) << "Reload failed, still serving the previous index";
+            status = kBadRequest;
+          } else {
+            loaded->generation = static_index_now()->generation + 1;
+            std::atomic_store(&static_index, loaded);  // the old index goes when its last batch finishes.
+          }
+        }
+        LOG(INFO) << "Reload finished in "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start).count() << " ms";
+        job->conn->respond(job->hdr.req_id, status);
+        reloading.store(false);
+      });
+    }
+
+    std::shared_ptr<LoadedIndex<T>> static_index_now() const {
+      return std::atomic_load(&static_index);
+    }
+
+    std::string stats_report() const {
+      pipeann::QueryStatsSnapshot snap = search_stats.snapshot();
+      pipeann::HdrHistogram search_lat = op_latency_ns[0].snapshot(), update_lat = op_latency_ns[1].snapshot();
+      pipeann::HdrHistogram batches = batch_size.snapshot();
+      std::ostringstream ss;
+      ss.setf(std::ios_base::fixed, std::ios_base::floatfield);
+      ss.precision(1);
+      ss << "search: " << search_lat.count() << " queries, server latency(us) mean " << search_lat.mean() / 1e3
+         << " p50 " << search_lat.percentile(50) / 1e3 << " p99 " << search_lat.percentile(99) / 1e3 << " p99.9 "
+         << search_lat.percentile(99.9) / 1e3 << "; index latency(us) mean " << snap.latency_ns.mean() / 1e3
+         << " p99 " << snap.latency_ns.percentile(99) / 1e3 << ", IOs mean " << snap.n_ios.mean() << "\n";
+      ss << "update: " << update_lat.count() << " ops, latency(us) p50 " << update_lat.percentile(50) / 1e3
+         << " p99 " << update_lat.percentile(99) / 1e3 << "\n";
+      ss << "batches: " << batches.count() << ", size mean " << batches.mean() << " max " << batches.max() << "\n";
+      if (cache != nullptr) {
+        pipeann::QueryCacheStats cs = cache->stats();
+        ss << "cache: " << cs.entries << " entries, " << cs.exact_hits << " exact hits, " << cs.near_hits
+           << " near hits, " << cs.misses << " misses (" << cs.stale << " stale, " << cs.expired << " expired), "
+           << cs.evictions << " evictions\n";
+      }
+      return ss.str();
+    }
+
+    static constexpr uint32_t kNoTag = std::numeric_limits<uint32_t>::max();
+
+    const Options opt;
+    pipeann::Metric metric;
+    uint32_t dim = 0, max_batch = 1;
+
+    std::shared_ptr<LoadedIndex<T>> static_index;  // swapped atomically by reload.
+    std::unique_ptr<pipeann::Distance<T>> dist_cmp;
+    std::unique_ptr<pipeann::DynamicSSDIndex<T>> dyn_index;
+    std::shared_ptr<pipeann::QueryCache<T>> cache;  // nullptr without --cache.
+
+    std::mutex queue_lock;  // guards queue, stopping and the arrival EWMA.
+    std::condition_variable queue_cv;
+    std::deque<Job *> queue;
+    bool stopping = false;
+    Clock::time_point last_arrival;
+    double arrival_gap_us = 1e9;
+    std::vector<std::thread> workers;
+
+    std::mutex conn_lock;
+    std::vector<std::weak_ptr<Connection>> conns;
+    std::vector<Reader> readers;
+
+    std::mutex reload_lock;
+    std::atomic<bool> reloading{false};
+    std::thread reload_thread;
+
+    pipeann::QueryStatsRecorder search_stats;
+    pipeann::StreamingHistogram op_latency_ns[2];  // search, insert/delete; arrival to response.
+    pipeann::StreamingHistogram batch_size;
+  };
+
+  template<typename T>
+  int serve(const Options &opt) {
+    Server<T> server(opt);
+    if (server.load() != 0) {
+      return -1;
+    }
+    return server.run();
+  }
+}  // namespace
+
+int main(int argc, char **argv) {
+  Options opt;
+  if (!parse_options(argc, argv, opt)) {
+    print_usage(argv[0]);
+    return -1;
+  }
+  if (opt.type == "float") {
+    return serve<float>(opt);
+  } else if (opt.type == "int8") {
+    return serve<int8_t>(opt);
+  } else if (opt.type == "uint8") {
+    return serve<uint8_t>(opt);
+  }
+  std::cout << "Unsupported type: " << opt.type << ". Use float/int8/uint8" << std::endl;
+  return -1;
+}
@@ -0,0 +1,192 @@
+#include <index.h>
+#include <omp.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "log.h"
+#include "parameters.h"
+#include "timer.h"
+#include "utils.h"
+
+// Checks Index::consolidate_deletes_incremental() end to end. Builds an in-memory index on the first half of
+// the data, deletes a fraction of it, and sweeps the deletes in bounded steps while the second half is
+// inserted (which also resizes the index mid-sweep). The deleted points are then re-inserted into the
+// released slots. Fails if any live node links to a deleted or free slot, if a live node is unreachable from
+// the entry point, or if recall@10 against brute force is below the given bound.
+
+namespace {
+  template<typename T>
+  float l2(const T *a, const T *b, size_t dim) {
+    float d = 0;
+    for (size_t i = 0; i < dim; ++i) {
+      float diff = (float) a[i] - (float) b[i];
+      d += diff * diff;
+    }
+    return d;
+  }
+}  // namespace
+
+template<typename T>
+int test_consolidate_incremental(int argc, char **argv) {
+  std::string data_path(argv[2]), query_path(argv[3]);
+  const float delete_frac = argc > 4 ? std::atof(argv[4]) / 100 : 0.3f;
+  const size_t step = argc > 5 ? std::atoi(argv[5]) : 1024;
+  const unsigned L = argc > 6 ? std::atoi(argv[6]) : 64;
+  const double min_recall = argc > 7 ? std::atof(argv[7]) : 0.9;
+  constexpr uint32_t K = 10;
+
+  T *data = nullptr, *queries = nullptr;
+  size_t n, dim, n_queries, query_dim, query_aligned_dim;
+  pipeann::load_bin<T>(data_path, data, n, dim);
+  pipeann::load_aligned_bin<T>(query_path, queries, n_queries, query_dim, query_aligned_dim);
+  if (query_dim != dim || n < 4) {
+    std::cout << "Need at least 4 points and queries of the data's dimension" << std::endl;
+    return -1;
+  }
+  const size_t n_build = n / 2;
+
+  pipeann::Parameters params;
+  params.Set<unsigned>("R", 32);
+  params.Set<unsigned>("L", 64);
+  params.Set<unsigned>("C", 750);
+  params.Set<float>("alpha", 1.2);
+  params.Set<bool>("saturate_graph", 0);
+  params.Set<unsigned>("num_threads", omp_get_max_threads());
+
+  // the index starts full, so the first insert resizes it.
+  std::string build_path = data_path + ".consolidate_build.bin";
+  pipeann::save_bin<T>(build_path, data, n_build, dim);
+  pipeann::Index<T, uint32_t> index(pipeann::Metric::L2, dim, n_build, true, false, true);
+  std::vector<uint32_t> tags(n_build);
+  std::iota(tags.begin(), tags.end(), 0);
+  index.build(build_path.c_str(), n_build, params, tags);
+  std::remove(build_path.c_str());
+  index.enable_delete();
+
+  std::vector<uint32_t> deleted(tags);
+  std::shuffle(deleted.begin(), deleted.end(), std::mt19937(0));
+  deleted.resize((size_t) (delete_frac * n_build));
+  for (auto tag : deleted) {
+    index.lazy_delete(tag);
+  }
+  LOG(INFO) << "Deleted " << deleted.size() << " of " << n_build << " points";
+
+  std::atomic<bool> inserting{true};
+  std::thread inserter([&]() {
+#pragma omp parallel for schedule(dynamic, 64)
+    for (int64_t i = n_build; i < (int64_t) n; ++i) {
+      index.insert_point(data + i * dim, params, (uint32_t) i);
+    }
+    inserting = false;
+  });
+  uint64_t steps = 0;
+  double max_step_ms = 0;
+  while (true) {
+    bool was_inserting = inserting.load();
+    pipeann::Timer timer;
+    size_t left = index.consolidate_deletes_incremental(params, step);
+    max_step_ms = std::max(max_step_ms, timer.elapsed() / 1e3);
+    ++steps;
+    if (left == 0 && !was_inserting) {
+      break;
+    }
+    std::this_thread::yield();
+  }
+  inserter.join();
+  bool ok = index._delete_set.empty();
+  LOG(INFO) << steps << " incremental steps of up to " << step << " slots, longest " << max_step_ms
+            << " ms; max_points " << n_build << " -> " << index._max_points;
+
+  // the released slots take the deleted points back.
+  for (auto tag : deleted) {
+    index.insert_point(data + (size_t) tag * dim, params, tag);
+  }
+
+  // every edge must point at a live node, and every live node must be reachable from the entry point.
+  const auto &graph = *index.get_graph();
+  const auto &loc_to_tag = *index.get_tags();
+  auto live = [&](unsigned loc) {
+    return loc_to_tag.find(loc) != loc_to_tag.end() ||
+           (loc >= index._max_points && loc < index._max_points + index._num_frozen_pts);
+  };
+  uint64_t n_live = 0, dangling = 0;
+  for (unsigned loc = 0; loc < index._max_points + index._num_frozen_pts; ++loc) {
+    if (!live(loc)) {
+      continue;
+    }
+    ++n_live;
+    for (auto nbr : graph[loc]) {
+      dangling += !live(nbr);
+    }
+  }
+  std::vector<bool> seen(graph.size(), false);
+  std::vector<unsigned> frontier{index._ep};
+  seen[index._ep] = true;
+  uint64_t reached = 0;
+  while (!frontier.empty()) {
+    unsigned loc = frontier.back();
+    frontier.pop_back();
+    reached += live(loc);
+    for (auto nbr : graph[loc]) {
+      if (live(nbr) && !seen[nbr]) {
+        seen[nbr] = true;
+        frontier.push_back(nbr);
+      }
+    }
+  }
+  ok = ok && dangling == 0 && reached == n_live;
+
+  // recall@K against brute force over all n points, which are all live again.
+  uint64_t hits = 0;
+#pragma omp parallel for schedule(dynamic, 1) reduction(+ : hits)
+  for (int64_t q = 0; q < (int64_t) n_queries; ++q) {
+    const T *query = queries + q * query_aligned_dim;
+    std::vector<std::pair<float, uint32_t>> dists(n);
+    for (size_t i = 0; i < n; ++i) {
+      dists[i] = {l2(query, data + i * dim, dim), (uint32_t) i};
+    }
+    std::partial_sort(dists.begin(), dists.begin() + K, dists.end());
+    std::vector<uint32_t> res(K);
+    size_t n_res = index.search_with_tags(query, K, L, res.data(), nullptr);
+    for (size_t r = 0; r < n_res; ++r) {
+      for (uint32_t g = 0; g < K; ++g) {
+        hits += res[r] == dists[g].second;
+      }
+    }
+  }
+  double recall = (double) hits / (n_queries * K);
+  ok = ok && recall >= min_recall;
+
+  std::cout << "pending deletes: " << index._delete_set.size() << ", live nodes: " << n_live
+            << ", edges to dead slots: " << dangling << ", reachable: " << reached << ", recall@" << K << " (L "
+            << L << "): " << recall << std::endl;
+  std::cout << (ok ? "PASSED" : "FAILED") << std::endl;
+  delete[] data;
+  pipeann::aligned_free(queries);
+  return ok ? 0 : 1;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 4) {
+    std::cout << "Usage: " << argv[0]
+              << " <index_type (float/int8/uint8)> <data.bin> <query.bin> [delete % (30)] [step (1024)] [L (64)]"
+                 " [min recall (0.9)]"
+              << std::endl;
+    return -1;
+  }
+  std::string type(argv[1]);
+  if (type == "float")
+    return test_consolidate_incremental<float>(argc, argv);
+  else if (type == "int8")
+    return test_consolidate_incremental<int8_t>(argc, argv);
+  else if (type == "uint8")
+    return test_consolidate_incremental<uint8_t>(argc, argv);
+  std::cout << "Unsupported index type. Use float or int8 or uint8" << std::endl;
+  return -1;
+}
@@ -122,8 +122,7 @@ void sync_search_kernel(T *query, size_t query_num, size_t query_dim, const int
     }
   }
 
-  std::vector<double> latency_stats(query_num, 0);
-  pipeann::QueryStats *stats = new pipeann::QueryStats[query_num];
+  pipeann::QueryStatsRecorder recorder;
   std::string recall_string = "Recall@" + std::to_string(recall_at);
   std::cerr << std::setw(4) << "Ls" << std::setw(12) << "QPS " << std::setw(18) << "Mean Lat" << std::setw(12)
             << "50 Lat" << std::setw(12) << "90 Lat" << std::setw(12) << "95 Lat" << std::setw(12) << "99 Lat"
@@ -135,10 +134,10 @@ void sync_search_kernel(T *query, size_t query_num, size_t query_dim, const int
   auto s = std::chrono::high_resolution_clock::now();
 #pragma omp parallel for num_threads(NUM_SEARCH_THREADS) schedule(dynamic)
   for (int64_t i = 0; i < (int64_t) query_num; i++) {
+    pipeann::QueryStats stats;
     sync_index.search(query + i * query_dim, recall_at, mem_L, L, beam_width, query_result_tags + i * recall_at,
-                      query_result_dists + i * recall_at, stats + i, true);
-
-    latency_stats[i] = stats[i].total_us / 1000.0;  // convert to ms
+                      query_result_dists + i * recall_at, &stats, true);
+    recorder.record(stats);
     if (search_mode == BEAM_SEARCH) {
       // Here we follow the original paper 's settings...
       // For PipeSearch, do not sleep is faster.
@@ -157,17 +156,16 @@ void sync_search_kernel(T *query, size_t query_num, size_t query_dim, const int
     delete[] gt_ids;
   }
 
-  float mean_ios =
-      (float) pipeann::get_mean_stats(stats, query_num, [](const pipeann::QueryStats &stats) { return stats.n_ios; });
-
-  std::sort(latency_stats.begin(), latency_stats.end());
-  std::cerr << std::setw(4) << L << std::setw(12) << qps << std::setw(18)
-            << ((float) std::accumulate(latency_stats.begin(), latency_stats.end(), 0.0f)) / (float) query_num
-            << std::setw(12) << (float) latency_stats[(_u64) (0.50 * ((double) query_num))] << std::setw(12)
-            << (float) latency_stats[(_u64) (0.90 * ((double) query_num))] << std::setw(12)
-            << (float) latency_stats[(_u64) (0.95 * ((double) query_num))] << std::setw(12)
-            << (float) latency_stats[(_u64) (0.99 * ((double) query_num))] << std::setw(12)
-            << (float) latency_stats[(_u64) (0.999 * ((double) query_num))] << std::setw(12) << recall << std::setw(12)
+  pipeann::QueryStatsSnapshot snap = recorder.snapshot();
+  float mean_ios = (float) snap.n_ios.mean();
+
+  // latency in ms.
+  const auto &lat = snap.latency_ns;
+  std::cerr << std::setw(4) << L << std::setw(12) << qps << std::setw(18) << (float) (lat.mean() / 1e6) << std::setw(12)
+            << (float) (lat.percentile(50) / 1e6) << std::setw(12) << (float) (lat.percentile(90) / 1e6)
+            << std::setw(12) << (float) (lat.percentile(95) / 1e6) << std::setw(12)
+            << (float) (lat.percentile(99) / 1e6) << std::setw(12) << (float) (lat.percentile(99.9) / 1e6)
+            << std::setw(12) << recall << std::setw(12)
             << mean_ios << std::endl;
 
   LOG(INFO) << "search current time: " << current_time;
@@ -175,7 +173,6 @@ void sync_search_kernel(T *query, size_t query_num, size_t query_dim, const int
 
   delete[] query_result_dists;
   delete[] query_result_tags;
-  delete[] stats;
 }
 
 template<typename T, typename TagT>
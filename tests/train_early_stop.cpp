@@ -0,0 +1,225 @@
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "aux_utils.h"
+#include "early_stop.h"
+#include "emulated_aligned_file_reader.h"
+#include "log.h"
+#include "ssd_index.h"
+#include "utils.h"
+
+// Trains the early-termination model of a search mode (see include/early_stop.h). Every query runs to
+// convergence while its hops are traced; a hop is labeled "final" if the k nearest nodes expanded so far
+// already have the recall of the converged search. A logistic regression on the hop features predicts
+// that label, and the threshold is the lowest one whose simulated early stops keep the mean recall within
+// the given loss of the converged recall. Train on queries other than the ones used for evaluation.
+
+namespace {
+  struct Sample {
+    const float *features;
+    float label;
+  };
+
+  void fit_logistic(const std::vector<Sample> &samples, pipeann::EarlyStopModel &model) {
+    constexpr uint32_t kIters = 500;
+    constexpr float kLearningRate = 0.5f, kL2 = 1e-4f;
+    constexpr uint32_t N = pipeann::kNumEarlyStopFeatures;
+    // standardize the features for the descent, then fold the scaling back into the weights.
+    double mean[N] = {}, sd[N] = {};
+    for (auto &s : samples) {
+      for (uint32_t i = 0; i < N; ++i) {
+        mean[i] += s.features[i];
+      }
+    }
+    for (uint32_t i = 0; i < N; ++i) {
+      mean[i] /= samples.size();
+    }
+    for (auto &s : samples) {
+      for (uint32_t i = 0; i < N; ++i) {
+        sd[i] += (s.features[i] - mean[i]) * (s.features[i] - mean[i]);
+      }
+    }
+    for (uint32_t i = 0; i < N; ++i) {
+      sd[i] = std::max(std::sqrt(sd[i] / samples.size()), 1e-6);
+    }
+
+    double w[N] = {}, b = 0;
+    for (uint32_t it = 0; it < kIters; ++it) {
+      double gw[N] = {}, gb = 0;
+      for (auto &s : samples) {
+        double z = b;
+        for (uint32_t i = 0; i < N; ++i) {
+          z += w[i] * (s.features[i] - mean[i]) / sd[i];
+        }
+        double err = 1.0 / (1.0 + std::exp(-z)) - s.label;
+        for (uint32_t i = 0; i < N; ++i) {
+          gw[i] += err * (s.features[i] - mean[i]) / sd[i];
+        }
+        gb += err;
+      }
+      for (uint32_t i = 0; i < N; ++i) {
+        w[i] -= kLearningRate * (gw[i] / samples.size() + kL2 * w[i]);
+      }
+      b -= kLearningRate * gb / samples.size();
+    }
+    model.bias = (float) b;
+    for (uint32_t i = 0; i < N; ++i) {
+      model.weights[i] = (float) (w[i] / sd[i]);
+      model.bias -= (float) (w[i] * mean[i] / sd[i]);
+    }
+  }
+}  // namespace
+
+template<typename T>
+int train(int argc, char **argv) {
+  std::string index_prefix = argv[2], query_bin = argv[3], gt_bin = argv[4];
+  uint64_t K = std::atoi(argv[5]), L = std::atoi(argv[6]), beam_width = std::atoi(argv[7]);
+  int mode = std::atoi(argv[8]);
+  double max_loss = std::atof(argv[9]);
+  std::string model_path = argv[10];
+  uint32_t min_hops = argc > 11 ? std::atoi(argv[11]) : 4;
+  if (mode < BEAM_SEARCH || mode > CORO_SEARCH || L < K) {
+    std::cout << "Mode must be 0-3 and L at least K." << std::endl;
+    return -1;
+  }
+
+  T *query = nullptr;
+  size_t query_num, query_dim, gt_num, gt_dim;
+  uint32_t *gt_ids = nullptr, *gt_tags = nullptr;
+  float *gt_dists = nullptr;
+  pipeann::load_bin<T>(query_bin, query, query_num, query_dim);
+  pipeann::load_truthset(gt_bin, gt_ids, gt_dists, gt_num, gt_dim, &gt_tags);
+  if (gt_num != query_num || gt_dim < K) {
+    LOG(ERROR) << "Truthset has " << gt_num << " x " << gt_dim << " entries for " << query_num << " queries, K " << K;
+    return -1;
+  }
+
+  std::shared_ptr<AlignedFileReader> reader(new_aligned_file_reader());
+  pipeann::SSDIndex<T> index(pipeann::Metric::L2, reader, false, true);
+  if (index.load(index_prefix.c_str(), 1, true, mode == PAGE_SEARCH) != 0) {
+    return -1;
+  }
+  pipeann::EarlyStopTrace trace;
+  index.set_early_stop(nullptr, &trace);
+
+  // one query at a time, so the trace lists the queries in order.
+  std::vector<uint32_t> res_tags(K);
+  std::vector<float> res_dists(K);
+  for (size_t q = 0; q < query_num; ++q) {
+    T *qp = query + q * query_dim;
+    if (mode == BEAM_SEARCH) {
+      index.beam_search(qp, K, 0, L, res_tags.data(), res_dists.data(), beam_width, nullptr, nullptr, false);
+    } else if (mode == PAGE_SEARCH) {
+      index.page_search(qp, K, 0, L, res_tags.data(), res_dists.data(), beam_width);
+    } else if (mode == PIPE_SEARCH) {
+      index.pipe_search(qp, K, 0, L, res_tags.data(), res_dists.data(), beam_width);
+    } else {
+      uint32_t *tags_p = res_tags.data();
+      float *dists_p = res_dists.data();
+      index.coro_search(&qp, K, 0, L, &tags_p, &dists_p, beam_width, 1);
+    }
+  }
+  if (trace.queries.size() != query_num) {
+    LOG(ERROR) << "Traced " << trace.queries.size() << " queries, expected " << query_num;
+    return -1;
+  }
+
+  // recall of each hop's k nearest expanded nodes.
+  std::vector<std::vector<double>> hop_recall(query_num);
+  std::vector<Sample> samples;
+  double full_recall = 0, full_hops = 0;
+  std::vector<uint32_t> topk(K);
+  for (size_t q = 0; q < query_num; ++q) {
+    auto &tq = trace.queries[q];
+    for (auto &ids : tq.topk) {
+      std::fill(topk.begin(), topk.end(), std::numeric_limits<uint32_t>::max());
+      for (size_t i = 0; i < ids.size(); ++i) {
+        topk[i] = index.id2tag(ids[i]);
+      }
+      hop_recall[q].push_back(pipeann::calculate_recall(1, gt_ids + q * gt_dim, gt_dists + q * gt_dim,
+                                                        (unsigned) gt_dim, topk.data(), (unsigned) K, (unsigned) K));
+    }
+    if (hop_recall[q].empty()) {
+      continue;
+    }
+    double final_recall = hop_recall[q].back();
+    full_recall += final_recall;
+    full_hops += hop_recall[q].size();
+    for (size_t h = 0; h < tq.features.size(); ++h) {
+      samples.push_back({tq.features[h].data(), hop_recall[q][h] >= final_recall ? 1.0f : 0.0f});
+    }
+  }
+  full_recall /= query_num;
+  full_hops /= query_num;
+
+  pipeann::EarlyStopModel model;
+  model.min_hops = min_hops;
+  fit_logistic(samples, model);
+
+  // simulated stop: the first hop past min_hops whose prediction reaches the threshold.
+  auto simulate = [&](float threshold, double &recall, double &hops) {
+    recall = hops = 0;
+    for (size_t q = 0; q < query_num; ++q) {
+      auto &tq = trace.queries[q];
+      size_t stop = tq.features.size();
+      for (size_t h = 0; h < tq.features.size(); ++h) {
+        if (h + 1 >= min_hops && model.predict(tq.features[h].data()) >= threshold) {
+          stop = h + 1;
+          break;
+        }
+      }
+      recall += stop == 0 ? 0 : hop_recall[q][stop - 1];
+      hops += stop;
+    }
+    recall /= query_num;
+    hops /= query_num;
+  };
+
+  std::cout.setf(std::ios_base::fixed, std::ios_base::floatfield);
+  std::cout.precision(3);
+  std::cout << std::setw(12) << "Threshold" << std::setw(12) << "Recall" << std::setw(12) << "Mean hops"
+            << std::setw(12) << "Hops saved" << std::endl;
+  model.threshold = 1.0f;  // never stops unless a threshold qualifies.
+  for (float threshold = 0.99f; threshold >= 0.5f; threshold -= 0.01f) {
+    double recall, hops;
+    simulate(threshold, recall, hops);
+    if (recall < full_recall - max_loss * 100) {
+      break;  // lower thresholds only stop earlier.
+    }
+    model.threshold = threshold;
+    std::cout << std::setw(12) << threshold << std::setw(12) << recall << std::setw(12) << hops << std::setw(11)
+              << 100 * (1 - hops / full_hops) << "%" << std::endl;
+  }
+  LOG(INFO) << samples.size() << " hops of " << query_num << " queries; converged recall " << full_recall
+            << ", mean hops " << full_hops << "; chose threshold " << model.threshold;
+  delete[] query;
+  delete[] gt_ids;
+  delete[] gt_dists;
+  delete[] gt_tags;
+  return model.save(model_path);
+}
+
+int main(int argc, char **argv) {
+  if (argc < 11) {
+    std::cout << "Usage: " << argv[0]
+              << " <index_type (float/int8/uint8)> <index_prefix> <query_file.bin> <truthset.bin> <K> <L>"
+                 " <beam_width> <search_mode (0-3)> <max recall loss (e.g. 0.005)> <output_model> [min_hops (4)]"
+              << std::endl;
+    return -1;
+  }
+  std::string type = argv[1];
+  if (type == "float") {
+    return train<float>(argc, argv);
+  } else if (type == "int8") {
+    return train<int8_t>(argc, argv);
+  } else if (type == "uint8") {
+    return train<uint8_t>(argc, argv);
+  }
+  std::cout << "Unsupported index type. Use float or int8 or uint8" << std::endl;
+  return -1;
+}
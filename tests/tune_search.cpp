@@ -0,0 +1,265 @@
+#include <omp.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "aux_utils.h"
+#include "emulated_aligned_file_reader.h"
+#include "log.h"
+#include "search_profile.h"
+#include "ssd_index.h"
+#include "utils.h"
+
+// Tunes search mode, mem_L, L and beam width of an index on the device it runs on, and writes the result as
+// the index's search profile (see include/search_profile.h). The target is recall@K >= X at the lowest P99
+// latency or, with a P99 bound, the highest QPS at recall@K >= X and P99 <= the bound. The grid is searched
+// with successive halving: every configuration runs on a small query sample, the best third moves on to a
+// three times larger sample, until one configuration is left.
+
+namespace {
+  constexpr int kAsyncSearchMode = 4;
+  constexpr uint64_t kEta = 3;          // keep 1 / kEta of the configurations per round.
+  constexpr uint64_t kMinQueries = 32;  // first-round sample.
+  constexpr uint64_t kCoroBatch = 8;
+
+  struct Config {
+    int mode;
+    uint32_t mem_L;
+    uint64_t l_search, beam_width;
+  };
+
+  struct Result {
+    double recall = 0, p99_us = 0, qps = 0;
+  };
+}  // namespace
+
+template<typename T>
+int tune(int argc, char **argv) {
+  std::string index_prefix = argv[2], query_bin = argv[3], gt_bin = argv[4];
+  uint64_t K = std::atoi(argv[5]);
+  pipeann::Metric metric = std::string(argv[6]) == "cosine" ? pipeann::Metric::COSINE : pipeann::Metric::L2;
+  uint32_t num_threads = std::atoi(argv[7]);
+  double target_recall = std::atof(argv[8]);
+  double max_p99 = argc > 9 ? std::atof(argv[9]) : 0;
+  std::string modes = argc > 10 ? argv[10] : "023";
+  std::string profile_path = argc > 11 ? argv[11] : index_prefix + "_search.profile";
+
+  T *query = nullptr;
+  size_t query_num, query_dim, gt_num, gt_dim;
+  uint32_t *gt_ids = nullptr, *gt_tags = nullptr;
+  float *gt_dists = nullptr;
+  pipeann::load_bin<T>(query_bin, query, query_num, query_dim);
+  pipeann::load_truthset(gt_bin, gt_ids, gt_dists, gt_num, gt_dim, &gt_tags);
+  if (gt_num != query_num || gt_dim < K) {
+    LOG(ERROR) << "Truthset has " << gt_num << " x " << gt_dim << " entries for " << query_num << " queries, K " << K;
+    return -1;
+  }
+
+  std::shared_ptr<AlignedFileReader> reader(new_aligned_file_reader());
+  pipeann::SSDIndex<T> index(metric, reader, false, true);
+  bool use_page_search = modes.find_first_not_of('0') != std::string::npos;
+  if (index.load(index_prefix.c_str(), num_threads, true, use_page_search) != 0) {
+    return -1;
+  }
+  std::vector<uint32_t> mem_Ls = {0};
+  if (file_exists(index_prefix + "_mem.index")) {
+    index.load_mem_index(metric, query_dim, index_prefix + "_mem.index");
+    mem_Ls.insert(mem_Ls.end(), {16, 32});
+  }
+  if (modes.find('4') != std::string::npos) {
+    index.start_async_engine(num_threads);
+  }
+  omp_set_num_threads(num_threads);
+
+  std::vector<Config> configs;
+  for (char c : modes) {
+    int mode = c - '0';
+    if (mode < BEAM_SEARCH || mode > kAsyncSearchMode) {
+      std::cout << "Search modes are 0-4, got " << c << std::endl;
+      return -1;
+    }
+    for (double f : {1.0, 1.5, 2.0, 3.0, 4.0, 6.0, 8.0}) {
+      for (uint64_t beam_width : {2, 4, 8, 16, 32}) {
+        for (uint32_t mem_L : mem_Ls) {
+          configs.push_back({mode, mem_L, (uint64_t) std::ceil(f * K), beam_width});
+        }
+      }
+    }
+  }
+
+  std::vector<uint32_t> res_tags(query_num * K);
+  std::vector<float> res_dists(query_num * K);
+  std::vector<double> latency_us(query_num);
+  auto evaluate = [&](const Config &cfg, uint64_t n) -> Result {
+    auto start = std::chrono::high_resolution_clock::now();
+    if (cfg.mode == CORO_SEARCH) {
+#pragma omp parallel for schedule(dynamic, 1)
+      for (int64_t i = 0; i < (int64_t) n; i += kCoroBatch) {
+        int N = (int) std::min<uint64_t>(kCoroBatch, n - i);
+        T *q[kCoroBatch];
+        uint32_t *tags[kCoroBatch];
+        float *dists[kCoroBatch];
+        pipeann::QueryStats stats[kCoroBatch];
+        for (int v = 0; v < N; ++v) {
+          q[v] = query + (i + v) * query_dim;
+          tags[v] = res_tags.data() + (i + v) * K;
+          dists[v] = res_dists.data() + (i + v) * K;
+        }
+        index.coro_search(q, K, cfg.mem_L, cfg.l_search, tags, dists, cfg.beam_width, N, stats);
+        for (int v = 0; v < N; ++v) {
+          latency_us[i + v] = stats[v].total_us;
+        }
+      }
+    } else if (cfg.mode == kAsyncSearchMode) {
+      pipeann::AsyncSearchParams params;
+      params.k_search = K;
+      params.mem_L = cfg.mem_L;
+      params.l_search = cfg.l_search;
+      params.beam_width = cfg.beam_width;
+      std::vector<std::future<pipeann::AsyncSearchResult<uint32_t>>> futures(n);
+      for (uint64_t i = 0; i < n; ++i) {
+        futures[i] = index.search_async(query + i * query_dim, params);
+      }
+      for (uint64_t i = 0; i < n; ++i) {
+        auto res = futures[i].get();
+        std::copy(res.tags.begin(), res.tags.end(), res_tags.data() + i * K);
+        latency_us[i] = res.stats.total_us;
+      }
+    } else {
+#pragma omp parallel for schedule(dynamic, 1)
+      for (int64_t i = 0; i < (int64_t) n; ++i) {
+        pipeann::QueryStats stats;
+        const T *q = query + i * query_dim;
+        uint32_t *tags = res_tags.data() + i * K;
+        float *dists = res_dists.data() + i * K;
+        if (cfg.mode == BEAM_SEARCH) {
+          index.beam_search(q, K, cfg.mem_L, cfg.l_search, tags, dists, cfg.beam_width, &stats, nullptr, false);
+        } else if (cfg.mode == PAGE_SEARCH) {
+          index.page_search(q, K, cfg.mem_L, cfg.l_search, tags, dists, cfg.beam_width, &stats);
+        } else {
+          index.pipe_search(q, K, cfg.mem_L, cfg.l_search, tags, dists, cfg.beam_width, &stats);
+        }
+        latency_us[i] = stats.total_us;
+      }
+    }
+    std::chrono::duration<double> wall = std::chrono::high_resolution_clock::now() - start;
+
+    Result r;
+    r.qps = n / wall.count();
+    r.recall = pipeann::calculate_recall((unsigned) n, gt_ids, gt_dists, (unsigned) gt_dim, res_tags.data(),
+                                         (unsigned) K, (unsigned) K);
+    std::vector<double> lat(latency_us.begin(), latency_us.begin() + n);
+    std::sort(lat.begin(), lat.end());
+    r.p99_us = lat[std::min<uint64_t>(n - 1, (uint64_t) (0.99 * n))];
+    return r;
+  };
+
+  // (recall shortfall, P99 excess, objective): lower is better. slack widens the recall target by the sampling
+  // error of small rounds, so that a configuration is not dropped for being unlucky on few queries.
+  auto score = [&](const Result &r, double slack) {
+    double p99_excess = max_p99 > 0 ? std::max(0.0, r.p99_us - max_p99) : 0;
+    return std::make_tuple(std::max(0.0, target_recall - slack - r.recall), p99_excess,
+                           max_p99 > 0 ? -r.qps : r.p99_us);
+  };
+
+  uint64_t rounds = 0;
+  for (uint64_t n = configs.size(); n > 1; n = (n + kEta - 1) / kEta) {
+    ++rounds;
+  }
+  uint64_t n_queries = std::max<uint64_t>(kMinQueries, query_num / (uint64_t) std::pow(kEta, rounds - 1));
+  LOG(INFO) << configs.size() << " configurations, " << rounds << " rounds, from " << n_queries << " queries";
+
+  Config warmup = configs.back();
+  warmup.l_search = 8 * K;
+  evaluate(warmup, query_num);
+
+  std::cout.setf(std::ios_base::fixed, std::ios_base::floatfield);
+  std::cout.precision(2);
+  std::vector<std::pair<Config, Result>> ranked;
+  for (uint64_t r = 0; r < rounds; ++r) {
+    uint64_t n = std::min<uint64_t>(n_queries, query_num);
+    double p = std::min(target_recall / 100, 1.0);
+    double slack = n == query_num ? 0 : 100 * std::sqrt(p * (1 - p) / (double) (n * K));
+    ranked.clear();
+    for (auto &cfg : configs) {
+      ranked.emplace_back(cfg, evaluate(cfg, n));
+    }
+    std::stable_sort(ranked.begin(), ranked.end(), [&](const auto &a, const auto &b) {
+      return score(a.second, slack) < score(b.second, slack);
+    });
+    std::cout << "Round " << r << ": " << configs.size() << " configurations on " << n << " queries" << std::endl;
+    std::cout << std::setw(6) << "Mode" << std::setw(8) << "mem_L" << std::setw(6) << "L" << std::setw(6) << "Beam"
+              << std::setw(12) << "Recall" << std::setw(12) << "P99 (us)" << std::setw(12) << "QPS" << std::endl;
+    for (size_t i = 0; i < std::min<size_t>(ranked.size(), 5); ++i) {
+      auto &[cfg, res] = ranked[i];
+      std::cout << std::setw(6) << cfg.mode << std::setw(8) << cfg.mem_L << std::setw(6) << cfg.l_search
+                << std::setw(6) << cfg.beam_width << std::setw(12) << res.recall << std::setw(12) << res.p99_us
+                << std::setw(12) << res.qps << std::endl;
+    }
+    configs.clear();
+    for (size_t i = 0; i < (ranked.size() + kEta - 1) / kEta; ++i) {
+      configs.push_back(ranked[i].first);
+    }
+    if (configs.size() == 1) {
+      break;  // ranked.front(), measured on this round's queries.
+    }
+    n_queries *= kEta;
+  }
+
+  auto &[best, res] = ranked.front();
+  if (std::get<0>(score(res, 0)) > 0 || std::get<1>(score(res, 0)) > 0) {
+    LOG(ERROR) << "No configuration meets the target; the closest reaches recall " << res.recall << ", P99 "
+               << res.p99_us << "us. No profile written.";
+    return -1;
+  }
+  pipeann::SearchProfile profile;
+  profile.mode = best.mode;
+  profile.mem_L = best.mem_L;
+  profile.l_search = best.l_search;
+  profile.beam_width = best.beam_width;
+  profile.k = K;
+  profile.threads = num_threads;
+  profile.recall = (float) res.recall;
+  profile.p99_us = (float) res.p99_us;
+  profile.qps = (float) res.qps;
+  if (profile.save(profile_path) != 0) {
+    return -1;
+  }
+  LOG(INFO) << "Wrote " << profile_path << ": mode " << best.mode << ", mem_L " << best.mem_L << ", L "
+            << best.l_search << ", beam width " << best.beam_width;
+  if (modes.find('4') != std::string::npos) {
+    index.stop_async_engine();
+  }
+  delete[] query;
+  delete[] gt_ids;
+  delete[] gt_dists;
+  delete[] gt_tags;
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  if (argc < 9) {
+    std::cout << "Usage: " << argv[0]
+              << " <index_type (float/int8/uint8)> <index_prefix> <query_file.bin> <truthset.bin> <K>"
+                 " <similarity (cosine/l2)> <num_threads> <target recall@K (%)> [max P99 latency (us), 0: none]"
+                 " [search modes (default 023)] [output profile (default <index_prefix>_search.profile)]"
+              << std::endl;
+    return -1;
+  }
+  std::string type = argv[1];
+  if (type == "float") {
+    return tune<float>(argc, argv);
+  } else if (type == "int8") {
+    return tune<int8_t>(argc, argv);
+  } else if (type == "uint8") {
+    return tune<uint8_t>(argc, argv);
+  }
+  std::cout << "Unsupported index type. Use float or int8 or uint8" << std::endl;
+  return -1;
+}